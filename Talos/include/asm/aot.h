@@ -0,0 +1,142 @@
+#ifndef ERGON_AOT_H
+#define ERGON_AOT_H
+
+#include "linker.h"
+#include "../computer/instructions_handler/opcode_semantics.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/*
+Ahead-of-time translation of a linked program to one C++ translation unit (aot/talos_aot, CMake: talos_aot_add()):
+ - the sections are constexpr arrays, every basic block a label, every instruction the ERGON_SEM_* statement of its
+   opcode with the operands known at compile time (see aot_handler.h for what they run on)
+ - jmp / jcc / call are gotos, ret and a start on any PC go through a switch over the block labels
+ - the unit defines `extern const AotProgram aot_<name>`, EnvironmentManager::load_aot() loads it,
+   start(ExecMode::AOT) runs it and check_aot() compares it with the interpreter
+*/
+
+namespace aot {
+    #define ERGON_AOT_LINEAR(name) name,
+    inline constexpr uint8_t linear_ops[] = { ERGON_LINEAR_OPS(ERGON_AOT_LINEAR) };
+    #undef ERGON_AOT_LINEAR
+
+    // what needs the whole SimpleCore: run by step_instr()
+    inline bool stepped(uint8_t op) {
+        switch (op) {
+        case MEMCPY: case CORE_ID: case NCORES: case SPAWN: case JOIN:
+        case CAS: case XADD: case XCHG: case LDAR: case STLR: case FENCE: case WAIT: case WAKE:
+            return true;
+        default:
+            return std::ranges::find(linear_ops, op) == std::end(linear_ops) && op != JMP && op != JZ && op != JNZ
+                && op != JG && op != JL && op != CALL && op != RET && op != HALT;
+        }
+    }
+
+    // valid C++ identifier out of a program name
+    inline std::string identifier(const std::string& name) {
+        std::string out;
+        for (char ch : name) out += std::isalnum(static_cast<unsigned char>(ch)) ? ch : '_';
+        if (out.empty() || std::isdigit(static_cast<unsigned char>(out[0]))) out.insert(out.begin(), '_');
+        return out;
+    }
+
+    inline void bytes(std::string& out, const char* name, const std::vector<uint8_t>& v) {
+        out += "constexpr std::array<uint8_t, " + std::to_string(v.size()) + "> " + name + " = {";
+        for (size_t i = 0; i < v.size(); i++) {
+            char hex[8];
+            std::snprintf(hex, sizeof(hex), "0x%02x,", v[i]);
+            out += (i % 24 == 0 ? "\n    " : " ") + std::string(hex);
+        }
+        out += "\n};\n";
+    }
+}
+
+// C++ source of bin, defining aot_<name>
+inline std::string translate_to_cpp(const LinkedBinary& bin, const std::string& name) {
+    const std::vector<DecodedInstr>& text = bin.text;
+    const size_t n = text.size();
+    auto target = [&](size_t pc) { return static_cast<int64_t>(pc) + 1 + text[pc].imm; };
+    auto in_text = [&](int64_t t) { return t >= 0 && t < static_cast<int64_t>(n); };
+
+    // block leaders: entry point, labels, targets, what follows a control transfer (return addresses...)
+    std::vector<bool> leader(n, false);
+    std::vector<std::string> label(n);
+    if (n != 0) leader[0] = true;
+    if (bin.entry_pc < n) leader[bin.entry_pc] = true;
+    for (const Symbol& sym : bin.text_symbols) {
+        if (sym.value >= n) continue;
+        leader[sym.value] = true;
+        if (label[sym.value].empty()) label[sym.value] = sym.name;
+    }
+    for (size_t pc = 0; pc < n; pc++) {
+        const uint8_t op = fused_head(text[pc].opcode);
+        const bool jumps = op == JMP || op == JZ || op == JNZ || op == JG || op == JL || op == CALL || op == SPAWN;
+        if (jumps && in_text(target(pc))) leader[target(pc)] = true;
+        if ((jumps || op == RET || op == HALT) && pc + 1 < n) leader[pc + 1] = true;
+    }
+
+    std::string out;
+    out += "// generated by talos_aot from the program \"" + name + "\", do not edit\n";
+    out += "#include \"computer/instructions_handler/aot_handler.h\"\n\nnamespace {\n\n";
+
+    out += "constexpr std::array<DecodedInstr, " + std::to_string(n) + "> text = {{\n";
+    for (const DecodedInstr& I : text)
+        out += "    { " + std::to_string(I.opcode) + ", " + std::to_string(I.rd) + ", " + std::to_string(I.rs1) + ", "
+             + std::to_string(I.rs2) + ", " + std::to_string(I.imm) + " }, // " + opcode_name(I.opcode) + "\n";
+    out += "}};\n";
+    aot::bytes(out, "data", bin.data);
+    aot::bytes(out, "rodata", bin.rodata);
+
+    out += "\n// operands in the assembler form, like step_instr()\n";
+    out += "#define I_IMM ((int32_t)instr->rs2)\n#define I_SHAMT ((uint32_t)instr->rs2 & 31)\n#define I_OFF (static_cast<int8_t>(instr->imm))\n\n";
+    out += "void run(SimpleCore& core) {\n    AotCore c(core);\n    uint32_t pc = core.PC;\ndispatch:\n    switch (pc) {\n";
+    for (size_t pc = 0; pc < n; pc++)
+        if (leader[pc]) out += "    case " + std::to_string(pc) + ": goto B" + std::to_string(pc) + ";\n";
+    out += "    default:\n";
+    out += "        if (pc >= text.size() || text[pc].opcode == HALT) {\n            c.sync(pc);\n            return;\n        }\n";
+    out += "        pc = c.step(text[pc], pc);\n        goto dispatch;\n    }\n";
+
+    auto jump = [&](int64_t t) {
+        if (in_text(t)) return "goto B" + std::to_string(t) + ";";
+        return "{ c.sync(" + std::to_string(static_cast<uint32_t>(t)) + "u); return; }";
+    };
+    for (size_t pc = 0; pc < n; pc++) {
+        const DecodedInstr& I = text[pc];
+        const uint8_t op = fused_head(I.opcode);
+        const std::string p = std::to_string(pc);
+        if (leader[pc]) out += "B" + p + ":" + (label[pc].empty() ? "" : " // " + label[pc]) + "\n";
+        if (stores_to_ram(op) && !aot::stepped(op)) out += "    c.pc = " + p + ";\n"; // for the fault path
+
+        switch (op) {
+        case JMP: out += "    " + jump(target(pc)) + "\n"; break;
+        case JZ: out += "    if (c.regs[13] == 0) " + jump(target(pc)) + "\n"; break;
+        case JNZ: out += "    if (c.regs[13] != 0) " + jump(target(pc)) + "\n"; break;
+        case JG: out += "    if ((int32_t)c.regs[13] > 0) " + jump(target(pc)) + "\n"; break;
+        case JL: out += "    if ((int32_t)c.regs[13] < 0) " + jump(target(pc)) + "\n"; break;
+        case CALL:
+            out += "    c.regs[15] -= 4;\n    c.store32(c.regs[15], " + std::to_string(pc + 1) + ");\n";
+            out += "    " + jump(target(pc)) + "\n";
+            break;
+        case RET: out += "    pc = c.load32(c.regs[15]);\n    c.regs[15] += 4;\n    goto dispatch;\n"; break;
+        case HALT: out += "    c.sync(" + p + ");\n    return;\n"; break;
+        case PUSH: out += "    c.regs[15] -= 4;\n    c.store32(c.regs[15], c.regs[" + std::to_string(I.rs1 & 15) + "]);\n"; break;
+        case POP: out += "    c.regs[" + std::to_string(I.rd & 15) + "] = c.load32(c.regs[15]);\n    c.regs[15] += 4;\n"; break;
+        default:
+            if (aot::stepped(op)) out += "    c.step(text[" + p + "], " + p + ");\n";
+            else out += "    { constexpr const DecodedInstr* instr = &text[" + p + "]; ERGON_SEM_" + opcode_name(op) + "; }\n";
+            break;
+        }
+    }
+    out += "    c.sync(" + std::to_string(n) + ");\n}\n\n";
+    out += "#undef I_IMM\n#undef I_SHAMT\n#undef I_OFF\n\n}\n\n";
+
+    out += "extern const AotProgram aot_" + aot::identifier(name) + " = { text, data, rodata, " + std::to_string(bin.entry_pc) + ", &run };\n";
+    return out;
+}
+
+
+#endif
@@ -0,0 +1,362 @@
+#ifndef ERGON_ASSEMBLER_H
+#define ERGON_ASSEMBLER_H
+
+#include "data.h"
+#include "error.h"
+#include "instructions.h"
+#include "parser.h"
+#include "perfect_hash.h"
+#include "utils.h"
+
+#include <array>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/*
+The two passes of the assembler, constexpr: AsmDecoder (decoder.h) runs them at runtime, static_asm::Decoder
+(static_asm.h) in the host compiler, so both accept and reject the same sources
+The front end (Derived) only stores what differs:
+    Sym& symbol(std::string_view name)                     created (local, no section yet) the first time
+    const Sym* find_symbol(std::string_view name) const    nullptr if never seen
+    const int32_t* constant(std::string_view name) const   .equ value, nullptr if none
+    void define(std::string_view name, int32_t value)      .equ
+    void set_entry(std::string_view name)                  .entry
+Error: ErrorInfo or AsmError, built with operator<< (no std::string in a constant expression)
+*/
+
+
+// the error of a build in a constant expression: no std::string, the message is cut to fit
+struct AsmError {
+    ErrorCode code = ErrorCode::OK;
+    size_t file = 0; // index in the files of the build (static_asm.h), the runtime tells it with the file name
+    size_t index_line = 0;
+    char message[96]{};
+
+    constexpr AsmError& operator<<(std::string_view s) {
+        size_t end = std::string_view(message).size();
+        for (char ch : s)
+            if (end + 1 < sizeof(message)) message[end++] = ch;
+        return *this;
+    }
+
+    constexpr AsmError& operator<<(size_t n) {
+        char digits[20]{};
+        size_t count = 0;
+        do {
+            digits[count++] = static_cast<char>('0' + n % 10);
+            n /= 10;
+        } while (n != 0);
+        while (count != 0) *this << std::string_view(&digits[--count], 1);
+        return *this;
+    }
+};
+
+
+enum class Directive : uint8_t {
+    SECTION, TEXT, DATA, RODATA, BSS,
+    GLOBAL, EXTERN, ENTRY,
+    EQU, BYTE, HWORD, WORD, SPACE, ALIGN
+};
+
+inline constexpr auto directive_table = make_perfect_hash<64>(std::to_array<std::pair<std::string_view, Directive>>({
+    { ".section", Directive::SECTION },
+    { ".text",    Directive::TEXT },
+    { ".data",    Directive::DATA },
+    { ".rodata",  Directive::RODATA },
+    { ".bss",     Directive::BSS },
+    { ".global",  Directive::GLOBAL },
+    { ".extern",  Directive::EXTERN },
+    { ".entry",   Directive::ENTRY },
+    { ".equ",     Directive::EQU },
+    { ".byte",    Directive::BYTE },
+    { ".hword",   Directive::HWORD },
+    { ".word",    Directive::WORD },
+    { ".space",   Directive::SPACE },
+    { ".align",   Directive::ALIGN },
+}));
+
+// ".text" or ".section .text" (args: ".text"), nullopt if it is not a section directive
+constexpr std::optional<Section> section_of(Directive d, std::string_view args) {
+    if (d == Directive::SECTION) {
+        const Directive* named = directive_table.find(args);
+        if (!named || *named == Directive::SECTION) return std::nullopt;
+        d = *named;
+    }
+    switch (d) {
+    case Directive::TEXT: return Section::TEXT;
+    case Directive::DATA: return Section::DATA;
+    case Directive::RODATA: return Section::RODATA;
+    case Directive::BSS: return Section::BSS;
+    default: return std::nullopt;
+    }
+}
+
+//true if not good
+constexpr bool check_if_constant(std::string_view instr) {
+    if (instr == "stb") return true;
+    if (instr == "sth") return true;
+    if (instr == "stw") return true;
+    return false;
+}
+
+// where a section of obj (ObjectFile or static_asm::Object) starts once linked
+template <class Obj>
+constexpr uint32_t section_base(const Obj& obj, Section section) {
+    switch (section) {
+    case Section::TEXT: return obj.text_base;
+    case Section::DATA: return obj.data_base;
+    case Section::RODATA: return obj.rodata_base;
+    case Section::BSS: return obj.bss_base;
+    default: return 0;
+    }
+}
+
+// imm of the instruction at pc for a symbol at addr, both in the same address space: what the linkers patch
+constexpr int32_t relocated_imm(RelocType type, uint32_t addr, uint32_t pc) {
+    if (type == RelocType::PC_REL_32) return static_cast<int32_t>(addr) - static_cast<int32_t>(pc + 1);
+    return static_cast<int32_t>(addr);
+}
+
+template <class Derived, class Object, class Error>
+struct AsmPasses {
+    Object obj;
+    std::vector<std::string_view> lines; // views on the source given to assemble(): it must outlive them
+    Section cur_section = Section::TEXT;
+    uint32_t cur_pc = 0;
+
+    // first pass -> second pass: only the lines with something in them, comment and spaces removed
+    struct CodeLine {
+        std::string_view text;
+        size_t index; // in lines
+    };
+    std::vector<CodeLine> code;
+    std::vector<std::string_view> args; // of the current line, reused
+
+    static constexpr Error fail(ErrorCode code) {
+        Error e;
+        e.code = code;
+        return e;
+    }
+
+    constexpr Derived& self() { return static_cast<Derived&>(*this); }
+
+    constexpr std::pair<Error, int> parse_imm(std::string_view s) {
+        std::pair<ErrorCode, int> r;
+        if (s.starts_with("0x")) r = string_utils::stoi_code(s.substr(2), nullptr, 16);
+        else if (s.starts_with("0b")) r = string_utils::stoi_code(s.substr(2), nullptr, 2);
+        else if (const int32_t* value = self().constant(s)) return { { }, *value };
+        else r = string_utils::stoi_code(s);
+        if (r.first != ErrorCode::OK) return { fail(r.first) << string_utils::stoi_message(r.first) << " \"" << s << "\"", 0 };
+        return { { }, r.second };
+    }
+
+    // .text has no data: nothing in it but instructions, or the PC of its labels would be wrong
+    constexpr Error emit(std::string_view arg, size_t bytes) {
+        auto [e, v] = parse_imm(arg);
+        if (e.code != ErrorCode::OK) return e;
+        if (cur_section == Section::BSS) {
+            obj.bss_size += bytes;
+            return { };
+        }
+        if (cur_section == Section::TEXT) return fail(ErrorCode::INVALID_ARG) << "data in the .text section";
+        auto& buf = cur_section == Section::DATA ? obj.data : obj.rodata;
+        for (size_t i = 0; i < bytes; i++) buf.push_back(static_cast<uint8_t>(static_cast<uint32_t>(v) >> (8 * i)));
+        return { };
+    }
+
+    // nothing to align in .text (one instruction per PC)
+    constexpr void align(size_t alignment) {
+        const size_t mask = alignment - 1;
+        if (cur_section == Section::BSS) obj.bss_size = (obj.bss_size + mask) & ~mask;
+        else if (cur_section != Section::TEXT) {
+            auto& buf = cur_section == Section::DATA ? obj.data : obj.rodata;
+            buf.resize((buf.size() + mask) & ~mask);
+        }
+    }
+
+    constexpr Error label(std::string_view name, uint32_t text_pc) {
+        auto* known = self().find_symbol(name);
+        if (known && known->bind == SymbolBinding::LOCAL) return fail(ErrorCode::DUPLICATE_LABEL) << "duplicate label \"" << name << "\"";
+
+        auto& S = self().symbol(name);
+        S.section = cur_section;
+        switch (cur_section) {
+        case Section::TEXT: S.value = text_pc; break;
+        case Section::DATA: S.value = static_cast<uint32_t>(obj.data.size()); break;
+        case Section::RODATA: S.value = static_cast<uint32_t>(obj.rodata.size()); break;
+        case Section::BSS: S.value = obj.bss_size; break;
+        default: break;
+        }
+        return { };
+    }
+
+    constexpr Error directive(std::string_view line) {
+        const auto [name, rest] = string_utils::split_mnemonic(line);
+        const Directive* d = directive_table.find(name);
+        if (!d) return { }; // not ours
+
+        if (auto section = section_of(*d, rest)) {
+            cur_section = *section;
+            return { };
+        }
+        if (*d == Directive::SECTION) return fail(ErrorCode::INVALID_ARG) << "unknown section \"" << rest << "\"";
+
+        string_utils::split_args(rest, args);
+        const size_t expected = *d == Directive::EQU ? 2 : 1;
+        if ((*d == Directive::GLOBAL || *d == Directive::EXTERN || *d == Directive::ENTRY || *d == Directive::EQU
+             || *d == Directive::SPACE || *d == Directive::ALIGN) && args.size() != expected)
+            return fail(ErrorCode::INVALID_ARG_SIZE) << "invalid argument size, expected " << expected;
+
+        switch (*d) {
+        case Directive::GLOBAL:
+            self().symbol(args[0]).bind = SymbolBinding::GLOBAL;
+            return { };
+        case Directive::EXTERN: {
+            auto& S = self().symbol(args[0]);
+            S.section = Section::NONE;
+            S.value = 0;
+            S.bind = SymbolBinding::EXTERN;
+            return { };
+        }
+        case Directive::ENTRY:
+            self().set_entry(args[0]);
+            return { };
+        case Directive::EQU: {
+            auto [e, value] = parse_imm(args[1]);
+            if (e.code != ErrorCode::OK) return e;
+            self().define(args[0], value);
+            return { };
+        }
+        case Directive::BYTE:
+        case Directive::HWORD:
+        case Directive::WORD: {
+            const size_t bytes = *d == Directive::BYTE ? 1 : *d == Directive::HWORD ? 2 : 4;
+            align(bytes);
+            for (std::string_view a : args)
+                if (Error e = emit(a, bytes); e.code != ErrorCode::OK) return e;
+            return { };
+        }
+        case Directive::SPACE: {
+            auto [e, size] = parse_imm(args[0]);
+            if (e.code != ErrorCode::OK) return e;
+            if (cur_section == Section::BSS) obj.bss_size += size;
+            else if (cur_section == Section::TEXT) return fail(ErrorCode::INVALID_ARG) << "data in the .text section";
+            else {
+                auto& buf = cur_section == Section::DATA ? obj.data : obj.rodata;
+                buf.resize(buf.size() + size, 0);
+            }
+            return { };
+        }
+        case Directive::ALIGN: {
+            auto [e, pow] = parse_imm(args[0]);
+            if (e.code != ErrorCode::OK) return e;
+            align(size_t{ 1 } << pow);
+            return { };
+        }
+        default:
+            return { };
+        }
+    }
+
+    constexpr Error instruction(std::string_view line) {
+        const auto [name, rest] = string_utils::split_mnemonic(line);
+        const InstrDef* def = instr_table.find(name);
+        if (!def) return fail(ErrorCode::UNKNOWN_INSTR) << "unknown instruction \"" << name << "\"";
+
+        string_utils::split_args(rest, args);
+        if (args.size() != def->n_args) return fail(ErrorCode::INVALID_ARG_SIZE) << "invalid argument size, expected " << size_t{ def->n_args } << " arguments";
+
+        std::array<uint8_t, 3> r{ }; // rd, rs1, rs2
+        int32_t imm = 0;
+        for (size_t i = 0; i < def->n_args; i++) {
+            switch (def->args[i]) {
+            case ArgType::REG: {
+                const uint8_t* reg = reg_table.find(args[i]);
+                if (!reg) return fail(ErrorCode::INVALID_REG) << "invalid register \"" << args[i] << "\"";
+                r[def->args_pos[i]] = *reg;
+                break;
+            }
+            case ArgType::IMM: {
+                auto [e, value] = parse_imm(args[i]);
+                if (e.code != ErrorCode::OK) return e;
+                if (def->opcode == MOV_IMM) imm = value;
+                else r[def->args_pos[i]] = static_cast<uint8_t>(value);
+                break;
+            }
+            case ArgType::LABEL:
+            case ArgType::VAR: {
+                const auto* S = self().find_symbol(args[i]);
+                if (!S) return fail(ErrorCode::UNKNOWN_SYMBOL) << "unknown symbol \"" << args[i] << "\"";
+                if (def->args[i] == ArgType::VAR && S->section == Section::RODATA && check_if_constant(name))
+                    return fail(ErrorCode::RODATA_VAR_MODIFIED) << "rodata variable \"" << args[i] << "\" is being modified";
+
+                const auto index = static_cast<uint32_t>(S - obj.symbols.data());
+                const RelocType type = def->args[i] == ArgType::LABEL ? RelocType::PC_REL_32 : RelocType::ABS_32;
+                obj.relocations.push_back({ Section::TEXT, cur_pc, type, index });
+                // already right for a local label of .text, the linker patches the rest
+                if (type == RelocType::PC_REL_32 && S->bind == SymbolBinding::LOCAL && S->section == Section::TEXT)
+                    imm = relocated_imm(type, S->value, cur_pc);
+                break;
+            }
+            case ArgType::NONE:
+                break;
+            }
+        }
+        obj.text.emplace_back(def->opcode, r[0], r[1], r[2], imm);
+        cur_pc++;
+        return { };
+    }
+
+    // both passes, the error has its index in lines; obj and the symbols of Derived must be empty
+    constexpr Error assemble(std::string_view source) {
+        cur_section = Section::TEXT;
+        cur_pc = 0;
+        lines.clear();
+        code.clear();
+        for (size_t start = 0;;) {
+            const size_t end = source.find('\n', start);
+            lines.push_back(source.substr(start, end - start));
+            if (end == std::string_view::npos) break;
+            start = end + 1;
+        }
+
+        // labels and directives
+        uint32_t text_pc = 0; // instructions only advance PC in .text
+        for (size_t i = 0; i < lines.size(); i++) {
+            const std::string_view line = string_utils::normalize(lines[i]);
+            if (line.empty()) continue;
+            code.push_back({ line, i });
+
+            Error e;
+            if (line.ends_with(':')) e = label(line.substr(0, line.size() - 1), text_pc);
+            else if (line[0] == '.') e = directive(line);
+            else if (cur_section == Section::TEXT) text_pc++;
+            if (e.code != ErrorCode::OK) {
+                e.index_line = i;
+                return e;
+            }
+        }
+
+        // instructions, the directives only switch sections now
+        cur_section = Section::TEXT;
+        for (const CodeLine& line : code) {
+            if (line.text.ends_with(':')) continue;
+            Error e;
+            if (line.text[0] == '.') {
+                const auto [name, rest] = string_utils::split_mnemonic(line.text);
+                if (const Directive* d = directive_table.find(name))
+                    if (auto section = section_of(*d, rest)) cur_section = *section;
+            } else if (cur_section == Section::TEXT) e = instruction(line.text);
+            if (e.code != ErrorCode::OK) {
+                e.index_line = line.index;
+                return e;
+            }
+        }
+        return { };
+    }
+};
+
+
+#endif
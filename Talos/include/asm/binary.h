@@ -0,0 +1,325 @@
+#ifndef ERGON_BINARY_H
+#define ERGON_BINARY_H
+
+#include "decoder.h"
+#include "linker.h"
+#include "error.h"
+
+#include <algorithm>
+#include <cstring>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+On-disk format of ObjectFile (.eo) and LinkedBinary (.ex), little-endian:
+ - BinaryHeader
+ - text: DecodedInstr records as they are in memory (8 bytes each, 8-aligned)
+ - data, rodata: raw bytes
+ - symbols then relocations: fixed-size records, names are offsets in the string table, relocations point
+   to their symbol by index
+ - string table
+Written in one pass, loaded by mapping the file read-only: text / data / rodata are spans on the mapping
+*/
+
+static_assert(std::is_trivially_copyable_v<DecodedInstr> && sizeof(DecodedInstr) == 8, "text is stored as raw DecodedInstr");
+
+enum class BinaryKind : uint32_t {
+    OBJECT = 1,
+    EXECUTABLE = 2
+};
+
+struct BinaryHeader {
+    static constexpr uint32_t MAGIC = 0x4E475245; // "ERGN"
+    static constexpr uint32_t VERSION = 2;
+
+    uint32_t magic = MAGIC;
+    uint32_t version = VERSION;
+    BinaryKind kind = BinaryKind::OBJECT;
+    uint32_t entry_pc = 0; // executables
+    uint32_t entry_symbol = 0; // objects: offset in the string table, + 1 (0 = none)
+    uint32_t bss_size = 0;
+
+    uint32_t text_count = 0;
+    uint32_t data_size = 0;
+    uint32_t rodata_size = 0;
+    uint32_t symbol_count = 0;
+    uint32_t reloc_count = 0;
+    uint32_t strings_size = 0;
+
+    uint64_t text_offset = 0;
+    uint64_t data_offset = 0;
+    uint64_t rodata_offset = 0;
+    uint64_t symbol_offset = 0;
+    uint64_t reloc_offset = 0;
+    uint64_t strings_offset = 0;
+};
+
+struct BinarySymbol {
+    uint32_t name = 0; // offset in the string table
+    uint32_t name_size = 0;
+    uint32_t value = 0;
+    uint8_t section = 0;
+    uint8_t bind = 0;
+    uint16_t pad = 0;
+};
+
+struct BinaryReloc {
+    uint32_t symbol = 0; // index in the symbol records
+    uint32_t offset = 0;
+    uint8_t section = 0;
+    uint8_t type = 0;
+    uint16_t pad = 0;
+};
+
+namespace binary {
+    inline uint64_t align8(uint64_t n) {
+        return (n + 7) & ~uint64_t(7);
+    }
+
+    // sections of either an ObjectFile or a LinkedBinary, symbols as { name, symbol }
+    inline std::vector<uint8_t> serialize(BinaryHeader header, std::span<const DecodedInstr> text, std::span<const uint8_t> data, std::span<const uint8_t> rodata,
+                                          std::span<const std::pair<std::string_view, ObjSymbol>> symbols, std::span<const Relocation> relocations, std::string_view entry_symbol) {
+        header.text_count = static_cast<uint32_t>(text.size());
+        header.data_size = static_cast<uint32_t>(data.size());
+        header.rodata_size = static_cast<uint32_t>(rodata.size());
+        header.symbol_count = static_cast<uint32_t>(symbols.size());
+        header.reloc_count = static_cast<uint32_t>(relocations.size());
+
+        header.text_offset = align8(sizeof(BinaryHeader));
+        header.data_offset = header.text_offset + text.size_bytes();
+        header.rodata_offset = header.data_offset + data.size();
+        header.symbol_offset = align8(header.rodata_offset + rodata.size());
+        header.reloc_offset = header.symbol_offset + symbols.size() * sizeof(BinarySymbol);
+        header.strings_offset = header.reloc_offset + relocations.size() * sizeof(BinaryReloc);
+
+        std::vector<uint8_t> out(header.strings_offset);
+        std::string strings;
+        auto add_string = [&](std::string_view s) {
+            auto offset = static_cast<uint32_t>(strings.size());
+            strings += s;
+            return offset;
+        };
+
+        if (!text.empty()) std::memcpy(out.data() + header.text_offset, text.data(), text.size_bytes());
+        if (!data.empty()) std::memcpy(out.data() + header.data_offset, data.data(), data.size());
+        if (!rodata.empty()) std::memcpy(out.data() + header.rodata_offset, rodata.data(), rodata.size());
+        for (size_t i = 0; i < symbols.size(); i++) {
+            const auto& [name, sym] = symbols[i];
+            BinarySymbol record{ add_string(name), static_cast<uint32_t>(name.size()), sym.value, static_cast<uint8_t>(sym.section), static_cast<uint8_t>(sym.bind) };
+            std::memcpy(out.data() + header.symbol_offset + i * sizeof(BinarySymbol), &record, sizeof(record));
+        }
+        for (size_t i = 0; i < relocations.size(); i++) {
+            const Relocation& rel = relocations[i];
+            BinaryReloc record{ rel.symbol, rel.offset, static_cast<uint8_t>(rel.section), static_cast<uint8_t>(rel.type) };
+            std::memcpy(out.data() + header.reloc_offset + i * sizeof(BinaryReloc), &record, sizeof(record));
+        }
+        if (!entry_symbol.empty()) header.entry_symbol = add_string(entry_symbol) + 1;
+
+        header.strings_size = static_cast<uint32_t>(strings.size());
+        out.insert(out.end(), strings.begin(), strings.end());
+        std::memcpy(out.data(), &header, sizeof(header));
+        return out;
+    }
+
+    inline ErrorInfo write_file(const std::string& path, const std::vector<uint8_t>& bytes) {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return { ErrorCode::FILE_ERROR, "cannot open \"" + path + "\" for writing" };
+        size_t written = 0;
+        while (written < bytes.size()) {
+            ssize_t n = write(fd, bytes.data() + written, bytes.size() - written);
+            if (n <= 0) {
+                close(fd);
+                return { ErrorCode::FILE_ERROR, "cannot write \"" + path + "\"" };
+            }
+            written += static_cast<size_t>(n);
+        }
+        close(fd);
+        return { };
+    }
+}
+
+inline ErrorInfo write_object(const std::string& path, const ObjectFile& obj) {
+    // in the order of obj.symbols, the relocations point into it
+    std::vector<std::pair<std::string_view, ObjSymbol>> symbols;
+    symbols.reserve(obj.symbols.size());
+    for (const ObjSymbol& sym : obj.symbols) symbols.emplace_back(symbol_names().name(sym.id), sym);
+
+    BinaryHeader header;
+    header.kind = BinaryKind::OBJECT;
+    header.bss_size = obj.bss_size;
+    const std::string_view entry = obj.entry_symbol == NO_SYMBOL ? "" : symbol_names().name(obj.entry_symbol);
+    return binary::write_file(path, binary::serialize(header, obj.text, obj.data, obj.rodata, symbols, obj.relocations, entry));
+}
+
+inline ErrorInfo write_executable(const std::string& path, const LinkedBinary& bin) {
+    std::vector<std::pair<std::string_view, ObjSymbol>> symbols;
+    symbols.reserve(bin.text_symbols.size());
+    for (const Symbol& sym : bin.text_symbols) symbols.push_back({ sym.name, { NO_SYMBOL, sym.section, sym.value, sym.bind } });
+
+    BinaryHeader header;
+    header.kind = BinaryKind::EXECUTABLE;
+    header.entry_pc = bin.entry_pc;
+    header.bss_size = bin.bss_size;
+    return binary::write_file(path, binary::serialize(header, bin.text, bin.data, bin.rodata, symbols, { }, ""));
+}
+
+
+// a binary file mapped read-only, the sections point into the mapping (valid as long as it lives)
+struct MappedBinary {
+    const uint8_t* base = nullptr;
+    size_t length = 0;
+    BinaryHeader header;
+
+    MappedBinary() = default;
+    MappedBinary(const MappedBinary&) = delete;
+    MappedBinary& operator=(const MappedBinary&) = delete;
+    MappedBinary(MappedBinary&& other) noexcept : base(other.base), length(other.length), header(other.header) {
+        other.base = nullptr;
+        other.length = 0;
+    }
+    MappedBinary& operator=(MappedBinary&& other) noexcept {
+        std::swap(base, other.base);
+        std::swap(length, other.length);
+        std::swap(header, other.header);
+        return *this;
+    }
+    ~MappedBinary() {
+        if (base) munmap(const_cast<uint8_t*>(base), length);
+    }
+
+    ErrorInfo open(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return { ErrorCode::FILE_ERROR, "cannot open \"" + path + "\"" };
+        struct stat st{};
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(BinaryHeader)) {
+            close(fd);
+            return { ErrorCode::INVALID_BINARY, "\"" + path + "\" is too small to be an Ergon binary" };
+        }
+        void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd); // the mapping keeps the file
+        if (p == MAP_FAILED) return { ErrorCode::FILE_ERROR, "cannot map \"" + path + "\"" };
+        base = static_cast<const uint8_t*>(p);
+        length = static_cast<size_t>(st.st_size);
+        std::memcpy(&header, base, sizeof(header));
+        return check(path);
+    }
+
+    std::span<const DecodedInstr> text() const {
+        return { reinterpret_cast<const DecodedInstr*>(base + header.text_offset), header.text_count };
+    }
+    std::span<const uint8_t> data() const {
+        return { base + header.data_offset, header.data_size };
+    }
+    std::span<const uint8_t> rodata() const {
+        return { base + header.rodata_offset, header.rodata_size };
+    }
+
+    std::vector<Symbol> symbols() const {
+        std::vector<Symbol> out(header.symbol_count);
+        for (size_t i = 0; i < out.size(); i++) {
+            BinarySymbol record;
+            std::memcpy(&record, base + header.symbol_offset + i * sizeof(BinarySymbol), sizeof(record));
+            out[i] = { std::string(string_at(record.name, record.name_size)), static_cast<Section>(record.section), record.value, static_cast<SymbolBinding>(record.bind) };
+        }
+        return out;
+    }
+
+    std::vector<Relocation> relocations() const {
+        std::vector<Relocation> out(header.reloc_count);
+        for (size_t i = 0; i < out.size(); i++) {
+            BinaryReloc record;
+            std::memcpy(&record, base + header.reloc_offset + i * sizeof(BinaryReloc), sizeof(record));
+            out[i] = { static_cast<Section>(record.section), record.offset, static_cast<RelocType>(record.type), record.symbol };
+        }
+        return out;
+    }
+
+    std::string_view entry_symbol() const {
+        if (header.entry_symbol == 0) return "";
+        const char* begin = reinterpret_cast<const char*>(base + header.strings_offset + header.entry_symbol - 1);
+        return { begin, strnlen(begin, header.strings_size - (header.entry_symbol - 1)) };
+    }
+
+    // for the linker, which fills the bases itself
+    ObjectFile object() const {
+        ObjectFile obj;
+        obj.text.assign(text().begin(), text().end());
+        obj.data.assign(data().begin(), data().end());
+        obj.rodata.assign(rodata().begin(), rodata().end());
+        obj.bss_size = header.bss_size;
+        obj.symbols.resize(header.symbol_count);
+        for (size_t i = 0; i < obj.symbols.size(); i++) {
+            BinarySymbol record;
+            std::memcpy(&record, base + header.symbol_offset + i * sizeof(BinarySymbol), sizeof(record));
+            obj.symbols[i] = { symbol_names().intern(string_at(record.name, record.name_size)), static_cast<Section>(record.section), record.value, static_cast<SymbolBinding>(record.bind) };
+        }
+        obj.relocations = relocations();
+        if (header.entry_symbol != 0) obj.entry_symbol = symbol_names().intern(entry_symbol());
+        return obj;
+    }
+
+private:
+    std::string_view string_at(uint32_t offset, uint32_t size) const {
+        return { reinterpret_cast<const char*>(base + header.strings_offset + offset), size };
+    }
+
+    // every section inside of the file, text aligned, and every instruction a known opcode on registers r0-r15,
+    // every symbol and relocation a known kind, relocations inside of the text: nothing read afterwards can go
+    // past the mapping (or the linked text), and the engines can index the register file with the fields
+    ErrorInfo check(const std::string& path) const {
+        auto bad = [&](const std::string& why) { return ErrorInfo(ErrorCode::INVALID_BINARY, "\"" + path + "\": " + why); };
+        if (header.magic != BinaryHeader::MAGIC) return bad("not an Ergon binary");
+        if (header.version != BinaryHeader::VERSION) return bad("version " + std::to_string(header.version) + ", expected " + std::to_string(BinaryHeader::VERSION));
+
+        auto inside = [&](uint64_t offset, uint64_t size) { return offset <= length && size <= length - offset; };
+        if (header.text_offset % alignof(DecodedInstr) != 0
+            || !inside(header.text_offset, uint64_t(header.text_count) * sizeof(DecodedInstr))
+            || !inside(header.data_offset, header.data_size)
+            || !inside(header.rodata_offset, header.rodata_size)
+            || !inside(header.symbol_offset, uint64_t(header.symbol_count) * sizeof(BinarySymbol))
+            || !inside(header.reloc_offset, uint64_t(header.reloc_count) * sizeof(BinaryReloc))
+            || !inside(header.strings_offset, header.strings_size))
+            return bad("truncated");
+
+        for (const DecodedInstr& I : text()) {
+            if (I.opcode >= OPCODE_COUNT) return bad("unknown opcode " + std::to_string(I.opcode));
+            if (I.rd >= 16 || I.rs1 >= 16 || (I.rs2 >= 16 && !rs2_is_imm(I.opcode))) return bad("register outside of r0-r15");
+        }
+        for (uint32_t i = 0; i < header.symbol_count; i++) {
+            BinarySymbol record;
+            std::memcpy(&record, base + header.symbol_offset + i * sizeof(BinarySymbol), sizeof(record));
+            if (uint64_t(record.name) + record.name_size > header.strings_size) return bad("symbol name outside of the string table");
+            if (record.section > static_cast<uint8_t>(Section::NONE) || record.bind > static_cast<uint8_t>(SymbolBinding::EXTERN))
+                return bad("symbol of an unknown section or binding");
+        }
+        for (uint32_t i = 0; i < header.reloc_count; i++) {
+            BinaryReloc record;
+            std::memcpy(&record, base + header.reloc_offset + i * sizeof(BinaryReloc), sizeof(record));
+            if (record.symbol >= header.symbol_count) return bad("relocation of an unknown symbol");
+            // the linker patches out.text[text_base + offset]: only text is relocated
+            if (record.section != static_cast<uint8_t>(Section::TEXT) || record.type > static_cast<uint8_t>(RelocType::ABS_32))
+                return bad("relocation of an unknown section or type");
+            if (record.offset >= header.text_count) return bad("relocation outside of the text");
+        }
+        if (header.entry_symbol > header.strings_size) return bad("entry symbol outside of the string table");
+        return { };
+    }
+};
+
+inline std::pair<ErrorInfo, ObjectFile> read_object(const std::string& path) {
+    MappedBinary file;
+    ErrorInfo e = file.open(path);
+    if (e.code != ErrorCode::OK) return { e, { } };
+    if (file.header.kind != BinaryKind::OBJECT) return { { ErrorCode::INVALID_BINARY, "\"" + path + "\" is not an object file" }, { } };
+    return { { }, file.object() };
+}
+
+
+#endif
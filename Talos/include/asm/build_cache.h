@@ -0,0 +1,117 @@
+#ifndef ERGON_BUILD_CACHE_H
+#define ERGON_BUILD_CACHE_H
+
+#include "decoder.h"
+#include "binary.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+Decoded object files by content: the key hashes the source, the constants the decoder already knows
+(a file can use the .equ of the files before it) and the assembler version.
+ - in memory for the life of the EnvironmentManager
+ - on disk too when directory is set: <key>.eo (see binary.h), + <key>.equ if the file defines constants
+A rebuild only decodes the files that changed, then links everything again
+*/
+
+constexpr uint32_t ASSEMBLER_VERSION = 3; // bump when the decoder output changes: every cached object is stale
+
+struct BuildStats {
+    size_t hits = 0; // in memory
+    size_t disk_hits = 0;
+    size_t misses = 0; // decoded
+};
+
+struct BuildCache {
+    struct Entry {
+        ObjectFile obj; // as decoded, before link() gives it its bases
+        ConstantTable constants; // of the decoder once the file is decoded
+    };
+
+    bool enabled = true;
+    std::string directory; // empty: memory only
+    size_t max_entries = 1024; // everything is dropped past it
+    BuildStats stats; // of the last build
+
+    std::unordered_map<uint64_t, Entry> entries;
+
+    static uint64_t key(const std::string& source, const ConstantTable& constants) {
+        uint64_t h = 14695981039346656037ull; // FNV-1a
+        auto mix = [&h](const void* p, size_t n) {
+            auto bytes = static_cast<const uint8_t*>(p);
+            for (size_t i = 0; i < n; i++) {
+                h ^= bytes[i];
+                h *= 1099511628211ull;
+            }
+        };
+        mix(&ASSEMBLER_VERSION, sizeof(ASSEMBLER_VERSION));
+        mix(source.data(), source.size());
+
+        // sorted: the hash map order is not the same from one run to the other
+        std::vector<std::pair<std::string, int32_t>> sorted(constants.begin(), constants.end());
+        std::ranges::sort(sorted);
+        for (const auto& [name, value] : sorted) {
+            mix(name.data(), name.size() + 1);
+            mix(&value, sizeof(value));
+        }
+        return h;
+    }
+
+    // memory first, then disk (kept in memory afterwards), nullptr on a miss
+    const Entry* find(uint64_t k, const ConstantTable& constants) {
+        if (!enabled) return nullptr;
+        if (auto it = entries.find(k); it != entries.end()) {
+            stats.hits++;
+            return &it->second;
+        }
+        if (directory.empty()) return nullptr;
+
+        auto [e, obj] = read_object(path(k, ".eo"));
+        if (e.code != ErrorCode::OK) return nullptr;
+        Entry entry{ std::move(obj), constants };
+        std::ifstream equ(path(k, ".equ"));
+        std::string name;
+        int32_t value;
+        while (equ >> name >> value) entry.constants[name] = value;
+
+        stats.disk_hits++;
+        return &insert(k, std::move(entry));
+    }
+
+    void store(uint64_t k, const ObjectFile& obj, const ConstantTable& constants_before, const ConstantTable& constants) {
+        if (!enabled) return;
+        insert(k, { obj, constants });
+        if (directory.empty()) return;
+
+        // the .equ first: a .eo without it would be read as "defines no constant"
+        if (constants != constants_before) {
+            std::ofstream equ(path(k, ".equ"));
+            for (const auto& [name, value] : constants) equ << name << " " << value << "\n";
+        }
+        write_object(path(k, ".eo"), obj);
+    }
+
+    void clear() {
+        entries.clear();
+    }
+
+private:
+    Entry& insert(uint64_t k, Entry entry) {
+        if (entries.size() >= max_entries) entries.clear();
+        return entries[k] = std::move(entry);
+    }
+
+    std::string path(uint64_t k, const char* extension) const {
+        char name[17];
+        std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(k));
+        return directory + "/" + name + extension;
+    }
+};
+
+
+#endif
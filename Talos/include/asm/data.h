@@ -1,6 +1,8 @@
 #ifndef ERGON_DATA_H
 #define ERGON_DATA_H
 
+#include "symbols.h"
+
 #include <cstdint>
 #include <string>
 
@@ -26,6 +28,7 @@ struct Label {
     size_t value;
 };
 
+// with its name: what tools see (LinkedBinary::text_symbols, profiler)
 struct Symbol {
     std::string name;
     Section section = Section::NONE;
@@ -33,6 +36,14 @@ struct Symbol {
     SymbolBinding bind = SymbolBinding::LOCAL;
 };
 
+// what object files keep: the name is interned (see symbols.h)
+struct ObjSymbol {
+    SymbolId id = NO_SYMBOL;
+    Section section = Section::NONE;
+    uint32_t value = 0; // offset in section
+    SymbolBinding bind = SymbolBinding::LOCAL;
+};
+
 enum class RelocType {
     PC_REL_32, // jumps, calls
     ABS_32 // data addresses
@@ -42,7 +53,7 @@ struct Relocation {
     Section section;
     uint32_t offset; // where to patch
     RelocType type;
-    std::string symbol;
+    uint32_t symbol; // index in the symbols of its ObjectFile
 };
 
 struct DecodedInstr {
@@ -54,7 +65,7 @@ struct DecodedInstr {
 
     DecodedInstr() = default;
 
-    DecodedInstr(uint8_t opcode, uint8_t rd, uint8_t rs1, uint8_t rs2, int32_t imm) : opcode(opcode), rd(rd), rs1(rs1), rs2(rs2), imm(imm) {}
+    constexpr DecodedInstr(uint8_t opcode, uint8_t rd, uint8_t rs1, uint8_t rs2, int32_t imm) : opcode(opcode), rd(rd), rs1(rs1), rs2(rs2), imm(imm) {}
 };
 
 #endif
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define ERGON_ERROR_H
 
 #include <string>
+#include <string_view>
 #include <utility>
 
 enum class ErrorCode : uint8_t {
@@ -24,6 +25,9 @@ enum class ErrorCode : uint8_t {
     VAR_OUTSIDE_BSS, //variable is outside bss section
     RAM_OVERFLOW, //ram overflow
     RODATA_VAR_MODIFIED, //rodata variable ... is being modified
+    FILE_ERROR, //cannot open / write / map the file
+    INVALID_BINARY, //not an Ergon binary, other version or truncated
+    UNKNOWN_INSTR, //unknown instruction " "
 
 };
 
@@ -38,6 +42,17 @@ struct ErrorInfo {
     ErrorInfo(ErrorCode e_code, std::string e_msg) : code(e_code), message(std::move(e_msg)) {}
     ErrorInfo(ErrorCode e_code, std::string e_msg, size_t i) : code(e_code), message(std::move(e_msg)), index_line(i) {}
 
+    // the message piece by piece, like AsmError (see assembler.h)
+    ErrorInfo& operator<<(std::string_view s) {
+        message += s;
+        return *this;
+    }
+
+    ErrorInfo& operator<<(size_t n) {
+        message += std::to_string(n);
+        return *this;
+    }
+
 };
 
 #endif
\ No newline at end of file
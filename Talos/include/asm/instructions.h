@@ -2,8 +2,10 @@
 #define ERGON_INSTRUCTIONS_H
 
 #include "computer/core.h"
+#include "perfect_hash.h"
 
-#include <unordered_map>
+#include <algorithm>
+#include <initializer_list>
 
 
 enum class InstrType { R, I, J };
@@ -19,16 +21,20 @@ enum class ArgType {
 struct InstrDef {
     OPCODE opcode;
     InstrType type;
-    std::vector<ArgType> args;
-    std::vector<size_t> args_pos;
-
-    InstrDef(OPCODE opcode, InstrType type, const std::vector<ArgType>& args, const std::vector<size_t>& args_pos) : opcode(opcode), type(type), args(args), args_pos(args_pos) {
-        if (args.size() != args_pos.size()) throw std::exception();
+    std::array<ArgType, 3> args{};
+    std::array<uint8_t, 3> args_pos{};
+    uint8_t n_args = 0;
+
+    constexpr InstrDef(OPCODE opcode, InstrType type, std::initializer_list<ArgType> args, std::initializer_list<uint8_t> args_pos) : opcode(opcode), type(type), n_args(static_cast<uint8_t>(args.size())) {
+        if (args.size() != args_pos.size() || args.size() > 3) throw std::exception(); // at compile time: does not compile
+        std::ranges::copy(args, this->args.begin());
+        std::ranges::copy(args_pos, this->args_pos.begin());
     }
 };
 
 // { <instruction_name>, { <opcode>, <instruction_type>, { <argument_type>, ... } } }
-inline std::unordered_map<std::string, InstrDef> instr_table = {
+// perfect hash built at compile time (see perfect_hash.h), read-only: shared by the decoders of every thread
+inline constexpr auto instr_table = make_perfect_hash<1024>(std::to_array<std::pair<std::string_view, InstrDef>>({
     {"add",  {ADD,  InstrType::R, { ArgType::REG, ArgType::REG, ArgType::REG }, { 0, 1, 2 } }}, //rd, rs1, rs2/imm
     {"sub",  {SUB,  InstrType::R, { ArgType::REG, ArgType::REG, ArgType::REG }, { 0, 1, 2 } }},
     {"mul",  {MUL,  InstrType::R, { ArgType::REG, ArgType::REG, ArgType::REG }, { 0, 1, 2 } }},
@@ -121,7 +127,32 @@ inline std::unordered_map<std::string, InstrDef> instr_table = {
     {"ret",  {RET,  InstrType::J, { }, { } }},
 
     {"halt",  {HALT,  InstrType::J, { }, { } }},
-};
+
+    {"coreid", {CORE_ID, InstrType::J, { ArgType::REG }, { 0 } }}, //rd
+    {"ncores", {NCORES,  InstrType::J, { ArgType::REG }, { 0 } }},
+    {"spawn",  {SPAWN,   InstrType::J, { ArgType::REG, ArgType::LABEL }, { 0, 0 } }}, //rd, label
+    {"join",   {JOIN,    InstrType::J, { ArgType::REG }, { 1 } }}, //rs1
+
+    {"cas",   {CAS,   InstrType::R, { ArgType::REG, ArgType::REG, ArgType::REG }, { 0, 1, 2 } }}, //rd (expected -> old), rs1 (addr), rs2 (desired)
+    {"xadd",  {XADD,  InstrType::R, { ArgType::REG, ArgType::REG, ArgType::REG }, { 0, 1, 2 } }},
+    {"xchg",  {XCHG,  InstrType::R, { ArgType::REG, ArgType::REG, ArgType::REG }, { 0, 1, 2 } }},
+    {"ldar",  {LDAR,  InstrType::R, { ArgType::REG, ArgType::REG }, { 0, 1 } }}, //rd, rs1 (addr)
+    {"stlr",  {STLR,  InstrType::R, { ArgType::REG, ArgType::REG }, { 0, 1 } }},
+    {"fence", {FENCE, InstrType::J, { }, { } }},
+    {"wait",  {WAIT,  InstrType::R, { ArgType::REG, ArgType::REG }, { 0, 1 } }}, //rd (expected), rs1 (addr)
+    {"wake",  {WAKE,  InstrType::J, { ArgType::REG }, { 1 } }}, //rs1 (addr)
+}));
+
+// rs2 holds an 8 bit immediate instead of a register (addi, cmpi, lbasew...), movi keeps its immediate in imm
+constexpr bool rs2_is_imm(uint8_t opcode) {
+    opcode = fused_head(opcode);
+    if (opcode == MOV_IMM) return false;
+    for (const auto& [name, def] : instr_table.entries)
+        if (def.opcode == opcode)
+            for (uint8_t i = 0; i < def.n_args; i++)
+                if (def.args[i] == ArgType::IMM && def.args_pos[i] == 2) return true;
+    return false;
+}
 
 
 #endif
\ No newline at end of file
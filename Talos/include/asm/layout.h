@@ -0,0 +1,246 @@
+#ifndef ERGON_LAYOUT_H
+#define ERGON_LAYOUT_H
+
+#include "data.h"
+#include "../computer/core.h"
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+/*
+Profile-guided layout of the linked .text (see link()):
+ - the text is cut in basic blocks (a call does not end its block: the return lands right after it)
+ - blocks are chained along their hottest edges (fall-through, jmp, taken jz/jnz) so the hot path falls through
+ - hot chains go first, hottest first, the blocks that never ran keep their order at the end (cold code)
+ - a jmp to the block placed right after it is dropped, a jz/jnz whose taken side is placed next is inverted,
+   a fall-through that lost its successor gets a jmp
+ - every branch, call and spawn is re-targeted, so are the entry point, the labels and the absolute
+   references to .text
+*/
+
+// counts of a run of a previous build of the same sources, indexed by PC (see Profile)
+struct LinkProfile {
+    std::vector<uint64_t> executed;
+    std::vector<uint64_t> taken; // conditional branches only
+
+    bool empty() const {
+        return executed.empty();
+    }
+};
+
+struct LayoutStats {
+    size_t blocks = 0;
+    size_t hot_blocks = 0;
+    size_t jumps_removed = 0;
+    size_t jumps_added = 0;
+    size_t branches_inverted = 0;
+};
+
+namespace layout {
+    constexpr bool is_branch(uint8_t opcode) {
+        return opcode == JZ || opcode == JNZ || opcode == JG || opcode == JL;
+    }
+
+    // the imm of these is relative to the next PC
+    constexpr bool is_relative(uint8_t opcode) {
+        return opcode == JMP || is_branch(opcode) || opcode == CALL || opcode == SPAWN;
+    }
+
+    constexpr bool ends_block(uint8_t opcode) {
+        return opcode == JMP || is_branch(opcode) || opcode == RET || opcode == HALT;
+    }
+
+    constexpr int32_t END = -1; // past the last instruction: the run halts
+
+    struct Block {
+        uint32_t begin = 0;
+        uint32_t end = 0; // exclusive
+        uint64_t count = 0; // runs of the last instruction
+        int32_t fall = END; // block right after it in the original text, if it can fall through
+        bool can_fall = true;
+        int32_t next = END; // chained after it
+        int32_t prev = END;
+    };
+}
+
+// abs_slots: PCs whose imm is an absolute address in .text (ABS_32 relocations against code labels)
+// origin_pc: when given, PC after linking of every slot, follows the blocks (filled if empty)
+inline LayoutStats layout_text(std::vector<DecodedInstr>& text, uint32_t& entry_pc, std::vector<Symbol>& text_symbols,
+                               const std::vector<uint32_t>& abs_slots, const LinkProfile& profile, std::vector<uint32_t>* origin_pc = nullptr) {
+    using namespace layout;
+    LayoutStats stats;
+    const auto n = static_cast<int64_t>(text.size());
+    if (n == 0 || profile.executed.size() < text.size() || profile.taken.size() < text.size()) return stats;
+
+    // absolute target of a relative instruction, END when outside of the text
+    auto target_of = [&](int64_t pc) -> int64_t {
+        int64_t t = pc + 1 + text[pc].imm;
+        return t >= 0 && t < n ? t : END;
+    };
+
+    // leaders
+    std::vector<bool> leader(text.size() + 1, false);
+    leader[0] = true;
+    if (entry_pc < n) leader[entry_pc] = true;
+    for (const Symbol& sym : text_symbols)
+        if (sym.value < n) leader[sym.value] = true;
+    for (uint32_t slot : abs_slots)
+        if (text[slot].imm >= 0 && text[slot].imm < n) leader[text[slot].imm] = true;
+    for (int64_t pc = 0; pc < n; pc++) {
+        if (is_relative(text[pc].opcode) && target_of(pc) != END) leader[target_of(pc)] = true;
+        if (ends_block(text[pc].opcode)) leader[pc + 1] = true;
+    }
+
+    // blocks
+    std::vector<Block> blocks;
+    std::vector<int32_t> block_of(text.size(), 0);
+    for (int64_t pc = 0; pc < n; pc++) {
+        if (leader[pc]) blocks.push_back({ static_cast<uint32_t>(pc), static_cast<uint32_t>(pc) });
+        blocks.back().end = static_cast<uint32_t>(pc + 1);
+        block_of[pc] = static_cast<int32_t>(blocks.size() - 1);
+    }
+    const auto block_at = [&](int64_t pc) -> int32_t { return pc == END ? END : block_of[pc]; };
+
+    for (size_t b = 0; b < blocks.size(); b++) {
+        Block& B = blocks[b];
+        uint8_t last = text[B.end - 1].opcode;
+        B.count = profile.executed[B.end - 1];
+        B.can_fall = last != JMP && last != RET && last != HALT;
+        B.fall = b + 1 < blocks.size() ? static_cast<int32_t>(b + 1) : END;
+        if (B.count != 0) stats.hot_blocks++;
+    }
+    stats.blocks = blocks.size();
+
+    // edges that can become fall-throughs, hottest first
+    struct Edge {
+        uint64_t weight;
+        int32_t from;
+        int32_t to;
+    };
+    std::vector<Edge> edges;
+    for (size_t b = 0; b < blocks.size(); b++) {
+        const Block& B = blocks[b];
+        const int64_t last_pc = B.end - 1;
+        const uint8_t last = text[last_pc].opcode;
+        const auto from = static_cast<int32_t>(b);
+
+        if (B.can_fall && B.fall != END) {
+            uint64_t weight = is_branch(last) ? B.count - std::min(B.count, profile.taken[last_pc]) : B.count;
+            edges.push_back({ weight, from, B.fall });
+        }
+        if (last == JMP && target_of(last_pc) != END)
+            edges.push_back({ B.count, from, block_at(target_of(last_pc)) });
+        if ((last == JZ || last == JNZ) && target_of(last_pc) != END)
+            edges.push_back({ profile.taken[last_pc], from, block_at(target_of(last_pc)) });
+    }
+    std::ranges::stable_sort(edges, [](const Edge& a, const Edge& b) { return a.weight > b.weight; });
+
+    // chains
+    std::vector<int32_t> chain(blocks.size());
+    std::iota(chain.begin(), chain.end(), 0);
+    for (const Edge& e : edges) {
+        if (e.weight == 0) break; // cold edges do not pull cold blocks into hot chains
+        Block& from = blocks[e.from];
+        Block& to = blocks[e.to];
+        if (from.next != END || to.prev != END || chain[e.from] == chain[e.to]) continue;
+
+        from.next = e.to;
+        to.prev = e.from;
+        for (int32_t b = e.to; b != END; b = blocks[b].next) chain[b] = chain[e.from];
+    }
+
+    // hot chains by weight, cold ones in their original order
+    std::vector<int32_t> heads;
+    std::vector<uint64_t> weight(blocks.size(), 0);
+    for (size_t b = 0; b < blocks.size(); b++) {
+        if (blocks[b].prev == END) heads.push_back(static_cast<int32_t>(b));
+        weight[chain[b]] += blocks[b].count;
+    }
+    std::ranges::stable_sort(heads, [&](int32_t a, int32_t b) { return weight[chain[a]] > weight[chain[b]]; });
+
+    std::vector<int32_t> order;
+    for (int32_t head : heads)
+        for (int32_t b = head; b != END; b = blocks[b].next) order.push_back(b);
+
+    // emission: new PCs, then the targets once every block has one
+    struct Fixup {
+        uint32_t at; // new PC of a relative instruction
+        int64_t old_target; // old PC, or END
+    };
+    std::vector<DecodedInstr> out;
+    std::vector<uint32_t> from; // old PC of every slot of out
+    std::vector<Fixup> fixups;
+    std::vector<int64_t> new_pc(text.size() + 1, 0);
+
+    for (size_t i = 0; i < order.size(); i++) {
+        const Block& B = blocks[order[i]];
+        const int32_t placed_next = i + 1 < order.size() ? order[i + 1] : END;
+
+        for (uint32_t pc = B.begin; pc + 1 < B.end; pc++) {
+            new_pc[pc] = static_cast<int64_t>(out.size());
+            if (is_relative(text[pc].opcode)) fixups.push_back({ static_cast<uint32_t>(out.size()), target_of(pc) });
+            out.push_back(text[pc]);
+            from.push_back(pc);
+        }
+
+        const uint32_t last_pc = B.end - 1;
+        DecodedInstr last = text[last_pc];
+        const int64_t target = is_relative(last.opcode) ? target_of(last_pc) : END;
+        const int64_t fall_pc = B.fall != END ? blocks[B.fall].begin : END;
+        new_pc[last_pc] = static_cast<int64_t>(out.size());
+
+        if (last.opcode == JMP && target != END && block_at(target) == placed_next) {
+            stats.jumps_removed++; // new_pc of the jmp is the next block: whatever jumped here lands on the target
+            continue;
+        }
+        // no inverse for jg / jl (jle / jge do not exist)
+        if ((last.opcode == JZ || last.opcode == JNZ) && B.fall != placed_next && target != END && block_at(target) == placed_next) {
+            last.opcode = last.opcode == JZ ? JNZ : JZ;
+            fixups.push_back({ static_cast<uint32_t>(out.size()), fall_pc });
+            out.push_back(last);
+            from.push_back(last_pc);
+            stats.branches_inverted++;
+            continue;
+        }
+
+        if (is_relative(last.opcode)) fixups.push_back({ static_cast<uint32_t>(out.size()), target });
+        out.push_back(last);
+        from.push_back(last_pc);
+
+        // lost its fall-through successor
+        if (B.can_fall && B.fall != placed_next) {
+            fixups.push_back({ static_cast<uint32_t>(out.size()), fall_pc });
+            out.push_back({ JMP, 0, 0, 0, 0 });
+            from.push_back(last_pc);
+            stats.jumps_added++;
+        }
+    }
+    const auto size = static_cast<int64_t>(out.size());
+    new_pc[text.size()] = size;
+
+    for (const Fixup& f : fixups) {
+        const int64_t t = f.old_target == END ? size : new_pc[f.old_target];
+        out[f.at].imm = static_cast<int32_t>(t - (f.at + 1));
+    }
+    for (uint32_t slot : abs_slots) {
+        const int64_t old = text[slot].imm;
+        if (old >= 0 && old <= n) out[new_pc[slot]].imm = static_cast<int32_t>(new_pc[old]);
+    }
+
+    entry_pc = static_cast<uint32_t>(entry_pc <= n ? new_pc[entry_pc] : entry_pc);
+    for (Symbol& sym : text_symbols)
+        if (sym.value <= n) sym.value = static_cast<uint32_t>(new_pc[sym.value]);
+    std::ranges::stable_sort(text_symbols, [](const Symbol& a, const Symbol& b) { return a.value < b.value; });
+
+    if (origin_pc != nullptr) {
+        std::vector<uint32_t> origin(out.size());
+        for (size_t i = 0; i < out.size(); i++) origin[i] = origin_pc->size() == text.size() ? (*origin_pc)[from[i]] : from[i];
+        *origin_pc = std::move(origin);
+    }
+    text = std::move(out);
+    return stats;
+}
+
+
+#endif
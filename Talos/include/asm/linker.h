@@ -5,6 +5,10 @@
 
 #include "decoder.h"
 #include "error.h"
+#include "layout.h"
+#include "optimizer.h"
+#include "parallel.h"
+#include "symbols.h"
 
 #include <string>
 
@@ -16,23 +20,28 @@ struct LinkedBinary {
     uint32_t bss_size = 0;
 
     uint32_t entry_pc = 0;
+
+    // every label of .text (local ones included) with its PC, sorted by PC: for profiles and tools
+    std::vector<Symbol> text_symbols;
+
+    LayoutStats layout; // what the profile-guided layout did (all zeros without a profile)
+    OptimizeStats optimize; // what the link-time optimizer did (all zeros without it)
+    std::vector<uint32_t> origin_pc; // PC right after linking of every PC of text, empty when neither moved anything
 };
 
 struct GlobalSymbol {
-    std::string name;
     Section section = Section::NONE;
-    uint32_t value = 0;
+    uint32_t value = 0; // address, the base of its object added
     size_t obj_index = 0;
-    GlobalSymbol() = default;
-    GlobalSymbol(const Symbol& sym, size_t index) {
-        name = sym.name;
-        section = sym.section;
-        value = sym.value;
-        obj_index = index;
-    }
 };
 
-inline std::pair<ErrorInfo, LinkedBinary> link(std::vector<ObjectFile>& objects) {
+// below it, spawning threads costs more than patching
+constexpr size_t PARALLEL_RELOCATIONS = 1 << 16;
+
+// with a profile (counts of a previous build of the same sources) the hot blocks are laid out first, see layout.h
+// optimize: the text goes through the link-time optimizer before, see optimizer.h
+// symbols are resolved by SymbolId (see symbols.h), the relocations of each object are applied on their own host thread
+inline std::pair<ErrorInfo, LinkedBinary> link(std::vector<ObjectFile>& objects, const LinkProfile* profile = nullptr, size_t threads = 0, bool optimize = false) {
     LinkedBinary out;
 
     uint32_t text_cursor = 0;
@@ -42,7 +51,13 @@ inline std::pair<ErrorInfo, LinkedBinary> link(std::vector<ObjectFile>& objects)
 
     bool entry_found = false;
 
-    std::unordered_map<std::string, GlobalSymbol> globals;
+    size_t global_count = 0;
+    size_t reloc_count = 0;
+    for (const auto& obj : objects) {
+        reloc_count += obj.relocations.size();
+        for (const auto& sym : obj.symbols) global_count += sym.bind == SymbolBinding::GLOBAL;
+    }
+    SymbolTable<GlobalSymbol> globals(global_count);
 
     // zssign bases + collect globals
     for (size_t i = 0; i < objects.size(); i++) {
@@ -53,38 +68,46 @@ inline std::pair<ErrorInfo, LinkedBinary> link(std::vector<ObjectFile>& objects)
         obj.rodata_base = rodata_cursor;
         obj.bss_base = bss_cursor;
 
-        for (auto& [name, sym] : obj.symbols) {
-            if (sym.bind == SymbolBinding::GLOBAL) {
-                if (globals.contains(name)) return { { ErrorCode::DUPLICATE_GLOBAL_SYMBOL, "duplicate global symbol" }, out };
-
-                Symbol resolved = sym;
-                switch (sym.section) {
-                case Section::TEXT:
-                    resolved.value += obj.text_base; break;
-                case Section::DATA:
-                    resolved.value += obj.data_base; break;
-                case Section::RODATA:
-                    resolved.value += obj.rodata_base; break;
-                case Section::BSS:
-                    resolved.value += obj.bss_base; break;
-                default: break;
-                }
-
-                globals[name] = { resolved, i };
-            }
+        for (const auto& sym : obj.symbols) {
+            if (sym.bind == SymbolBinding::GLOBAL)
+                if (!globals.insert(sym.id, { sym.section, section_base(obj, sym.section) + sym.value, i }))
+                    return { { ErrorCode::DUPLICATE_GLOBAL_SYMBOL, "duplicate global symbol \"" + std::string(symbol_names().name(sym.id)) + "\"" }, out };
+
+            if (sym.section == Section::TEXT && sym.bind != SymbolBinding::EXTERN)
+                out.text_symbols.push_back({ std::string(symbol_names().name(sym.id)), Section::TEXT, obj.text_base + sym.value, sym.bind });
         }
+
         text_cursor += obj.text.size();
         data_cursor += obj.data.size();
         rodata_cursor += obj.rodata.size();
         bss_cursor += obj.bss_size;
     }
+    // globals first when two labels share a PC, then by name so the order does not depend on the hash maps
+    std::ranges::sort(out.text_symbols, [](const Symbol& a, const Symbol& b) {
+        if (a.value != b.value) return a.value < b.value;
+        if (a.bind != b.bind) return a.bind == SymbolBinding::GLOBAL;
+        return a.name < b.name;
+    });
+
     // pass 2
     for (auto& obj : objects)
-        for (auto& [name, sym] : obj.symbols)
-            if (sym.bind == SymbolBinding::EXTERN && !globals.contains(name))
-                return { { ErrorCode::UNRESOLVED_EXTERN_SYMBOL, "unresolved extern symbol \"" + name + "\"" }, out };
+        for (const auto& sym : obj.symbols)
+            if (sym.bind == SymbolBinding::EXTERN && !globals.find(sym.id))
+                return { { ErrorCode::UNRESOLVED_EXTERN_SYMBOL, "unresolved extern symbol \"" + std::string(symbol_names().name(sym.id)) + "\"" }, out };
+
+    for (auto& obj : objects) {
+        if (obj.entry_symbol == NO_SYMBOL) continue;
+        const GlobalSymbol* entry = globals.find(obj.entry_symbol);
+        if (!entry) return { { ErrorCode::UNKNOWN_ENTRY_SYBOL, "unknown entry symbol \"" + std::string(symbol_names().name(obj.entry_symbol)) + "\"" }, out };
+
+        out.entry_pc = entry->value;
+        entry_found = true;
+    }
 
     // merge sections
+    out.text.reserve(text_cursor);
+    out.data.reserve(data_cursor);
+    out.rodata.reserve(rodata_cursor);
     for (auto& obj : objects) {
         out.text.insert(out.text.end(), obj.text.begin(), obj.text.end());
         out.data.insert(out.data.end(), obj.data.begin(), obj.data.end());
@@ -92,55 +115,42 @@ inline std::pair<ErrorInfo, LinkedBinary> link(std::vector<ObjectFile>& objects)
         out.bss_size += obj.bss_size;
     }
 
-    // apply relocations
-    for (auto& obj : objects) {
-        if (!obj.entry_symbol.empty()) {
-            if (!globals.contains(obj.entry_symbol)) return { { ErrorCode::UNKNOWN_ENTRY_SYBOL, "unknown entry symbol \"" + obj.entry_symbol + "\"" }, out };
-
-            out.entry_pc = globals[obj.entry_symbol].value;
-            entry_found = true;
-        }
-
-        for (auto& rel : obj.relocations) {
-            uint32_t sym_addr = 0;
-            if (!globals.contains(rel.symbol)) {
-                Symbol S = obj.symbols[rel.symbol];
-                sym_addr = obj.text_base + S.value;
-            }
-            else {
-                const GlobalSymbol& GS = globals.at(rel.symbol);
-                switch (GS.section) {
-                case Section::TEXT:
-                    sym_addr = GS.value; break;
-                case Section::DATA:
-                    sym_addr = GS.value; break; //pas sur si c'est bon (voir ancien commit)
-                case Section::RODATA:
-                    sym_addr = GS.value; break; //pas sur si c'est bon (voir ancien commit)
-                case Section::BSS:
-                    sym_addr = GS.value; break; //pas sur si c'est bon (voir ancien commit)
-                default: break;
-                }
+    // apply relocations: an object only patches its own part of out.text
+    std::vector<std::vector<uint32_t>> abs_slots(objects.size()); // absolute addresses of code, the layout has to move them too
+    auto relocate = [&](size_t i) {
+        const ObjectFile& obj = objects[i];
+        for (const Relocation& rel : obj.relocations) {
+            const ObjSymbol& S = obj.symbols[rel.symbol];
+            uint32_t sym_addr = section_base(obj, S.section) + S.value;
+            Section sym_section = S.section;
+            if (S.bind == SymbolBinding::EXTERN) {
+                const GlobalSymbol* GS = globals.find(S.id); // found: checked by pass 2
+                sym_addr = GS->value;
+                sym_section = GS->section;
             }
 
-            DecodedInstr& I = out.text[obj.text_base + rel.offset];
-
-            if (rel.type == RelocType::PC_REL_32) {
-                auto pc = static_cast<int32_t>(obj.text_base + rel.offset);
-                I.imm = static_cast<int32_t>(sym_addr) - (pc + 1);
-            }
-            if (rel.type == RelocType::ABS_32)
-                I.imm = static_cast<int32_t>(sym_addr);
-
+            const uint32_t pc = obj.text_base + rel.offset;
+            out.text[pc].imm = relocated_imm(rel.type, sym_addr, pc); // see assembler.h, shared with static_asm.h
+            if (rel.type == RelocType::ABS_32 && sym_section == Section::TEXT) abs_slots[i].push_back(pc);
         }
-    }
+    };
+    if (reloc_count >= PARALLEL_RELOCATIONS) parallel_for(objects.size(), threads, relocate);
+    else for (size_t i = 0; i < objects.size(); i++) relocate(i);
+
+    std::vector<uint32_t> text_abs_slots;
+    for (const auto& slots : abs_slots) text_abs_slots.insert(text_abs_slots.end(), slots.begin(), slots.end());
+    if (optimize)
+        out.optimize = optimize_text(out.text, out.entry_pc, out.text_symbols, text_abs_slots, out.origin_pc);
+    if (profile != nullptr && !profile->empty())
+        out.layout = layout_text(out.text, out.entry_pc, out.text_symbols, text_abs_slots, *profile, &out.origin_pc);
 
     //if (!entry_found) return { { ErrorCode::NO_ENTRY_DEFINED, "no entry defined, cannot know what should the starting PC" }, out };
 
-    return { { }, out };
+    return { { }, std::move(out) };
 }
 
 //you may loose some data
-inline ObjectFile unlink(const LinkedBinary& lb, const std::unordered_map<std::string, Symbol>& symbols, const std::vector<Relocation>& relocations, const std::string& entry_symbol) {
+inline ObjectFile unlink(const LinkedBinary& lb, const std::vector<ObjSymbol>& symbols, const std::vector<Relocation>& relocations, SymbolId entry_symbol) {
     ObjectFile out;
 
     out.text = lb.text;
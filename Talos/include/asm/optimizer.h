@@ -0,0 +1,492 @@
+#ifndef ERGON_OPTIMIZER_H
+#define ERGON_OPTIMIZER_H
+
+#include "data.h"
+#include "layout.h"
+#include "../computer/instructions_handler/opcode_semantics.h"
+
+#include <array>
+#include <bit>
+#include <numeric>
+#include <optional>
+#include <vector>
+
+/*
+Link-time optimizer over the linked .text (link(..., optimize = true)), it runs before the profile-guided layout:
+ - constant propagation / folding: inside a basic block, what only depends on known registers becomes a movi,
+   a conditional branch on known flags becomes a jmp or goes away
+ - strength reduction: muli by a power of 2 -> shli, reg-reg ops with a known small operand -> their imm form
+ - no-ops: mov r, r / addi r, r, 0 / a movi of the value the register already holds...
+ - dead code: what no root reaches (entry point, global labels, absolute references to .text),
+   register writes overwritten in the same block before being read
+ - jump threading: a jump to a jmp goes to its final target, a jmp to ret / halt becomes it, a jump to the next
+   instruction goes away
+Instructions are only rewritten or removed, never reordered: relative offsets, labels, entry point and absolute
+references to .text are fixed up like the layout does. origin_pc keeps for every new PC the PC it had after linking.
+Guest code that makes up PCs by itself (a PC set by hand on a local label...) has to be built without it
+*/
+
+struct OptimizeStats {
+    size_t folded = 0; // constant results turned into movi, branches on known flags
+    size_t strength_reduced = 0;
+    size_t moves_removed = 0; // no-ops
+    size_t dead_removed = 0; // unreachable or overwritten before being read
+    size_t jumps_threaded = 0;
+    size_t removed = 0; // instructions, every pass together
+    size_t rounds = 0; // the passes run again while one of them changes something
+};
+
+namespace optimizer {
+    constexpr size_t MAX_ROUNDS = 8;
+    constexpr uint32_t ALL = 0xFFFF;
+    constexpr uint8_t FLAGS = 13; // written by cmp & co, read by the branches
+    constexpr uint8_t SP = 15;
+
+    constexpr uint32_t bit(uint8_t reg) {
+        return 1u << (reg & 15);
+    }
+
+    // integer registers of an instruction, anything not listed reads and may write all of them
+    struct Effects {
+        uint32_t uses = ALL;
+        uint32_t kills = 0; // always written
+        uint32_t clobbers = ALL; // maybe written
+        bool pure = false; // nothing else than its register writes: can go once they are dead
+    };
+
+    inline Effects effects(const DecodedInstr& I) {
+        const uint32_t rd = bit(I.rd), rs1 = bit(I.rs1), rs2 = bit(I.rs2);
+        switch (I.opcode) {
+        case ADD: case SUB: case MUL: case AND: case OR: case XOR:
+        case SHL: case SHR: case SAR: case ROL: case ROR: case MIN: case MAX:
+            return { rs1 | rs2, rd, rd, true };
+        case DIV: case MOD: // rd unchanged on a division by 0
+            return { rs1 | rs2 | rd, 0, rd, true };
+        case ADDI: case SUBI: case MULI: case ANDI: case ORI: case XORI:
+        case SHLI: case SHRI: case SARI: case ROLI: case RORI: case MINI: case MAXI:
+        case NOT: case ABS: case MOV_REG: case LEA:
+            return { rs1, rd, rd, true };
+        case DIVI: case MODI: case NEG:
+            return { rs1 | rd, 0, rd, true };
+        case CMP: case CMPU: case TEST:
+            return { rs1 | rs2, bit(FLAGS), bit(FLAGS), true };
+        case CMPI: case CMPUI: case TESTI:
+            return { rs1, bit(FLAGS), bit(FLAGS), true };
+        case INC: case DEC:
+            return { rd, rd, rd, true };
+        case MOV_IMM: case CLR:
+            return { 0, rd, rd, true };
+        case SWAP:
+            return { rd | rs1, rd | rs1, rd | rs1, true };
+
+        case FADD: case FSUB: case FMUL: case FDIV: case FMA: case FSQRT: case FABS: case FNEG:
+        case FLDW_ABS: case FSTW_ABS:
+            return { 0, 0, 0, false };
+        case ITOF: case FMOV: case FLDW_BASE: case FSTW_BASE:
+            return { rs1, 0, 0, false };
+        case FCMP:
+            return { 0, bit(FLAGS), bit(FLAGS), false };
+        case FTOI: case MOVF:
+        case LDB_ABS: case LDH_ABS: case LDW_ABS:
+            return { 0, rd, rd, false };
+        case LDB_BASE: case LDH_BASE: case LDW_BASE:
+            return { rs1, rd, rd, false };
+        case STB_ABS: case STH_ABS: case STW_ABS:
+            return { rd, 0, 0, false };
+        case STB_BASE: case STH_BASE: case STW_BASE: case MEMCPY:
+            return { rd | rs1, 0, 0, false };
+        case PUSH:
+            return { rs1 | bit(SP), bit(SP), bit(SP), false };
+        case POP:
+            return { bit(SP), rd | bit(SP), rd | bit(SP), false };
+
+        case JZ: case JNZ: case JG: case JL:
+            return { bit(FLAGS), 0, 0, false };
+        case JMP:
+            return { 0, 0, 0, false };
+        default: // call, ret, halt, multi-core, atomics
+            return { };
+        }
+    }
+
+    using Known = std::array<std::optional<uint32_t>, 16>;
+
+    struct Value {
+        uint8_t reg = 0;
+        uint32_t value = 0;
+    };
+
+    // register written by an instruction whose inputs are all known, with the semantics of the engines
+    // (assembler form of the operands, like step_instr). ROL / ROR are left out: rotating by 0 shifts by 32
+    inline std::optional<Value> evaluate(const DecodedInstr& I, const Known& known) {
+        const Effects fx = effects(I);
+        for (uint8_t r = 0; r < 16; r++)
+            if (fx.uses & bit(r) && !known[r]) return std::nullopt;
+
+        struct {
+            std::array<uint32_t, 16> regs{};
+        } c;
+        for (uint8_t r = 0; r < 16; r++) c.regs[r] = known[r].value_or(0);
+        const DecodedInstr* instr = &I;
+
+        #define I_IMM ((int32_t)instr->rs2)
+        #define I_SHAMT ((uint32_t)instr->rs2 & 31)
+        #define I_OFF (static_cast<int8_t>(instr->imm))
+        #define ERGON_FOLD(name) case name: ERGON_SEM_##name; return Value{ I.rd, c.regs[I.rd] };
+        #define ERGON_FOLD_FLAGS(name) case name: ERGON_SEM_##name; return Value{ FLAGS, c.regs[FLAGS] };
+
+        switch (I.opcode) {
+            ERGON_FOLD(ADD) ERGON_FOLD(SUB) ERGON_FOLD(MUL) ERGON_FOLD(DIV) ERGON_FOLD(MOD)
+            ERGON_FOLD(ADDI) ERGON_FOLD(SUBI) ERGON_FOLD(MULI) ERGON_FOLD(DIVI) ERGON_FOLD(MODI)
+            ERGON_FOLD(AND) ERGON_FOLD(OR) ERGON_FOLD(XOR) ERGON_FOLD(ANDI) ERGON_FOLD(ORI) ERGON_FOLD(XORI)
+            ERGON_FOLD(SHL) ERGON_FOLD(SHR) ERGON_FOLD(SAR) ERGON_FOLD(SHLI) ERGON_FOLD(SHRI) ERGON_FOLD(SARI)
+            ERGON_FOLD(INC) ERGON_FOLD(DEC) ERGON_FOLD(NOT) ERGON_FOLD(ABS) ERGON_FOLD(NEG) ERGON_FOLD(MIN) ERGON_FOLD(MAX)
+            ERGON_FOLD(MOV_IMM) ERGON_FOLD(MOV_REG) ERGON_FOLD(LEA) ERGON_FOLD(CLR)
+            ERGON_FOLD_FLAGS(CMP) ERGON_FOLD_FLAGS(CMPU) ERGON_FOLD_FLAGS(TEST)
+            ERGON_FOLD_FLAGS(CMPI) ERGON_FOLD_FLAGS(CMPUI) ERGON_FOLD_FLAGS(TESTI)
+        default:
+            return std::nullopt;
+        }
+
+        #undef ERGON_FOLD
+        #undef ERGON_FOLD_FLAGS
+        #undef I_IMM
+        #undef I_SHAMT
+        #undef I_OFF
+    }
+
+    inline bool branch_taken(uint8_t opcode, uint32_t flags) {
+        switch (opcode) {
+        case JZ: return flags == 0;
+        case JNZ: return flags != 0;
+        case JG: return static_cast<int32_t>(flags) > 0;
+        default: return static_cast<int32_t>(flags) < 0; // JL
+        }
+    }
+
+    // leaves its registers as they were
+    inline bool is_noop(const DecodedInstr& I) {
+        switch (I.opcode) {
+        case MOV_REG: case SWAP:
+            return I.rd == I.rs1;
+        case ADDI: case SUBI: case ORI: case XORI: case SHLI: case SHRI: case SARI:
+            return I.rd == I.rs1 && (I.rs2 == 0 || (I.opcode >= SHLI && (I.rs2 & 31) == 0));
+        case MULI: case DIVI:
+            return I.rd == I.rs1 && I.rs2 == 1;
+        case LEA:
+            return I.rd == I.rs1 && static_cast<int8_t>(I.imm) == 0;
+        default:
+            return false;
+        }
+    }
+
+    // immediate form of a reg-reg op (the imm field is 8 bits), HALT if there is none
+    constexpr uint8_t imm_form(uint8_t opcode) {
+        switch (opcode) {
+        case ADD: return ADDI;
+        case SUB: return SUBI;
+        case AND: return ANDI;
+        case OR: return ORI;
+        case XOR: return XORI;
+        case SHL: return SHLI;
+        case SHR: return SHRI;
+        case SAR: return SARI;
+        case CMP: return CMPI;
+        case TEST: return TESTI;
+        default: return HALT;
+        }
+    }
+
+    // cheaper instruction doing the same, false if there is none
+    inline bool reduce(DecodedInstr& I, const Known& known) {
+        if (I.opcode == MULI) {
+            if (I.rs2 == 0) I = { MOV_IMM, I.rd, 0, 0, 0 };
+            else if (I.rs2 == 1) I = { MOV_REG, I.rd, I.rs1, 0, 0 };
+            else if (std::has_single_bit(I.rs2)) I = { SHLI, I.rd, I.rs1, static_cast<uint8_t>(std::countr_zero(I.rs2)), 0 };
+            else return false;
+            return true;
+        }
+        if (I.opcode == MUL) {
+            for (auto [k, other] : { std::pair{ I.rs2, I.rs1 }, std::pair{ I.rs1, I.rs2 } }) {
+                if (!known[k]) continue;
+                const uint32_t v = *known[k];
+                if (v == 0) I = { MOV_IMM, I.rd, 0, 0, 0 };
+                else if (v == 1) I = { MOV_REG, I.rd, other, 0, 0 };
+                else if (std::has_single_bit(v)) I = { SHLI, I.rd, other, static_cast<uint8_t>(std::countr_zero(v)), 0 };
+                else continue;
+                return true;
+            }
+            return false;
+        }
+
+        const uint8_t imm_op = imm_form(I.opcode);
+        if (imm_op == HALT) return false;
+        const bool shift = imm_op == SHLI || imm_op == SHRI || imm_op == SARI;
+        const bool commutes = I.opcode == ADD || I.opcode == AND || I.opcode == OR || I.opcode == XOR || I.opcode == TEST;
+
+        if (known[I.rs2] && (shift || *known[I.rs2] <= 255)) {
+            I = { imm_op, I.rd, I.rs1, static_cast<uint8_t>(shift ? *known[I.rs2] & 31 : *known[I.rs2]), 0 };
+            return true;
+        }
+        if (commutes && known[I.rs1] && *known[I.rs1] <= 255) {
+            I = { imm_op, I.rd, I.rs2, static_cast<uint8_t>(*known[I.rs1]), 0 };
+            return true;
+        }
+        return false;
+    }
+
+    // PCs where a basic block starts
+    inline std::vector<bool> leaders(const std::vector<DecodedInstr>& text, uint32_t entry_pc, const std::vector<Symbol>& text_symbols,
+                                     const std::vector<uint32_t>& abs_slots) {
+        const auto n = static_cast<int64_t>(text.size());
+        std::vector<bool> leader(text.size() + 1, false);
+        leader[0] = true;
+        if (entry_pc < n) leader[entry_pc] = true;
+        for (const Symbol& sym : text_symbols)
+            if (sym.value < n) leader[sym.value] = true;
+        for (uint32_t slot : abs_slots)
+            if (text[slot].imm >= 0 && text[slot].imm < n) leader[text[slot].imm] = true;
+        for (int64_t pc = 0; pc < n; pc++) {
+            const uint8_t op = text[pc].opcode;
+            if (layout::is_relative(op)) {
+                const int64_t t = pc + 1 + text[pc].imm;
+                if (t >= 0 && t < n) leader[t] = true;
+            }
+            if (layout::ends_block(op) || op == CALL) leader[pc + 1] = true; // the return lands after a call
+        }
+        return leader;
+    }
+
+    // forward in every block: folding, no-ops, strength reduction
+    inline size_t fold(std::vector<DecodedInstr>& text, const std::vector<bool>& leader, std::vector<bool>& removed, OptimizeStats& stats) {
+        size_t changes = 0;
+        Known known;
+        for (size_t pc = 0; pc < text.size(); pc++) {
+            if (leader[pc]) known = { };
+            DecodedInstr& I = text[pc];
+
+            if (layout::is_branch(I.opcode) && known[FLAGS]) {
+                if (branch_taken(I.opcode, *known[FLAGS])) I.opcode = JMP;
+                else removed[pc] = true;
+                stats.folded++;
+                changes++;
+                continue;
+            }
+
+            if (std::optional<Value> v = evaluate(I, known)) {
+                if (known[v->reg] == v->value) { // writes what is already there
+                    removed[pc] = true;
+                    stats.folded++;
+                    changes++;
+                    continue;
+                }
+                if (v->reg != FLAGS && I.opcode != MOV_IMM && I.opcode != CLR) {
+                    I = { MOV_IMM, v->reg, 0, 0, static_cast<int32_t>(v->value) };
+                    stats.folded++;
+                    changes++;
+                }
+                known[v->reg] = v->value;
+                continue;
+            }
+            if (is_noop(I)) {
+                removed[pc] = true;
+                stats.moves_removed++;
+                changes++;
+                continue;
+            }
+            if (reduce(I, known)) {
+                stats.strength_reduced++;
+                changes++;
+            }
+            const uint32_t clobbers = effects(I).clobbers;
+            for (uint8_t r = 0; r < 16; r++)
+                if (clobbers & bit(r)) known[r].reset();
+        }
+        return changes;
+    }
+
+    inline size_t thread_jumps(std::vector<DecodedInstr>& text, std::vector<bool>& removed, OptimizeStats& stats) {
+        const auto n = static_cast<int64_t>(text.size());
+        const auto live_from = [&](int64_t pc) {
+            while (pc < n && removed[pc]) pc++;
+            return pc;
+        };
+        const auto target_of = [&](int64_t pc) -> int64_t {
+            const int64_t t = pc + 1 + text[pc].imm;
+            return t >= 0 && t < n ? live_from(t) : layout::END;
+        };
+
+        size_t changes = 0;
+        for (int64_t pc = 0; pc < n; pc++) {
+            DecodedInstr& I = text[pc];
+            if (removed[pc] || !layout::is_relative(I.opcode)) continue;
+            int64_t t = target_of(pc);
+            if (t == layout::END || t == n) continue;
+
+            // a loop of jmps is left as it is after a few hops
+            int64_t final = t;
+            for (int hops = 0; hops < 16 && final < n && text[final].opcode == JMP; hops++) {
+                const int64_t next = target_of(final);
+                if (next == layout::END) break;
+                final = next;
+            }
+            if (final != t && final < n) {
+                I.imm = static_cast<int32_t>(final - (pc + 1));
+                t = final;
+                stats.jumps_threaded++;
+                changes++;
+            }
+
+            if (I.opcode == JMP && t < n && (text[t].opcode == RET || text[t].opcode == HALT)) {
+                I = { text[t].opcode, 0, 0, 0, 0 };
+                stats.jumps_threaded++;
+                changes++;
+                continue;
+            }
+            if ((I.opcode == JMP || layout::is_branch(I.opcode)) && t == live_from(pc + 1)) {
+                removed[pc] = true;
+                stats.jumps_threaded++;
+                changes++;
+            }
+        }
+        return changes;
+    }
+
+    inline size_t remove_unreachable(const std::vector<DecodedInstr>& text, uint32_t entry_pc, const std::vector<Symbol>& text_symbols,
+                                     const std::vector<uint32_t>& abs_slots, std::vector<bool>& removed, OptimizeStats& stats) {
+        const auto n = static_cast<int64_t>(text.size());
+        std::vector<bool> reached(text.size(), false);
+        std::vector<int64_t> work;
+        const auto reach = [&](int64_t pc) {
+            if (pc >= 0 && pc < n && !reached[pc]) {
+                reached[pc] = true;
+                work.push_back(pc);
+            }
+        };
+
+        reach(entry_pc);
+        for (const Symbol& sym : text_symbols)
+            if (sym.bind == SymbolBinding::GLOBAL) reach(sym.value);
+        for (uint32_t slot : abs_slots)
+            if (!removed[slot]) reach(text[slot].imm);
+
+        while (!work.empty()) {
+            const int64_t pc = work.back();
+            work.pop_back();
+            const uint8_t op = text[pc].opcode;
+            if (removed[pc]) {
+                reach(pc + 1);
+                continue;
+            }
+            if (layout::is_relative(op)) reach(pc + 1 + text[pc].imm);
+            if (op != JMP && op != RET && op != HALT) reach(pc + 1);
+        }
+
+        size_t changes = 0;
+        for (int64_t pc = 0; pc < n; pc++) {
+            if (reached[pc] || removed[pc]) continue;
+            removed[pc] = true;
+            stats.dead_removed++;
+            changes++;
+        }
+        return changes;
+    }
+
+    // backward in every block, everything is live at its end
+    inline size_t remove_dead_writes(const std::vector<DecodedInstr>& text, const std::vector<bool>& leader, std::vector<bool>& removed, OptimizeStats& stats) {
+        size_t changes = 0;
+        uint32_t live = ALL;
+        for (size_t pc = text.size(); pc-- > 0;) {
+            const DecodedInstr& I = text[pc];
+            if (leader[pc + 1] || layout::ends_block(I.opcode)) live = ALL;
+            if (removed[pc]) continue;
+
+            const Effects fx = effects(I);
+            if (fx.pure && fx.kills != 0 && (fx.kills & live) == 0) {
+                removed[pc] = true;
+                stats.dead_removed++;
+                changes++;
+                continue;
+            }
+            live = (live & ~fx.kills) | fx.uses;
+        }
+        return changes;
+    }
+
+    // drops the removed slots, a jump to one of them lands on the next slot kept
+    inline void compact(std::vector<DecodedInstr>& text, uint32_t& entry_pc, std::vector<Symbol>& text_symbols,
+                        std::vector<uint32_t>& abs_slots, std::vector<uint32_t>& origin_pc, const std::vector<bool>& removed) {
+        const auto n = static_cast<int64_t>(text.size());
+        std::vector<int64_t> new_pc(text.size() + 1, 0);
+        int64_t kept = 0;
+        for (int64_t pc = 0; pc < n; pc++) {
+            new_pc[pc] = kept;
+            if (!removed[pc]) kept++;
+        }
+        new_pc[n] = kept;
+
+        std::vector<DecodedInstr> out;
+        std::vector<uint32_t> origin;
+        out.reserve(kept);
+        origin.reserve(kept);
+        for (int64_t pc = 0; pc < n; pc++) {
+            if (removed[pc]) continue;
+            DecodedInstr I = text[pc];
+            if (layout::is_relative(I.opcode)) {
+                const int64_t t = pc + 1 + I.imm;
+                const int64_t new_t = t >= 0 && t < n ? new_pc[t] : kept; // outside of the text: the run halts
+                I.imm = static_cast<int32_t>(new_t - (new_pc[pc] + 1));
+            }
+            out.push_back(I);
+            origin.push_back(origin_pc[pc]);
+        }
+
+        std::vector<uint32_t> slots;
+        for (uint32_t slot : abs_slots) {
+            if (removed[slot]) continue;
+            const int64_t old = text[slot].imm;
+            if (old >= 0 && old <= n) out[new_pc[slot]].imm = static_cast<int32_t>(new_pc[old]);
+            slots.push_back(static_cast<uint32_t>(new_pc[slot]));
+        }
+
+        entry_pc = static_cast<uint32_t>(entry_pc <= n ? new_pc[entry_pc] : entry_pc);
+        for (Symbol& sym : text_symbols) // new_pc never goes down: still sorted
+            if (sym.value <= n) sym.value = static_cast<uint32_t>(new_pc[sym.value]);
+
+        text = std::move(out);
+        abs_slots = std::move(slots);
+        origin_pc = std::move(origin);
+    }
+}
+
+// abs_slots: PCs whose imm is an absolute address in .text, kept up to date
+// origin_pc: PC after linking of every slot (filled here if empty)
+inline OptimizeStats optimize_text(std::vector<DecodedInstr>& text, uint32_t& entry_pc, std::vector<Symbol>& text_symbols,
+                                   std::vector<uint32_t>& abs_slots, std::vector<uint32_t>& origin_pc) {
+    using namespace optimizer;
+    OptimizeStats stats;
+    const size_t size = text.size();
+    if (origin_pc.size() != size) {
+        origin_pc.resize(size);
+        std::iota(origin_pc.begin(), origin_pc.end(), 0);
+    }
+
+    while (stats.rounds < MAX_ROUNDS && !text.empty()) {
+        stats.rounds++;
+        std::vector<bool> removed(text.size(), false);
+        std::vector<bool> leader = leaders(text, entry_pc, text_symbols, abs_slots);
+
+        size_t changes = fold(text, leader, removed, stats);
+        changes += thread_jumps(text, removed, stats);
+        changes += remove_unreachable(text, entry_pc, text_symbols, abs_slots, removed, stats);
+        changes += remove_dead_writes(text, leader, removed, stats);
+        if (changes == 0) break;
+
+        compact(text, entry_pc, text_symbols, abs_slots, origin_pc, removed);
+    }
+    stats.removed = size - text.size();
+    return stats;
+}
+
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef ERGON_PARALLEL_H
+#define ERGON_PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// f(i) for every i < count, on threads host threads (0: one per host thread, never more than count),
+// the calling thread is one of them. Each i is taken by exactly one thread: f only has to be safe for different i
+template <typename F>
+void parallel_for(size_t count, size_t threads, F&& f) {
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, count);
+
+    std::atomic<size_t> next = 0;
+    auto worker = [&] {
+        for (size_t i = next++; i < count; i = next++) f(i);
+    };
+
+    std::vector<std::thread> pool;
+    for (size_t t = 1; t < threads; t++) pool.emplace_back(worker);
+    worker();
+    for (std::thread& t : pool) t.join();
+}
+
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef ERGON_PARALLEL_DECODE_H
+#define ERGON_PARALLEL_DECODE_H
+
+#include "decoder.h"
+#include "parallel.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+Files decoded at the same time, each by its own AsmDecoder on its own host thread (the instruction and
+register tables are read-only). A file sees the .equ of the files before it: the caller gives each job
+the constants it starts with (see EnvironmentManager::assemble())
+*/
+
+struct DecodeJob {
+    const std::string* source = nullptr;
+    ConstantTable constants; // known before the file
+    ObjectFile obj;
+    ErrorInfo error;
+
+    DecodeJob(const std::string* source, ConstantTable constants) : source(source), constants(std::move(constants)) {}
+};
+
+// threads = 0: one per host thread, never more than jobs (see parallel_for())
+inline void decode_parallel(std::vector<DecodeJob>& jobs, size_t threads = 0) {
+    parallel_for(jobs.size(), threads, [&](size_t i) {
+        DecodeJob& job = jobs[i];
+        AsmDecoder decoder;
+        decoder.constants = std::move(job.constants);
+        auto [obj, e] = decoder.decode(*job.source);
+        job.obj = std::move(obj);
+        job.error = std::move(e);
+        job.constants = std::move(decoder.constants);
+    });
+}
+
+
+#endif
@@ -3,11 +3,16 @@
 
 #include "error.h"
 #include "utils.h"
+#include "perfect_hash.h"
 
 #include <unordered_map>
 
 
-inline std::unordered_map<std::string, uint8_t> reg_table = {
+// .equ name -> value, looked up with the string_view of the argument (no std::string built)
+using ConstantTable = std::unordered_map<std::string, int32_t, string_utils::string_hash, std::equal_to<>>;
+
+// perfect hash built at compile time (see perfect_hash.h), read-only: shared by the decoders of every thread
+inline constexpr auto reg_table = make_perfect_hash<256>(std::to_array<std::pair<std::string_view, uint8_t>>({
     { "r0", 0 },
     { "r1", 1 },
     { "r2", 2 },
@@ -41,21 +46,21 @@ inline std::unordered_map<std::string, uint8_t> reg_table = {
     { "f13", 13 },
     { "f14", 14 },
     { "f15", 15 }
-};
+}));
 
-static std::pair<ErrorInfo, uint8_t> parse_reg(const std::string& s) {
-    if (reg_table.contains(s))
-        return { { }, reg_table[s] };
-    return { { ErrorCode::INVALID_REG, "invalid register \"" + s + "\"" }, 0 };
+inline std::pair<ErrorInfo, uint8_t> parse_reg(std::string_view s) {
+    if (const uint8_t* reg = reg_table.find(s))
+        return { { }, *reg };
+    return { { ErrorCode::INVALID_REG, "invalid register \"" + std::string(s) + "\"" }, 0 };
 }
 
-static std::pair<ErrorInfo, int> parse_imm(const std::string& s, std::unordered_map<std::string, int32_t>& constants) {
+inline std::pair<ErrorInfo, int> parse_imm(std::string_view s, const ConstantTable& constants) {
     if (s.starts_with("0x"))
         return string_utils::better_stoi(s.substr(2), nullptr, 16);
     if (s.starts_with("0b"))
         return string_utils::better_stoi(s.substr(2), nullptr, 2);
-    if (constants.contains(s))
-        return { {}, constants[s] };
+    if (auto it = constants.find(s); it != constants.end())
+        return { {}, it->second };
     return string_utils::better_stoi(s);
 }
 
@@ -0,0 +1,69 @@
+#ifndef ERGON_PERFECT_HASH_H
+#define ERGON_PERFECT_HASH_H
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+/*
+Read-only string -> T table built at compile time: the seed is searched until every key gets its own slot,
+so a lookup is one hash, one load and one string compare (no bucket, no probing, no allocation).
+SLOTS is a power of 2 around N² / 4 or more, or the seed search gives up and the table does not compile
+*/
+
+template <typename T, size_t N, size_t SLOTS>
+struct PerfectHash {
+    static_assert((SLOTS & (SLOTS - 1)) == 0, "SLOTS must be a power of 2");
+    static_assert(N < 0xFFFF, "too many keys");
+
+    using Slot = std::conditional_t<(N < 0xFF), uint8_t, uint16_t>;
+
+    std::array<std::pair<std::string_view, T>, N> entries;
+    std::array<Slot, SLOTS> slots{}; // index in entries + 1, 0: empty
+    uint32_t seed = 0;
+
+    static constexpr uint32_t hash(std::string_view s, uint32_t seed) {
+        uint32_t h = 2166136261u ^ seed; // FNV-1a
+        for (char c : s) {
+            h ^= static_cast<uint8_t>(c);
+            h *= 16777619u;
+        }
+        return h ^ (h >> 15); // the low bits of FNV are the worst ones, and the ones used
+    }
+
+    consteval PerfectHash(const std::array<std::pair<std::string_view, T>, N>& e) : entries(e) {
+        for (;; seed++) {
+            if (seed == 100000) throw "no perfect hash found, make SLOTS bigger";
+            slots.fill(0);
+
+            bool collision = false;
+            for (size_t i = 0; i < N && !collision; i++) {
+                Slot& slot = slots[hash(entries[i].first, seed) & (SLOTS - 1)];
+                collision = slot != 0;
+                slot = static_cast<Slot>(i + 1);
+            }
+            if (!collision) return;
+        }
+    }
+
+    // nullptr if key is not in the table
+    constexpr const T* find(std::string_view key) const {
+        const Slot slot = slots[hash(key, seed) & (SLOTS - 1)];
+        if (slot == 0 || entries[slot - 1].first != key) return nullptr;
+        return &entries[slot - 1].second;
+    }
+
+    constexpr bool contains(std::string_view key) const {
+        return find(key) != nullptr;
+    }
+};
+
+template <size_t SLOTS, typename T, size_t N>
+consteval auto make_perfect_hash(const std::array<std::pair<std::string_view, T>, N>& entries) {
+    return PerfectHash<T, N, SLOTS>(entries);
+}
+
+
+#endif
@@ -0,0 +1,264 @@
+#ifndef ERGON_STATIC_ASM_H
+#define ERGON_STATIC_ASM_H
+
+#include "assembler.h"
+#include "data.h"
+
+#include <algorithm>
+#include <array>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+Assembler + linker run by the host compiler, for programs embedded in the host code:
+    constexpr AsmSource main_src = ".section .text \n ... ";
+    constexpr auto program = assemble_static<main_src, lib_src>();
+    env.load_static(program); // or mb.load_prog(program.text): nothing decoded or linked at startup
+ - the passes of EnvironmentManager::assemble() (assembler.h): same syntax, sections and errors (no optimizer, no layout, load fuses the superinstructions)
+ - an error does not compile: the note shows static_asm::report<AsmError{code, file, line, "message"}>,
+   file is the index in the list, line the same as build() (0 for link errors)
+ - names are compared as strings (the interner of symbols.h is not constexpr), fine for the size of an embedded program
+*/
+
+// string literal as a template argument
+template <size_t N>
+struct AsmSource {
+    char chars[N]{};
+
+    constexpr AsmSource(const char (&s)[N]) {
+        std::copy_n(s, N, chars);
+    }
+
+    constexpr std::string_view view() const {
+        return { chars, N - 1 };
+    }
+};
+
+// a .text label of a static program, the name points into its AsmSource
+struct StaticSymbol {
+    std::string_view name;
+    uint32_t value = 0;
+    SymbolBinding bind = SymbolBinding::LOCAL;
+};
+
+template <size_t TEXT, size_t DATA, size_t RODATA, size_t SYMBOLS>
+struct StaticProgram {
+    std::array<DecodedInstr, TEXT> text{};
+    std::array<uint8_t, DATA> data{};
+    std::array<uint8_t, RODATA> rodata{};
+    uint32_t bss_size = 0;
+    uint32_t entry_pc = 0;
+    std::array<StaticSymbol, SYMBOLS> text_symbols{}; // sorted like LinkedBinary::text_symbols
+
+    // for EnvironmentManager::load(), at runtime
+    std::vector<Symbol> symbols() const {
+        std::vector<Symbol> out;
+        out.reserve(SYMBOLS);
+        for (const StaticSymbol& s : text_symbols) out.push_back({ std::string(s.name), Section::TEXT, s.value, s.bind });
+        return out;
+    }
+};
+
+namespace static_asm {
+    using Error = AsmError;
+
+    constexpr Error fail(ErrorCode code) {
+        Error e;
+        e.code = code;
+        return e;
+    }
+
+    // instantiated with the error of the build: the static_assert prints it
+    template <Error e>
+    struct report {
+        static_assert(e.code == ErrorCode::OK, "the embedded program does not assemble (error, file index, line and message above)");
+        static constexpr bool ok = true;
+    };
+
+    struct Sym {
+        std::string_view name;
+        Section section = Section::NONE;
+        uint32_t value = 0;
+        SymbolBinding bind = SymbolBinding::LOCAL;
+    };
+
+    struct Object {
+        std::vector<DecodedInstr> text;
+        std::vector<uint8_t> data;
+        std::vector<uint8_t> rodata;
+        uint32_t bss_size = 0;
+        uint32_t text_base = 0;
+        uint32_t data_base = 0;
+        uint32_t rodata_base = 0;
+        uint32_t bss_base = 0;
+        std::vector<Sym> symbols;
+        std::vector<Relocation> relocations;
+        std::string_view entry; // empty: no .entry
+    };
+
+    // .equ name -> value, kept from one file to the next like AsmDecoder::constants, the last one wins
+    using Constants = std::vector<std::pair<std::string_view, int32_t>>;
+
+    // the two passes of assembler.h (the same as AsmDecoder), with vectors instead of hash maps
+    struct Decoder : AsmPasses<Decoder, Object, Error> {
+        Constants& constants;
+
+        constexpr explicit Decoder(Constants& constants) : constants(constants) {}
+
+        constexpr Sym& symbol(std::string_view name) {
+            for (Sym& s : obj.symbols)
+                if (s.name == name) return s;
+            return obj.symbols.emplace_back(name);
+        }
+
+        constexpr const Sym* find_symbol(std::string_view name) const {
+            for (const Sym& s : obj.symbols)
+                if (s.name == name) return &s;
+            return nullptr;
+        }
+
+        constexpr const int32_t* constant(std::string_view name) const {
+            for (auto it = constants.rbegin(); it != constants.rend(); ++it)
+                if (it->first == name) return &it->second;
+            return nullptr;
+        }
+
+        constexpr void define(std::string_view name, int32_t value) {
+            constants.emplace_back(name, value);
+        }
+
+        constexpr void set_entry(std::string_view name) {
+            obj.entry = name;
+        }
+    };
+
+    struct Linked {
+        Error error;
+        std::vector<DecodedInstr> text;
+        std::vector<uint8_t> data;
+        std::vector<uint8_t> rodata;
+        uint32_t bss_size = 0;
+        uint32_t entry_pc = 0;
+        std::vector<StaticSymbol> text_symbols;
+
+        constexpr Linked& fail(Error e, size_t file) {
+            error = e;
+            error.file = file;
+            return *this;
+        }
+    };
+
+    // decode every file then link() them
+    constexpr Linked build(const std::vector<std::string_view>& files) {
+        Linked out;
+        Constants constants;
+        std::vector<Object> objects;
+        for (size_t f = 0; f < files.size(); f++) {
+            Decoder decoder(constants);
+            if (Error e = decoder.assemble(files[f]); e.code != ErrorCode::OK) return out.fail(e, f);
+            objects.push_back(std::move(decoder.obj));
+        }
+
+        struct Global {
+            std::string_view name;
+            Section section;
+            uint32_t value;
+        };
+        std::vector<Global> globals;
+        auto find_global = [&](std::string_view name) -> const Global* {
+            for (const Global& g : globals)
+                if (g.name == name) return &g;
+            return nullptr;
+        };
+
+        uint32_t text_cursor = 0, data_cursor = 0, rodata_cursor = 0, bss_cursor = 0;
+        for (size_t f = 0; f < objects.size(); f++) {
+            Object& obj = objects[f];
+            obj.text_base = text_cursor;
+            obj.data_base = data_cursor;
+            obj.rodata_base = rodata_cursor;
+            obj.bss_base = bss_cursor;
+            for (const Sym& sym : obj.symbols) {
+                if (sym.bind == SymbolBinding::GLOBAL) {
+                    if (find_global(sym.name)) return out.fail(fail(ErrorCode::DUPLICATE_GLOBAL_SYMBOL) << "duplicate global symbol \"" << sym.name << "\"", f);
+                    globals.push_back({ sym.name, sym.section, section_base(obj, sym.section) + sym.value });
+                }
+                if (sym.section == Section::TEXT && sym.bind != SymbolBinding::EXTERN)
+                    out.text_symbols.push_back({ sym.name, obj.text_base + sym.value, sym.bind });
+            }
+            text_cursor += obj.text.size();
+            data_cursor += obj.data.size();
+            rodata_cursor += obj.rodata.size();
+            bss_cursor += obj.bss_size;
+        }
+        std::ranges::sort(out.text_symbols, [](const StaticSymbol& a, const StaticSymbol& b) {
+            if (a.value != b.value) return a.value < b.value;
+            if (a.bind != b.bind) return a.bind == SymbolBinding::GLOBAL;
+            return a.name < b.name;
+        });
+
+        for (size_t f = 0; f < objects.size(); f++) {
+            for (const Sym& sym : objects[f].symbols)
+                if (sym.bind == SymbolBinding::EXTERN && !find_global(sym.name))
+                    return out.fail(fail(ErrorCode::UNRESOLVED_EXTERN_SYMBOL) << "unresolved extern symbol \"" << sym.name << "\"", f);
+            if (objects[f].entry.empty()) continue;
+            const Global* entry = find_global(objects[f].entry);
+            if (!entry) return out.fail(fail(ErrorCode::UNKNOWN_ENTRY_SYBOL) << "unknown entry symbol \"" << objects[f].entry << "\"", f);
+            out.entry_pc = entry->value;
+        }
+
+        for (const Object& obj : objects) {
+            out.text.insert(out.text.end(), obj.text.begin(), obj.text.end());
+            out.data.insert(out.data.end(), obj.data.begin(), obj.data.end());
+            out.rodata.insert(out.rodata.end(), obj.rodata.begin(), obj.rodata.end());
+            out.bss_size += obj.bss_size;
+        }
+        for (const Object& obj : objects) {
+            for (const Relocation& rel : obj.relocations) {
+                const Sym& S = obj.symbols[rel.symbol];
+                uint32_t addr = section_base(obj, S.section) + S.value;
+                if (S.bind == SymbolBinding::EXTERN) addr = find_global(S.name)->value;
+
+                const uint32_t pc = obj.text_base + rel.offset;
+                out.text[pc].imm = relocated_imm(rel.type, addr, pc);
+            }
+        }
+        return out;
+    }
+
+    struct Sizes {
+        Error error;
+        size_t text = 0;
+        size_t data = 0;
+        size_t rodata = 0;
+        size_t symbols = 0;
+    };
+
+    // first build: the sizes of the arrays (and the error)
+    template <AsmSource... files>
+    consteval Sizes sizes_of() {
+        const Linked l = build({ files.view()... });
+        return { l.error, l.text.size(), l.data.size(), l.rodata.size(), l.text_symbols.size() };
+    }
+}
+
+// the files assembled and linked by the host compiler, a compile error if they do not assemble
+template <AsmSource... files>
+consteval auto assemble_static() {
+    constexpr static_asm::Sizes sizes = static_asm::sizes_of<files...>();
+    static_assert(static_asm::report<sizes.error>::ok);
+
+    StaticProgram<sizes.text, sizes.data, sizes.rodata, sizes.symbols> out;
+    const static_asm::Linked l = static_asm::build({ files.view()... });
+    std::ranges::copy(l.text, out.text.begin());
+    std::ranges::copy(l.data, out.data.begin());
+    std::ranges::copy(l.rodata, out.rodata.begin());
+    std::ranges::copy(l.text_symbols, out.text_symbols.begin());
+    out.bss_size = l.bss_size;
+    out.entry_pc = l.entry_pc;
+    return out;
+}
+
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef ERGON_SUPERINSTRUCTIONS_H
+#define ERGON_SUPERINSTRUCTIONS_H
+
+#include "data.h"
+#include "../computer/core.h"
+
+#include <vector>
+
+
+struct FusionStats {
+    size_t triples = 0; // addi/inc + cmp/cmpi + jl/jnz
+    size_t pairs = 0; // cmp/cmpi + jz/jnz/jg/jl
+};
+
+inline uint8_t fuse_pair(uint8_t cmp, uint8_t jump) {
+    if (cmp == CMP) {
+        switch (jump) {
+        case JZ: return CMP_JZ;
+        case JNZ: return CMP_JNZ;
+        case JG: return CMP_JG;
+        case JL: return CMP_JL;
+        default: return HALT;
+        }
+    }
+    if (cmp == CMPI) {
+        switch (jump) {
+        case JZ: return CMPI_JZ;
+        case JNZ: return CMPI_JNZ;
+        case JG: return CMPI_JG;
+        case JL: return CMPI_JL;
+        default: return HALT;
+        }
+    }
+    return HALT;
+}
+
+inline uint8_t fuse_triple(uint8_t head, uint8_t cmp, uint8_t jump) {
+    if (head != INC && head != ADDI) return HALT;
+    if (cmp != CMP && cmp != CMPI) return HALT;
+    if (jump != JL && jump != JNZ) return HALT;
+
+    // INC_CMP_JL ... ADDI_CMPI_JNZ are laid out as head * 4 + cmp * 2 + jump
+    static_assert(ADDI_CMPI_JNZ == INC_CMP_JL + 7);
+    return INC_CMP_JL + (head == ADDI) * 4 + (cmp == CMPI) * 2 + (jump == JNZ);
+}
+
+// post-link pass: rewrites the opcode of the first slot of every known sequence.
+// nothing is removed so PCs, relative jumps and StepInfo are unchanged, and a jump
+// landing in the middle of a sequence still runs the original instructions
+inline FusionStats fuse_superinstructions(std::vector<DecodedInstr>& text) {
+    FusionStats stats;
+
+    // going forward, slots i + 1 and i + 2 still hold their original opcode
+    for (size_t i = 0; i + 1 < text.size(); i++) {
+        if (i + 2 < text.size()) {
+            uint8_t fused = fuse_triple(text[i].opcode, text[i + 1].opcode, text[i + 2].opcode);
+            if (fused != HALT) {
+                text[i].opcode = fused;
+                stats.triples++;
+                continue;
+            }
+        }
+        uint8_t fused = fuse_pair(text[i].opcode, text[i + 1].opcode);
+        if (fused != HALT) {
+            text[i].opcode = fused;
+            stats.pairs++;
+        }
+    }
+    return stats;
+}
+
+
+#endif
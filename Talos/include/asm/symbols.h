@@ -0,0 +1,160 @@
+#ifndef ERGON_SYMBOLS_H
+#define ERGON_SYMBOLS_H
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+/*
+Symbol names interned once for the whole process: the decoders, the linker, the build cache and the binary
+reader all give the same name the same SymbolId, so resolving a symbol compares integers.
+ - 16 shards (by hash), one mutex each: the decoders of decode_parallel() rarely wait for each other
+ - name() takes no lock: a name never moves once interned
+*/
+
+using SymbolId = uint32_t;
+constexpr SymbolId NO_SYMBOL = UINT32_MAX;
+
+struct SymbolInterner {
+    static constexpr uint32_t SHARD_BITS = 4;
+    static constexpr uint32_t SHARDS = 1u << SHARD_BITS;
+
+    SymbolId intern(std::string_view name) {
+        const size_t h = std::hash<std::string_view>{ }(name);
+        const auto s = static_cast<uint32_t>(h & (SHARDS - 1));
+        const auto tag = static_cast<uint32_t>(h >> 32) | 1; // 0: empty slot
+        Shard& shard = shards[s];
+        std::lock_guard lock(shard.mutex);
+
+        if ((shard.count + 1) * 2 > shard.slots.size()) shard.grow();
+        const size_t mask = shard.slots.size() - 1;
+        for (size_t i = (h >> SHARD_BITS) & mask;; i = (i + 1) & mask) {
+            Slot& slot = shard.slots[i];
+            if (slot.tag == 0) {
+                slot = { tag, shard.count };
+                shard.add(name);
+                return shard.count++ << SHARD_BITS | s;
+            }
+            if (slot.tag == tag && shard.name(slot.index) == name) return slot.index << SHARD_BITS | s;
+        }
+    }
+
+    std::string_view name(SymbolId id) const {
+        return shards[id & (SHARDS - 1)].name(id >> SHARD_BITS);
+    }
+
+private:
+    struct Slot {
+        uint32_t tag = 0;
+        uint32_t index = 0;
+    };
+
+    // names[i] lives in segment k = bit_width(i / FIRST + 1) - 1, segment k holds FIRST << k names: they never move
+    struct Shard {
+        static constexpr uint32_t FIRST = 64;
+        static constexpr size_t BLOCK = 64 * 1024; // chars
+
+        std::mutex mutex;
+        std::vector<Slot> slots;
+        uint32_t count = 0;
+        std::array<std::unique_ptr<std::string_view[]>, 26> segments;
+        std::vector<std::unique_ptr<char[]>> blocks;
+        size_t block_used = 0;
+
+        std::string_view name(uint32_t i) const {
+            const int k = std::bit_width(i / FIRST + 1) - 1;
+            return segments[k][i - FIRST * ((1u << k) - 1)];
+        }
+
+        void add(std::string_view name) {
+            const int k = std::bit_width(count / FIRST + 1) - 1;
+            if (!segments[k]) segments[k] = std::make_unique<std::string_view[]>(FIRST << k);
+
+            if (blocks.empty() || block_used + name.size() > BLOCK) {
+                blocks.push_back(std::make_unique<char[]>(std::max(BLOCK, name.size())));
+                block_used = 0;
+            }
+            char* copy = blocks.back().get() + block_used;
+            std::memcpy(copy, name.data(), name.size());
+            block_used += name.size();
+            segments[k][count - FIRST * ((1u << k) - 1)] = { copy, name.size() };
+        }
+
+        void grow() {
+            std::vector<Slot> old = std::move(slots);
+            slots.assign(std::max<size_t>(64, old.size() * 2), { });
+            const size_t mask = slots.size() - 1;
+            for (const Slot& slot : old) {
+                if (slot.tag == 0) continue;
+                size_t i = (std::hash<std::string_view>{ }(name(slot.index)) >> SHARD_BITS) & mask;
+                while (slots[i].tag != 0) i = (i + 1) & mask;
+                slots[i] = slot;
+            }
+        }
+    };
+
+    std::array<Shard, SHARDS> shards;
+};
+
+inline SymbolInterner& symbol_names() {
+    static SymbolInterner interner;
+    return interner;
+}
+
+// SymbolId -> T, open addressing (linear probing), what the linker resolves the globals with
+template <typename T>
+struct SymbolTable {
+    std::vector<SymbolId> keys; // NO_SYMBOL: empty
+    std::vector<T> values;
+    size_t count = 0;
+
+    explicit SymbolTable(size_t expected = 0) {
+        const size_t n = std::bit_ceil(std::max<size_t>(16, expected * 2));
+        keys.assign(n, NO_SYMBOL);
+        values.resize(n);
+    }
+
+    T* find(SymbolId id) {
+        for (size_t i = slot_of(id);; i = (i + 1) & (keys.size() - 1)) {
+            if (keys[i] == id) return &values[i];
+            if (keys[i] == NO_SYMBOL) return nullptr;
+        }
+    }
+
+    const T* find(SymbolId id) const {
+        return const_cast<SymbolTable*>(this)->find(id);
+    }
+
+    // false (and nothing changed) if id is already in the table
+    bool insert(SymbolId id, const T& value) {
+        if ((count + 1) * 2 > keys.size()) grow();
+        size_t i = slot_of(id);
+        for (; keys[i] != NO_SYMBOL; i = (i + 1) & (keys.size() - 1))
+            if (keys[i] == id) return false;
+        keys[i] = id;
+        values[i] = value;
+        count++;
+        return true;
+    }
+
+private:
+    size_t slot_of(SymbolId id) const {
+        return (id * 0x9E3779B97F4A7C15ull >> 32) & (keys.size() - 1); // ids are dense: spread them
+    }
+
+    void grow() {
+        SymbolTable bigger(keys.size());
+        for (size_t i = 0; i < keys.size(); i++)
+            if (keys[i] != NO_SYMBOL) bigger.insert(keys[i], values[i]);
+        *this = std::move(bigger);
+    }
+};
+
+
+#endif
@@ -5,6 +5,8 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
+#include <climits>
 #include <cctype>
 #include <limits>
 
@@ -33,7 +35,7 @@ namespace string_utils {
         return i;
     }
 
-    inline int char_to_int(char c) {
+    constexpr int char_to_int(char c) {
         if (c >= '0' && c <= '9') return c - '0';
         if (c >= 'a' && c <= 'z') return c - 'a' + 10;
         if (c >= 'A' && c <= 'Z') return c - 'A' + 10;
@@ -47,87 +49,107 @@ namespace string_utils {
         return result;
     }
 
-    inline std::string replace_null(std::string s, char a) {
-        size_t move = 0;
-        size_t i = 0;
-
-        for (; i < s.size(); ++i) {
-            if (s[i] == a) {
-                move++;
-            } else {
-                s[i - move] = s[i];
-            }
-        }
-
-        s.resize(s.size() - move);
-        return s;
-    }
-
-    // returns { error_code, result }
-    inline std::pair<ErrorInfo, int> better_stoi(const std::string& str, size_t* idx = nullptr, int base = 10) {
+    // better_stoi() without the messages: usable in constant expressions (see static_asm.h)
+    constexpr std::pair<ErrorCode, int> stoi_code(std::string_view str, size_t* idx = nullptr, int base = 10) {
         if (base < 2 || base > 36)
-            return { { ErrorCode::INVALID_BASE, "invalid base in stoi (base should be between 2 and 36)" }, 0};
+            return { ErrorCode::INVALID_BASE, 0 };
 
         size_t i = 0;
         int sign = 1;
 
-        const std::string cleaned_str = replace_null(str, '_');
-        if (cleaned_str.empty()) return { { }, 0 };
+        auto skip_null = [&] { while (i < str.size() && str[i] == '_') ++i; };
+        skip_null();
+        if (i == str.size()) return { ErrorCode::OK, 0 };
 
-        if (cleaned_str[i] == '+' || cleaned_str[i] == '-') {
-            if (cleaned_str[i] == '-') sign = -1;
+        if (str[i] == '+' || str[i] == '-') {
+            if (str[i] == '-') sign = -1;
             ++i;
         }
 
         int result = 0;
-        size_t start = i;
+        bool digits = false;
 
-        for (; i < cleaned_str.size(); ++i) {
-            int digit = char_to_int(cleaned_str[i]);
+        for (skip_null(); i < str.size(); ++i, skip_null()) {
+            int digit = char_to_int(str[i]);
             if (digit < 0 || digit >= base)
                 break;
+            digits = true;
 
             if (sign == 1 && result > (INT_MAX - digit) / base)
-                return { { ErrorCode::STOI_POS_OVERFLOW, "positive overflow in stoi"}, 0};
-            if (sign == -1 && result > (INT_MAX - digit + 1) / base)
-                return { { ErrorCode::STOI_NEG_OVERFLOW, "negative overflow in stoi" }, 0};
+                return { ErrorCode::STOI_POS_OVERFLOW, 0 };
+            if (sign == -1 && result > (static_cast<long long>(INT_MAX) - digit + 1) / base)
+                return { ErrorCode::STOI_NEG_OVERFLOW, 0 };
 
             result = result * base + digit;
         }
 
-        if (i == start)
-            return { { ErrorCode::STOI_INVALID_CHAR, "invalid char in stoi" }, 0};
+        if (!digits)
+            return { ErrorCode::STOI_INVALID_CHAR, 0 };
 
         if (idx)
             *idx = i;
 
-        return {{ ErrorCode::OK, ""}, result * sign};
+        return { ErrorCode::OK, result * sign };
     }
 
-    inline std::string remove_char(const std::string& s, char c) {
-        std::string result;
-        result.reserve(s.size());
-
-        for (char ch : s)
-            if (ch != c)
-                result.push_back(ch);
+    constexpr const char* stoi_message(ErrorCode code) {
+        switch (code) {
+        case ErrorCode::INVALID_BASE: return "invalid base in stoi (base should be between 2 and 36)";
+        case ErrorCode::STOI_POS_OVERFLOW: return "positive overflow in stoi";
+        case ErrorCode::STOI_NEG_OVERFLOW: return "negative overflow in stoi";
+        case ErrorCode::STOI_INVALID_CHAR: return "invalid char in stoi";
+        default: return "";
+        }
+    }
 
-        return result;
+    // returns { error_code, result }
+    // '_' are skipped (1_000_000), idx: where it stopped in str
+    inline std::pair<ErrorInfo, int> better_stoi(std::string_view str, size_t* idx = nullptr, int base = 10) {
+        auto [code, result] = stoi_code(str, idx, base);
+        if (code != ErrorCode::OK) return { { code, stoi_message(code) }, 0 };
+        return { { ErrorCode::OK, "" }, result };
     }
 
-    inline std::string trim_spaces(const std::string& str) {
-        auto l = str.find_first_not_of(" \t");
-        auto r = str.find_last_not_of(" \t");
-        if (l == std::string::npos) return "";
+    // the views below point into the source, nothing is copied
+
+    constexpr std::string_view trim_spaces(std::string_view str) {
+        auto l = str.find_first_not_of(" \t\r");
+        auto r = str.find_last_not_of(" \t\r");
+        if (l == std::string_view::npos) return { };
         return str.substr(l, r - l + 1);
     }
 
-    static std::string normalize(std::string line) {
+    constexpr std::string_view normalize(std::string_view line) {
         //comments
         line = line.substr(0, line.find(';'));
 
         return trim_spaces(line);
     }
+
+    // "addi r1, r1, 1" -> { "addi", "r1, r1, 1" }
+    constexpr std::pair<std::string_view, std::string_view> split_mnemonic(std::string_view line) {
+        auto end = line.find_first_of(" \t");
+        if (end == std::string_view::npos) return { line, { } };
+        return { line.substr(0, end), trim_spaces(line.substr(end + 1)) };
+    }
+
+    // "r1 , r1,1" -> { "r1", "r1", "1" }, args is reused from one line to the next: no allocation once it is big enough
+    constexpr void split_args(std::string_view str, std::vector<std::string_view>& args) {
+        args.clear();
+        if (str.empty()) return;
+        for (size_t start = 0;;) {
+            auto comma = str.find(',', start);
+            args.push_back(trim_spaces(str.substr(start, comma - start)));
+            if (comma == std::string_view::npos) return;
+            start = comma + 1;
+        }
+    }
+
+    // transparent hash: unordered_map<std::string, ...>::find() with a string_view
+    struct string_hash {
+        using is_transparent = void;
+        size_t operator()(std::string_view s) const noexcept { return std::hash<std::string_view>{ }(s); }
+    };
 }
 
 
@@ -3,7 +3,9 @@
 
 #include "alu.h"
 #include "fpu.h"
+#include "memory.h"
 
+#include <atomic>
 #include <vector>
 #include <array>
 
@@ -107,9 +109,76 @@ enum OPCODE : uint8_t {
     CALL, // call label (24b)  (JMPR and saves the current PC)
     RET , // ret (load previous PC and JMPR there)
 
-    HALT // halt (stops program)
+    HALT, // halt (stops program)
+
+    //----------------- MULTI-CORE OPERATIONS -----------------
+    CORE_ID, // coreid rd (index of the core running it, 0 for the boot core)
+    NCORES , // ncores rd (number of cores of the CPU)
+    SPAWN  , // spawn rd, label (starts an idle core at label with a copy of the registers, rd = its id or -1)
+    JOIN   , // join rs1 (waits until the core rs1 halted)
+
+    //----------------- ATOMIC OPERATIONS -----------------
+    // word accesses on [rs1], the address is rounded down to a multiple of 4
+    CAS  , // cas rd, rs1, rs2 ([rs1] = rs2 if [rs1] == rd, rd = old [rs1], CMP = 0 if swapped else 1)
+    XADD , // xadd rd, rs1, rs2 (rd = [rs1], [rs1] += rs2)
+    XCHG , // xchg rd, rs1, rs2 (rd = [rs1], [rs1] = rs2)
+    LDAR , // ldar rd, rs1 (load-acquire)
+    STLR , // stlr rd, rs1 (store-release of rd)
+    FENCE, // fence (full barrier)
+    WAIT , // wait rd, rs1 (sleeps while [rs1] == rd, until a wake on the same address)
+    WAKE , // wake rs1 (wakes every core waiting on [rs1])
+
+    //----------------- SUPER-INSTRUCTIONS -----------------
+    // never emitted by the assembler, see asm/superinstructions.h
+    // the head slot keeps its own operands, the tail is read from the next slots
+    INC_CMP_JL  , // inc rd + cmp rs1, rs2 + jl label
+    INC_CMP_JNZ , // inc rd + cmp rs1, rs2 + jnz label
+    INC_CMPI_JL , // inc rd + cmpi rs, imm + jl label
+    INC_CMPI_JNZ, // inc rd + cmpi rs, imm + jnz label
+    ADDI_CMP_JL  , // addi rd, rs, imm + cmp rs1, rs2 + jl label
+    ADDI_CMP_JNZ , // addi rd, rs, imm + cmp rs1, rs2 + jnz label
+    ADDI_CMPI_JL , // addi rd, rs, imm + cmpi rs, imm + jl label
+    ADDI_CMPI_JNZ, // addi rd, rs, imm + cmpi rs, imm + jnz label
+    CMP_JZ  , // cmp rs1, rs2 + jz label
+    CMP_JNZ , // cmp rs1, rs2 + jnz label
+    CMP_JG  , // cmp rs1, rs2 + jg label
+    CMP_JL  , // cmp rs1, rs2 + jl label
+    CMPI_JZ , // cmpi rs, imm + jz label
+    CMPI_JNZ, // cmpi rs, imm + jnz label
+    CMPI_JG , // cmpi rs, imm + jg label
+    CMPI_JL   // cmpi rs, imm + jl label
 };
 
+// number of opcodes, super-instructions included: anything above is not an instruction
+constexpr uint32_t OPCODE_COUNT = CMPI_JL + 1;
+
+// opcode of the first instruction a super-instruction was built from
+constexpr uint8_t fused_head(uint8_t opcode) {
+    switch (opcode) {
+    case INC_CMP_JL: case INC_CMP_JNZ: case INC_CMPI_JL: case INC_CMPI_JNZ:
+        return INC;
+    case ADDI_CMP_JL: case ADDI_CMP_JNZ: case ADDI_CMPI_JL: case ADDI_CMPI_JNZ:
+        return ADDI;
+    case CMP_JZ: case CMP_JNZ: case CMP_JG: case CMP_JL:
+        return CMP;
+    case CMPI_JZ: case CMPI_JNZ: case CMPI_JG: case CMPI_JL:
+        return CMPI;
+    default:
+        return opcode;
+    }
+}
+
+
+struct SimpleCore;
+
+// what a core can ask to the other cores of its CPU (see SimpleCPU)
+struct CoreGroup {
+    virtual ~CoreGroup() = default;
+    virtual uint32_t count() const = 0;
+    // starts an idle core at pc with the registers of parent, returns its id or UINT32_MAX if they are all busy
+    virtual uint32_t spawn(const SimpleCore& parent, uint32_t pc) = 0;
+    virtual void join(uint32_t id) = 0;
+};
 
 struct SimpleCore {
     std::array<uint32_t, 16> regs{};
@@ -117,52 +186,102 @@ struct SimpleCore {
     uint32_t& SP = regs[15]; // Stack Pointer
     uint32_t PC = 0; // Program Counter
 
-    std::vector<uint8_t>& ram;
+    GuestRam& ram;
 
-    SimpleCore(std::vector<uint8_t>& ram) : ram(ram) {
-        SP = ram.size() - 1;
+    uint32_t id = 0;
+    uint32_t stack_top = 0; // every core gets its own stack below the previous one
+    CoreGroup* group = nullptr; // nullptr for a lone core: spawn fails and join returns at once
+    std::atomic<bool> active = false; // running on its own host thread
+    bool faulted = false; // stored outside of the RAM, set by whoever ran it
+
+    SimpleCore(GuestRam& ram, uint32_t id = 0, uint32_t stack_top = 0) : ram(ram), id(id), stack_top(stack_top) {
+        if (this->stack_top == 0) this->stack_top = ram.size() - 1;
+        SP = this->stack_top;
     }
 
+    // the whole 32-bit space is mapped (see GuestRam): no range check, one host access each
+
     // <- memory[addr]
     uint32_t load32(uint32_t addr) {
-        if (addr + 3 >= ram.size()) return 0;
-        return ram[addr] |
-               (ram[addr + 1] << 8) |
-               (ram[addr + 2] << 16) |
-               (ram[addr + 3] << 24);
+        uint32_t value;
+        std::memcpy(&value, ram.data() + addr, 4);
+        return value;
     }
     uint16_t load16(uint32_t addr) {
-        if (addr + 1 >= ram.size()) return 0;
-        return ram[addr] |
-               (ram[addr + 1] << 8);
+        uint16_t value;
+        std::memcpy(&value, ram.data() + addr, 2);
+        return value;
     }
     uint8_t load8(uint32_t addr) {
-        if (addr >= ram.size()) return 0;
-        return ram[addr];
+        return ram.data()[addr];
     }
-    // value -> ram
+    // value -> ram, faults above ram.size(), marks the granule dirty (see GuestRam)
     void store32(uint32_t addr, uint32_t value) {
-        if (addr + 3 >= ram.size()) return;
-        ram[addr] = value & 0xFF;
-        ram[addr + 1] = (value >> 8) & 0xFF;
-        ram[addr + 2] = (value >> 16) & 0xFF;
-        ram[addr + 3] = (value >> 24) & 0xFF;
+        std::memcpy(ram.data() + addr, &value, 4);
+        ram.mark_dirty(addr, 4);
     }
     void store16(uint32_t addr, uint16_t value) {
-        if (addr + 1 >= ram.size()) return;
-        ram[addr] = value & 0xFF;
-        ram[addr + 1] = (value >> 8) & 0xFF;
+        std::memcpy(ram.data() + addr, &value, 2);
+        ram.mark_dirty(addr, 2);
     }
     void store8(uint32_t addr, uint8_t value) {
-        if (addr >= ram.size()) return;
-        ram[addr] = value;
+        ram.data()[addr] = value;
+        ram.mark_dirty(addr);
+    }
+
+    // atomics, straight on the guest RAM (RAM base is page aligned so the word is aligned on the host too)
+    std::atomic_ref<uint32_t> atomic32(uint32_t addr) {
+        return std::atomic_ref<uint32_t>(*reinterpret_cast<uint32_t*>(ram.data() + (addr & ~3u)));
+    }
+    // returns the old value, sets CMP like a cmp: 0 if it swapped
+    uint32_t cas32(uint32_t addr, uint32_t expected, uint32_t desired) {
+        bool swapped = atomic32(addr).compare_exchange_strong(expected, desired);
+        if (swapped) ram.mark_dirty(addr);
+        regs[13] = swapped ? 0 : 1;
+        return expected;
+    }
+    uint32_t xadd32(uint32_t addr, uint32_t value) {
+        uint32_t old = atomic32(addr).fetch_add(value);
+        ram.mark_dirty(addr);
+        return old;
+    }
+    uint32_t xchg32(uint32_t addr, uint32_t value) {
+        uint32_t old = atomic32(addr).exchange(value);
+        ram.mark_dirty(addr);
+        return old;
+    }
+    uint32_t load_acquire32(uint32_t addr) {
+        return atomic32(addr).load(std::memory_order_acquire);
+    }
+    void store_release32(uint32_t addr, uint32_t value) {
+        atomic32(addr).store(value, std::memory_order_release);
+        ram.mark_dirty(addr);
+    }
+    // futex-like, the host thread blocks instead of spinning
+    void wait32(uint32_t addr, uint32_t expected) {
+        atomic32(addr).wait(expected);
+    }
+    void wake32(uint32_t addr) {
+        atomic32(addr).notify_all();
     }
 
     void reset() {
         std::ranges::fill(regs, 0);
         std::ranges::fill(fregs, 0);
-        SP = ram.size() - 1;
+        SP = stack_top;
         PC = 0;
+        faulted = false;
+    }
+
+    // helpers for the multi-core handlers, same behaviour in every execution mode
+    uint32_t core_count() const {
+        return group ? group->count() : 1;
+    }
+    uint32_t spawn(uint32_t pc) const {
+        return group ? group->spawn(*this, pc) : UINT32_MAX;
+    }
+    void join(uint32_t other) const {
+        if (group && other != id) group->join(other);
     }
 };
 
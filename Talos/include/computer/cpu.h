@@ -1,16 +1,128 @@
 #ifndef ERGON_CPU_H
 #define ERGON_CPU_H
 
+#include <deque>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include "core.h"
 
-struct SimpleCPU {
-    SimpleCore core;
+/*
+N cores over the same RAM, core 0 runs on the calling thread and the others on their own
+host thread once started (spawn from the guest or launch from the host).
+Every core has its own registers, PC and stack: core i's stack starts stack_size * i bytes
+under the top of the RAM.
+*/
+struct SimpleCPU : CoreGroup {
+    static constexpr uint32_t DEFAULT_STACK_SIZE = 0x4000; // 16 KiB per core
 
-    SimpleCPU(std::vector<uint8_t>& ram) : core(ram) {};
+    std::deque<SimpleCore> cores; // deque: a SimpleCore holds references and is never moved
+    SimpleCore& core; // core 0, the one programs boot on
+    std::vector<std::thread> threads; // threads[i] runs cores[i], threads[0] is never used
+    std::function<void(SimpleCore&)> runner; // how a started core runs, set by EnvironmentManager::start()
+    std::mutex threads_mutex;
 
+    SimpleCPU(GuestRam& ram, size_t core_count = 1, uint32_t stack_size = DEFAULT_STACK_SIZE) : core(make_cores(ram, core_count, stack_size)), threads(cores.size()) {};
+    SimpleCPU(const SimpleCPU&) = delete;
+    SimpleCPU& operator=(const SimpleCPU&) = delete;
+    ~SimpleCPU() override {
+        join_all();
+    }
+
+    uint32_t count() const override {
+        return static_cast<uint32_t>(cores.size());
+    }
+
+    uint32_t spawn(const SimpleCore& parent, uint32_t pc) override {
+        for (uint32_t i = 1; i < cores.size(); i++) {
+            bool idle = false;
+            if (!cores[i].active.compare_exchange_strong(idle, true)) continue;
+
+            SimpleCore& child = cores[i];
+            child.regs = parent.regs;
+            child.fregs = parent.fregs;
+            child.SP = child.stack_top;
+            child.PC = pc;
+            child.faulted = false;
+            start_thread(child);
+            return i;
+        }
+        return UINT32_MAX;
+    }
+
+    void join(uint32_t id) override {
+        if (id >= cores.size()) return;
+        while (cores[id].active.load())
+            cores[id].active.wait(true);
+    }
+
+    // host side: starts core id at pc from a clean state, false if it is already running
+    bool launch(uint32_t id, uint32_t pc) {
+        if (id == 0 || id >= cores.size()) return false;
+        bool idle = false;
+        if (!cores[id].active.compare_exchange_strong(idle, true)) return false;
+
+        cores[id].reset();
+        cores[id].PC = pc;
+        start_thread(cores[id]);
+        return true;
+    }
+
+    // waits for every started core, including the ones started while waiting
+    void join_all() {
+        bool again = true;
+        while (again) {
+            again = false;
+            for (uint32_t i = 1; i < cores.size(); i++) {
+                join(i);
+                std::lock_guard lock(threads_mutex);
+                // claimed again in the meantime: its thread may be the new one, see it on the next pass
+                if (cores[i].active.load()) again = true;
+                else if (threads[i].joinable()) {
+                    threads[i].join();
+                    again = true;
+                }
+            }
+        }
+    }
+
+    bool any_faulted() const {
+        for (const SimpleCore& c : cores)
+            if (c.faulted) return true;
+        return false;
+    }
+
+    void reset() {
+        join_all();
+        for (SimpleCore& c : cores) c.reset();
+    }
+
+private:
+    SimpleCore& make_cores(GuestRam& ram, size_t core_count, uint32_t stack_size) {
+        if (core_count == 0) core_count = 1;
+        // small RAMs get smaller stacks instead of overlapping ones
+        if (stack_size * core_count > ram.size()) stack_size = static_cast<uint32_t>(ram.size() / core_count) & ~3u;
+
+        for (size_t i = 0; i < core_count; i++)
+            cores.emplace_back(ram, static_cast<uint32_t>(i), static_cast<uint32_t>(ram.size() - 1 - i * stack_size));
+        for (SimpleCore& c : cores) c.group = this;
+        return cores.front();
+    }
+
+    // the core is already claimed (active == true)
+    void start_thread(SimpleCore& c) {
+        std::lock_guard lock(threads_mutex);
+        if (threads[c.id].joinable()) threads[c.id].join(); // previous run, already done
+        threads[c.id] = std::thread([this, &c] {
+            if (runner) runner(c);
+            c.active.store(false);
+            c.active.notify_all();
+        });
+    }
 };
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,88 @@
+#ifndef ERGON_AOT_HANDLER_H
+#define ERGON_AOT_HANDLER_H
+
+#include "computer/core.h"
+#include "asm/data.h"
+#include "step_handler.h"
+
+#include <array>
+#include <cstring>
+#include <span>
+
+/*
+Runtime side of the ahead-of-time translation (see asm/aot.h): what the generated C++ links against.
+ - every basic block of the text is a label, every instruction its ERGON_SEM_* statement with constant operands
+ - the statements run on an AotCore: a local copy of the registers the host compiler keeps in host registers,
+   written back to the SimpleCore on HALT, when leaving the text and around the instructions step_instr() runs
+   (multicore, atomics, memcpy)
+ - RET and a start on any PC go through a switch over the block labels
+A store outside of the RAM writes the registers back first (PC on the store), then faults like run()
+*/
+
+// a translated program: its sections for the MotherBoard (load_aot()) and the code that runs them
+struct AotProgram {
+    std::span<const DecodedInstr> text;
+    std::span<const uint8_t> data;
+    std::span<const uint8_t> rodata;
+    uint32_t entry_pc = 0;
+    void (*run)(SimpleCore& c) = nullptr; // from c.PC until HALT or the end of the text, like run()
+};
+
+// what the ERGON_SEM_* macros see in translated code
+struct AotCore {
+    std::array<uint32_t, 16> regs;
+    std::array<uint32_t, 16> fregs;
+    SimpleCore& core;
+    GuestRam& ram;
+    uint8_t* const base;
+    uint32_t pc = 0; // set before every store by the translated code, for the fault path
+
+    explicit AotCore(SimpleCore& core) : regs(core.regs), fregs(core.fregs), core(core), ram(core.ram), base(core.ram.data()) {}
+
+    uint32_t load32(uint32_t addr) const {
+        uint32_t value;
+        std::memcpy(&value, base + addr, 4);
+        return value;
+    }
+    uint16_t load16(uint32_t addr) const {
+        uint16_t value;
+        std::memcpy(&value, base + addr, 2);
+        return value;
+    }
+    uint8_t load8(uint32_t addr) const { return base[addr]; }
+    void store32(uint32_t addr, uint32_t value) {
+        if (!writable(addr, 4)) [[unlikely]] sync(pc);
+        std::memcpy(base + addr, &value, 4);
+        ram.mark_dirty(addr, 4);
+    }
+    void store16(uint32_t addr, uint16_t value) {
+        if (!writable(addr, 2)) [[unlikely]] sync(pc);
+        std::memcpy(base + addr, &value, 2);
+        ram.mark_dirty(addr, 2);
+    }
+    void store8(uint32_t addr, uint8_t value) {
+        if (!writable(addr, 1)) [[unlikely]] sync(pc);
+        base[addr] = value;
+        ram.mark_dirty(addr);
+    }
+
+    // the store faults past the RAM size
+    bool writable(uint32_t addr, uint32_t bytes) const { return static_cast<uint64_t>(addr) + bytes <= ram.size(); }
+    // registers back in the SimpleCore, PC on pc
+    void sync(uint32_t pc) {
+        core.regs = regs;
+        core.fregs = fregs;
+        core.PC = pc;
+    }
+    // instructions that need the whole core, returns the PC it goes on with
+    uint32_t step(const DecodedInstr& instr, uint32_t pc) {
+        sync(pc);
+        step_instr(core, instr);
+        regs = core.regs;
+        fregs = core.fregs;
+        return core.PC;
+    }
+};
+
+
+#endif
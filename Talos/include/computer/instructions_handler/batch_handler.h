@@ -0,0 +1,483 @@
+#ifndef ERGON_BATCH_HANDLER_H
+#define ERGON_BATCH_HANDLER_H
+
+#include "computer/core.h"
+#include "run_handler.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <vector>
+
+/*
+SIMT batch mode: one program, N lanes, each lane is a SimpleCore with its own RAM.
+ - registers are stored per register (structure of arrays), regs[r * lanes + lane],
+   so every ALU/FPU handler is a plain loop over contiguous columns with a lane mask
+   that the compiler turns into SSE/AVX2 blends (-O3 / Release, -mavx2 or -march=native for AVX2)
+ - lanes are run by warps of warp_size, every step runs the instruction at the smallest
+   PC among the running lanes of the warp, for the lanes sitting on that PC: lanes that took the other side of a branch
+   just wait there and join back when the others reach them (min-PC reconvergence)
+ - a lane that waited more than divergence_limit steps in a row, or that reaches an
+   instruction the batch does not handle (MEMCPY, multi-core, atomics), finishes alone
+   through the scalar run(), and so do the last lanes once most of their warp halted
+*/
+
+enum class LaneStatus : uint8_t {
+    RUNNING,
+    HALTED,
+    FAULT // stored outside of its RAM
+};
+
+struct BatchEngine {
+    ThreadedCode code; // a copy: the batch outlives a rebuild of the board it came from
+    size_t lanes = 0;
+    size_t ram_size = 0; // per lane, rounded up to the page size like GuestRam
+    uint32_t divergence_limit = 1 << 14; // steps a lane can wait behind the others
+    size_t warp_size = 256; // lanes stepped together, divergence only makes lanes of the same warp wait
+    uint32_t tail_fraction = 16; // below warp_size / tail_fraction running lanes, the warp finishes in run()
+
+    std::vector<uint32_t> regs; // regs[r * lanes + lane]
+    std::vector<uint32_t> fregs;
+    std::vector<uint32_t> pc;
+    std::vector<LaneStatus> status;
+    std::vector<uint8_t> memory; // lane RAMs, one after the other
+
+    size_t scalar_lanes = 0; // lanes that ended in run()
+    std::unique_ptr<GuestRam> scalar_ram; // made by the first lane that ends in run()
+    uint64_t steps = 0; // instructions issued for the whole batch
+
+    BatchEngine(const ThreadedCode& code, size_t lanes, size_t lane_ram_size) : code(code), lanes(lanes) {
+        static const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        ram_size = (lane_ram_size + page - 1) & ~(page - 1);
+
+        regs.assign(16 * lanes, 0);
+        fregs.assign(16 * lanes, 0);
+        pc.assign(lanes, 0);
+        status.assign(lanes, LaneStatus::RUNNING);
+        memory.assign(lanes * ram_size, 0);
+        running.assign(lanes, 0);
+        mask.assign(lanes, 0);
+        waited.assign(lanes, 0);
+        for (size_t l = 0; l < lanes; l++) reg(15)[l] = static_cast<uint32_t>(ram_size - 1);
+    }
+
+    uint32_t* reg(uint8_t r) { return regs.data() + r * lanes; }
+    uint32_t* freg(uint8_t r) { return fregs.data() + r * lanes; }
+    uint8_t* ram(size_t lane) { return memory.data() + lane * ram_size; }
+
+    // same state for every lane: image at addr (usually the RAM of the built program)
+    void load_all(std::span<const uint8_t> image, uint32_t addr = 0) {
+        for (size_t l = 0; l < lanes; l++) load(l, image, addr);
+    }
+    void load(size_t lane, std::span<const uint8_t> image, uint32_t addr = 0) {
+        if (addr >= ram_size) return;
+        std::memcpy(ram(lane) + addr, image.data(), std::min(image.size(), ram_size - addr));
+    }
+
+    // false without a program (empty code, after a build that failed): nothing runs, the lanes stay RUNNING
+    bool run(uint32_t entry_pc) {
+        if (code.empty()) return false;
+        std::ranges::fill(pc, entry_pc);
+        for (lo = 0; lo < lanes; lo = hi) {
+            hi = std::min(lanes, lo + warp_size);
+            run_warp();
+        }
+        return true;
+    }
+
+private:
+    std::vector<uint32_t> running; // UINT32_MAX while status is RUNNING
+    std::vector<uint32_t> mask; // UINT32_MAX for the lanes issuing this step
+    std::vector<uint32_t> waited; // steps since the lane last issued
+    size_t lo = 0, hi = 0; // lanes of the warp being run, every loop below only goes over them
+    size_t live = 0; // running lanes of the warp
+    // every running lane of the warp is on the same PC: mask == running, pc[] is not
+    // kept up to date and the next PC is next_at, until a branch splits the warp
+    bool uniform = false;
+    uint32_t next_at = 0;
+
+    void stop(size_t lane, LaneStatus st) {
+        status[lane] = st;
+        running[lane] = 0;
+        mask[lane] = 0;
+        live--;
+    }
+
+    void run_warp() {
+        const auto prog_size = static_cast<uint32_t>(code.size() - 1);
+        live = 0;
+        for (size_t l = lo; l < hi; l++) {
+            running[l] = status[l] == LaneStatus::RUNNING ? UINT32_MAX : 0;
+            live += running[l] & 1;
+        }
+
+        uniform = false;
+        uint32_t at = 0;
+        while (live != 0) {
+            if (uniform) at = next_at;
+
+            // a nearly empty warp costs as much as a full one: the last lanes go on alone
+            if (live * tail_fraction < hi - lo) {
+                for (size_t l = lo; l < hi; l++)
+                    if (running[l]) {
+                        if (uniform) pc[l] = at;
+                        finish_scalar(l);
+                    }
+                return;
+            }
+
+            if (!uniform) {
+                // next PC to issue: the smallest one, the lanes in front of it wait for the others
+                at = UINT32_MAX;
+                for (size_t l = lo; l < hi; l++)
+                    at = std::min(at, pc[l] | ~running[l]);
+                at = std::min(at, prog_size);
+
+                uint32_t longest_wait = 0;
+                size_t issued = 0;
+                for (size_t l = lo; l < hi; l++) {
+                    uint32_t on = running[l] & (0u - static_cast<uint32_t>(std::min(pc[l], prog_size) == at));
+                    mask[l] = on;
+                    issued += on & 1;
+                    waited[l] = (waited[l] + 1) & ~on;
+                    longest_wait = std::max(longest_wait, waited[l] & running[l]);
+                }
+                if (longest_wait > divergence_limit)
+                    for (size_t l = lo; l < hi; l++)
+                        if (running[l] && waited[l] > divergence_limit) {
+                            finish_scalar(l);
+                            issued -= mask[l] & 1;
+                        }
+                uniform = issued == live;
+            }
+
+            steps++;
+            issue(code[at], at);
+        }
+    }
+
+    static uint32_t blend(uint32_t m, uint32_t value, uint32_t old) {
+        return (value & m) | (old & ~m);
+    }
+
+    // dst = f(a, b, dst) on the issuing lanes, f runs on every lane so it must be defined for any input
+    template<typename F>
+    void lanes_rr(uint32_t* dst, const uint32_t* a, const uint32_t* b, F f) {
+        for (size_t l = lo; l < hi; l++)
+            dst[l] = blend(mask[l], f(a[l], b[l], dst[l]), dst[l]);
+    }
+    template<typename F>
+    void lanes_ri(uint32_t* dst, const uint32_t* a, uint32_t imm, F f) {
+        for (size_t l = lo; l < hi; l++)
+            dst[l] = blend(mask[l], f(a[l], imm, dst[l]), dst[l]);
+    }
+    void next_pc(uint32_t at) {
+        if (uniform) {
+            next_at = at + 1;
+            return;
+        }
+        for (size_t l = lo; l < hi; l++)
+            if (mask[l]) pc[l] = at + 1;
+    }
+    // taken lanes jump to target, the others go on
+    template<typename Cond>
+    void branch(uint32_t at, uint32_t target, Cond taken) {
+        const uint32_t* cmp = reg(13);
+        size_t issued = 0, jumped = 0;
+        for (size_t l = lo; l < hi; l++)
+            if (mask[l]) {
+                bool t = taken(cmp[l]);
+                pc[l] = t ? target : at + 1;
+                jumped += t;
+                issued++;
+            }
+        if (jumped != 0 && jumped != issued) uniform = false;
+        next_at = jumped != 0 ? target : at + 1;
+    }
+
+    // lane memory: loads above the RAM read zeros, stores there stop the lane (same as GuestRam)
+    template<typename T>
+    T load(size_t lane, uint32_t addr) {
+        T value = 0;
+        if (addr < ram_size) std::memcpy(&value, ram(lane) + addr, std::min(sizeof(T), ram_size - addr));
+        return value;
+    }
+    template<typename T>
+    void store(size_t lane, uint32_t addr, T value) {
+        if (static_cast<uint64_t>(addr) + sizeof(T) > ram_size) {
+            stop(lane, LaneStatus::FAULT);
+            return;
+        }
+        std::memcpy(ram(lane) + addr, &value, sizeof(T));
+    }
+    template<typename T, typename Addr>
+    void lanes_load(uint32_t* dst, Addr addr) {
+        for (size_t l = lo; l < hi; l++)
+            if (mask[l]) {
+                if constexpr (sizeof(T) == 4) dst[l] = load<uint32_t>(l, addr(l));
+                else dst[l] = static_cast<uint32_t>(static_cast<int32_t>(load<T>(l, addr(l))));
+            }
+    }
+    template<typename T, typename Addr>
+    void lanes_store(const uint32_t* src, Addr addr) {
+        for (size_t l = lo; l < hi; l++)
+            if (mask[l]) store<T>(l, addr(l), static_cast<T>(src[l]));
+    }
+
+    // the rest of the program for one lane, through the scalar interpreter on a real GuestRam
+    // (one for the whole batch, only the granules the lane stored to are copied back)
+    void finish_scalar(size_t l) {
+        if (!scalar_ram) scalar_ram = std::make_unique<GuestRam>(ram_size);
+        GuestRam& lane_ram = *scalar_ram;
+        std::memcpy(lane_ram.data(), ram(l), ram_size);
+        lane_ram.clear_dirty();
+        SimpleCore core(lane_ram);
+        for (uint8_t r = 0; r < 16; r++) {
+            core.regs[r] = reg(r)[l];
+            core.fregs[r] = freg(r)[l];
+        }
+        core.PC = pc[l];
+
+        bool ok = guarded_run(lane_ram, [&] { ::run(core, code); });
+
+        for (uint8_t r = 0; r < 16; r++) {
+            reg(r)[l] = core.regs[r];
+            freg(r)[l] = core.fregs[r];
+        }
+        pc[l] = core.PC;
+        for (size_t g = 0; g < lane_ram.dirty.size(); g++) {
+            const size_t at = g << GuestRam::DIRTY_SHIFT;
+            if (lane_ram.dirty[g] && at < ram_size)
+                std::memcpy(ram(l) + at, lane_ram.data() + at, std::min(GuestRam::GRANULE, ram_size - at));
+        }
+        stop(l, ok ? LaneStatus::HALTED : LaneStatus::FAULT);
+        scalar_lanes++;
+    }
+
+    static float f32(uint32_t v) { return std::bit_cast<float>(v); }
+    static uint32_t u32(float v) { return std::bit_cast<uint32_t>(v); }
+
+    // one instruction for every lane in mask, same semantics as the handlers of run()
+    void issue(const ThreadedInstr& I, uint32_t at) {
+        uint32_t* rd = reg(I.rd);
+        const uint32_t* rs1 = reg(I.rs1);
+        const uint32_t* rs2 = reg(I.rs2);
+        uint32_t* frd = freg(I.rd);
+        const uint32_t* frs1 = freg(I.rs1);
+        const uint32_t* frs2 = freg(I.rs2);
+        uint32_t* cmp = reg(13);
+        const auto imm = static_cast<uint32_t>(I.imm);
+
+        // super-instructions only issue their head, the tail slots are issued on their own like in step_instr()
+        switch (fused_head(I.opcode)) {
+        case ADD: lanes_rr(rd, rs1, rs2, [](uint32_t a, uint32_t b, uint32_t) { return a + b; }); break;
+        case SUB: lanes_rr(rd, rs1, rs2, [](uint32_t a, uint32_t b, uint32_t) { return a - b; }); break;
+        case MUL: lanes_rr(rd, rs1, rs2, [](uint32_t a, uint32_t b, uint32_t) { return a * b; }); break;
+        case DIV:
+            lanes_rr(rd, rs1, rs2, [](uint32_t a, uint32_t b, uint32_t d) {
+                if ((int32_t)b == 0 || ((int32_t)a == INT32_MIN && (int32_t)b == -1)) return d;
+                return (uint32_t)((int32_t)a / (int32_t)b);
+            });
+            break;
+        case MOD:
+            lanes_rr(rd, rs1, rs2, [](uint32_t a, uint32_t b, uint32_t d) {
+                if ((int32_t)b == 0 || ((int32_t)a == INT32_MIN && (int32_t)b == -1)) return (int32_t)b == 0 ? d : 0u;
+                return (uint32_t)((int32_t)a % (int32_t)b);
+            });
+            break;
+        case ADDI: lanes_ri(rd, rs1, imm, [](uint32_t a, uint32_t b, uint32_t) { return a + b; }); break;
+        case SUBI: lanes_ri(rd, rs1, imm, [](uint32_t a, uint32_t b, uint32_t) { return a - b; }); break;
+        case MULI: lanes_ri(rd, rs1, imm, [](uint32_t a, uint32_t b, uint32_t) { return a * b; }); break;
+        case DIVI:
+            lanes_ri(rd, rs1, imm, [](uint32_t a, uint32_t b, uint32_t d) {
+                if ((int32_t)b == 0 || ((int32_t)a == INT32_MIN && (int32_t)b == -1)) return d;
+                return (uint32_t)((int32_t)a / (int32_t)b);
+            });
+            break;
+        case MODI:
+            lanes_ri(rd, rs1, imm, [](uint32_t a, uint32_t b, uint32_t d) {
+                if ((int32_t)b == 0 || ((int32_t)a == INT32_MIN && (int32_t)b == -1)) return (int32_t)b == 0 ? d : 0u;
+                return (uint32_t)((int32_t)a % (int32_t)b);
+            });
+            break;
+
+        case AND: lanes_rr(rd, rs1, rs2, [](uint32_t a, uint32_t b, uint32_t) { return a & b; }); break;
+        case OR: lanes_rr(rd, rs1, rs2, [](uint32_t a, uint32_t b, uint32_t) { return a | b; }); break;
+        case XOR: lanes_rr(rd, rs1, rs2, [](uint32_t a, uint32_t b, uint32_t) { return a ^ b; }); break;
+        case ANDI: lanes_ri(rd, rs1, imm, [](uint32_t a, uint32_t b, uint32_t) { return a & b; }); break;
+        case ORI: lanes_ri(rd, rs1, imm, [](uint32_t a, uint32_t b, uint32_t) { return a | b; }); break;
+        case XORI: lanes_ri(rd, rs1, imm, [](uint32_t a, uint32_t b, uint32_t) { return a ^ b; }); break;
+
+        case SHL: case SHLI:
+            if (I.opcode == SHL) lanes_rr(rd, rs1, rs2, [](uint32_t a, uint32_t b, uint32_t) { return a << (b & 31); });
+            else lanes_ri(rd, rs1, imm, [](uint32_t a, uint32_t b, uint32_t) { return a << (b & 31); });
+            break;
+        case SHR: case SHRI:
+            if (I.opcode == SHR) lanes_rr(rd, rs1, rs2, [](uint32_t a, uint32_t b, uint32_t) { return a >> (b & 31); });
+            else lanes_ri(rd, rs1, imm, [](uint32_t a, uint32_t b, uint32_t) { return a >> (b & 31); });
+            break;
+        case SAR: case SARI:
+            if (I.opcode == SAR) lanes_rr(rd, rs1, rs2, [](uint32_t a, uint32_t b, uint32_t) { return (uint32_t)((int32_t)a >> (b & 31)); });
+            else lanes_ri(rd, rs1, imm, [](uint32_t a, uint32_t b, uint32_t) { return (uint32_t)((int32_t)a >> (b & 31)); });
+            break;
+        case ROL: case ROLI:
+            if (I.opcode == ROL) lanes_rr(rd, rs1, rs2, [](uint32_t a, uint32_t b, uint32_t) { return std::rotl(a, (int)(b & 31)); });
+            else lanes_ri(rd, rs1, imm, [](uint32_t a, uint32_t b, uint32_t) { return std::rotl(a, (int)(b & 31)); });
+            break;
+        case ROR: case RORI:
+            if (I.opcode == ROR) lanes_rr(rd, rs1, rs2, [](uint32_t a, uint32_t b, uint32_t) { return std::rotr(a, (int)(b & 31)); });
+            else lanes_ri(rd, rs1, imm, [](uint32_t a, uint32_t b, uint32_t) { return std::rotr(a, (int)(b & 31)); });
+            break;
+
+        case CMP:
+            lanes_rr(cmp, rs1, rs2, [](uint32_t a, uint32_t b, uint32_t) { return (int32_t)a < (int32_t)b ? UINT32_MAX : (uint32_t)((int32_t)a > (int32_t)b); });
+            break;
+        case CMPU:
+            lanes_rr(cmp, rs1, rs2, [](uint32_t a, uint32_t b, uint32_t) { return a < b ? UINT32_MAX : (uint32_t)(a > b); });
+            break;
+        case TEST:
+            lanes_rr(cmp, rs1, rs2, [](uint32_t a, uint32_t b, uint32_t) { return (uint32_t)((a & b) != 0); });
+            break;
+        case CMPI:
+            lanes_ri(cmp, rs1, imm, [](uint32_t a, uint32_t b, uint32_t) { return (int32_t)a < (int32_t)b ? UINT32_MAX : (uint32_t)((int32_t)a > (int32_t)b); });
+            break;
+        case CMPUI: // same result as run(): never 1
+            lanes_ri(cmp, rs1, imm, [](uint32_t a, uint32_t b, uint32_t) { return a < b ? UINT32_MAX : 0u; });
+            break;
+        case TESTI:
+            lanes_ri(cmp, rs1, imm, [](uint32_t a, uint32_t b, uint32_t) { return (uint32_t)((a & b) != 0); });
+            break;
+
+        case INC: lanes_ri(rd, rd, 1, [](uint32_t a, uint32_t b, uint32_t) { return a + b; }); break;
+        case DEC: lanes_ri(rd, rd, 1, [](uint32_t a, uint32_t b, uint32_t) { return a - b; }); break;
+        case NOT: lanes_ri(rd, rs1, 0, [](uint32_t a, uint32_t, uint32_t) { return ~a; }); break;
+        case ABS: lanes_ri(rd, rs1, 0, [](uint32_t a, uint32_t, uint32_t) { return (int32_t)a < 0 ? 0u - a : a; }); break;
+        case NEG: lanes_ri(rd, rs1, 0, [](uint32_t a, uint32_t, uint32_t d) { return (int32_t)a != INT32_MIN ? 0u - a : d; }); break;
+        case MIN: lanes_rr(rd, rs1, rs2, [](uint32_t a, uint32_t b, uint32_t) { return a < b ? a : b; }); break;
+        case MAX: lanes_rr(rd, rs1, rs2, [](uint32_t a, uint32_t b, uint32_t) { return a > b ? a : b; }); break;
+        case MINI: // same result as run(): the register indices are written
+            {
+                const uint32_t i1 = I.rs1, i2 = I.rs2;
+                lanes_ri(rd, rs1, I.rs2, [i1, i2](uint32_t a, uint32_t b, uint32_t) { return a < b ? i1 : i2; });
+                break;
+            }
+        case MAXI:
+            {
+                const uint32_t i1 = I.rs1, i2 = I.rs2;
+                lanes_ri(rd, rs1, I.rs2, [i1, i2](uint32_t a, uint32_t b, uint32_t) { return a > b ? i1 : i2; });
+                break;
+            }
+
+        case FADD: lanes_rr(frd, frs1, frs2, [](uint32_t a, uint32_t b, uint32_t) { return u32(f32(a) + f32(b)); }); break;
+        case FSUB: lanes_rr(frd, frs1, frs2, [](uint32_t a, uint32_t b, uint32_t) { return u32(f32(a) - f32(b)); }); break;
+        case FMUL: lanes_rr(frd, frs1, frs2, [](uint32_t a, uint32_t b, uint32_t) { return u32(f32(a) * f32(b)); }); break;
+        case FDIV: lanes_rr(frd, frs1, frs2, [](uint32_t a, uint32_t b, uint32_t) { return u32(f32(a) / f32(b)); }); break;
+        case FMA: lanes_rr(frd, frs1, frs2, [](uint32_t a, uint32_t b, uint32_t d) { return u32(std::fma(f32(d), f32(a), f32(b))); }); break;
+        case FSQRT: lanes_ri(frd, frs1, 0, [](uint32_t a, uint32_t, uint32_t) { return u32(std::sqrt(f32(a))); }); break;
+        case FABS: lanes_ri(frd, frs1, 0, [](uint32_t a, uint32_t, uint32_t) { return u32(std::abs(f32(a))); }); break;
+        case FNEG: lanes_ri(frd, frs1, 0, [](uint32_t a, uint32_t, uint32_t) { return u32(-f32(a)); }); break;
+        case FCMP:
+            lanes_rr(cmp, frs1, frs2, [](uint32_t a, uint32_t b, uint32_t) { return f32(a) < f32(b) ? UINT32_MAX : (uint32_t)(f32(a) > f32(b)); });
+            break;
+        case ITOF: lanes_ri(frd, rs1, 0, [](uint32_t a, uint32_t, uint32_t) { return a; }); break;
+        case FTOI: lanes_ri(rd, frs1, 0, [](uint32_t a, uint32_t, uint32_t) { return a; }); break;
+        case FMOV: lanes_ri(frd, rs1, 0, [](uint32_t a, uint32_t, uint32_t) { return a; }); break;
+        case MOVF: lanes_ri(rd, frs1, 0, [](uint32_t a, uint32_t, uint32_t) { return a; }); break;
+        case FLDW_ABS: lanes_load<uint32_t>(frd, [imm](size_t) { return imm; }); break;
+        case FSTW_ABS: lanes_store<uint32_t>(frd, [imm](size_t) { return imm; }); break;
+        case FLDW_BASE: lanes_load<uint32_t>(frd, [rs1, imm](size_t l) { return rs1[l] + imm; }); break;
+        case FSTW_BASE: lanes_store<uint32_t>(frd, [rs1, imm](size_t l) { return rs1[l] + imm; }); break;
+
+        case MOV_IMM: lanes_ri(rd, rd, imm, [](uint32_t, uint32_t b, uint32_t) { return b; }); break;
+        case MOV_REG: lanes_ri(rd, rs1, 0, [](uint32_t a, uint32_t, uint32_t) { return a; }); break;
+        case LDB_ABS: lanes_load<int8_t>(rd, [imm](size_t) { return imm; }); break;
+        case LDH_ABS: lanes_load<int16_t>(rd, [imm](size_t) { return imm; }); break;
+        case LDW_ABS: lanes_load<uint32_t>(rd, [imm](size_t) { return imm; }); break;
+        case STB_ABS: lanes_store<uint8_t>(rd, [imm](size_t) { return imm; }); break;
+        case STH_ABS: lanes_store<uint16_t>(rd, [imm](size_t) { return imm; }); break;
+        case STW_ABS: lanes_store<uint32_t>(rd, [imm](size_t) { return imm; }); break;
+        case LDB_BASE: lanes_load<int8_t>(rd, [rs1, imm](size_t l) { return rs1[l] + imm; }); break;
+        case LDH_BASE: lanes_load<int16_t>(rd, [rs1, imm](size_t l) { return rs1[l] + imm; }); break;
+        case LDW_BASE: lanes_load<uint32_t>(rd, [rs1, imm](size_t l) { return rs1[l] + imm; }); break;
+        case STB_BASE: lanes_store<uint8_t>(rd, [rs1, imm](size_t l) { return rs1[l] + imm; }); break;
+        case STH_BASE: lanes_store<uint16_t>(rd, [rs1, imm](size_t l) { return rs1[l] + imm; }); break;
+        case STW_BASE: lanes_store<uint32_t>(rd, [rs1, imm](size_t l) { return rs1[l] + imm; }); break;
+
+        case PUSH:
+            {
+                uint32_t* sp = reg(15);
+                lanes_ri(sp, sp, 4, [](uint32_t a, uint32_t b, uint32_t) { return a - b; });
+                lanes_store<uint32_t>(rs1, [sp](size_t l) { return sp[l]; });
+                break;
+            }
+        case POP:
+            {
+                uint32_t* sp = reg(15);
+                lanes_load<uint32_t>(rd, [sp](size_t l) { return sp[l]; });
+                lanes_ri(sp, sp, 4, [](uint32_t a, uint32_t b, uint32_t) { return a + b; });
+                break;
+            }
+        case LEA: lanes_ri(rd, rs1, imm, [](uint32_t a, uint32_t b, uint32_t) { return a + b; }); break;
+        case SWAP:
+            for (size_t l = lo; l < hi; l++)
+                if (mask[l]) std::swap(rd[l], reg(I.rs1)[l]);
+            break;
+        case CLR: lanes_ri(rd, rd, 0, [](uint32_t, uint32_t, uint32_t) { return 0u; }); break;
+
+        case JMP: branch(at, imm, [](uint32_t) { return true; }); return;
+        case JZ: branch(at, imm, [](uint32_t c) { return c == 0; }); return;
+        case JNZ: branch(at, imm, [](uint32_t c) { return c != 0; }); return;
+        case JG: branch(at, imm, [](uint32_t c) { return (int32_t)c > 0; }); return;
+        case JL: branch(at, imm, [](uint32_t c) { return (int32_t)c < 0; }); return;
+        case CALL:
+            {
+                uint32_t* sp = reg(15);
+                lanes_ri(sp, sp, 4, [](uint32_t a, uint32_t b, uint32_t) { return a - b; });
+                for (size_t l = lo; l < hi; l++)
+                    if (mask[l]) store<uint32_t>(l, sp[l], at + 1);
+                branch(at, imm, [](uint32_t) { return true; });
+                return;
+            }
+        case RET:
+            {
+                uint32_t* sp = reg(15);
+                const auto prog_size = static_cast<uint32_t>(code.size() - 1);
+                next_at = UINT32_MAX;
+                for (size_t l = lo; l < hi; l++)
+                    if (mask[l]) {
+                        uint32_t target = load<uint32_t>(l, sp[l]);
+                        sp[l] += 4;
+                        pc[l] = target < prog_size ? target : prog_size;
+                        if (next_at == UINT32_MAX) next_at = pc[l];
+                        else if (next_at != pc[l]) uniform = false;
+                    }
+                return;
+            }
+
+        case HALT: // also the end-of-ROM sentinel
+            for (size_t l = lo; l < hi; l++)
+                if (mask[l]) {
+                    stop(l, LaneStatus::HALTED);
+                    pc[l] = at;
+                }
+            uniform = false;
+            return;
+
+        default: // MEMCPY, multi-core and atomic instructions: every lane here goes on alone
+            for (size_t l = lo; l < hi; l++)
+                if (mask[l]) {
+                    pc[l] = at;
+                    finish_scalar(l);
+                }
+            uniform = false;
+            return;
+        }
+        next_pc(at);
+    }
+};
+
+
+#endif
@@ -0,0 +1,428 @@
+#ifndef ERGON_JIT_HANDLER_H
+#define ERGON_JIT_HANDLER_H
+
+#include "computer/core.h"
+#include "step_handler.h"
+#include "trace_handler.h" // TALOS_JIT_AVAILABLE
+
+#include <climits>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+/*
+Baseline template JIT (x86-64, System V):
+ - the whole ROM is translated once, every guest instruction gets a fixed machine code template
+ - rbx is pinned to the SimpleCore, guest registers are read and written in place ([rbx + offset])
+ - JMP/Jcc/CALL become direct native jumps, RET goes through a PC -> native address table
+ - loads and stores call the SimpleCore helpers so the RAM checks stay the same as run(), stores set PC first
+ - anything without a template exits with PC set on it, step_instr() runs it and we re-enter
+ - taken backward branches count down a counter of their target, hot loops go to the tracing tier (see trace_handler.h)
+*/
+
+enum class JitExit : uint32_t {
+    HALT, // HALT reached
+    FALLBACK, // PC is on an instruction the JIT does not translate
+    END, // PC left the ROM
+    HOT // PC is on the head of a loop that just got hot
+};
+
+// called from the generated code (pointer to SimpleCore in rdi)
+inline uint32_t jit_load8(SimpleCore* c, uint32_t addr) { return static_cast<uint32_t>(static_cast<int8_t>(c->load8(addr))); }
+inline uint32_t jit_load16(SimpleCore* c, uint32_t addr) { return static_cast<uint32_t>(static_cast<int16_t>(c->load16(addr))); }
+inline uint32_t jit_load32(SimpleCore* c, uint32_t addr) { return c->load32(addr); }
+inline void jit_store8(SimpleCore* c, uint32_t addr, uint32_t value) { c->store8(addr, value & 0xFF); }
+inline void jit_store16(SimpleCore* c, uint32_t addr, uint32_t value) { c->store16(addr, value & 0xFFFF); }
+inline void jit_store32(SimpleCore* c, uint32_t addr, uint32_t value) { c->store32(addr, value); }
+
+
+struct JitEmitter {
+    std::vector<uint8_t> code;
+    int32_t regs_off = 0; // offset of SimpleCore::regs from the pinned pointer
+    int32_t pc_off = 0; // offset of SimpleCore::PC
+
+    void u8(uint8_t v) { code.push_back(v); }
+    void u32(uint32_t v) { for (int i = 0; i < 4; i++) u8((v >> (i * 8)) & 0xFF); }
+    void u64(uint64_t v) { for (int i = 0; i < 8; i++) u8((v >> (i * 8)) & 0xFF); }
+    void bytes(std::initializer_list<uint8_t> b) { code.insert(code.end(), b); }
+
+    int32_t reg(uint8_t r) const { return regs_off + 4 * (r & 15); }
+
+    // op r32, [rbx + disp32]   host: 0 = eax, 1 = ecx, 2 = edx, 6 = esi
+    void modrm_rbx(uint8_t op, uint8_t host, int32_t disp) {
+        u8(op);
+        u8(0x80 | (host << 3) | 0x03);
+        u32(disp);
+    }
+    void load(uint8_t host, uint8_t guest) { modrm_rbx(0x8B, host, reg(guest)); }
+    void store(uint8_t guest, uint8_t host) { modrm_rbx(0x89, host, reg(guest)); }
+    void store_imm(uint8_t guest, uint32_t value) { modrm_rbx(0xC7, 0, reg(guest)); u32(value); }
+    void store_pc(uint32_t pc) { modrm_rbx(0xC7, 0, pc_off); u32(pc); }
+
+    // call fn(core, esi, edx), result in eax
+    void call(const void* fn) {
+        bytes({ 0x48, 0x89, 0xDF }); // mov rdi, rbx
+        bytes({ 0x48, 0xB8 }); u64(reinterpret_cast<uint64_t>(fn)); // mov rax, fn
+        bytes({ 0xFF, 0xD0 }); // call rax
+    }
+
+    // jump with a rel32 to patch, returns the position of the rel32
+    size_t jmp32() { u8(0xE9); u32(0); return code.size() - 4; }
+    size_t jcc32(uint8_t cc) { u8(0x0F); u8(0x80 | cc); u32(0); return code.size() - 4; }
+    void patch(size_t at, size_t target) {
+        auto rel = static_cast<int32_t>(static_cast<int64_t>(target) - static_cast<int64_t>(at + 4));
+        std::memcpy(&code[at], &rel, 4);
+    }
+};
+
+struct JitProgram {
+    static constexpr int32_t HOT_LOOP = 64; // taken back edges before a loop head is traced
+    static constexpr int32_t COLD = INT32_MAX; // loops that cannot be traced
+
+    uint8_t* mem = nullptr;
+    size_t mem_size = 0;
+    std::vector<const uint8_t*> native_pc; // native address of every guest PC
+    bool tracing = true; // set before compile(): false leaves the baseline alone
+    std::unique_ptr<int32_t[]> hot; // back edge counters by loop head, decremented by the generated code
+    TraceCache traces;
+
+    JitProgram() = default;
+    JitProgram(const JitProgram&) = delete;
+    JitProgram& operator=(const JitProgram&) = delete;
+    ~JitProgram() { clear(); }
+
+    bool empty() const { return mem == nullptr; }
+
+    void clear() {
+    #if TALOS_JIT_AVAILABLE
+        if (mem) munmap(mem, mem_size);
+    #endif
+        mem = nullptr;
+        mem_size = 0;
+        native_pc.clear();
+        hot.reset();
+        traces.reset(0);
+    }
+
+    // false if the host cannot run generated code, the caller then keeps using run()
+    bool compile(SimpleCore& c, const std::vector<DecodedInstr>& prog);
+
+    JitExit enter(SimpleCore& c) const {
+        using Entry = uint32_t (*)(SimpleCore*, const uint8_t*);
+        return static_cast<JitExit>(reinterpret_cast<Entry>(mem)(&c, native_pc[c.PC]));
+    }
+};
+
+inline bool JitProgram::compile(SimpleCore& c, const std::vector<DecodedInstr>& prog) {
+    clear();
+#if !TALOS_JIT_AVAILABLE
+    (void)c; (void)prog;
+    return false;
+#else
+    JitEmitter e;
+    e.regs_off = static_cast<int32_t>(reinterpret_cast<uint8_t*>(c.regs.data()) - reinterpret_cast<uint8_t*>(&c));
+    e.pc_off = static_cast<int32_t>(reinterpret_cast<uint8_t*>(&c.PC) - reinterpret_cast<uint8_t*>(&c));
+    const uint8_t SP = 15; // SimpleCore::SP aliases regs[15]
+    const uint8_t CMP_REG = 13;
+    if (tracing) {
+        hot = std::make_unique<int32_t[]>(prog.size());
+        std::fill_n(hot.get(), prog.size(), HOT_LOOP);
+        traces.reset(prog.size());
+    }
+
+    // entry(core, target): push rbx; mov rbx, rdi; jmp rsi
+    e.bytes({ 0x53, 0x48, 0x89, 0xFB, 0xFF, 0xE6 });
+    // epilogue, status already in eax
+    const size_t epilogue = e.code.size();
+    e.bytes({ 0x5B, 0xC3 });
+
+    std::vector<size_t> offsets(prog.size() + 1);
+    std::vector<std::pair<size_t, int64_t>> branches; // rel32 position, guest target
+    std::vector<size_t> ret_patches; // mov rcx, imm64 of the native_pc table
+
+    auto exit_with = [&](uint32_t pc, JitExit status) {
+        e.store_pc(pc);
+        e.u8(0xB8); e.u32(static_cast<uint32_t>(status)); // mov eax, status
+        e.patch(e.jmp32(), epilogue);
+    };
+    // rd = rs1 op rs2 with op being "op r/m32, r32" (eax, ecx)
+    auto alu_rr = [&](const DecodedInstr& I, uint8_t op) {
+        e.load(0, I.rs1); e.load(1, I.rs2);
+        e.bytes({ op, 0xC8 });
+        e.store(I.rd, 0);
+    };
+    // rd = rs1 op imm with op being the "op eax, imm32" short form
+    auto alu_ri = [&](const DecodedInstr& I, uint8_t op, uint32_t imm) {
+        e.load(0, I.rs1);
+        e.u8(op); e.u32(imm);
+        e.store(I.rd, 0);
+    };
+    // rd = rs1 shift (ecx & 31), ext is the /digit of D3
+    auto shift_r = [&](const DecodedInstr& I, uint8_t ext) {
+        e.load(0, I.rs1); e.load(1, I.rs2);
+        e.bytes({ 0xD3, static_cast<uint8_t>(0xC0 | (ext << 3)) });
+        e.store(I.rd, 0);
+    };
+    auto shift_i = [&](const DecodedInstr& I, uint8_t ext) {
+        e.load(0, I.rs1);
+        e.bytes({ 0xC1, static_cast<uint8_t>(0xC0 | (ext << 3)), static_cast<uint8_t>(I.rs2 & 31) });
+        e.store(I.rd, 0);
+    };
+    // cmp = eax < ecx ? -1 : eax > ecx ? 1 : 0 (lt/gt are setcc opcodes)
+    auto compare = [&](uint8_t lt, uint8_t gt) {
+        e.bytes({ 0x39, 0xC8 }); // cmp eax, ecx
+        e.bytes({ 0x0F, gt, 0xC2 }); // setgt dl
+        e.bytes({ 0x0F, lt, 0xC0 }); // setlt al
+        e.bytes({ 0x0F, 0xB6, 0xD2 }); // movzx edx, dl
+        e.bytes({ 0x0F, 0xB6, 0xC0 }); // movzx eax, al
+        e.bytes({ 0x29, 0xC2 }); // sub edx, eax
+        e.store(CMP_REG, 2);
+    };
+    auto test = [&]() {
+        e.bytes({ 0x85, 0xC8 }); // test eax, ecx
+        e.bytes({ 0x0F, 0x95, 0xC0 }); // setne al
+        e.bytes({ 0x0F, 0xB6, 0xC0 }); // movzx eax, al
+        e.store(CMP_REG, 0);
+    };
+    // taken back edge: dec dword [hot + target], still running while it is not 0
+    auto count_back_edge = [&](int64_t target) {
+        e.bytes({ 0x48, 0xB8 }); e.u64(reinterpret_cast<uint64_t>(hot.get() + target)); // mov rax, counter
+        e.bytes({ 0xFF, 0x08 }); // dec dword [rax]
+        branches.emplace_back(e.jcc32(0x85), target); // jne
+        exit_with(static_cast<uint32_t>(target), JitExit::HOT);
+    };
+    auto branch = [&](size_t pc, const DecodedInstr& I, int cc, bool call = false) {
+        int64_t target = static_cast<int64_t>(pc) + 1 + I.imm;
+        const bool back = tracing && !call && target >= 0 && target <= static_cast<int64_t>(pc);
+        if (cc >= 0) {
+            e.bytes({ 0x83, 0xBB }); e.u32(e.reg(CMP_REG)); e.u8(0); // cmp dword [cmp], 0
+            if (!back) {
+                branches.emplace_back(e.jcc32(static_cast<uint8_t>(cc)), target);
+                return;
+            }
+            const size_t not_taken = e.jcc32(static_cast<uint8_t>(cc ^ 1));
+            count_back_edge(target);
+            e.patch(not_taken, e.code.size());
+        } else if (back)
+            count_back_edge(target);
+        else
+            branches.emplace_back(e.jmp32(), target);
+    };
+    auto base_addr = [&](const DecodedInstr& I) {
+        e.load(6, I.rs1);
+        e.bytes({ 0x81, 0xC6 }); e.u32(static_cast<uint32_t>(static_cast<int32_t>(static_cast<int8_t>(I.imm)))); // add esi, imm
+    };
+
+    for (size_t pc = 0; pc < prog.size(); pc++) {
+        offsets[pc] = e.code.size();
+        const DecodedInstr& I = prog[pc];
+
+        // PC on the store before it runs, a fault stops the core there
+        if (stores_to_ram(I.opcode)) e.store_pc(static_cast<uint32_t>(pc));
+
+        // super-instructions are translated as their head, the tail slots follow anyway
+        switch (fused_head(I.opcode)) {
+        case ADD: alu_rr(I, 0x01); break;
+        case SUB: alu_rr(I, 0x29); break;
+        case AND: alu_rr(I, 0x21); break;
+        case OR: alu_rr(I, 0x09); break;
+        case XOR: alu_rr(I, 0x31); break;
+        case MUL:
+            e.load(0, I.rs1); e.load(1, I.rs2);
+            e.bytes({ 0x0F, 0xAF, 0xC1 }); // imul eax, ecx
+            e.store(I.rd, 0);
+            break;
+        case ADDI: alu_ri(I, 0x05, I.rs2); break;
+        case SUBI: alu_ri(I, 0x2D, I.rs2); break;
+        case ANDI: alu_ri(I, 0x25, I.rs2); break;
+        case ORI: alu_ri(I, 0x0D, I.rs2); break;
+        case XORI: alu_ri(I, 0x35, I.rs2); break;
+        case MULI:
+            e.load(0, I.rs1);
+            e.bytes({ 0x69, 0xC0 }); e.u32(I.rs2); // imul eax, eax, imm
+            e.store(I.rd, 0);
+            break;
+
+        case SHL: shift_r(I, 4); break;
+        case SHR: shift_r(I, 5); break;
+        case SAR: shift_r(I, 7); break;
+        case ROL: shift_r(I, 0); break;
+        case ROR: shift_r(I, 1); break;
+        case SHLI: shift_i(I, 4); break;
+        case SHRI: shift_i(I, 5); break;
+        case SARI: shift_i(I, 7); break;
+        case ROLI: shift_i(I, 0); break;
+        case RORI: shift_i(I, 1); break;
+
+        case CMP: e.load(0, I.rs1); e.load(1, I.rs2); compare(0x9C, 0x9F); break;
+        case CMPU: e.load(0, I.rs1); e.load(1, I.rs2); compare(0x92, 0x97); break;
+        case CMPI: e.load(0, I.rs1); e.u8(0xB9); e.u32(I.rs2); compare(0x9C, 0x9F); break;
+        case TEST: e.load(0, I.rs1); e.load(1, I.rs2); test(); break;
+        case TESTI: e.load(0, I.rs1); e.u8(0xB9); e.u32(I.rs2); test(); break;
+
+        case INC: e.modrm_rbx(0xFF, 0, e.reg(I.rd)); break;
+        case DEC: e.modrm_rbx(0xFF, 1, e.reg(I.rd)); break;
+        case NOT:
+            e.load(0, I.rs1);
+            e.bytes({ 0xF7, 0xD0 }); // not eax
+            e.store(I.rd, 0);
+            break;
+        case ABS:
+            e.load(0, I.rs1);
+            e.bytes({ 0x85, 0xC0, 0x79, 0x02, 0xF7, 0xD8 }); // test eax, eax; jns +2; neg eax
+            e.store(I.rd, 0);
+            break;
+        case NEG:
+            e.load(0, I.rs1);
+            e.u8(0x3D); e.u32(0x80000000); // cmp eax, INT32_MIN
+            e.bytes({ 0x74, 0x08, 0xF7, 0xD8 }); // je over the store; neg eax
+            e.store(I.rd, 0); // 6 bytes
+            break;
+        case MIN:
+            e.load(0, I.rs1); e.load(1, I.rs2);
+            e.bytes({ 0x39, 0xC8, 0x0F, 0x43, 0xC1 }); // cmp eax, ecx; cmovae eax, ecx
+            e.store(I.rd, 0);
+            break;
+        case MAX:
+            e.load(0, I.rs1); e.load(1, I.rs2);
+            e.bytes({ 0x39, 0xC8, 0x0F, 0x46, 0xC1 }); // cmp eax, ecx; cmovbe eax, ecx
+            e.store(I.rd, 0);
+            break;
+
+        case MOV_IMM: e.store_imm(I.rd, static_cast<uint32_t>(I.imm)); break;
+        case MOV_REG: e.load(0, I.rs1); e.store(I.rd, 0); break;
+        case CLR: e.store_imm(I.rd, 0); break;
+        case SWAP:
+            e.load(0, I.rd); e.load(1, I.rs1);
+            e.store(I.rd, 1); e.store(I.rs1, 0);
+            break;
+        case LEA:
+            e.load(0, I.rs1);
+            e.u8(0x05); e.u32(static_cast<uint32_t>(static_cast<int32_t>(static_cast<int8_t>(I.imm))));
+            e.store(I.rd, 0);
+            break;
+
+        case LDB_ABS: e.u8(0xBE); e.u32(I.imm); e.call(reinterpret_cast<const void*>(&jit_load8)); e.store(I.rd, 0); break;
+        case LDH_ABS: e.u8(0xBE); e.u32(I.imm); e.call(reinterpret_cast<const void*>(&jit_load16)); e.store(I.rd, 0); break;
+        case LDW_ABS: e.u8(0xBE); e.u32(I.imm); e.call(reinterpret_cast<const void*>(&jit_load32)); e.store(I.rd, 0); break;
+        case STB_ABS: e.u8(0xBE); e.u32(I.imm); e.load(2, I.rd); e.call(reinterpret_cast<const void*>(&jit_store8)); break;
+        case STH_ABS: e.u8(0xBE); e.u32(I.imm); e.load(2, I.rd); e.call(reinterpret_cast<const void*>(&jit_store16)); break;
+        case STW_ABS: e.u8(0xBE); e.u32(I.imm); e.load(2, I.rd); e.call(reinterpret_cast<const void*>(&jit_store32)); break;
+        case LDB_BASE: base_addr(I); e.call(reinterpret_cast<const void*>(&jit_load8)); e.store(I.rd, 0); break;
+        case LDH_BASE: base_addr(I); e.call(reinterpret_cast<const void*>(&jit_load16)); e.store(I.rd, 0); break;
+        case LDW_BASE: base_addr(I); e.call(reinterpret_cast<const void*>(&jit_load32)); e.store(I.rd, 0); break;
+        case STB_BASE: base_addr(I); e.load(2, I.rd); e.call(reinterpret_cast<const void*>(&jit_store8)); break;
+        case STH_BASE: base_addr(I); e.load(2, I.rd); e.call(reinterpret_cast<const void*>(&jit_store16)); break;
+        case STW_BASE: base_addr(I); e.load(2, I.rd); e.call(reinterpret_cast<const void*>(&jit_store32)); break;
+
+        case PUSH:
+            e.bytes({ 0x83, 0xAB }); e.u32(e.reg(SP)); e.u8(4); // sub dword [SP], 4
+            e.load(6, SP); e.load(2, I.rs1);
+            e.call(reinterpret_cast<const void*>(&jit_store32));
+            break;
+        case POP:
+            e.load(6, SP);
+            e.call(reinterpret_cast<const void*>(&jit_load32));
+            e.store(I.rd, 0);
+            e.bytes({ 0x83, 0x83 }); e.u32(e.reg(SP)); e.u8(4); // add dword [SP], 4
+            break;
+
+        case JMP: branch(pc, I, -1); break;
+        case JZ: branch(pc, I, 0x84); break; // je
+        case JNZ: branch(pc, I, 0x85); break; // jne
+        case JG: branch(pc, I, 0x8F); break; // jg
+        case JL: branch(pc, I, 0x8C); break; // jl
+        case CALL:
+            e.bytes({ 0x83, 0xAB }); e.u32(e.reg(SP)); e.u8(4);
+            e.load(6, SP);
+            e.u8(0xBA); e.u32(static_cast<uint32_t>(pc + 1)); // mov edx, return PC
+            e.call(reinterpret_cast<const void*>(&jit_store32));
+            branch(pc, I, -1, true);
+            break;
+        case RET:
+            e.load(6, SP);
+            e.call(reinterpret_cast<const void*>(&jit_load32));
+            e.bytes({ 0x89, 0xC0 }); // mov eax, eax (clears the upper half of rax)
+            e.bytes({ 0x83, 0x83 }); e.u32(e.reg(SP)); e.u8(4);
+            e.u8(0x3D); e.u32(static_cast<uint32_t>(prog.size())); // cmp eax, size
+            e.bytes({ 0x73, 0x0D }); // jae out of the ROM
+            e.bytes({ 0x48, 0xB9 }); ret_patches.push_back(e.code.size()); e.u64(0); // mov rcx, native_pc
+            e.bytes({ 0xFF, 0x24, 0xC1 }); // jmp [rcx + rax * 8]
+            exit_with(static_cast<uint32_t>(prog.size()), JitExit::END); // PC clamped to the end, as run() does
+            break;
+
+        case HALT: exit_with(pc, JitExit::HALT); break;
+
+        default: // FPU, DIV/MOD, MINI/MAXI, MEMCPY: left to the interpreter
+            exit_with(pc, JitExit::FALLBACK);
+            break;
+        }
+    }
+    // falling off the ROM
+    offsets[prog.size()] = e.code.size();
+    exit_with(prog.size(), JitExit::END);
+
+    for (auto [at, target] : branches) {
+        if (target >= 0 && target < static_cast<int64_t>(prog.size())) {
+            e.patch(at, offsets[target]);
+            continue;
+        }
+        // taken branch out of the ROM, lands on the end like in run()
+        e.patch(at, e.code.size());
+        exit_with(static_cast<uint32_t>(prog.size()), JitExit::END);
+    }
+
+    mem_size = (e.code.size() + 4095) & ~size_t(4095);
+    void* p = mmap(nullptr, mem_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        mem = nullptr;
+        mem_size = 0;
+        return false;
+    }
+    mem = static_cast<uint8_t*>(p);
+
+    native_pc.resize(prog.size());
+    for (size_t pc = 0; pc < prog.size(); pc++)
+        native_pc[pc] = mem + offsets[pc];
+    for (size_t at : ret_patches) {
+        auto table = reinterpret_cast<uint64_t>(native_pc.data());
+        std::memcpy(&e.code[at], &table, 8);
+    }
+
+    std::memcpy(mem, e.code.data(), e.code.size());
+    if (mprotect(mem, mem_size, PROT_READ | PROT_EXEC) != 0) {
+        clear();
+        return false;
+    }
+    return true;
+#endif
+}
+
+// AUTO mode through the JIT, single instructions it cannot translate go through step_instr()
+inline void run_jit(SimpleCore& c, const std::vector<DecodedInstr>& prog, JitProgram& jit) {
+    while (c.PC < prog.size()) {
+        JitExit status = jit.enter(c);
+        if (status == JitExit::HALT || status == JitExit::END) break;
+        if (status != JitExit::HOT) {
+            step_instr(c, prog[c.PC]);
+            continue;
+        }
+
+        // hot loop head: its trace, recorded now if it has none yet
+        const uint32_t head = c.PC;
+        const Trace* t = jit.traces.find(head);
+        if (t == nullptr) t = jit.traces.record(c, prog);
+        std::atomic_ref<int32_t> counter(jit.hot[head]);
+        if (t == nullptr) {
+            counter.store(JitProgram::COLD, std::memory_order_relaxed);
+            continue;
+        }
+        counter.store(1, std::memory_order_relaxed); // the next back edge comes straight back here
+        if (c.PC == head) t->enter(c);
+    }
+    // a trace side exit or a fallback can still leave PC past the ROM
+    if (c.PC > prog.size()) c.PC = static_cast<uint32_t>(prog.size());
+}
+
+
+#endif
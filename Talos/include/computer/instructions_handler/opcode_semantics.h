@@ -0,0 +1,252 @@
+#ifndef ERGON_OPCODE_SEMANTICS_H
+#define ERGON_OPCODE_SEMANTICS_H
+
+#include "computer/core.h"
+
+#include <cstddef>
+
+/*
+What every opcode does, written once for all the interpreters (step_instr, run_threaded and
+their instrumented variants). An engine defines the operand macros, then expands the lists
+into its own handlers, the only thing it writes itself is how to go on (next, jump, return).
+ - c is the SimpleCore, instr the slot being run (rd, rs1, rs2 are register indices)
+ - I_IMM: I-type immediate (int32_t), I_SHAMT: shift amount of shli..rori,
+   I_OFF: signed 8 bit offset of the base accesses, I_TARGET: absolute PC of a branch or spawn
+step_instr reads them from the assembler form, run() from the slots decoded by thread_prog().
+*/
+
+// every opcode in enum order, dispatch tables are generated from it
+#define ERGON_OPCODES(X) \
+    X(ADD) X(SUB) X(MUL) X(DIV) X(MOD) \
+    X(ADDI) X(SUBI) X(MULI) X(DIVI) X(MODI) \
+    X(AND) X(OR) X(XOR) X(ANDI) X(ORI) X(XORI) \
+    X(SHL) X(SHR) X(SAR) X(ROL) X(ROR) \
+    X(SHLI) X(SHRI) X(SARI) X(ROLI) X(RORI) \
+    X(CMP) X(CMPU) X(TEST) X(CMPI) X(CMPUI) X(TESTI) \
+    X(INC) X(DEC) X(NOT) X(ABS) X(NEG) X(MIN) X(MAX) X(MINI) X(MAXI) \
+    X(FADD) X(FSUB) X(FMUL) X(FDIV) X(FMA) X(FSQRT) X(FABS) X(FNEG) \
+    X(FCMP) X(ITOF) X(FTOI) X(FMOV) X(MOVF) \
+    X(FLDW_ABS) X(FSTW_ABS) X(FLDW_BASE) X(FSTW_BASE) \
+    X(MOV_IMM) X(MOV_REG) \
+    X(LDB_ABS) X(LDH_ABS) X(LDW_ABS) X(STB_ABS) X(STH_ABS) X(STW_ABS) \
+    X(LDB_BASE) X(LDH_BASE) X(LDW_BASE) X(STB_BASE) X(STH_BASE) X(STW_BASE) \
+    X(PUSH) X(POP) X(LEA) X(SWAP) X(CLR) X(MEMCPY) \
+    X(JMP) X(JZ) X(JNZ) X(JG) X(JL) X(CALL) X(RET) \
+    X(HALT) \
+    X(CORE_ID) X(NCORES) X(SPAWN) X(JOIN) \
+    X(CAS) X(XADD) X(XCHG) X(LDAR) X(STLR) X(FENCE) X(WAIT) X(WAKE) \
+    X(INC_CMP_JL) X(INC_CMP_JNZ) X(INC_CMPI_JL) X(INC_CMPI_JNZ) \
+    X(ADDI_CMP_JL) X(ADDI_CMP_JNZ) X(ADDI_CMPI_JL) X(ADDI_CMPI_JNZ) \
+    X(CMP_JZ) X(CMP_JNZ) X(CMP_JG) X(CMP_JL) \
+    X(CMPI_JZ) X(CMPI_JNZ) X(CMPI_JG) X(CMPI_JL)
+
+// the list above has to follow the enum, a missing or moved opcode stops the build here
+namespace opcode_semantics {
+    #define ERGON_OPCODE_ENTRY(name) name,
+    inline constexpr uint8_t order[] = { ERGON_OPCODES(ERGON_OPCODE_ENTRY) };
+    #undef ERGON_OPCODE_ENTRY
+
+    constexpr bool in_enum_order() {
+        for (size_t i = 0; i < std::size(order); i++)
+            if (order[i] != i) return false;
+        return order[std::size(order) - 1] == CMPI_JL;
+    }
+    static_assert(in_enum_order(), "ERGON_OPCODES is out of sync with OPCODE");
+
+    #define ERGON_OPCODE_NAME(name) #name,
+    inline constexpr const char* names[] = { ERGON_OPCODES(ERGON_OPCODE_NAME) };
+    #undef ERGON_OPCODE_NAME
+}
+
+// enum name of an opcode ("MOV_IMM", "CMPI_JL"...), for reports
+inline const char* opcode_name(uint8_t opcode) {
+    return opcode < std::size(opcode_semantics::names) ? opcode_semantics::names[opcode] : "?";
+}
+
+// X(NAME): opcodes without control flow, their body is ERGON_SEM_NAME and the engine goes on with the next slot
+#define ERGON_LINEAR_OPS(X) \
+    X(ADD) X(SUB) X(MUL) X(DIV) X(MOD) \
+    X(ADDI) X(SUBI) X(MULI) X(DIVI) X(MODI) \
+    X(AND) X(OR) X(XOR) X(ANDI) X(ORI) X(XORI) \
+    X(SHL) X(SHR) X(SAR) X(ROL) X(ROR) \
+    X(SHLI) X(SHRI) X(SARI) X(ROLI) X(RORI) \
+    X(CMP) X(CMPU) X(TEST) X(CMPI) X(CMPUI) X(TESTI) \
+    X(INC) X(DEC) X(NOT) X(ABS) X(NEG) X(MIN) X(MAX) X(MINI) X(MAXI) \
+    X(FADD) X(FSUB) X(FMUL) X(FDIV) X(FMA) X(FSQRT) X(FABS) X(FNEG) \
+    X(FCMP) X(ITOF) X(FTOI) X(FMOV) X(MOVF) \
+    X(FLDW_ABS) X(FSTW_ABS) X(FLDW_BASE) X(FSTW_BASE) \
+    X(MOV_IMM) X(MOV_REG) \
+    X(LDB_ABS) X(LDH_ABS) X(LDW_ABS) X(STB_ABS) X(STH_ABS) X(STW_ABS) \
+    X(LDB_BASE) X(LDH_BASE) X(LDW_BASE) X(STB_BASE) X(STH_BASE) X(STW_BASE) \
+    X(PUSH) X(POP) X(LEA) X(SWAP) X(CLR) X(MEMCPY) \
+    X(CORE_ID) X(NCORES) X(SPAWN) X(JOIN) \
+    X(CAS) X(XADD) X(XCHG) X(LDAR) X(STLR) X(FENCE) X(WAIT) X(WAKE)
+
+// what writes the guest RAM, call included: the only opcodes that can fault (memcpy checks its bounds).
+// An engine that keeps the PC or the registers to itself publishes them before these
+constexpr bool stores_to_ram(uint8_t opcode) {
+    switch (opcode) {
+    case FSTW_ABS: case FSTW_BASE:
+    case STB_ABS: case STH_ABS: case STW_ABS: case STB_BASE: case STH_BASE: case STW_BASE:
+    case PUSH: case CALL:
+    case CAS: case XADD: case XCHG: case STLR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// X(NAME, taken): conditional branches to I_TARGET, jmp/call/ret/halt are up to the engine
+#define ERGON_BRANCH_OPS(X) \
+    X(JZ, c.regs[13] == 0) \
+    X(JNZ, c.regs[13] != 0) \
+    X(JG, (int32_t)c.regs[13] > 0) \
+    X(JL, (int32_t)c.regs[13] < 0)
+
+// X(NAME, HEAD, COMPARE, BRANCH) / X(NAME, COMPARE, BRANCH): super-instructions and what they are made of
+#define ERGON_FUSED_TRIPLES(X) \
+    X(INC_CMP_JL, INC, CMP, JL) X(INC_CMP_JNZ, INC, CMP, JNZ) \
+    X(INC_CMPI_JL, INC, CMPI, JL) X(INC_CMPI_JNZ, INC, CMPI, JNZ) \
+    X(ADDI_CMP_JL, ADDI, CMP, JL) X(ADDI_CMP_JNZ, ADDI, CMP, JNZ) \
+    X(ADDI_CMPI_JL, ADDI, CMPI, JL) X(ADDI_CMPI_JNZ, ADDI, CMPI, JNZ)
+#define ERGON_FUSED_PAIRS(X) \
+    X(CMP_JZ, CMP, JZ) X(CMP_JNZ, CMP, JNZ) X(CMP_JG, CMP, JG) X(CMP_JL, CMP, JL) \
+    X(CMPI_JZ, CMPI, JZ) X(CMPI_JNZ, CMPI, JNZ) X(CMPI_JG, CMPI, JG) X(CMPI_JL, CMPI, JL)
+
+
+//----------------- ALU OPERATIONS -----------------
+#define ERGON_SEM_ADD c.regs[instr->rd] = (uint32_t)((uint64_t)c.regs[instr->rs1] + (uint64_t)c.regs[instr->rs2])
+#define ERGON_SEM_SUB c.regs[instr->rd] = (uint32_t)((uint64_t)c.regs[instr->rs1] - (uint64_t)c.regs[instr->rs2])
+#define ERGON_SEM_MUL c.regs[instr->rd] = (uint32_t)((int64_t)(int32_t)c.regs[instr->rs1] * (int64_t)(int32_t)c.regs[instr->rs2])
+#define ERGON_SEM_DIV \
+    if ((int32_t)c.regs[instr->rs2] != 0 && !((int32_t)c.regs[instr->rs1] == INT32_MIN && (int32_t)c.regs[instr->rs2] == -1)) \
+        c.regs[instr->rd] = (uint32_t)((int32_t)c.regs[instr->rs1] / (int32_t)c.regs[instr->rs2])
+// x % -1 is 0: INT32_MIN % -1 would trap on the host (same result as the batch engine)
+#define ERGON_SEM_MOD \
+    if ((int32_t)c.regs[instr->rs2] != 0) \
+        c.regs[instr->rd] = (int32_t)c.regs[instr->rs2] == -1 ? 0u : (uint32_t)((int32_t)c.regs[instr->rs1] % (int32_t)c.regs[instr->rs2])
+#define ERGON_SEM_ADDI c.regs[instr->rd] = (uint32_t)((uint64_t)c.regs[instr->rs1] + (uint64_t)(uint32_t)I_IMM)
+#define ERGON_SEM_SUBI c.regs[instr->rd] = (uint32_t)((uint64_t)c.regs[instr->rs1] - (uint64_t)(uint32_t)I_IMM)
+#define ERGON_SEM_MULI c.regs[instr->rd] = (uint32_t)((int64_t)(int32_t)c.regs[instr->rs1] * (int64_t)I_IMM)
+#define ERGON_SEM_DIVI \
+    if (I_IMM != 0 && !((int32_t)c.regs[instr->rs1] == INT32_MIN && I_IMM == -1)) \
+        c.regs[instr->rd] = (uint32_t)((int32_t)c.regs[instr->rs1] / I_IMM)
+#define ERGON_SEM_MODI if (I_IMM != 0) c.regs[instr->rd] = I_IMM == -1 ? 0u : (uint32_t)((int32_t)c.regs[instr->rs1] % I_IMM)
+
+#define ERGON_SEM_AND c.regs[instr->rd] = c.regs[instr->rs1] & c.regs[instr->rs2]
+#define ERGON_SEM_OR c.regs[instr->rd] = c.regs[instr->rs1] | c.regs[instr->rs2]
+#define ERGON_SEM_XOR c.regs[instr->rd] = c.regs[instr->rs1] ^ c.regs[instr->rs2]
+#define ERGON_SEM_ANDI c.regs[instr->rd] = c.regs[instr->rs1] & (uint32_t)I_IMM
+#define ERGON_SEM_ORI c.regs[instr->rd] = c.regs[instr->rs1] | (uint32_t)I_IMM
+#define ERGON_SEM_XORI c.regs[instr->rd] = c.regs[instr->rs1] ^ (uint32_t)I_IMM
+
+#define ERGON_SEM_SHL c.regs[instr->rd] = c.regs[instr->rs1] << (c.regs[instr->rs2] & 31)
+#define ERGON_SEM_SHR c.regs[instr->rd] = c.regs[instr->rs1] >> (c.regs[instr->rs2] & 31)
+#define ERGON_SEM_SAR c.regs[instr->rd] = static_cast<uint32_t>(static_cast<int32_t>(c.regs[instr->rs1]) >> (c.regs[instr->rs2] & 31))
+#define ERGON_SEM_ROL c.regs[instr->rd] = (c.regs[instr->rs1] << (c.regs[instr->rs2] & 31)) | (c.regs[instr->rs1] >> (32 - (c.regs[instr->rs2] & 31)))
+#define ERGON_SEM_ROR c.regs[instr->rd] = (c.regs[instr->rs1] >> (c.regs[instr->rs2] & 31)) | (c.regs[instr->rs1] << (32 - (c.regs[instr->rs2] & 31)))
+#define ERGON_SEM_SHLI c.regs[instr->rd] = c.regs[instr->rs1] << I_SHAMT
+#define ERGON_SEM_SHRI c.regs[instr->rd] = c.regs[instr->rs1] >> I_SHAMT
+#define ERGON_SEM_SARI c.regs[instr->rd] = (uint32_t)((int32_t)c.regs[instr->rs1] >> I_SHAMT)
+#define ERGON_SEM_ROLI c.regs[instr->rd] = (c.regs[instr->rs1] << I_SHAMT) | (c.regs[instr->rs1] >> (32 - I_SHAMT))
+#define ERGON_SEM_RORI c.regs[instr->rd] = (c.regs[instr->rs1] >> I_SHAMT) | (c.regs[instr->rs1] << (32 - I_SHAMT))
+
+#define ERGON_SEM_CMP c.regs[13] = ((int32_t)c.regs[instr->rs1] < (int32_t)c.regs[instr->rs2]) ? -1 : (((int32_t)c.regs[instr->rs1] > (int32_t)c.regs[instr->rs2]) ? 1 : 0)
+#define ERGON_SEM_CMPU c.regs[13] = (c.regs[instr->rs1] < c.regs[instr->rs2]) ? -1 : ((c.regs[instr->rs1] > c.regs[instr->rs2]) ? 1 : 0)
+#define ERGON_SEM_TEST c.regs[13] = ((c.regs[instr->rs1] & c.regs[instr->rs2]) != 0) ? 1 : 0
+#define ERGON_SEM_CMPI c.regs[13] = ((int32_t)c.regs[instr->rs1] < I_IMM) ? -1 : (((int32_t)c.regs[instr->rs1] > I_IMM) ? 1 : 0)
+#define ERGON_SEM_CMPUI c.regs[13] = (c.regs[instr->rs1] < (uint32_t)I_IMM) ? -1 : ((c.regs[instr->rs1] < (uint32_t)I_IMM) ? 1 : 0)
+#define ERGON_SEM_TESTI c.regs[13] = ((c.regs[instr->rs1] & (uint32_t)I_IMM) != 0) ? 1 : 0
+
+#define ERGON_SEM_INC c.regs[instr->rd] = (uint32_t)(int64_t)(int32_t)c.regs[instr->rd] + 1
+#define ERGON_SEM_DEC c.regs[instr->rd] = (uint32_t)(int64_t)(int32_t)c.regs[instr->rd] - 1
+#define ERGON_SEM_NOT c.regs[instr->rd] = ~c.regs[instr->rs1]
+#define ERGON_SEM_ABS \
+    if ((int32_t)c.regs[instr->rs1] < 0) c.regs[instr->rd] = (uint32_t)-(int32_t)c.regs[instr->rs1]; \
+    else c.regs[instr->rd] = c.regs[instr->rs1]
+#define ERGON_SEM_NEG if ((int32_t)c.regs[instr->rs1] != INT32_MIN) c.regs[instr->rd] = (uint32_t)-(int32_t)c.regs[instr->rs1]
+#define ERGON_SEM_MIN \
+    if (c.regs[instr->rs1] < c.regs[instr->rs2]) c.regs[instr->rd] = c.regs[instr->rs1]; \
+    else c.regs[instr->rd] = c.regs[instr->rs2]
+#define ERGON_SEM_MAX \
+    if (c.regs[instr->rs1] > c.regs[instr->rs2]) c.regs[instr->rd] = c.regs[instr->rs1]; \
+    else c.regs[instr->rd] = c.regs[instr->rs2]
+#define ERGON_SEM_MINI \
+    if (c.regs[instr->rs1] < instr->rs2) c.regs[instr->rd] = instr->rs1; \
+    else c.regs[instr->rd] = instr->rs2
+#define ERGON_SEM_MAXI \
+    if (c.regs[instr->rs1] > instr->rs2) c.regs[instr->rd] = instr->rs1; \
+    else c.regs[instr->rd] = instr->rs2
+
+//----------------- FPU OPERATIONS -----------------
+#define ERGON_SEM_FADD c.fregs[instr->rd] = std::bit_cast<uint32_t>(std::bit_cast<float>(c.fregs[instr->rs1]) + std::bit_cast<float>(c.fregs[instr->rs2]))
+#define ERGON_SEM_FSUB c.fregs[instr->rd] = std::bit_cast<uint32_t>(std::bit_cast<float>(c.fregs[instr->rs1]) - std::bit_cast<float>(c.fregs[instr->rs2]))
+#define ERGON_SEM_FMUL c.fregs[instr->rd] = std::bit_cast<uint32_t>(std::bit_cast<float>(c.fregs[instr->rs1]) * std::bit_cast<float>(c.fregs[instr->rs2]))
+#define ERGON_SEM_FDIV c.fregs[instr->rd] = std::bit_cast<uint32_t>(std::bit_cast<float>(c.fregs[instr->rs1]) / std::bit_cast<float>(c.fregs[instr->rs2]))
+#define ERGON_SEM_FMA c.fregs[instr->rd] = std::bit_cast<uint32_t>( std::fma(std::bit_cast<float>(c.fregs[instr->rd]), std::bit_cast<float>(c.fregs[instr->rs1]), std::bit_cast<float>(c.fregs[instr->rs2])))
+#define ERGON_SEM_FSQRT c.fregs[instr->rd] = std::bit_cast<uint32_t>(std::sqrt(std::bit_cast<float>(c.fregs[instr->rs1])))
+#define ERGON_SEM_FABS c.fregs[instr->rd] = std::bit_cast<uint32_t>(std::abs(std::bit_cast<float>(c.fregs[instr->rs1])))
+#define ERGON_SEM_FNEG c.fregs[instr->rd] = std::bit_cast<uint32_t>(-std::bit_cast<float>(c.fregs[instr->rs1]))
+#define ERGON_SEM_FCMP c.regs[13] = std::bit_cast<uint32_t>(std::bit_cast<float>(c.fregs[instr->rs1]) < std::bit_cast<float>(c.fregs[instr->rs2]) ? -1 : std::bit_cast<float>(c.fregs[instr->rs1]) > std::bit_cast<float>(c.fregs[instr->rs2]) ? 1 : 0)
+#define ERGON_SEM_ITOF c.fregs[instr->rd] = std::bit_cast<uint32_t>(std::bit_cast<float>(c.regs[instr->rs1]))
+#define ERGON_SEM_FTOI c.regs[instr->rd] = std::bit_cast<uint32_t>(c.fregs[instr->rs1])
+#define ERGON_SEM_FMOV c.fregs[instr->rd] = c.regs[instr->rs1]
+#define ERGON_SEM_MOVF c.regs[instr->rd] = c.fregs[instr->rs1]
+#define ERGON_SEM_FLDW_ABS c.fregs[instr->rd] = c.load32(instr->imm)
+#define ERGON_SEM_FSTW_ABS c.store32(instr->imm, c.fregs[instr->rd])
+#define ERGON_SEM_FLDW_BASE c.fregs[instr->rd] = c.load32(c.regs[instr->rs1] + I_OFF)
+#define ERGON_SEM_FSTW_BASE c.store32(c.regs[instr->rs1] + I_OFF, c.fregs[instr->rd])
+
+//----------------- MEMORY OPERATIONS -----------------
+#define ERGON_SEM_MOV_IMM c.regs[instr->rd] = instr->imm
+#define ERGON_SEM_MOV_REG c.regs[instr->rd] = c.regs[instr->rs1]
+#define ERGON_SEM_LDB_ABS c.regs[instr->rd] = static_cast<int8_t>(c.load8(instr->imm))
+#define ERGON_SEM_LDH_ABS c.regs[instr->rd] = static_cast<int16_t>(c.load16(instr->imm))
+#define ERGON_SEM_LDW_ABS c.regs[instr->rd] = c.load32(instr->imm)
+#define ERGON_SEM_STB_ABS c.store8(instr->imm, c.regs[instr->rd] & 0xFF)
+#define ERGON_SEM_STH_ABS c.store16(instr->imm, c.regs[instr->rd] & 0xFFFF)
+#define ERGON_SEM_STW_ABS c.store32(instr->imm, c.regs[instr->rd])
+#define ERGON_SEM_LDB_BASE c.regs[instr->rd] = static_cast<int8_t>(c.load8(c.regs[instr->rs1] + I_OFF))
+#define ERGON_SEM_LDH_BASE c.regs[instr->rd] = static_cast<int16_t>(c.load16(c.regs[instr->rs1] + I_OFF))
+#define ERGON_SEM_LDW_BASE c.regs[instr->rd] = c.load32(c.regs[instr->rs1] + I_OFF)
+#define ERGON_SEM_STB_BASE c.store8(c.regs[instr->rs1] + I_OFF, c.regs[instr->rd] & 0xFF)
+#define ERGON_SEM_STH_BASE c.store16(c.regs[instr->rs1] + I_OFF, c.regs[instr->rd] & 0xFFFF)
+#define ERGON_SEM_STW_BASE c.store32(c.regs[instr->rs1] + I_OFF, c.regs[instr->rd])
+
+#define ERGON_SEM_PUSH \
+    c.SP -= 4; \
+    c.store32(c.SP, c.regs[instr->rs1])
+#define ERGON_SEM_POP \
+    c.regs[instr->rd] = c.load32(c.SP); \
+    c.SP += 4
+#define ERGON_SEM_LEA c.regs[instr->rd] = c.regs[instr->rs1] + I_OFF
+#define ERGON_SEM_SWAP std::swap(c.regs[instr->rd], c.regs[instr->rs1])
+#define ERGON_SEM_CLR c.regs[instr->rd] = 0
+#define ERGON_SEM_MEMCPY \
+    { \
+        int32_t len = I_OFF; \
+        if (len >= 0) { \
+            for (uint32_t index = 0; index < instr->rs2; ++index) \
+                if (c.regs[instr->rd] + index < c.ram.size() && c.regs[instr->rs1] + index < c.ram.size()) \
+                    c.store8(c.regs[instr->rd] + index, c.ram[c.regs[instr->rs1] + index]); \
+        } \
+    }
+
+//----------------- MULTI-CORE OPERATIONS -----------------
+#define ERGON_SEM_CORE_ID c.regs[instr->rd] = c.id
+#define ERGON_SEM_NCORES c.regs[instr->rd] = c.core_count()
+#define ERGON_SEM_SPAWN c.regs[instr->rd] = c.spawn(I_TARGET)
+#define ERGON_SEM_JOIN c.join(c.regs[instr->rs1])
+
+//----------------- ATOMIC OPERATIONS -----------------
+#define ERGON_SEM_CAS c.regs[instr->rd] = c.cas32(c.regs[instr->rs1], c.regs[instr->rd], c.regs[instr->rs2])
+#define ERGON_SEM_XADD c.regs[instr->rd] = c.xadd32(c.regs[instr->rs1], c.regs[instr->rs2])
+#define ERGON_SEM_XCHG c.regs[instr->rd] = c.xchg32(c.regs[instr->rs1], c.regs[instr->rs2])
+#define ERGON_SEM_LDAR c.regs[instr->rd] = c.load_acquire32(c.regs[instr->rs1])
+#define ERGON_SEM_STLR c.store_release32(c.regs[instr->rs1], c.regs[instr->rd])
+#define ERGON_SEM_FENCE std::atomic_thread_fence(std::memory_order_seq_cst)
+#define ERGON_SEM_WAIT c.wait32(c.regs[instr->rs1], c.regs[instr->rd])
+#define ERGON_SEM_WAKE c.wake32(c.regs[instr->rs1])
+
+
+#endif
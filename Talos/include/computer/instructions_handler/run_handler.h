@@ -2,364 +2,562 @@
 #define ERGON_RUN_HANDLER_H
 
 #include "computer/core.h"
+#include "asm/data.h"
+#include "opcode_semantics.h"
+#include "step_handler.h"
 
+#include <algorithm>
+#include <bit>
+#include <vector>
 
-inline void run(SimpleCore& c, const std::vector<DecodedInstr>& prog) {
-    #if !defined(__GNUC__) && !defined(__clang__)
-        #error "Computed goto requires GCC or Clang therefore you cannot use AUTO execution mode"
-    #endif
+#ifdef TALOS_COUNT_DISPATCHES
+// number of indirect dispatches done by run(), only compiled in for benchmarks
+inline uint64_t dispatch_count = 0;
+#endif
+
+// one ROM slot, pre-decoded for run() (direct threading)
+struct ThreadedInstr {
+    const void* handler = nullptr; // label of the handler in run()
+    uint8_t opcode = 0; // original opcode, for tools
+    uint8_t rd = 0;
+    uint8_t rs1 = 0;
+    uint8_t rs2 = 0;
+    int32_t imm = 0; // immediate already sign-extended, absolute target PC for branches
+};
+
+// prog.size() + 1 entries, the last one is a HALT sentinel so NEXT() never checks the PC
+struct ThreadedCode : std::vector<ThreadedInstr> {
+    using std::vector<ThreadedInstr>::vector;
+
+    // for the budgeted run(): instructions from each slot up to the next jmp/call/ret/halt
+    // (conditional branches are counted through), the sentinel counts for 0
+    std::vector<uint32_t> region;
+    uint32_t specialized = 0; // slots running one of the specialized handlers (see specialized_handler())
+};
+
+// registers of a specialized handler, known when compiling: inside it instr is one of these
+// instead of the slot, so the ERGON_SEM_ bodies index the register file with constants
+template<uint8_t RD, uint8_t RS1, uint8_t RS2>
+struct FixedOperands {
+    static constexpr uint8_t rd = RD;
+    static constexpr uint8_t rs1 = RS1;
+    static constexpr uint8_t rs2 = RS2;
+    int32_t imm; // still from the slot
+};
+
+// every register index, and every pair of them, for the specialized handlers
+#define ERGON_REGS(X) X(0) X(1) X(2) X(3) X(4) X(5) X(6) X(7) X(8) X(9) X(10) X(11) X(12) X(13) X(14) X(15)
+#define ERGON_REG_ROW(X, a) \
+    X(a, 0) X(a, 1) X(a, 2) X(a, 3) X(a, 4) X(a, 5) X(a, 6) X(a, 7) \
+    X(a, 8) X(a, 9) X(a, 10) X(a, 11) X(a, 12) X(a, 13) X(a, 14) X(a, 15)
+#define ERGON_REG_PAIRS(X) \
+    ERGON_REG_ROW(X, 0) ERGON_REG_ROW(X, 1) ERGON_REG_ROW(X, 2) ERGON_REG_ROW(X, 3) \
+    ERGON_REG_ROW(X, 4) ERGON_REG_ROW(X, 5) ERGON_REG_ROW(X, 6) ERGON_REG_ROW(X, 7) \
+    ERGON_REG_ROW(X, 8) ERGON_REG_ROW(X, 9) ERGON_REG_ROW(X, 10) ERGON_REG_ROW(X, 11) \
+    ERGON_REG_ROW(X, 12) ERGON_REG_ROW(X, 13) ERGON_REG_ROW(X, 14) ERGON_REG_ROW(X, 15)
+
+// labels of the specialized handlers in run_threaded<PLAIN_RUN>, picked per slot by thread_prog()
+struct SpecializedHandlers {
+    const void* inc[16]; // inc rN
+    const void* dec[16]; // dec rN, subi rN, rN, 1
+    const void* addi[16]; // addi rN, rN, imm (imm from the slot)
+    const void* cmp[16][16]; // cmp rA, rB
+    const void* ldw_base[16][16]; // lbasew rD, rS, off (off from the slot)
+    const void* nop; // addi rN, rN, 0, divi by 0...
+    const void* muli_pow2; // muli by 2^k: shift
+    const void* divi_pow2; // divi by 2^k: rounded toward 0 like the division
+    const void* modi_pow2;
+};
+
+enum class RunStatus : uint8_t {
+    HALTED, // HALT or end of the ROM
+    BUDGET, // budget used up, run() again to resume from c.PC
+    FAULT // stored outside of the RAM
+};
 
-        static void* dispatch_table[256] = {
-            &&OP_ADD, &&OP_SUB, &&OP_MUL, &&OP_DIV, &&OP_MOD,
-            &&OP_ADDI, &&OP_SUBI, &&OP_MULI, &&OP_DIVI, &&OP_MODI,
+struct RunSlice {
+    RunStatus status = RunStatus::HALTED;
+    uint64_t retired = 0; // instructions run, the HALT included (the faulting store excluded)
+};
 
-            &&OP_AND, &&OP_OR, &&OP_XOR, &&OP_ANDI, &&OP_ORI, &&OP_XORI,
-            &&OP_SHL, &&OP_SHR, &&OP_SAR, &&OP_ROL, &&OP_ROR,
-            &&OP_SHLI, &&OP_SHRI, &&OP_SARI, &&OP_ROLI, &&OP_RORI,
+// compile-time variants of run_threaded(), every one is built from the same handlers (opcode_semantics.h)
+// and a flag left to false costs nothing
+struct RunPolicy {
+    bool budgeted = false; // stops after a number of instructions, see run(c, code, budget)
+    bool profiled = false; // counts what runs in a Profile, see run(c, code, profile)
+};
 
-            &&OP_CMP, &&OP_CMPU, &&OP_TEST,
-            &&OP_CMPI, &&OP_CMPUI, &&OP_TESTI,
+inline constexpr RunPolicy PLAIN_RUN{};
+inline constexpr RunPolicy BUDGETED_RUN{ .budgeted = true };
+inline constexpr RunPolicy PROFILED_RUN{ .profiled = true };
 
-            &&OP_INC, &&OP_DEC, &&OP_NOT, &&OP_ABS, &&OP_NEG,
-            &&OP_MIN, &&OP_MAX, &&OP_MINI, &&OP_MAXI,
+// in/out of run_threaded<BUDGETED_RUN>
+struct Budget {
+    uint64_t left = 0;
+    RunStatus status = RunStatus::HALTED;
+};
 
-            &&OP_FADD, &&OP_FSUB, &&OP_FMUL, &&OP_FDIV, &&OP_FMA,
-            &&OP_FSQRT, &&OP_FABS, &&OP_FNEG, &&OP_FCMP, &&OP_ITOF, &&OP_FTOI,
-            &&OP_FMOV, &&OP_MOVF, &&OP_FLDW_ABS, &&OP_FSDW_ABS, &&OP_FLDW_BASE, &&OP_FSDW_BASE,
+// filled by run_threaded<PROFILED_RUN>, flat counters indexed by PC (one per ThreadedCode slot)
+struct Profile {
+    std::vector<uint64_t> executed; // instructions retired at this PC (a super-instruction counts for each of its slots)
+    std::vector<uint64_t> taken; // conditional branches only
+    std::vector<uint64_t> not_taken;
 
-            &&OP_MOV_IMM, &&OP_MOV_REG,
-            &&OP_LDB_ABS, &&OP_LDH_ABS, &&OP_LDW_ABS,
-            &&OP_STB_ABS, &&OP_STH_ABS, &&OP_STW_ABS,
-            &&OP_LDB_BASE, &&OP_LDH_BASE, &&OP_LDW_BASE,
-            &&OP_STB_BASE, &&OP_STH_BASE, &&OP_STW_BASE,
+    // keeps the counts if the size does not change
+    void resize(size_t slots) {
+        if (executed.size() == slots) return;
+        executed.assign(slots, 0);
+        taken.assign(slots, 0);
+        not_taken.assign(slots, 0);
+    }
+
+    void clear() {
+        std::ranges::fill(executed, 0);
+        std::ranges::fill(taken, 0);
+        std::ranges::fill(not_taken, 0);
+    }
 
-            &&OP_PUSH, &&OP_POP,
+    void merge(const Profile& other) {
+        resize(other.executed.size());
+        for (size_t pc = 0; pc < executed.size(); pc++) {
+            executed[pc] += other.executed[pc];
+            taken[pc] += other.taken[pc];
+            not_taken[pc] += other.not_taken[pc];
+        }
+    }
 
-            &&OP_LEA, &&OP_SWAP, &&OP_CLR, &&OP_MEMCPY,
+    uint64_t total() const {
+        uint64_t sum = 0;
+        for (uint64_t n : executed) sum += n;
+        return sum;
+    }
+};
 
-            &&OP_JMP, &&OP_JZ, &&OP_JNZ, &&OP_JG, &&OP_JL,
+// with code == nullptr only hands out the dispatch table (and the specialized handlers) to thread_prog()
+// budgeted: budget is the number of instructions left, the run stops at a jump/call/ret whose
+// target region does not fit anymore (c.PC = target). Dispatch goes through the table with the
+// opcode (handlers stored in the code are the ones of run_threaded<PLAIN_RUN>), regions are only
+// charged on taken transfers: the plain run() does not pay for any of it
+// profiled: every handler bumps the counters of its slot in profile (sized for code), also through the table
+template<RunPolicy P = PLAIN_RUN>
+void* const* run_threaded(SimpleCore* core, const ThreadedCode* code, Budget* budget = nullptr, Profile* profile = nullptr,
+                          const SpecializedHandlers** specialized = nullptr) {
+    #if !defined(__GNUC__) && !defined(__clang__)
+        #error "Computed goto requires GCC or Clang therefore you cannot use AUTO execution mode"
+    #endif
 
-            &&OP_CALL, &&OP_RET,
-            &&OP_HALT
-        };
+    #define ERGON_TABLE_ENTRY(name) &&OP_##name,
+        static void* dispatch_table[256] = { ERGON_OPCODES(ERGON_TABLE_ENTRY) };
+    #undef ERGON_TABLE_ENTRY
+
+    // the specialized handlers are only reached through the slots: the budgeted and profiled runs never see them
+    if constexpr (!P.budgeted && !P.profiled) {
+        #define ERGON_INC_ENTRY(n) &&OP_INC_R##n,
+        #define ERGON_DEC_ENTRY(n) &&OP_DEC_R##n,
+        #define ERGON_ADDI_ENTRY(n) &&OP_ADDI_R##n,
+        #define ERGON_CMP_ENTRY(a, b) &&OP_CMP_R##a##_R##b,
+        #define ERGON_LDW_BASE_ENTRY(d, s) &&OP_LDW_BASE_R##d##_R##s,
+            static const SpecializedHandlers specialized_handlers = {
+                { ERGON_REGS(ERGON_INC_ENTRY) },
+                { ERGON_REGS(ERGON_DEC_ENTRY) },
+                { ERGON_REGS(ERGON_ADDI_ENTRY) },
+                { ERGON_REG_PAIRS(ERGON_CMP_ENTRY) },
+                { ERGON_REG_PAIRS(ERGON_LDW_BASE_ENTRY) },
+                &&OP_NOP, &&OP_MULI_POW2, &&OP_DIVI_POW2, &&OP_MODI_POW2
+            };
+        #undef ERGON_INC_ENTRY
+        #undef ERGON_DEC_ENTRY
+        #undef ERGON_ADDI_ENTRY
+        #undef ERGON_CMP_ENTRY
+        #undef ERGON_LDW_BASE_ENTRY
+        if (specialized != nullptr) *specialized = &specialized_handlers;
+    }
+    if (code == nullptr) return dispatch_table;
+    if (code->empty() || core->PC >= code->size() - 1) return nullptr;
+
+    SimpleCore& c = *core;
+    const ThreadedInstr* const base = code->data();
+    const uint32_t prog_size = code->size() - 1;
+
+    // operands decoded once by thread_prog()
+    #define I_IMM (instr->imm)
+    #define I_SHAMT ((uint32_t)instr->imm)
+    #define I_OFF (instr->imm)
+    #define I_TARGET (instr->imm)
 
     //magie noire >w<
-    #define FETCH() instr = &prog[c.PC];
-    #define DISPATCH() goto *dispatch_table[instr->opcode]
+    // PC only lives in instr while running, it is written back to c.PC on exit and before a store
+    #ifdef TALOS_COUNT_DISPATCHES
+        #define COUNT_DISPATCH() ++dispatch_count;
+    #else
+        #define COUNT_DISPATCH()
+    #endif
+    #define DISPATCH() \
+    COUNT_DISPATCH() \
+    if constexpr (P.budgeted || P.profiled) goto *dispatch_table[instr->opcode]; \
+    else goto *instr->handler
     #define NEXT() \
-    c.PC++; \
-    if (c.PC >= prog.size()) return; \
-    FETCH(); DISPATCH();
+    ++instr; \
+    DISPATCH();
+    // leaving instr for target: gives back what is left of the current region, pays for the next one
+    #define CHARGE(target) \
+    if constexpr (P.budgeted) { \
+        left += region[instr - base] - 1; \
+        if (left < region[(target) - base]) { \
+            stop = (target); \
+            goto OUT_OF_BUDGET; \
+        } \
+        left -= region[(target) - base]; \
+    }
+    #define RETIRE() \
+    if constexpr (P.profiled) executed[instr - base]++;
+    #define TAKEN() \
+    if constexpr (P.profiled) taken[instr - base]++;
+    #define NOT_TAKEN() \
+    if constexpr (P.profiled) not_taken[instr - base]++;
+    #define JUMP() \
+    CHARGE(base + instr->imm); \
+    instr = base + instr->imm; \
+    DISPATCH();
+    // before a store (stores_to_ram()): a fault leaves through guarded_run() with PC on the store
+    // and what was left of the budget before it
+    #define FAULT_POINT() \
+    { \
+        c.PC = static_cast<uint32_t>(instr - base); \
+        if constexpr (P.budgeted) budget->left = left + region[instr - base]; \
+    }
 
-    const DecodedInstr* instr;
+    const ThreadedInstr* instr = base + c.PC;
+    [[maybe_unused]] const uint32_t* region = nullptr;
+    [[maybe_unused]] uint64_t left = 0;
+    [[maybe_unused]] const ThreadedInstr* stop = nullptr;
+    if constexpr (P.budgeted) {
+        region = code->region.data();
+        left = budget->left;
+        budget->status = RunStatus::BUDGET;
+        if (left < region[c.PC]) return nullptr; // c.PC stays, the caller steps what is left
+        left -= region[c.PC];
+    }
+    [[maybe_unused]] uint64_t* executed = nullptr;
+    [[maybe_unused]] uint64_t* taken = nullptr;
+    [[maybe_unused]] uint64_t* not_taken = nullptr;
+    if constexpr (P.profiled) {
+        executed = profile->executed.data();
+        taken = profile->taken.data();
+        not_taken = profile->not_taken.data();
+    }
 
-    FETCH();
     DISPATCH();
 
-OP_ADD:
-    c.regs[instr->rd] = (uint32_t)((uint64_t)c.regs[instr->rs1] + (uint64_t)c.regs[instr->rs2]);
-    NEXT();
-OP_SUB:
-    c.regs[instr->rd] = (uint32_t)((uint64_t)c.regs[instr->rs1] - (uint64_t)c.regs[instr->rs2]);
-    NEXT();
-OP_MUL:
-    c.regs[instr->rd] = (uint32_t)((int64_t)(int32_t)c.regs[instr->rs1] * (int64_t)(int32_t)c.regs[instr->rs2]);
-    NEXT();
-OP_DIV:
-    if ((int32_t)c.regs[instr->rs2] != 0 && !((int32_t)c.regs[instr->rs1] == INT32_MIN && (int32_t)c.regs[instr->rs2] == -1))
-        c.regs[instr->rd] = (uint32_t)((int32_t)c.regs[instr->rs1] / (int32_t)c.regs[instr->rs2]);
-    NEXT();
-OP_MOD:
-    if ((int32_t)c.regs[instr->rs2] != 0)
-        c.regs[instr->rd] = (uint32_t)((int32_t)c.regs[instr->rs1] % (int32_t)c.regs[instr->rs2]);
-    NEXT();
-OP_ADDI:
-    c.regs[instr->rd] = (uint32_t)((uint64_t)c.regs[instr->rs1] + (uint64_t)instr->rs2);
-    NEXT();
-OP_SUBI:
-    c.regs[instr->rd] = (uint32_t)((uint64_t)c.regs[instr->rs1] - (uint64_t)(int32_t)instr->rs2);
-    NEXT();
-OP_MULI:
-    c.regs[instr->rd] = (uint32_t)((int64_t)(int32_t)c.regs[instr->rs1] * (int64_t)(int32_t)instr->rs2);
-    NEXT();
-OP_DIVI:
-    if ((int32_t)instr->rs2 != 0 && !((int32_t)c.regs[instr->rs1] == INT32_MIN && (int32_t)instr->rs2 == -1))
-        c.regs[instr->rd] = (uint32_t)((int32_t)c.regs[instr->rs1] / (int32_t)instr->rs2);
-    NEXT();
-OP_MODI:
-    if ((int32_t)instr->rs2 != 0) c.regs[instr->rd] = (uint32_t)((int32_t)c.regs[instr->rs1] % (int32_t)instr->rs2);
-    NEXT();
-
-OP_AND:
-    c.regs[instr->rd] = c.regs[instr->rs1] & c.regs[instr->rs2];
-    NEXT();
-OP_OR:
-    c.regs[instr->rd] = c.regs[instr->rs1] | c.regs[instr->rs2];
-    NEXT();
-OP_XOR:
-    c.regs[instr->rd] = c.regs[instr->rs1] ^ c.regs[instr->rs2];
-    NEXT();
-OP_ANDI:
-    c.regs[instr->rd] = c.regs[instr->rs1] & (uint32_t)(int32_t)instr->rs2;
-    NEXT();
-OP_ORI:
-    c.regs[instr->rd] = c.regs[instr->rs1] | (uint32_t)(int32_t)instr->rs2;
-    NEXT();
-OP_XORI:
-    c.regs[instr->rd] = c.regs[instr->rs1] ^ (uint32_t)(int32_t)instr->rs2;
-    NEXT();
+    #define LINEAR_OP(name) \
+    OP_##name: \
+        RETIRE() \
+        if constexpr (stores_to_ram(name)) FAULT_POINT() \
+        ERGON_SEM_##name; \
+        NEXT();
+    ERGON_LINEAR_OPS(LINEAR_OP)
+    #undef LINEAR_OP
 
-OP_SHL:
-    c.regs[instr->rd] = c.regs[instr->rs1] << (c.regs[instr->rs2] & 31);
-    NEXT();
-OP_SHR:
-    c.regs[instr->rd] = c.regs[instr->rs1] >> (c.regs[instr->rs2] & 31);
-    NEXT();
-OP_SAR:
-    c.regs[instr->rd] = static_cast<uint32_t>(static_cast<int32_t>(c.regs[instr->rs1]) >> (c.regs[instr->rs2] & 31));
-    NEXT();
-OP_ROL:
-    c.regs[instr->rd] = (c.regs[instr->rs1] << (c.regs[instr->rs2] & 31)) | (c.regs[instr->rs1] >> (32 - (c.regs[instr->rs2] & 31)));
-    NEXT();
-OP_ROR:
-    c.regs[instr->rd] = (c.regs[instr->rs1] >> (c.regs[instr->rs2] & 31)) | (c.regs[instr->rs1] << (32 - (c.regs[instr->rs2] & 31)));
-    NEXT();
-OP_SHLI:
-    c.regs[instr->rd] = c.regs[instr->rs1] << ((uint32_t)instr->rs2 & 31);
-    NEXT();
-OP_SHRI:
-    c.regs[instr->rd] = c.regs[instr->rs1] >> ((uint32_t)instr->rs2 & 31);
-    NEXT();
-OP_SARI:
-    c.regs[instr->rd] = (uint32_t)((int32_t)c.regs[instr->rs1] >> ((uint32_t)instr->rs2 & 31));
-    NEXT();
-OP_ROLI:
-    c.regs[instr->rd] = (c.regs[instr->rs1] << ((uint32_t)instr->rs2 & 31)) | (c.regs[instr->rs1] >> (32 - ((uint32_t)instr->rs2 & 31)));
-    NEXT();
-OP_RORI:
-    c.regs[instr->rd] = (c.regs[instr->rs1] >> ((uint32_t)instr->rs2 & 31)) | (c.regs[instr->rs1] << (32 - ((uint32_t)instr->rs2 & 31)));
-    NEXT();
-OP_CMP:
-    c.regs[13] = ((int32_t)c.regs[instr->rs1] < (int32_t)c.regs[instr->rs2]) ? -1 : (((int32_t)c.regs[instr->rs1] > (int32_t)c.regs[instr->rs2]) ? 1 : 0);
-    NEXT();
-OP_CMPU:
-    c.regs[13] = (c.regs[instr->rs1] < c.regs[instr->rs2]) ? -1 : ((c.regs[instr->rs1] > c.regs[instr->rs2]) ? 1 : 0);
-    NEXT();
-OP_CMPI:
-    c.regs[13] = ((int32_t)c.regs[instr->rs1] < (int32_t)instr->rs2) ? -1 : (((int32_t)c.regs[instr->rs1] > (int32_t)instr->rs2) ? 1 : 0);
-    NEXT();
-OP_CMPUI:
-    c.regs[13] = (c.regs[instr->rs1] < (uint32_t)instr->rs2) ? -1 : ((c.regs[instr->rs1] < (uint32_t)instr->rs2) ? 1 : 0);
-    NEXT();
-OP_TEST:
-    c.regs[13] = ((c.regs[instr->rs1] & c.regs[instr->rs2]) != 0) ? 1 : 0;
-    NEXT();
-OP_TESTI:
-    c.regs[13] = ((c.regs[instr->rs1] & (uint32_t)instr->rs2) != 0) ? 1 : 0;
-    NEXT();
+    #define BRANCH_OP(name, cond) \
+    OP_##name: \
+        RETIRE() \
+        if (cond) { \
+            TAKEN() \
+            JUMP(); \
+        } \
+        NOT_TAKEN() \
+        NEXT();
+    ERGON_BRANCH_OPS(BRANCH_OP)
+    #undef BRANCH_OP
 
-OP_INC:
-    c.regs[instr->rd] = (uint32_t)(int64_t)(int32_t)c.regs[instr->rd] + 1;
-    NEXT();
-OP_DEC:
-    c.regs[instr->rd] = (uint32_t)(int64_t)(int32_t)c.regs[instr->rd] - 1;
-    NEXT();
-OP_NOT:
-    c.regs[instr->rd] = ~c.regs[instr->rs1];
-    NEXT();
-OP_ABS:
-    if ((int32_t)c.regs[instr->rs1] < 0) c.regs[instr->rd] = (uint32_t)-(int32_t)c.regs[instr->rs1];
-    else c.regs[instr->rd] = c.regs[instr->rs1];
-    NEXT();
-OP_NEG:
-    if ((int32_t)c.regs[instr->rs1] != INT32_MIN) c.regs[instr->rd] = (uint32_t)-(int32_t)c.regs[instr->rs1];
-    NEXT();
-OP_MIN:
-    if (c.regs[instr->rs1] < c.regs[instr->rs2]) c.regs[instr->rd] = c.regs[instr->rs1];
-    else c.regs[instr->rd] = c.regs[instr->rs2];
-    NEXT();
-OP_MAX:
-    if (c.regs[instr->rs1] > c.regs[instr->rs2]) c.regs[instr->rd] = c.regs[instr->rs1];
-    else c.regs[instr->rd] = c.regs[instr->rs2];
-    NEXT();
-OP_MINI:
-    if (c.regs[instr->rs1] < instr->rs2) c.regs[instr->rd] = instr->rs1;
-    else c.regs[instr->rd] = instr->rs2;
-    NEXT();
-OP_MAXI:
-    if (c.regs[instr->rs1] > instr->rs2) c.regs[instr->rd] = instr->rs1;
-    else c.regs[instr->rd] = instr->rs2;
-    NEXT();
+OP_JMP:
+    RETIRE()
+    JUMP();
+OP_CALL:
+    RETIRE()
+    FAULT_POINT()
+    c.SP -= 4;
+    c.store32(c.SP, static_cast<uint32_t>(instr - base) + 1);
+    JUMP();
+OP_RET:
+    RETIRE()
+    {
+        uint32_t pc = c.load32(c.SP);
+        c.SP += 4;
+        const ThreadedInstr* target = base + (pc < prog_size ? pc : prog_size);
+        CHARGE(target);
+        instr = target;
+    }
+    DISPATCH();
 
-OP_FADD:
-    c.fregs[instr->rd] = std::bit_cast<uint32_t>(std::bit_cast<float>(c.fregs[instr->rs1]) + std::bit_cast<float>(c.fregs[instr->rs2]));
-    NEXT();
-OP_FSUB:
-    c.fregs[instr->rd] = std::bit_cast<uint32_t>(std::bit_cast<float>(c.fregs[instr->rs1]) - std::bit_cast<float>(c.fregs[instr->rs2]));
-    NEXT();
-OP_FMUL:
-    c.fregs[instr->rd] = std::bit_cast<uint32_t>(std::bit_cast<float>(c.fregs[instr->rs1]) * std::bit_cast<float>(c.fregs[instr->rs2]));
-    NEXT();
-OP_FDIV:
-    c.fregs[instr->rd] = std::bit_cast<uint32_t>(std::bit_cast<float>(c.fregs[instr->rs1]) / std::bit_cast<float>(c.fregs[instr->rs2]));
-    NEXT();
-OP_FMA:
-    c.fregs[instr->rd] = std::bit_cast<uint32_t>( std::fma(std::bit_cast<float>(c.fregs[instr->rd]), std::bit_cast<float>(c.fregs[instr->rs1]), std::bit_cast<float>(c.fregs[instr->rs2])));
-    NEXT();
-OP_FSQRT:
-    c.fregs[instr->rd] = std::bit_cast<uint32_t>(std::sqrt(std::bit_cast<float>(c.fregs[instr->rs1])));
-    NEXT();
-OP_FABS:
-    c.fregs[instr->rd] = std::bit_cast<uint32_t>(std::abs(std::bit_cast<float>(c.fregs[instr->rs1])));
-    NEXT();
-OP_FNEG:
-    c.fregs[instr->rd] = std::bit_cast<uint32_t>(-std::bit_cast<float>(c.fregs[instr->rs1]));
-    NEXT();
-OP_FCMP:
-    c.regs[13] = std::bit_cast<uint32_t>(std::bit_cast<float>(c.fregs[instr->rs1]) < std::bit_cast<float>(c.fregs[instr->rs2]) ? -1 : std::bit_cast<float>(c.fregs[instr->rs1]) > std::bit_cast<float>(c.fregs[instr->rs2]) ? 1 : 0);
-    NEXT();
-OP_ITOF:
-    c.fregs[instr->rd] = std::bit_cast<uint32_t>(std::bit_cast<float>(c.regs[instr->rs1]));
-    NEXT();
-OP_FTOI:
-    c.regs[instr->rd] = std::bit_cast<uint32_t>(c.fregs[instr->rs1]);
-    NEXT();
-OP_FMOV:
-    c.fregs[instr->rd] = c.regs[instr->rs1];
-    NEXT();
-OP_MOVF:
-    c.regs[instr->rd] = c.fregs[instr->rs1];
-    NEXT();
-OP_FLDW_ABS:
-    c.fregs[instr->rd] = c.load32(instr->imm);
-    NEXT();
-OP_FSDW_ABS:
-    c.store32(instr->imm, c.fregs[instr->rd]);
-    NEXT();
-OP_FLDW_BASE:
-    c.fregs[instr->rd] = c.load32(c.regs[instr->rs1] + static_cast<int8_t>(instr->imm));
-    NEXT();
-OP_FSDW_BASE:
-    c.store32(c.regs[instr->rs1] + static_cast<int8_t>(instr->imm), c.fregs[instr->rd]);
-    NEXT();
+    // super-instructions: the head and the compare are done in place (each with its own slot),
+    // then we jump straight into the branch handler of the last slot
+    #define FUSED_TRIPLE(name, head, cmp, jump) \
+    OP_##name: \
+        RETIRE() \
+        ERGON_SEM_##head; \
+        ++instr; \
+        RETIRE() \
+        ERGON_SEM_##cmp; \
+        ++instr; \
+        goto OP_##jump;
+    #define FUSED_PAIR(name, cmp, jump) \
+    OP_##name: \
+        RETIRE() \
+        ERGON_SEM_##cmp; \
+        ++instr; \
+        goto OP_##jump;
+    ERGON_FUSED_TRIPLES(FUSED_TRIPLE)
+    ERGON_FUSED_PAIRS(FUSED_PAIR)
+    #undef FUSED_TRIPLE
+    #undef FUSED_PAIR
 
-OP_MOV_IMM:
-    c.regs[instr->rd] = instr->imm;
-    NEXT();
-OP_MOV_REG:
-    c.regs[instr->rd] = c.regs[instr->rs1];
-    NEXT();
-OP_LDB_ABS:
-    c.regs[instr->rd] = static_cast<int8_t>(c.load8(instr->imm));
-    NEXT();
-OP_LDH_ABS:
-    c.regs[instr->rd] = static_cast<int16_t>(c.load16(instr->imm));
-    NEXT();
-OP_LDW_ABS:
-    c.regs[instr->rd] = c.load32(instr->imm);
-    NEXT();
-OP_STB_ABS:
-    c.store8(instr->imm, c.regs[instr->rd] & 0xFF);
-    NEXT();
-OP_STH_ABS:
-    c.store16(instr->imm, c.regs[instr->rd] & 0xFFFF);
-    NEXT();
-OP_STW_ABS:
-    c.store32(instr->imm, c.regs[instr->rd]);
-    NEXT();
-OP_LDB_BASE:
-    c.regs[instr->rd] = static_cast<int8_t>(c.load8(c.regs[instr->rs1] + static_cast<int8_t>(instr->imm)));
-    NEXT();
-OP_LDH_BASE:
-    c.regs[instr->rd] = static_cast<int16_t>(c.load16(c.regs[instr->rs1] + static_cast<int8_t>(instr->imm)));
-    NEXT();
-OP_LDW_BASE:
-    c.regs[instr->rd] = c.load32(c.regs[instr->rs1] + static_cast<int8_t>(instr->imm));
-    NEXT();
-OP_STB_BASE:
-    c.store8(c.regs[instr->rs1] + static_cast<int8_t>(instr->imm), c.regs[instr->rd] & 0xFF);
-    NEXT();
-OP_STH_BASE:
-    c.store16(c.regs[instr->rs1] + static_cast<int8_t>(instr->imm), c.regs[instr->rd] & 0xFFFF);
-    NEXT();
-OP_STW_BASE:
-    c.store32(c.regs[instr->rs1] + static_cast<int8_t>(instr->imm), c.regs[instr->rd]);
-    NEXT();
+    // operand-specialized handlers: the semantics of the opcode with instr standing for a FixedOperands,
+    // the registers are constants and nothing is decoded but the immediate (unused by the budgeted and profiled runs)
+    #define SPECIALIZED_OP(label, name, rd, rs1, rs2) \
+    [[maybe_unused]] label: \
+        { \
+            const FixedOperands<rd, rs1, rs2> fixed{ instr->imm }; \
+            const auto* instr = &fixed; \
+            ERGON_SEM_##name; \
+        } \
+        NEXT();
+    #define INC_OP(n) SPECIALIZED_OP(OP_INC_R##n, INC, n, n, 0)
+    #define DEC_OP(n) SPECIALIZED_OP(OP_DEC_R##n, DEC, n, n, 0)
+    #define ADDI_OP(n) SPECIALIZED_OP(OP_ADDI_R##n, ADDI, n, n, 0)
+    #define CMP_OP(a, b) SPECIALIZED_OP(OP_CMP_R##a##_R##b, CMP, 0, a, b)
+    #define LDW_BASE_OP(d, s) SPECIALIZED_OP(OP_LDW_BASE_R##d##_R##s, LDW_BASE, d, s, 0)
+    ERGON_REGS(INC_OP)
+    ERGON_REGS(DEC_OP)
+    ERGON_REGS(ADDI_OP)
+    ERGON_REG_PAIRS(CMP_OP)
+    ERGON_REG_PAIRS(LDW_BASE_OP)
+    #undef SPECIALIZED_OP
+    #undef INC_OP
+    #undef DEC_OP
+    #undef ADDI_OP
+    #undef CMP_OP
+    #undef LDW_BASE_OP
 
-OP_PUSH:
-    c.SP -= 4;
-    c.store32(c.SP, c.regs[instr->rs1]);
+    // immediates of 0 and powers of two (imm = 2^k, 1 included)
+[[maybe_unused]] OP_NOP:
     NEXT();
-OP_POP:
-    c.regs[instr->rd] = c.load32(c.SP);
-    c.SP += 4;
+[[maybe_unused]] OP_MULI_POW2:
+    c.regs[instr->rd] = c.regs[instr->rs1] << std::countr_zero(static_cast<uint32_t>(instr->imm));
     NEXT();
-OP_LEA:
-    c.regs[instr->rd] = c.regs[instr->rs1] + static_cast<int8_t>(instr->imm);
-    NEXT();
-OP_SWAP:
-    std::swap(c.regs[instr->rd], c.regs[instr->rs1]);
-    NEXT();
-OP_CLR:
-    c.regs[instr->rd] = 0;
+[[maybe_unused]] OP_DIVI_POW2:
+    {
+        const auto x = static_cast<int32_t>(c.regs[instr->rs1]);
+        const int32_t bias = (x >> 31) & (instr->imm - 1); // negative dividends round toward 0
+        c.regs[instr->rd] = static_cast<uint32_t>((x + bias) >> std::countr_zero(static_cast<uint32_t>(instr->imm)));
+    }
     NEXT();
-OP_MEMCPY:
+[[maybe_unused]] OP_MODI_POW2:
     {
-        int32_t len = static_cast<int8_t>(instr->imm);
-        if (len >= 0) {
-            for (uint32_t index = 0; index < instr->rs2; ++index)
-                if (c.regs[instr->rd] + index < c.ram.size() && c.regs[instr->rs1] + index < c.ram.size())
-                    c.ram[c.regs[instr->rd] + index] = c.ram[c.regs[instr->rs1] + index];
-        }
+        const uint32_t x = c.regs[instr->rs1];
+        const uint32_t bias = static_cast<uint32_t>(static_cast<int32_t>(x) >> 31) & (instr->imm - 1);
+        c.regs[instr->rd] = x - ((x + bias) & static_cast<uint32_t>(-instr->imm)); // same sign as x
     }
     NEXT();
 
-OP_JMP:
-    c.PC += instr->imm;
-    FETCH();
-    DISPATCH();
-OP_JZ:
-    if(c.regs[13] == 0) {
-        c.PC += instr->imm;
-        FETCH();
-        DISPATCH();
+OP_HALT: // also the end-of-ROM sentinel
+    if (instr != base + prog_size) {
+        RETIRE()
     }
-    NEXT();
-OP_JNZ:
-    if(c.regs[13] != 0) {
-        c.PC += instr->imm;
-        FETCH();
-        DISPATCH();
+    c.PC = static_cast<uint32_t>(instr - base);
+    if constexpr (P.budgeted) {
+        budget->left = left;
+        budget->status = RunStatus::HALTED;
     }
-    NEXT();
-OP_JL:
-    if((int32_t)c.regs[13] < 0) {
-        c.PC += instr->imm;
-        FETCH();
-        DISPATCH();
+    return nullptr;
+
+[[maybe_unused]] OUT_OF_BUDGET:
+    if constexpr (P.budgeted) {
+        c.PC = static_cast<uint32_t>(stop - base);
+        budget->left = left;
     }
-    NEXT();
-OP_JG:
-    if((int32_t)c.regs[13] > 0) {
-        c.PC += instr->imm;
-        FETCH();
-        DISPATCH();
+    return nullptr;
+
+    #undef I_IMM
+    #undef I_SHAMT
+    #undef I_OFF
+    #undef I_TARGET
+    #undef COUNT_DISPATCH
+    #undef DISPATCH
+    #undef NEXT
+    #undef CHARGE
+    #undef RETIRE
+    #undef TAKEN
+    #undef NOT_TAKEN
+    #undef JUMP
+    #undef FAULT_POINT
+}
+
+// handler of run() made for the operands of T (decoded by thread_prog()), nullptr if there is none:
+// the registers of inc / dec / addi / cmp / lbasew, and the immediates of 0, 1 and powers of two.
+// Only the handler changes, the opcode and operands stay the ones of the generic handler
+inline const void* specialized_handler(const ThreadedInstr& T, const SpecializedHandlers& s, void* const* table) {
+    if (T.rd > 15 || T.rs1 > 15 || (T.opcode == CMP && T.rs2 > 15)) return nullptr;
+    const bool in_place = T.rd == T.rs1;
+    const bool pow2 = T.imm > 0 && std::has_single_bit(static_cast<uint32_t>(T.imm));
+    switch (T.opcode) {
+    case INC:
+        return s.inc[T.rd];
+    case DEC:
+        return s.dec[T.rd];
+    case ADDI:
+        if (T.imm == 0) return in_place ? s.nop : table[MOV_REG];
+        if (!in_place) return nullptr;
+        return T.imm == 1 ? s.inc[T.rd] : s.addi[T.rd];
+    case SUBI:
+        if (T.imm == 0) return in_place ? s.nop : table[MOV_REG];
+        return in_place && T.imm == 1 ? s.dec[T.rd] : nullptr;
+    case ORI: case XORI:
+    case SHLI: case SHRI: case SARI: case ROLI: case RORI:
+        if (T.imm == 0) return in_place ? s.nop : table[MOV_REG];
+        return nullptr;
+    case ANDI:
+        return T.imm == 0 ? table[CLR] : nullptr;
+    case MULI:
+        if (T.imm == 0) return table[CLR];
+        if (T.imm == 1 && in_place) return s.nop;
+        return pow2 ? s.muli_pow2 : nullptr;
+    case DIVI:
+        if (T.imm == 0 || (T.imm == 1 && in_place)) return s.nop; // a division by 0 leaves rd as it is
+        return pow2 ? s.divi_pow2 : nullptr;
+    case MODI:
+        if (T.imm == 0) return s.nop;
+        return pow2 ? s.modi_pow2 : nullptr;
+    case CMP:
+        return s.cmp[T.rs1][T.rs2];
+    case LDW_BASE:
+        return s.ldw_base[T.rd][T.rs1];
+    default:
+        return nullptr;
     }
-    NEXT();
-OP_CALL:
-    c.SP -= 4;
-    c.store32(c.SP, c.PC + 1);
-    c.PC += instr->imm;
-    FETCH();
-    DISPATCH();
-OP_RET:
-    c.PC = c.load32(c.SP);
-    c.SP += 4;
-    FETCH();
-    DISPATCH();
+}
+
+// load-time translation of the ROM, operands are decoded once here instead of in every handler
+// specialize: hot opcodes get the handler made for their operands when there is one (specialized_handler())
+inline ThreadedCode thread_prog(const std::vector<DecodedInstr>& prog, bool specialize = true) {
+    const SpecializedHandlers* specialized = nullptr;
+    void* const* table = run_threaded<PLAIN_RUN>(nullptr, nullptr, nullptr, nullptr, &specialized);
+    const auto size = static_cast<int64_t>(prog.size());
+
+    ThreadedCode code(prog.size() + 1);
+    for (size_t pc = 0; pc < prog.size(); pc++) {
+        const DecodedInstr& I = prog[pc];
+        ThreadedInstr& T = code[pc];
 
-OP_HALT:
-    return;
+        T.handler = table[I.opcode] ? table[I.opcode] : table[HALT];
+        T.opcode = table[I.opcode] ? I.opcode : static_cast<uint8_t>(HALT);
+        T.rd = I.rd;
+        T.rs1 = I.rs1;
+        T.rs2 = I.rs2;
+        T.imm = I.imm;
+
+        switch (fused_head(I.opcode)) {
+        // I-type immediates are stored in rs2 by the assembler
+        case ADDI: case SUBI: case MULI: case DIVI: case MODI:
+        case ANDI: case ORI: case XORI:
+        case CMPI: case CMPUI: case TESTI:
+            T.imm = I.rs2;
+            break;
+        case SHLI: case SHRI: case SARI: case ROLI: case RORI:
+            T.imm = I.rs2 & 31;
+            break;
+        // 8 bit signed offsets
+        case FLDW_BASE: case FSTW_BASE:
+        case LDB_BASE: case LDH_BASE: case LDW_BASE:
+        case STB_BASE: case STH_BASE: case STW_BASE:
+        case LEA: case MEMCPY:
+            T.imm = static_cast<int8_t>(I.imm);
+            break;
+        // relative offset -> absolute target, anything outside of the ROM ends on the sentinel
+        case JMP: case JZ: case JNZ: case JG: case JL: case CALL: case SPAWN:
+            {
+                int64_t target = static_cast<int64_t>(pc) + 1 + I.imm;
+                T.imm = static_cast<int32_t>(target >= 0 && target < size ? target : size);
+                break;
+            }
+        default:
+            break;
+        }
+
+        if (!specialize) continue;
+        if (const void* handler = specialized_handler(T, *specialized, table)) {
+            T.handler = handler;
+            code.specialized++;
+        }
+    }
+    code[prog.size()].handler = table[HALT];
+    code[prog.size()].opcode = HALT;
+
+    // regions for the budgeted run(), from the end
+    code.region.assign(code.size(), 0);
+    for (size_t pc = prog.size(); pc-- > 0;) {
+        switch (code[pc].opcode) {
+        case JMP: case CALL: case RET: case HALT:
+            code.region[pc] = 1;
+            break;
+        default:
+            code.region[pc] = 1 + code.region[pc + 1];
+            break;
+        }
+    }
+    return code;
+}
+
+inline void run(SimpleCore& c, const ThreadedCode& code) {
+    run_threaded(&c, &code);
+}
+
+// like run(c, code), counting into profile (resized for code if needed, the counts add up across runs)
+inline void run(SimpleCore& c, const ThreadedCode& code, Profile& profile) {
+    profile.resize(code.size());
+    run_threaded<PROFILED_RUN>(&c, &code, nullptr, &profile);
+}
+
+// back to the assembler form for step_instr(): branch targets are relative again and a
+// super-instruction is only its head, the tail is still in the next slots
+inline DecodedInstr decoded_instr(const ThreadedInstr& T, uint32_t pc) {
+    DecodedInstr I(fused_head(T.opcode), T.rd, T.rs1, T.rs2, T.imm);
+    switch (T.opcode) {
+    case JMP: case JZ: case JNZ: case JG: case JL: case CALL: case SPAWN:
+        I.imm = T.imm - static_cast<int32_t>(pc) - 1;
+        break;
+    default:
+        break;
+    }
+    return I;
+}
+
+// at most budget instructions, resumes from c.PC. A fault only ends the run if no
+// guarded_run() is already armed on this thread (the outer one catches it otherwise)
+inline RunSlice run(SimpleCore& c, const ThreadedCode& code, uint64_t budget) {
+    if (code.empty() || c.PC >= code.size() - 1) return { RunStatus::HALTED, 0 };
+    const auto prog_size = static_cast<uint32_t>(code.size() - 1);
+
+    Budget b{ budget };
+    bool ok = guarded_run(c.ram, [&] {
+        run_threaded<BUDGETED_RUN>(&c, &code, &b);
+        // what is left does not cover the next region: the last instructions one by one
+        while (b.status == RunStatus::BUDGET && b.left != 0) {
+            if (c.PC >= prog_size) {
+                b.status = RunStatus::HALTED;
+                break;
+            }
+            if (code[c.PC].opcode == HALT) {
+                b.left--;
+                b.status = RunStatus::HALTED;
+                break;
+            }
+            step_instr(c, decoded_instr(code[c.PC], c.PC));
+            b.left--; // after it: a store that faults is not counted
+        }
+    });
+    if (!ok) return { RunStatus::FAULT, budget - b.left };
+    return { b.status, budget - b.left };
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,245 @@
+#ifndef ERGON_TAIL_HANDLER_H
+#define ERGON_TAIL_HANDLER_H
+
+#include "computer/core.h"
+#include "opcode_semantics.h"
+#include "run_handler.h"
+
+#include <cstring>
+#include <vector>
+
+/*
+Handler-per-function interpreter: every opcode is its own function, which ends by calling the handler
+of the next slot. The state lives in the arguments of that call (the slot, the register file, the RAM
+base, the ROM base and size), so it stays in host argument registers from one handler to the next
+instead of being spilled around one big function like run_threaded().
+ - with [[clang::musttail]] / [[gnu::musttail]] the call is a jump (TALOS_TAIL_CALLS is defined)
+ - without, each handler returns the next slot to a loop (call threading), same handlers
+ERGON_MUSTTAIL can be defined by hand (-DERGON_MUSTTAIL= checks the tail form on a compiler without the
+attribute, the calls are then only tail calls if the optimizer makes them so: -O2 and above)
+*/
+
+#ifndef ERGON_MUSTTAIL
+    #if defined(__has_cpp_attribute)
+        #if __has_cpp_attribute(clang::musttail)
+            #define ERGON_MUSTTAIL [[clang::musttail]]
+        #elif __has_cpp_attribute(gnu::musttail)
+            #define ERGON_MUSTTAIL [[gnu::musttail]]
+        #endif
+    #endif
+#endif
+
+#if defined(ERGON_MUSTTAIL) && !defined(TALOS_TAIL_CALLS)
+    #define TALOS_TAIL_CALLS
+#endif
+
+struct TailInstr;
+
+#ifdef TALOS_TAIL_CALLS
+using TailNext = void;
+#else
+using TailNext = const TailInstr*; // nullptr once halted
+#endif
+
+using TailHandler = TailNext (*)(SimpleCore& core, const TailInstr* instr, uint32_t* regs, uint8_t* ram, const TailInstr* base, uint32_t size);
+
+// one ROM slot: the operands of thread_prog() with the function of the opcode
+struct TailInstr {
+    TailHandler handler = nullptr;
+    uint8_t opcode = 0;
+    uint8_t rd = 0;
+    uint8_t rs1 = 0;
+    uint8_t rs2 = 0;
+    int32_t imm = 0; // immediate already sign-extended, absolute target PC for branches
+};
+
+// prog.size() + 1 entries like ThreadedCode, the last one is a HALT sentinel
+struct TailCode : std::vector<TailInstr> {
+    using std::vector<TailInstr>::vector;
+};
+
+namespace tail {
+    // what the handlers see as c: the register file and the RAM from the arguments
+    struct View {
+        uint32_t* regs;
+        std::array<uint32_t, 16>& fregs;
+        uint32_t& SP;
+        uint8_t* ram;
+        GuestRam& guest;
+
+        uint32_t load32(uint32_t addr) const {
+            uint32_t value;
+            std::memcpy(&value, ram + addr, 4);
+            return value;
+        }
+        uint16_t load16(uint32_t addr) const {
+            uint16_t value;
+            std::memcpy(&value, ram + addr, 2);
+            return value;
+        }
+        uint8_t load8(uint32_t addr) const {
+            return ram[addr];
+        }
+        void store32(uint32_t addr, uint32_t value) const {
+            std::memcpy(ram + addr, &value, 4);
+            guest.mark_dirty(addr, 4);
+        }
+        void store16(uint32_t addr, uint16_t value) const {
+            std::memcpy(ram + addr, &value, 2);
+            guest.mark_dirty(addr, 2);
+        }
+        void store8(uint32_t addr, uint8_t value) const {
+            ram[addr] = value;
+            guest.mark_dirty(addr);
+        }
+    };
+
+    // opcodes that talk to the other cores or walk the RAM by its size get the SimpleCore itself
+    constexpr bool needs_core(uint8_t opcode) {
+        switch (opcode) {
+        case MEMCPY: case CORE_ID: case NCORES: case SPAWN: case JOIN:
+        case CAS: case XADD: case XCHG: case LDAR: case STLR: case FENCE: case WAIT: case WAKE:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    template<uint8_t OP>
+    decltype(auto) view(SimpleCore& core, uint32_t* regs, uint8_t* ram) {
+        if constexpr (needs_core(OP)) return (core);
+        else return View{ regs, core.fregs, regs[15], ram, core.ram };
+    }
+
+    #define I_IMM (instr->imm)
+    #define I_SHAMT ((uint32_t)instr->imm)
+    #define I_OFF (instr->imm)
+    #define I_TARGET (instr->imm)
+
+    // every handler has the same signature, but jmp, ret, halt and the linear ops of a call-threaded build
+    // (which only return their next slot) each leave some of these unread
+    #define TAIL_PARAMS [[maybe_unused]] SimpleCore& core, [[maybe_unused]] const TailInstr* instr, \
+        [[maybe_unused]] uint32_t* regs, [[maybe_unused]] uint8_t* ram, \
+        [[maybe_unused]] const TailInstr* base, [[maybe_unused]] uint32_t size
+    #ifdef TALOS_TAIL_CALLS
+        #define TAIL_GO(next) \
+        { \
+            const TailInstr* next_ = (next); \
+            ERGON_MUSTTAIL return next_->handler(core, next_, regs, ram, base, size); \
+        }
+        #define TAIL_INTO(handler, at) ERGON_MUSTTAIL return handler(core, (at), regs, ram, base, size)
+        #define TAIL_STOP() return
+    #else
+        #define TAIL_GO(next) return (next)
+        #define TAIL_INTO(handler, at) return handler(core, (at), regs, ram, base, size)
+        #define TAIL_STOP() return nullptr
+    #endif
+
+    // PC is only written back on HALT and before a store: a fault stops the core on the store
+    #define LINEAR_OP(name) \
+    inline TailNext op_##name(TAIL_PARAMS) { \
+        [[maybe_unused]] auto&& c = view<name>(core, regs, ram); /* fence does not touch it */ \
+        if constexpr (stores_to_ram(name)) core.PC = static_cast<uint32_t>(instr - base); \
+        ERGON_SEM_##name; \
+        TAIL_GO(instr + 1); \
+    }
+    ERGON_LINEAR_OPS(LINEAR_OP)
+    #undef LINEAR_OP
+
+    #define BRANCH_OP(name, cond) \
+    inline TailNext op_##name(TAIL_PARAMS) { \
+        auto&& c = view<name>(core, regs, ram); \
+        if (cond) TAIL_GO(base + instr->imm); \
+        TAIL_GO(instr + 1); \
+    }
+    ERGON_BRANCH_OPS(BRANCH_OP)
+    #undef BRANCH_OP
+
+    inline TailNext op_JMP(TAIL_PARAMS) {
+        TAIL_GO(base + instr->imm);
+    }
+
+    inline TailNext op_CALL(TAIL_PARAMS) {
+        auto&& c = view<CALL>(core, regs, ram);
+        core.PC = static_cast<uint32_t>(instr - base);
+        c.SP -= 4;
+        c.store32(c.SP, static_cast<uint32_t>(instr - base) + 1);
+        TAIL_GO(base + instr->imm);
+    }
+
+    inline TailNext op_RET(TAIL_PARAMS) {
+        auto&& c = view<RET>(core, regs, ram);
+        uint32_t pc = c.load32(c.SP);
+        c.SP += 4;
+        TAIL_GO(base + (pc < size ? pc : size));
+    }
+
+    // also the end-of-ROM sentinel
+    inline TailNext op_HALT(TAIL_PARAMS) {
+        core.PC = static_cast<uint32_t>(instr - base);
+        TAIL_STOP();
+    }
+
+    // super-instructions: head and compare in place, then into the branch handler with the last slot
+    #define FUSED_TRIPLE(name, head, cmp, jump) \
+    inline TailNext op_##name(TAIL_PARAMS) { \
+        { \
+            auto&& c = view<head>(core, regs, ram); \
+            ERGON_SEM_##head; \
+        } \
+        ++instr; \
+        { \
+            auto&& c = view<cmp>(core, regs, ram); \
+            ERGON_SEM_##cmp; \
+        } \
+        TAIL_INTO(op_##jump, instr + 1); \
+    }
+    #define FUSED_PAIR(name, cmp, jump) \
+    inline TailNext op_##name(TAIL_PARAMS) { \
+        auto&& c = view<cmp>(core, regs, ram); \
+        ERGON_SEM_##cmp; \
+        TAIL_INTO(op_##jump, instr + 1); \
+    }
+    ERGON_FUSED_TRIPLES(FUSED_TRIPLE)
+    ERGON_FUSED_PAIRS(FUSED_PAIR)
+    #undef FUSED_TRIPLE
+    #undef FUSED_PAIR
+
+    #define ERGON_TABLE_ENTRY(name) &op_##name,
+    inline constexpr TailHandler handlers[256] = { ERGON_OPCODES(ERGON_TABLE_ENTRY) };
+    #undef ERGON_TABLE_ENTRY
+
+    #undef I_IMM
+    #undef I_SHAMT
+    #undef I_OFF
+    #undef I_TARGET
+    #undef TAIL_PARAMS
+    #undef TAIL_GO
+    #undef TAIL_INTO
+    #undef TAIL_STOP
+}
+
+// the slots of thread_prog() (operands already decoded) with a function per opcode instead of a label
+inline TailCode tail_prog(const ThreadedCode& threaded) {
+    TailCode code(threaded.size());
+    for (size_t pc = 0; pc < threaded.size(); pc++) {
+        const ThreadedInstr& T = threaded[pc];
+        code[pc] = { tail::handlers[T.opcode], T.opcode, T.rd, T.rs1, T.rs2, T.imm };
+    }
+    return code;
+}
+
+// until HALT (or the end of the ROM), from c.PC
+inline void run(SimpleCore& c, const TailCode& code) {
+    if (code.empty() || c.PC >= code.size() - 1) return;
+    const TailInstr* const base = code.data();
+    const auto size = static_cast<uint32_t>(code.size() - 1);
+    const TailInstr* instr = base + c.PC;
+#ifdef TALOS_TAIL_CALLS
+    instr->handler(c, instr, c.regs.data(), c.ram.data(), base, size);
+#else
+    while (instr != nullptr) instr = instr->handler(c, instr, c.regs.data(), c.ram.data(), base, size);
+#endif
+}
+
+#endif
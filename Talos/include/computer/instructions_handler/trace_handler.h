@@ -0,0 +1,628 @@
+#ifndef ERGON_TRACE_HANDLER_H
+#define ERGON_TRACE_HANDLER_H
+
+#include "computer/core.h"
+#include "step_handler.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+    #define TALOS_JIT_AVAILABLE 1
+    #include <sys/mman.h>
+#else
+    #define TALOS_JIT_AVAILABLE 0
+#endif
+
+/*
+Tracing tier of the JIT (x86-64, System V), for the loops the baseline finds hot:
+ - every taken backward JMP/Jcc of the baseline code counts down a counter of its target,
+   at 0 the baseline exits with PC on the loop head (JitExit::HOT)
+ - the loop is then run once through step_instr() and recorded: the path it took, until PC is back on the head
+ - the path is compiled as a native loop: the guest registers it uses most live in host registers,
+   loads and stores go straight to the RAM and compares stay in the host flags until something reads regs[13]
+ - every branch of the path is a guard, leaving the path writes the host registers back, sets PC
+   and returns: the baseline goes on from there
+ - so is every store: one outside of the RAM leaves the path on it, the baseline then faults with PC
+   and the registers of the store
+ - a loop with a call, a division, the FPU or anything multicore on its path is never traced
+*/
+
+struct TraceOp {
+    uint32_t pc;
+    DecodedInstr instr; // opcode is the fused head
+    bool taken; // branches: what the recorded run did
+};
+
+namespace trace {
+
+// host registers
+constexpr uint8_t RAX = 0, RCX = 1, RDX = 2, RBX = 3, RBP = 5, RSI = 6, RDI = 7;
+constexpr uint8_t R8 = 8, R9 = 9, R10 = 10, R11 = 11, R12 = 12, R13 = 13, R14 = 14, R15 = 15;
+// rbx: SimpleCore, r15: RAM base, r14: dirty map, rax / rcx / rdx: scratch, the rest holds guest registers
+constexpr std::array<uint8_t, 9> POOL = { RBP, R12, R13, RSI, RDI, R8, R9, R10, R11 };
+
+constexpr uint8_t CMP_REG = 13;
+constexpr uint8_t SP = 15;
+
+// condition codes (low nibble of jcc / setcc / cmovcc)
+constexpr int CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7, CC_L = 0xC, CC_G = 0xF;
+constexpr int NEVER = -1;
+
+inline bool traceable(uint8_t op) {
+    switch (op) {
+    case ADD: case SUB: case AND: case OR: case XOR: case MUL:
+    case ADDI: case SUBI: case ANDI: case ORI: case XORI: case MULI:
+    case SHL: case SHR: case SAR: case ROL: case ROR:
+    case SHLI: case SHRI: case SARI: case ROLI: case RORI:
+    case CMP: case CMPU: case CMPI: case CMPUI: case TEST: case TESTI:
+    case INC: case DEC: case NOT: case ABS: case NEG: case MIN: case MAX:
+    case MOV_IMM: case MOV_REG: case CLR: case SWAP: case LEA:
+    case LDB_ABS: case LDH_ABS: case LDW_ABS: case STB_ABS: case STH_ABS: case STW_ABS:
+    case LDB_BASE: case LDH_BASE: case LDW_BASE: case STB_BASE: case STH_BASE: case STW_BASE:
+    case PUSH: case POP:
+    case JMP: case JZ: case JNZ: case JG: case JL:
+        return true;
+    default:
+        return false;
+    }
+}
+
+inline bool is_branch(uint8_t op) { return op == JMP || op == JZ || op == JNZ || op == JG || op == JL; }
+inline bool is_store(uint8_t op) {
+    return op == STB_ABS || op == STH_ABS || op == STW_ABS || op == STB_BASE || op == STH_BASE || op == STW_BASE;
+}
+inline bool is_compare(uint8_t op) { return op == CMP || op == CMPU || op == CMPI || op == CMPUI || op == TEST || op == TESTI; }
+inline bool writes_rd(uint8_t op) { return !is_branch(op) && !is_store(op) && !is_compare(op) && op != PUSH; }
+inline bool reg_rs2(uint8_t op) {
+    return op == ADD || op == SUB || op == AND || op == OR || op == XOR || op == MUL || op == SHL || op == SHR || op == SAR
+        || op == ROL || op == ROR || op == CMP || op == CMPU || op == TEST || op == MIN || op == MAX;
+}
+
+// compare of the path whose result is still in the host flags
+struct Flags {
+    enum Kind : uint8_t { NONE, SIGNED, UNSIGNED, TEST } kind = NONE;
+    uint8_t a = 0, b = 0; // guest registers compared
+    bool b_imm = false;
+    uint32_t imm = 0;
+};
+
+// condition of a branch on these flags, NEVER if it cannot be taken
+inline int taken_cc(Flags::Kind kind, uint8_t op) {
+    switch (kind) {
+    case Flags::UNSIGNED: return op == JZ ? CC_E : op == JNZ ? CC_NE : op == JG ? CC_A : CC_B;
+    case Flags::TEST: return op == JZ ? CC_E : op == JL ? NEVER : CC_NE; // 0 or 1
+    default: return op == JZ ? CC_E : op == JNZ ? CC_NE : op == JG ? CC_G : CC_L; // signed, or cmp [regs[13]], 0
+    }
+}
+
+struct Emitter {
+    std::vector<uint8_t> code;
+    int32_t regs_off = 0;
+    int32_t pc_off = 0;
+    std::array<int8_t, 16> host{}; // host register of every guest register, -1: stays in SimpleCore::regs
+
+    void u8(uint8_t v) { code.push_back(v); }
+    void u32(uint32_t v) { for (int i = 0; i < 4; i++) u8((v >> (i * 8)) & 0xFF); }
+    void bytes(std::initializer_list<uint8_t> b) { code.insert(code.end(), b); }
+
+    int32_t slot(uint8_t guest) const { return regs_off + 4 * (guest & 15); }
+    void rex(uint8_t reg, uint8_t base) {
+        const uint8_t r = 0x40 | ((reg >> 3) << 2) | (base >> 3);
+        if (r != 0x40) u8(r);
+    }
+    static uint8_t modrm(uint8_t reg, uint8_t rm) { return 0xC0 | ((reg & 7) << 3) | (rm & 7); }
+
+    // op r/m32, r32
+    void rr(uint8_t op, uint8_t dst, uint8_t src) { rex(src, dst); u8(op); u8(modrm(src, dst)); }
+    void mov(uint8_t dst, uint8_t src) { if (dst != src) rr(0x89, dst, src); }
+    void mov_imm(uint8_t dst, uint32_t imm) { rex(0, dst); u8(0xB8 | (dst & 7)); u32(imm); }
+    // 81 /ext: add 0, or 1, and 4, sub 5, xor 6, cmp 7
+    void alu_imm(uint8_t ext, uint8_t dst, uint32_t imm) { rex(0, dst); u8(0x81); u8(modrm(ext, dst)); u32(imm); }
+    void test_imm(uint8_t dst, uint32_t imm) { rex(0, dst); u8(0xF7); u8(modrm(0, dst)); u32(imm); }
+    // C1 / D3 /ext: rol 0, ror 1, shl 4, shr 5, sar 7
+    void shift_imm(uint8_t ext, uint8_t dst, uint8_t n) { rex(0, dst); u8(0xC1); u8(modrm(ext, dst)); u8(n); }
+    void shift_cl(uint8_t ext, uint8_t dst) { rex(0, dst); u8(0xD3); u8(modrm(ext, dst)); }
+    void unary(uint8_t ext, uint8_t dst) { rex(0, dst); u8(0xF7); u8(modrm(ext, dst)); } // not 2, neg 3
+    void imul(uint8_t dst, uint8_t src) { rex(dst, src); bytes({ 0x0F, 0xAF }); u8(modrm(dst, src)); }
+    void imul_imm(uint8_t dst, uint8_t src, uint32_t imm) { rex(dst, src); u8(0x69); u8(modrm(dst, src)); u32(imm); }
+
+    // op r32, [rbx + slot]
+    void at_slot(uint8_t op, uint8_t reg, uint8_t guest) { rex(reg, RBX); u8(op); u8(0x80 | ((reg & 7) << 3) | RBX); u32(slot(guest)); }
+    void load_slot(uint8_t reg, uint8_t guest) { at_slot(0x8B, reg, guest); }
+    void store_slot(uint8_t guest, uint8_t reg) { at_slot(0x89, reg, guest); }
+    void store_slot_imm(uint8_t guest, uint32_t imm) { u8(0xC7); u8(0x80 | RBX); u32(slot(guest)); u32(imm); }
+    void store_pc(uint32_t pc) { u8(0xC7); u8(0x80 | RBX); u32(pc_off); u32(pc); }
+
+    // [r15 + rax]: prefix / opcode bytes, then the register
+    void ram(std::initializer_list<uint8_t> prefix, std::initializer_list<uint8_t> op, uint8_t reg) {
+        code.insert(code.end(), prefix);
+        rex(reg, R15);
+        code.insert(code.end(), op);
+        u8(0x04 | ((reg & 7) << 3));
+        u8(0x07); // index rax, base r15
+    }
+
+    size_t jcc32(int cc) { u8(0x0F); u8(0x80 | cc); u32(0); return code.size() - 4; }
+    size_t jmp32() { u8(0xE9); u32(0); return code.size() - 4; }
+    void patch(size_t at, size_t target) {
+        auto rel = static_cast<int32_t>(static_cast<int64_t>(target) - static_cast<int64_t>(at + 4));
+        std::memcpy(&code[at], &rel, 4);
+    }
+
+    // host register holding the guest register, loaded in scratch if it has none
+    uint8_t read(uint8_t guest, uint8_t scratch) {
+        if (host[guest] >= 0) return static_cast<uint8_t>(host[guest]);
+        load_slot(scratch, guest);
+        return scratch;
+    }
+    // guest register -> dst
+    void read_into(uint8_t dst, uint8_t guest) {
+        if (host[guest] >= 0) mov(dst, static_cast<uint8_t>(host[guest]));
+        else load_slot(dst, guest);
+    }
+    // where to compute a new value of the guest register
+    uint8_t target(uint8_t guest) const { return host[guest] >= 0 ? static_cast<uint8_t>(host[guest]) : RAX; }
+    void write(uint8_t guest, uint8_t src) {
+        if (host[guest] >= 0) mov(static_cast<uint8_t>(host[guest]), src);
+        else store_slot(guest, src);
+    }
+};
+
+// native loop of a recorded path: trace(core, ram base, dirty map, ram size), returns on a side exit
+inline std::vector<uint8_t> compile_trace(const SimpleCore& c, const std::vector<TraceOp>& path) {
+    Emitter e;
+    e.regs_off = static_cast<int32_t>(reinterpret_cast<const uint8_t*>(c.regs.data()) - reinterpret_cast<const uint8_t*>(&c));
+    e.pc_off = static_cast<int32_t>(reinterpret_cast<const uint8_t*>(&c.PC) - reinterpret_cast<const uint8_t*>(&c));
+
+    // the guest registers used most get a host register, regs[13] never does (compares keep it in the flags)
+    std::array<uint32_t, 16> uses{};
+    for (const TraceOp& t : path) {
+        const uint8_t op = t.instr.opcode;
+        uses[t.instr.rd & 15]++;
+        uses[t.instr.rs1 & 15]++;
+        if (reg_rs2(op)) uses[t.instr.rs2 & 15]++;
+        if (op == PUSH || op == POP) uses[SP] += 2;
+    }
+    uses[CMP_REG] = 0;
+    std::array<uint8_t, 16> order{};
+    for (uint8_t r = 0; r < 16; r++) order[r] = r;
+    std::ranges::stable_sort(order, [&](uint8_t a, uint8_t b) { return uses[a] > uses[b]; });
+    e.host.fill(-1);
+    std::vector<uint8_t> allocated;
+    for (size_t i = 0; i < POOL.size() && uses[order[i]] > 0; i++) {
+        e.host[order[i]] = static_cast<int8_t>(POOL[i]);
+        allocated.push_back(order[i]);
+    }
+
+    // trace(core, ram base, dirty map, ram size)
+    e.bytes({ 0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57 }); // push rbx, rbp, r12 - r15
+    e.u8(0x51); // push rcx: the RAM size stays on [rsp]
+    e.bytes({ 0x48, 0x89, 0xFB }); // mov rbx, rdi
+    e.bytes({ 0x49, 0x89, 0xF7 }); // mov r15, rsi
+    e.bytes({ 0x49, 0x89, 0xD6 }); // mov r14, rdx
+    for (uint8_t g : allocated) e.load_slot(static_cast<uint8_t>(e.host[g]), g);
+    const size_t loop = e.code.size();
+
+    Flags flags;
+    // regs[13] = the flags: a, b in eax, ecx
+    auto materialize = [&](const Flags& f) {
+        if (f.kind == Flags::NONE) return;
+        e.read_into(RAX, f.a);
+        if (f.b_imm) e.mov_imm(RCX, f.imm);
+        else e.read_into(RCX, f.b);
+        if (f.kind == Flags::TEST) {
+            e.bytes({ 0x85, 0xC8, 0x0F, 0x95, 0xC0, 0x0F, 0xB6, 0xC0 }); // test eax, ecx; setne al; movzx eax, al
+            e.store_slot(CMP_REG, RAX);
+            return;
+        }
+        const bool is_signed = f.kind == Flags::SIGNED;
+        e.bytes({ 0x39, 0xC8 }); // cmp eax, ecx
+        e.bytes({ 0x0F, static_cast<uint8_t>(is_signed ? 0x9F : 0x97), 0xC2 }); // setg / seta dl
+        e.bytes({ 0x0F, static_cast<uint8_t>(is_signed ? 0x9C : 0x92), 0xC0 }); // setl / setb al
+        e.bytes({ 0x0F, 0xB6, 0xD2, 0x0F, 0xB6, 0xC0, 0x29, 0xC2 }); // movzx edx, dl; movzx eax, al; sub edx, eax
+        e.store_slot(CMP_REG, RDX);
+    };
+    auto flush = [&] {
+        materialize(flags);
+        flags = { };
+    };
+    auto before_read = [&](uint8_t guest) {
+        if (guest == CMP_REG) flush();
+    };
+    auto before_write = [&](uint8_t guest) {
+        if (flags.kind != Flags::NONE && (guest == flags.a || (!flags.b_imm && guest == flags.b))) flush();
+        if (guest == CMP_REG) flags = { };
+    };
+
+    struct Exit {
+        size_t at;
+        uint32_t pc;
+        Flags flags;
+    };
+    std::vector<Exit> exits;
+
+    // jump to a side exit on cc
+    auto guard = [&](int cc, uint32_t exit_pc) {
+        exits.push_back({ e.jcc32(cc), exit_pc, flags });
+    };
+    // the condition of branch op is now in the host flags, NEVER if it cannot be taken
+    auto condition = [&](uint8_t op) -> int {
+        if (flags.kind == Flags::NONE) {
+            e.u8(0x83); e.u8(0x80 | (7 << 3) | RBX); e.u32(e.slot(CMP_REG)); e.u8(0); // cmp dword [regs[13]], 0
+            return taken_cc(Flags::NONE, op);
+        }
+        const int cc = taken_cc(flags.kind, op);
+        if (cc == NEVER) return cc;
+        const uint8_t a = e.read(flags.a, RAX);
+        if (flags.b_imm) {
+            if (flags.kind == Flags::TEST) e.test_imm(a, flags.imm);
+            else e.alu_imm(7, a, flags.imm);
+        } else
+            e.rr(flags.kind == Flags::TEST ? 0x85 : 0x39, a, e.read(flags.b, RCX));
+        return cc;
+    };
+
+    // value at the address of a load / store -> eax
+    auto address = [&](const DecodedInstr& I, bool base) {
+        if (!base) {
+            e.mov_imm(RAX, I.imm);
+            return;
+        }
+        e.read_into(RAX, I.rs1);
+        const auto off = static_cast<int8_t>(I.imm);
+        if (off != 0) e.alu_imm(0, RAX, static_cast<uint32_t>(static_cast<int32_t>(off)));
+    };
+    auto load = [&](const DecodedInstr& I, uint8_t size) {
+        const uint8_t t = e.target(I.rd);
+        if (size == 4) e.ram({ }, { 0x8B }, t);
+        else if (size == 2) e.ram({ }, { 0x0F, 0xBF }, t); // movsx
+        else e.ram({ }, { 0x0F, 0xBE }, t);
+        e.write(I.rd, t);
+    };
+    // guard of a store of size bytes at eax: leaves the path on it if it ends past the RAM size
+    auto writable = [&](uint8_t size, uint32_t pc) {
+        e.bytes({ 0x48, 0x8D, 0x50, size }); // lea rdx, [rax + size]
+        e.bytes({ 0x48, 0x3B, 0x14, 0x24 }); // cmp rdx, [rsp]
+        guard(CC_A, pc);
+    };
+    // ecx -> [ram + eax], then the dirty map like GuestRam::mark_dirty()
+    auto store = [&](uint8_t size) {
+        if (size == 4) e.ram({ }, { 0x89 }, RCX);
+        else if (size == 2) e.ram({ 0x66 }, { 0x89 }, RCX);
+        else e.ram({ }, { 0x88 }, RCX);
+        e.bytes({ 0x89, 0xC2, 0xC1, 0xEA, 0x0C }); // mov edx, eax; shr edx, 12
+        e.bytes({ 0x41, 0xC6, 0x04, 0x16, 0x01 }); // mov byte [r14 + rdx], 1
+        if (size == 1) return;
+        e.bytes({ 0x8D, 0x50, static_cast<uint8_t>(size - 1), 0xC1, 0xEA, 0x0C }); // lea edx, [rax + size - 1]; shr edx, 12
+        e.bytes({ 0x41, 0xC6, 0x04, 0x16, 0x01 });
+    };
+    // rd = rs1 op rs2, op being "op r/m32, r32"
+    auto alu_rr = [&](const DecodedInstr& I, uint8_t op) {
+        uint8_t t = e.target(I.rd);
+        if (I.rs1 != I.rs2 && e.host[I.rs2] >= 0 && t == e.host[I.rs2]) t = RAX;
+        const uint8_t b = e.read(I.rs2, RCX);
+        e.read_into(t, I.rs1);
+        if (op == 0xAF) e.imul(t, b);
+        else e.rr(op, t, b);
+        e.write(I.rd, t);
+    };
+    // rd = rs1 op imm, ext being the /digit of 81
+    auto alu_ri = [&](const DecodedInstr& I, uint8_t ext, uint32_t imm) {
+        const uint8_t t = e.target(I.rd);
+        e.read_into(t, I.rs1);
+        e.alu_imm(ext, t, imm);
+        e.write(I.rd, t);
+    };
+    auto shift_r = [&](const DecodedInstr& I, uint8_t ext) {
+        e.read_into(RCX, I.rs2);
+        const uint8_t t = e.target(I.rd);
+        e.read_into(t, I.rs1);
+        e.shift_cl(ext, t);
+        e.write(I.rd, t);
+    };
+    auto shift_i = [&](const DecodedInstr& I, uint8_t ext) {
+        const uint8_t t = e.target(I.rd);
+        e.read_into(t, I.rs1);
+        e.shift_imm(ext, t, I.rs2 & 31);
+        e.write(I.rd, t);
+    };
+    auto compare = [&](const DecodedInstr& I, Flags::Kind kind, bool imm) {
+        flags = { };
+        if (I.rs1 == CMP_REG || (!imm && I.rs2 == CMP_REG)) { // reads what it overwrites: straight to regs[13]
+            materialize({ kind, I.rs1, I.rs2, imm, I.rs2 });
+            return;
+        }
+        flags = { kind, I.rs1, I.rs2, imm, I.rs2 };
+    };
+
+    for (size_t i = 0; i < path.size(); i++) {
+        const TraceOp& t = path[i];
+        const DecodedInstr& I = t.instr;
+        const uint8_t op = I.opcode;
+
+        before_read(I.rd);
+        before_read(I.rs1);
+        if (reg_rs2(op)) before_read(I.rs2);
+        if (writes_rd(op)) before_write(I.rd);
+        if (op == SWAP) before_write(I.rs1);
+        if (op == PUSH || op == POP) before_write(SP);
+
+        switch (op) {
+        case ADD: alu_rr(I, 0x01); break;
+        case SUB: alu_rr(I, 0x29); break;
+        case AND: alu_rr(I, 0x21); break;
+        case OR: alu_rr(I, 0x09); break;
+        case XOR: alu_rr(I, 0x31); break;
+        case MUL: alu_rr(I, 0xAF); break;
+        case ADDI: alu_ri(I, 0, I.rs2); break;
+        case SUBI: alu_ri(I, 5, I.rs2); break;
+        case ANDI: alu_ri(I, 4, I.rs2); break;
+        case ORI: alu_ri(I, 1, I.rs2); break;
+        case XORI: alu_ri(I, 6, I.rs2); break;
+        case MULI: {
+            const uint8_t d = e.target(I.rd);
+            e.imul_imm(d, e.read(I.rs1, RCX), I.rs2);
+            e.write(I.rd, d);
+            break;
+        }
+
+        case SHL: shift_r(I, 4); break;
+        case SHR: shift_r(I, 5); break;
+        case SAR: shift_r(I, 7); break;
+        case ROL: shift_r(I, 0); break;
+        case ROR: shift_r(I, 1); break;
+        case SHLI: shift_i(I, 4); break;
+        case SHRI: shift_i(I, 5); break;
+        case SARI: shift_i(I, 7); break;
+        case ROLI: shift_i(I, 0); break;
+        case RORI: shift_i(I, 1); break;
+
+        case CMP: compare(I, Flags::SIGNED, false); break;
+        case CMPU: compare(I, Flags::UNSIGNED, false); break;
+        case TEST: compare(I, Flags::TEST, false); break;
+        case CMPI: compare(I, Flags::SIGNED, true); break;
+        case TESTI: compare(I, Flags::TEST, true); break;
+        case CMPUI: // regs[13] = rs1 < imm ? -1 : 0 (never 1)
+            flags = { };
+            e.read_into(RAX, I.rs1);
+            e.alu_imm(7, RAX, I.rs2);
+            e.bytes({ 0x19, 0xD2 }); // sbb edx, edx
+            e.store_slot(CMP_REG, RDX);
+            break;
+
+        case INC:
+        case DEC: {
+            const uint8_t d = e.target(I.rd);
+            e.read_into(d, I.rd);
+            e.alu_imm(op == INC ? 0 : 5, d, 1);
+            e.write(I.rd, d);
+            break;
+        }
+        case NOT: {
+            const uint8_t d = e.target(I.rd);
+            e.read_into(d, I.rs1);
+            e.unary(2, d);
+            e.write(I.rd, d);
+            break;
+        }
+        case ABS:
+            e.read_into(RAX, I.rs1);
+            e.bytes({ 0x85, 0xC0, 0x79, 0x02, 0xF7, 0xD8 }); // test eax, eax; jns +2; neg eax
+            e.write(I.rd, RAX);
+            break;
+        case NEG: {
+            e.read_into(RAX, I.rs1);
+            e.unary(3, RAX);
+            e.bytes({ 0x70, 0x00 }); // jo over the write: -INT32_MIN leaves rd as it was
+            const size_t skip = e.code.size();
+            e.write(I.rd, RAX);
+            e.code[skip - 1] = static_cast<uint8_t>(e.code.size() - skip);
+            break;
+        }
+        case MIN:
+        case MAX:
+            e.read_into(RCX, I.rs2);
+            e.read_into(RAX, I.rs1);
+            e.bytes({ 0x39, 0xC8, 0x0F, static_cast<uint8_t>(op == MIN ? 0x43 : 0x46), 0xC1 }); // cmp eax, ecx; cmovae / cmovbe eax, ecx
+            e.write(I.rd, RAX);
+            break;
+
+        case MOV_IMM:
+        case CLR: {
+            const uint32_t v = op == CLR ? 0 : static_cast<uint32_t>(I.imm);
+            if (e.host[I.rd] >= 0) e.mov_imm(static_cast<uint8_t>(e.host[I.rd]), v);
+            else e.store_slot_imm(I.rd, v);
+            break;
+        }
+        case MOV_REG: e.write(I.rd, e.read(I.rs1, RAX)); break;
+        case SWAP:
+            e.read_into(RAX, I.rd);
+            e.read_into(RCX, I.rs1);
+            e.write(I.rd, RCX);
+            e.write(I.rs1, RAX);
+            break;
+        case LEA: alu_ri(I, 0, static_cast<uint32_t>(static_cast<int32_t>(static_cast<int8_t>(I.imm)))); break;
+
+        case LDB_ABS: case LDB_BASE: address(I, op == LDB_BASE); load(I, 1); break;
+        case LDH_ABS: case LDH_BASE: address(I, op == LDH_BASE); load(I, 2); break;
+        case LDW_ABS: case LDW_BASE: address(I, op == LDW_BASE); load(I, 4); break;
+        case STB_ABS: case STB_BASE: e.read_into(RCX, I.rd); address(I, op == STB_BASE); writable(1, t.pc); store(1); break;
+        case STH_ABS: case STH_BASE: e.read_into(RCX, I.rd); address(I, op == STH_BASE); writable(2, t.pc); store(2); break;
+        case STW_ABS: case STW_BASE: e.read_into(RCX, I.rd); address(I, op == STW_BASE); writable(4, t.pc); store(4); break;
+
+        case PUSH: { // SP -= 4 first: push sp stores the new SP
+            e.read_into(RAX, SP);
+            e.alu_imm(5, RAX, 4);
+            writable(4, t.pc); // before SP changes, the baseline runs the whole push again
+            const uint8_t s = e.target(SP);
+            e.read_into(s, SP);
+            e.alu_imm(5, s, 4);
+            e.write(SP, s);
+            e.read_into(RCX, I.rs1);
+            e.read_into(RAX, SP);
+            store(4);
+            break;
+        }
+        case POP: {
+            e.read_into(RAX, SP);
+            load(I, 4);
+            const uint8_t s = e.target(SP);
+            e.read_into(s, SP);
+            e.alu_imm(0, s, 4);
+            e.write(SP, s);
+            break;
+        }
+
+        case JMP: break; // the path goes on at the target
+        default: { // JZ JNZ JG JL
+            const int cc = condition(op);
+            if (cc == NEVER) break; // the path did not take it either
+            guard(t.taken ? cc ^ 1 : cc, t.taken ? t.pc + 1 : static_cast<uint32_t>(static_cast<int64_t>(t.pc) + 1 + I.imm));
+            break;
+        }
+        }
+    }
+
+    // back edge: regs[13] as the loop head expects it, known when the last branch was taken on it
+    const TraceOp& last = path.back();
+    if (flags.kind != Flags::NONE) {
+        int32_t known = 2;
+        const uint8_t op = last.instr.opcode;
+        if (op == JZ) known = 0;
+        else if (op == JG || (op == JNZ && flags.kind == Flags::TEST)) known = 1;
+        else if (op == JL && flags.kind != Flags::TEST) known = -1;
+        if (known != 2) e.store_slot_imm(CMP_REG, static_cast<uint32_t>(known));
+        else materialize(flags);
+    }
+    e.patch(e.jmp32(), loop);
+
+    // side exits: the compare still pending, every host register back in SimpleCore::regs
+    const size_t epilogue = e.code.size();
+    for (uint8_t g : allocated) e.store_slot(g, static_cast<uint8_t>(e.host[g]));
+    e.u8(0x59); // pop rcx
+    e.bytes({ 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B, 0xC3 }); // pop r15 - r12, rbp, rbx; ret
+    for (const Exit& x : exits) {
+        e.patch(x.at, e.code.size());
+        materialize(x.flags);
+        e.store_pc(x.pc);
+        e.patch(e.jmp32(), epilogue);
+    }
+    return e.code;
+}
+
+}
+
+struct Trace {
+    uint8_t* mem = nullptr;
+    size_t mem_size = 0;
+    uint32_t head = 0;
+    uint32_t length = 0; // guest instructions
+
+    Trace() = default;
+    Trace(const Trace&) = delete;
+    Trace& operator=(const Trace&) = delete;
+    ~Trace() {
+    #if TALOS_JIT_AVAILABLE
+        if (mem) munmap(mem, mem_size);
+    #endif
+    }
+
+    // runs the loop until one of its guards fails, PC is then where the path was left
+    void enter(SimpleCore& c) const {
+        using Entry = void (*)(SimpleCore*, uint8_t*, uint8_t*, size_t);
+        reinterpret_cast<Entry>(mem)(&c, c.ram.data(), c.ram.dirty.data(), c.ram.size());
+    }
+};
+
+struct TraceStats {
+    size_t compiled = 0;
+    size_t aborted = 0; // loops that could not be traced, left to the baseline
+};
+
+// traces by loop head, shared by every core running the same JitProgram
+struct TraceCache {
+    static constexpr size_t MAX_LENGTH = 256; // guest instructions in a path
+    static constexpr size_t MAX_TRACES = 1024;
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Trace>> traces;
+    std::unique_ptr<std::atomic<const Trace*>[]> by_head;
+    size_t size = 0;
+    TraceStats stats;
+
+    void reset(size_t rom_size) {
+        std::lock_guard lock(mutex);
+        traces.clear();
+        size = rom_size;
+        by_head = std::make_unique<std::atomic<const Trace*>[]>(rom_size);
+        stats = { };
+    }
+
+    const Trace* find(uint32_t head) const {
+        return head < size ? by_head[head].load(std::memory_order_acquire) : nullptr;
+    }
+
+    // records the loop at c.PC by running it once with step_instr(), then compiles it
+    // nullptr if it cannot be traced: PC is then wherever the recording stopped
+    // the guest runs without the lock: a store fault jumps straight back to guarded_run(), past any destructor.
+    // Two cores may record the same loop, the first one to publish it wins
+    const Trace* record(SimpleCore& c, const std::vector<DecodedInstr>& prog) {
+        const uint32_t head = c.PC;
+        if (head >= size) return nullptr;
+        if (const Trace* t = find(head)) return t;
+
+        thread_local std::vector<TraceOp> path; // not freed by a fault either
+        path.clear();
+        bool closed = false;
+        while (path.size() < MAX_LENGTH && c.PC < prog.size()) {
+            const uint32_t pc = c.PC;
+            DecodedInstr I = prog[pc];
+            I.opcode = fused_head(I.opcode);
+            if (!trace::traceable(I.opcode)) break;
+            step_instr(c, prog[pc]);
+            path.push_back({ pc, I, c.PC != pc + 1 });
+            if (c.PC == head) {
+                closed = true;
+                break;
+            }
+            if (c.PC <= pc) break; // an inner loop
+        }
+        if (!closed) {
+            std::lock_guard lock(mutex);
+            stats.aborted++;
+            return nullptr;
+        }
+
+    #if !TALOS_JIT_AVAILABLE
+        return nullptr;
+    #else
+        const std::vector<uint8_t> code = trace::compile_trace(c, path);
+        auto t = std::make_unique<Trace>();
+        t->mem_size = (code.size() + 4095) & ~size_t(4095);
+        void* p = mmap(nullptr, t->mem_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) return nullptr;
+        t->mem = static_cast<uint8_t*>(p);
+        std::memcpy(t->mem, code.data(), code.size());
+        if (mprotect(t->mem, t->mem_size, PROT_READ | PROT_EXEC) != 0) return nullptr;
+        t->head = head;
+        t->length = static_cast<uint32_t>(path.size());
+
+        std::lock_guard lock(mutex);
+        if (const Trace* other = find(head)) return other;
+        if (traces.size() >= MAX_TRACES) return nullptr;
+        by_head[head].store(t.get(), std::memory_order_release);
+        stats.compiled++;
+        traces.push_back(std::move(t));
+        return traces.back().get();
+    #endif
+    }
+};
+
+
+#endif
@@ -1,9 +1,26 @@
 #ifndef ERGON_MEMORY_H
 #define ERGON_MEMORY_H
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <cstdint>
+#include <cstring>
+#include <csetjmp>
+#include <csignal>
+#include <mutex>
+#include <new>
 #include <vector>
 
+#if defined(__unix__) || defined(__APPLE__)
+    #include <sys/mman.h>
+    #include <unistd.h>
+#else
+    #error "GuestRam reserves the guest address space with mmap, only POSIX hosts are supported"
+#endif
+
+static_assert(std::endian::native == std::endian::little, "guest memory is little-endian and accessed with host loads");
+
 
 struct Bus {
     bool used = false; //cannot write when memory is being written
@@ -26,4 +43,140 @@ struct ROM : Memory {
     }
 };
 
-#endif
\ No newline at end of file
+
+/*
+Guest RAM backed by a reservation of the whole 32-bit address space (+ a guard for the
+last bytes of a word at 0xFFFFFFFF), so any guest address is a valid host offset:
+ - [0, size()) is read-write, the kernel only commits pages on first touch
+ - everything above is mapped read-only: loads there read zeros, stores fault
+ - a store fault inside guarded_run() ends the run instead of killing the process
+ - every guest store marks its 4 KiB granule in a dirty map, for snapshots (see MotherBoard::snapshot())
+*/
+struct GuestRam {
+    static constexpr uint64_t ADDRESS_SPACE = 1ull << 32;
+    static constexpr uint64_t GUARD = 1ull << 16;
+
+    static constexpr uint32_t DIRTY_SHIFT = 12; // 4 KiB granules, whatever the host page size
+    static constexpr size_t GRANULE = size_t(1) << DIRTY_SHIFT;
+
+    uint8_t* base = nullptr;
+    size_t length = 0; // writable bytes, multiple of the page size
+    std::vector<uint8_t> dirty; // one byte per granule, set by the SimpleCore store helpers
+
+    explicit GuestRam(size_t size) {
+        static const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        if (size > ADDRESS_SPACE) size = ADDRESS_SPACE;
+        length = (size + page - 1) & ~(page - 1);
+
+        void* p = mmap(nullptr, ADDRESS_SPACE + GUARD, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED) throw std::bad_alloc();
+        base = static_cast<uint8_t*>(p);
+        if (length != 0 && mprotect(base, length, PROT_READ | PROT_WRITE) != 0) {
+            munmap(base, ADDRESS_SPACE + GUARD);
+            throw std::bad_alloc();
+        }
+        dirty.assign((length >> DIRTY_SHIFT) + 1, 0);
+        install_fault_handler();
+    }
+    GuestRam(const GuestRam&) = delete;
+    GuestRam& operator=(const GuestRam&) = delete;
+    ~GuestRam() {
+        if (base) munmap(base, ADDRESS_SPACE + GUARD);
+    }
+
+    size_t size() const { return length; }
+    uint8_t* data() { return base; }
+    const uint8_t* data() const { return base; }
+    uint8_t* begin() { return base; }
+    uint8_t* end() { return base + length; }
+    const uint8_t* begin() const { return base; }
+    const uint8_t* end() const { return base + length; }
+    uint8_t& operator[](size_t i) { return base[i]; }
+    const uint8_t& operator[](size_t i) const { return base[i]; }
+
+    // gives the pages back to the kernel, they read as zero again (no memset of the whole RAM)
+    void clear() {
+        if (length != 0) madvise(base, length, MADV_DONTNEED);
+        clear_dirty();
+    }
+
+    // called after the store: a store that faulted never gets here, so addr is below size()
+    void mark_dirty(uint32_t addr) {
+        std::atomic_ref<uint8_t>(dirty[addr >> DIRTY_SHIFT]).store(1, std::memory_order_relaxed);
+    }
+    void mark_dirty(uint32_t addr, uint32_t bytes) {
+        mark_dirty(addr);
+        mark_dirty(addr + bytes - 1); // may straddle two granules
+    }
+    void clear_dirty() {
+        std::ranges::fill(dirty, 0);
+    }
+
+    // the fault handler only acts for the thread that armed it, on the RAM it is running
+    struct FaultGuard {
+        sigjmp_buf env;
+        const uint8_t* lo = nullptr;
+        const uint8_t* hi = nullptr;
+        bool armed = false;
+    };
+    static FaultGuard& fault_guard() {
+        thread_local FaultGuard guard;
+        return guard;
+    }
+
+    static void install_fault_handler() {
+        static std::once_flag once;
+        std::call_once(once, [] {
+            struct sigaction sa{};
+            sa.sa_sigaction = &on_fault;
+            sa.sa_flags = SA_SIGINFO;
+            sigemptyset(&sa.sa_mask);
+            sigaction(SIGSEGV, &sa, &previous_handler());
+            sigaction(SIGBUS, &sa, &previous_bus_handler());
+        });
+    }
+
+private:
+    static struct sigaction& previous_handler() { static struct sigaction sa{}; return sa; }
+    static struct sigaction& previous_bus_handler() { static struct sigaction sa{}; return sa; }
+
+    static void on_fault(int sig, siginfo_t* info, void* ctx) {
+        FaultGuard& guard = fault_guard();
+        auto addr = static_cast<const uint8_t*>(info->si_addr);
+        if (guard.armed && addr >= guard.lo && addr < guard.hi) {
+            guard.armed = false;
+            siglongjmp(guard.env, 1);
+        }
+        // not a guest store: hand it to whoever was there before, or crash as usual
+        struct sigaction& prev = sig == SIGSEGV ? previous_handler() : previous_bus_handler();
+        if (prev.sa_flags & SA_SIGINFO && prev.sa_sigaction) {
+            prev.sa_sigaction(sig, info, ctx);
+            return;
+        }
+        if (prev.sa_handler != SIG_DFL && prev.sa_handler != SIG_IGN && prev.sa_handler) {
+            prev.sa_handler(sig);
+            return;
+        }
+        signal(sig, SIG_DFL);
+    }
+};
+
+// runs f(), returns false if it stored outside of the writable RAM
+// nothing local lives across sigsetjmp() (it would be clobbered): the guard is read again after it
+template<typename F>
+bool guarded_run(const GuestRam& ram, F&& f) {
+    if (GuestRam::fault_guard().armed) { // nested calls keep the outer jump point
+        f();
+        return true;
+    }
+    GuestRam::FaultGuard& guard = GuestRam::fault_guard();
+    guard.lo = ram.data();
+    guard.hi = ram.data() + GuestRam::ADDRESS_SPACE + GuestRam::GUARD;
+    if (sigsetjmp(guard.env, 1) != 0) return false;
+    GuestRam::fault_guard().armed = true;
+    f();
+    GuestRam::fault_guard().armed = false;
+    return true;
+}
+
+#endif
@@ -2,35 +2,125 @@
 #define ERGON_MOTHER_BOARD_H
 
 #include "cpu.h"
+#include "instructions_handler/run_handler.h"
 #include "asm/data.h"
 
+#include <algorithm>
 #include <atomic>
+#include <cstring>
+#include <span>
 #include <vector>
 
 
+// registers of every core and the RAM that was not zero (see MotherBoard::snapshot())
+struct MachineSnapshot {
+    struct CoreState {
+        std::array<uint32_t, 16> regs{};
+        std::array<uint32_t, 16> fregs{};
+        uint32_t PC = 0;
+        bool faulted = false;
+    };
+    std::vector<CoreState> cores;
+    std::vector<uint32_t> granules; // 4 KiB granules of the RAM that were not zero, sorted
+    std::vector<uint8_t> bytes; // their content, one after the other
+    bool valid = false;
+
+    // saved content of a granule, nullptr if it was zero
+    const uint8_t* granule(uint32_t index) const {
+        auto it = std::ranges::lower_bound(granules, index);
+        if (it == granules.end() || *it != index) return nullptr;
+        return bytes.data() + (it - granules.begin()) * GuestRam::GRANULE;
+    }
+};
+
 struct MotherBoard {
+    GuestRam ram; // declared before the cpu: the core reads its size for SP
     SimpleCPU cpu;
-    std::vector<uint8_t> ram{};
     std::vector<DecodedInstr> rom{};
+    ThreadedCode threaded{}; // rom translated once for run(), reused by every start()
+    MachineSnapshot saved{};
     bool running = false;
 
-    MotherBoard(size_t RAM_SIZE) : cpu(ram) {
-        if (RAM_SIZE >= 0xFFFFFF - 1) RAM_SIZE = 0xFFFFFF - 1;
-        ram.resize(RAM_SIZE);
-        std::ranges::fill(ram, 0);
+    // RAM_SIZE is rounded up to the host page size, up to the full 4 GiB
+    MotherBoard(size_t RAM_SIZE, size_t CORES = 1) : ram(RAM_SIZE), cpu(ram, CORES) {
+        cpu.reset();
     }
 
     void reset() {
         running = false;
 
-        std::ranges::fill(ram, 0);
+        cpu.reset();
+        drop_snapshot();
+        ram.clear();
         std::ranges::fill(rom, DecodedInstr());
+        threaded = thread_prog(rom);
     }
 
-    void load_prog(const std::vector<DecodedInstr>& program, size_t max_size = 0xFFFFFF - 1) {
+    void load_prog(std::vector<DecodedInstr> program, size_t max_size = 0xFFFFFF - 1) {
         if (max_size >= 0xFFFFFF - 1) max_size = 0xFFFFFF - 1;
-        rom = program;
+        rom = std::move(program);
         if (rom.size() > max_size) rom.resize(max_size);
+        threaded = thread_prog(rom);
+    }
+
+    // text of a program assembled at compile time (StaticProgram::text, see static_asm.h) or mapped from a file
+    void load_prog(std::span<const DecodedInstr> program, size_t max_size = 0xFFFFFF - 1) {
+        load_prog(std::vector<DecodedInstr>(program.begin(), program.end()), max_size);
+    }
+
+    // registers, PCs and RAM of the board, restore() comes back to it as many times as needed
+    // the cores must be joined, only the pages the host committed are looked at (mincore())
+    void snapshot() {
+        const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        saved = { };
+        for (const SimpleCore& c : cpu.cores)
+            saved.cores.push_back({ c.regs, c.fregs, c.PC, c.faulted });
+
+        std::vector<unsigned char> resident(ram.size() / page);
+#if defined(__APPLE__)
+        if (ram.size() != 0 && mincore(ram.data(), ram.size(), reinterpret_cast<char*>(resident.data())) != 0)
+#else
+        if (ram.size() != 0 && mincore(ram.data(), ram.size(), resident.data()) != 0)
+#endif
+            std::ranges::fill(resident, 1); // no idea: look at every page
+        for (size_t g = 0; g < ram.size() / GuestRam::GRANULE; g++) {
+            if (!(resident[g * GuestRam::GRANULE / page] & 1)) continue;
+            const uint8_t* bytes = ram.data() + g * GuestRam::GRANULE;
+            if (std::all_of(bytes, bytes + GuestRam::GRANULE, [](uint8_t b) { return b == 0; })) continue;
+            saved.granules.push_back(static_cast<uint32_t>(g));
+            saved.bytes.insert(saved.bytes.end(), bytes, bytes + GuestRam::GRANULE);
+        }
+
+        ram.clear_dirty(); // from now on every guest store marks its granule
+        saved.valid = true;
+    }
+
+    // back to the last snapshot(): only the granules stored to since get their saved content back (or zeros)
+    // false without a snapshot
+    bool restore() {
+        if (!saved.valid) return false;
+
+        for (size_t g = 0; g < ram.size() / GuestRam::GRANULE; g++) {
+            if (ram.dirty[g] == 0) continue;
+            uint8_t* bytes = ram.data() + g * GuestRam::GRANULE;
+            const uint8_t* from = saved.granule(static_cast<uint32_t>(g));
+            if (from != nullptr) std::memcpy(bytes, from, GuestRam::GRANULE);
+            else std::memset(bytes, 0, GuestRam::GRANULE);
+        }
+        ram.clear_dirty();
+
+        for (size_t i = 0; i < cpu.cores.size() && i < saved.cores.size(); i++) {
+            SimpleCore& c = cpu.cores[i];
+            c.regs = saved.cores[i].regs;
+            c.fregs = saved.cores[i].fregs;
+            c.PC = saved.cores[i].PC;
+            c.faulted = saved.cores[i].faulted;
+        }
+        return true;
+    }
+
+    void drop_snapshot() {
+        saved = { };
     }
 };
 
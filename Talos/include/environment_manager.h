@@ -4,8 +4,26 @@
 #include "computer/mother_board.h"
 #include "computer/instructions_handler/step_handler.h"
 #include "computer/instructions_handler/run_handler.h"
+#include "computer/instructions_handler/tail_handler.h"
+#include "computer/instructions_handler/jit_handler.h"
+#include "computer/instructions_handler/batch_handler.h"
+#include "computer/instructions_handler/aot_handler.h"
 #include "asm/decoder.h"
 #include "asm/linker.h"
+#include "asm/binary.h"
+#include "asm/static_asm.h"
+#include "asm/build_cache.h"
+#include "asm/parallel_decode.h"
+#include "asm/superinstructions.h"
+
+enum class ExecMode : uint8_t {
+    AUTO, // computed-goto interpreter (the TAIL one when built with TALOS_TAIL_DISPATCH)
+    STEP, // one instruction at a time, until HALT
+    JIT, // native x86-64 code, falls back to AUTO on other hosts
+    PROFILE, // AUTO counting every instruction, read with profile()
+    AOT, // program translated to C++ at build time (see aot.h), loaded with load_aot(), AUTO otherwise
+    TAIL // one function per opcode, tail-calling the next one (see tail_handler.h)
+};
 
 struct StepInfo {
     std::array<uint32_t, 16> regs{};
@@ -16,45 +34,63 @@ struct StepInfo {
     DecodedInstr instr;
 
     StepInfo() = default;
-    StepInfo(const MotherBoard& mb) {
-        regs = mb.cpu.core.regs;
-        fregs = mb.cpu.core.fregs;
-        PC = mb.cpu.core.PC;
-        SP = mb.cpu.core.SP;
+    StepInfo(const MotherBoard& mb) : StepInfo(mb, mb.cpu.core) {}
+    StepInfo(const MotherBoard& mb, const SimpleCore& core) {
+        regs = core.regs;
+        fregs = core.fregs;
+        PC = core.PC;
+        SP = core.SP;
 
-        instr = mb.rom[mb.cpu.core.PC];
+        if (core.PC < mb.rom.size()) instr = mb.rom[core.PC];
+        instr.opcode = fused_head(instr.opcode); // the instruction as written, not the super-instruction it heads
     }
 };
 
 
 struct EnvironmentManager {
     size_t RAM_SIZE = 65535; // 2^16 - 1
+    size_t CORES = 1;
     MotherBoard mb;
     AsmDecoder decoder;
+    BuildCache cache; // decoded files by content, build() only decodes what changed (cache.stats)
+    size_t build_threads = 0; // host threads decoding the files of a build and relocating them, 0: one per host thread
+    JitProgram jit; // compiled on the first JIT start after a build
+    TailCode tail; // made on the first TAIL start after a build
+    const AotProgram* aot = nullptr; // set by load_aot(), any other load drops it
+    bool superinstructions = true; // fuse hot sequences after linking (AUTO mode only gets faster)
+    bool optimize = false; // link-time optimizer over the linked text (see optimizer.h)
 
-    EnvironmentManager(size_t RAM_SIZE = 65535) : RAM_SIZE(RAM_SIZE), mb(MotherBoard(RAM_SIZE)) {}
+    uint32_t entry_pc = 0;
+    std::vector<uint8_t> ram_image; // RAM right after the build (data + rodata), every batch lane starts from it
+    std::vector<Symbol> text_symbols; // labels of the linked .text, sorted by PC
+    std::vector<Profile> profiles; // one per core, filled by PROFILE runs
+    LinkProfile layout_profile; // when set, build() lays the hot code out first (see layout_from_profile())
+    LayoutStats layout; // of the last build
+    OptimizeStats optimized; // of the last build
+    std::vector<uint32_t> origin_pc; // PC right after linking of every ROM slot, empty: the ROM is the linked text
+
+    EnvironmentManager(size_t RAM_SIZE = 65535, size_t CORES = 1) : RAM_SIZE(RAM_SIZE), CORES(CORES), mb(RAM_SIZE, CORES), profiles(mb.cpu.count()) {}
 
     std::string handle_error(const std::string& file_name, ErrorInfo e) {
         std::string e_msg = "Error at line " + std::to_string(e.index_line) + " in file " + file_name + ": \n";
         e_msg += e.message + "\n";
         e_msg += "\n";
-        e_msg += decoder.lines[e.index_line];
-        e_msg += "\n";
-        for (size_t i = 0; i < decoder.lines[e.index_line].size(); i++)
-            e_msg += "^";
-        e_msg += "\n";
+        if (e.index_line < decoder.lines.size()) { // files taken from the cache were not decoded
+            e_msg += decoder.lines[e.index_line];
+            e_msg += "\n";
+            for (size_t i = 0; i < decoder.lines[e.index_line].size(); i++)
+                e_msg += "^";
+            e_msg += "\n";
+        }
         return e_msg;
     }
 
-    ErrorCode load_ram( const std::vector<uint8_t>& data, const std::vector<uint8_t>& rodata) {
-        for (size_t i = 0; i < data.size(); i++) {
-            if (i >= mb.ram.size()) return ErrorCode::RAM_OVERFLOW;
-            mb.ram[i] = data[i];
-        }
-        for (size_t i = 0; i < rodata.size(); i++) {
-            if (i >= mb.ram.size()) return ErrorCode::RAM_OVERFLOW;
-            mb.ram[i] = rodata[i];
-        }
+    ErrorCode load_ram(std::span<const uint8_t> data, std::span<const uint8_t> rodata) {
+        // both sections start at 0, rodata last
+        if (!data.empty()) std::memcpy(mb.ram.data(), data.data(), std::min(data.size(), mb.ram.size()));
+        if (data.size() > mb.ram.size()) return ErrorCode::RAM_OVERFLOW;
+        if (!rodata.empty()) std::memcpy(mb.ram.data(), rodata.data(), std::min(rodata.size(), mb.ram.size()));
+        if (rodata.size() > mb.ram.size()) return ErrorCode::RAM_OVERFLOW;
         return ErrorCode::OK;
     }
 
@@ -64,21 +100,158 @@ struct EnvironmentManager {
 
     //args are { { <name/path>, <my_program> } }, returns error message
     std::string build(const std::vector<std::pair<std::string, std::string>>& inputs) {
-        std::vector<ObjectFile> obj_files;
-        std::vector<std::string> error_infos;
-        for (const auto& [name, program] : inputs) {
+        auto [e, linked_bin] = assemble(inputs);
+        if (!e.empty()) return e;
+        layout = linked_bin.layout;
+        optimized = linked_bin.optimize;
+        origin_pc = std::move(linked_bin.origin_pc);
+        return load(linked_bin.text, linked_bin.data, linked_bin.rodata, linked_bin.entry_pc, std::move(linked_bin.text_symbols));
+    }
+
+    // decode + link without loading anything, for write_executable(), returns error message
+    // files are decoded on build_threads host threads, except the ones with a .equ: the files after them need
+    // their constants, they are decoded first, in order
+    std::pair<std::string, LinkedBinary> assemble(const std::vector<std::pair<std::string, std::string>>& inputs) {
+        std::vector<ObjectFile> obj_files(inputs.size());
+        std::vector<DecodeJob> jobs;
+        std::vector<size_t> job_file; // index in inputs of each job
+        std::vector<uint64_t> keys(inputs.size());
+        size_t failed = inputs.size(); // first file with a .equ that did not decode, nothing after it matters
+        cache.stats = { };
+        decoder.constants.clear(); // shared by the files of a build, not from one build to the next
+        decoder.lines.clear(); // views on the sources of the last build
+
+        for (size_t i = 0; i < inputs.size() && failed == inputs.size(); i++) {
+            const std::string& program = inputs[i].second;
+            keys[i] = BuildCache::key(program, decoder.constants);
+            if (const BuildCache::Entry* hit = cache.find(keys[i], decoder.constants)) {
+                obj_files[i] = hit->obj;
+                decoder.constants = hit->constants; // what decoding it would have defined
+                continue;
+            }
+            if (program.find(".equ") == std::string::npos) { // cannot change the constants
+                jobs.emplace_back(&program, decoder.constants);
+                job_file.push_back(i);
+                continue;
+            }
+
+            auto constants_before = decoder.constants;
             auto [obj_file, error_info] = decoder.decode(program);
-            if (error_info.code != ErrorCode::OK) return handle_error(name, error_info);
-            obj_files.emplace_back(obj_file);
+            if (error_info.code != ErrorCode::OK) {
+                failed = i;
+                decoder.constants = std::move(constants_before); // for the decode again below
+                break;
+            }
+            cache.stats.misses++;
+            cache.store(keys[i], obj_file, constants_before, decoder.constants);
+            obj_files[i] = std::move(obj_file);
+        }
+        const auto constants_after = decoder.constants; // before the failed file if any
+
+        decode_parallel(jobs, build_threads);
+
+        // errors in input order, the failing file is decoded again here for its lines
+        for (size_t j = 0; j < jobs.size(); j++) {
+            const size_t i = job_file[j];
+            if (jobs[j].error.code == ErrorCode::OK) continue;
+            decoder.constants = jobs[j].constants;
+            return { handle_error(inputs[i].first, decoder.decode(inputs[i].second).second), { } };
         }
-        auto [e, linked_bin] = link(obj_files);
-        if (e.code != ErrorCode::OK) return handle_error("linked binary", e);
+        if (failed != inputs.size()) {
+            decoder.constants = constants_after;
+            return { handle_error(inputs[failed].first, decoder.decode(inputs[failed].second).second), { } };
+        }
+        for (size_t j = 0; j < jobs.size(); j++) {
+            cache.stats.misses++;
+            cache.store(keys[job_file[j]], jobs[j].obj, jobs[j].constants, jobs[j].constants);
+            obj_files[job_file[j]] = std::move(jobs[j].obj);
+        }
+        decoder.constants = constants_after;
+
+        auto [e, linked_bin] = link(obj_files, &layout_profile, build_threads, optimize);
+        if (e.code != ErrorCode::OK) return { handle_error("linked binary", e), { } };
+        return { "", std::move(linked_bin) };
+    }
+
+    // executable written by write_executable(): nothing is decoded nor linked, the sections are copied from the mapping
+    std::string load_binary(const std::string& path) {
+        MappedBinary file;
+        ErrorInfo e = file.open(path);
+        if (e.code == ErrorCode::OK && file.header.kind != BinaryKind::EXECUTABLE) e = { ErrorCode::INVALID_BINARY, "\"" + path + "\" is an object file, link it first" };
+        if (e.code != ErrorCode::OK) return "Error in file " + path + ": \n" + e.message + "\n";
+
+        layout = { };
+        optimized = { };
+        origin_pc.clear();
+        return load(file.text(), file.data(), file.rodata(), file.header.entry_pc, file.symbols());
+    }
+
+    // program translated by talos_aot (declared with extern const AotProgram aot_<name>;): its sections go
+    // in the ROM and RAM like any build, start(ExecMode::AOT) then runs its code
+    std::string load_aot(const AotProgram& program) {
+        layout = { };
+        optimized = { };
+        origin_pc.clear();
+        std::string e = load(program.text, program.data, program.rodata, program.entry_pc, { });
+        if (e.empty()) aot = &program;
+        return e;
+    }
+
+    // test mode of load_aot(): runs the translated code then AUTO from the same state (replaces the snapshot),
+    // "" when every core ends with the same registers and PC and the RAM is the same, else what differs
+    std::string check_aot() {
+        if (aot == nullptr) return "no translated program loaded";
+        snapshot();
+        const ErrorCode translated_error = start(ExecMode::AOT);
+        std::vector<MachineSnapshot::CoreState> translated;
+        for (const SimpleCore& c : mb.cpu.cores) translated.push_back({ c.regs, c.fregs, c.PC, c.faulted });
+        const std::vector<uint8_t> translated_ram(mb.ram.begin(), mb.ram.end());
+
+        restore();
+        if (start(ExecMode::AUTO) != translated_error) return translated_error == ErrorCode::OK ? "only the interpreter faulted" : "only the translated code faulted";
+        for (size_t i = 0; i < translated.size(); i++) {
+            const MachineSnapshot::CoreState& t = translated[i];
+            const SimpleCore& c = mb.cpu.cores[i];
+            for (size_t r = 0; r < 16; r++) {
+                if (t.regs[r] != c.regs[r]) return "core " + std::to_string(i) + ": r" + std::to_string(r) + " = " + std::to_string(t.regs[r]) + " translated, " + std::to_string(c.regs[r]) + " interpreted";
+                if (t.fregs[r] != c.fregs[r]) return "core " + std::to_string(i) + ": f" + std::to_string(r) + " = " + std::to_string(t.fregs[r]) + " translated, " + std::to_string(c.fregs[r]) + " interpreted";
+            }
+            if (t.PC != c.PC) return "core " + std::to_string(i) + ": PC = " + std::to_string(t.PC) + " translated, " + std::to_string(c.PC) + " interpreted";
+        }
+        auto [a, b] = std::ranges::mismatch(translated_ram, mb.ram);
+        if (a != translated_ram.end()) {
+            const size_t addr = a - translated_ram.begin();
+            return "RAM[" + std::to_string(addr) + "] = " + std::to_string(*a) + " translated, " + std::to_string(*b) + " interpreted";
+        }
+        return "";
+    }
+
+    // program assembled by the host compiler (assemble_static(), see static_asm.h): nothing to decode or link
+    template <size_t TEXT, size_t DATA, size_t RODATA, size_t SYMBOLS>
+    std::string load_static(const StaticProgram<TEXT, DATA, RODATA, SYMBOLS>& program) {
+        layout = { };
+        optimized = { };
+        origin_pc.clear();
+        return load(program.text, program.data, program.rodata, program.entry_pc, program.symbols());
+    }
+
+    // linked sections -> ROM and RAM, returns error message
+    std::string load(std::span<const DecodedInstr> text, std::span<const uint8_t> data, std::span<const uint8_t> rodata, uint32_t entry, std::vector<Symbol> symbols) {
+        std::vector<DecodedInstr> program(text.begin(), text.end());
+        if (superinstructions) fuse_superinstructions(program);
 
         mb.reset();
-        if (load_ram(linked_bin.data, linked_bin.rodata) != ErrorCode::OK) return handle_error("linked binary", ErrorInfo(ErrorCode::RAM_OVERFLOW, 0));
+        jit.clear();
+        tail.clear();
+        aot = nullptr;
+        if (load_ram(data, rodata) != ErrorCode::OK) return "Error in file linked binary: \ndata and rodata do not fit in the RAM\n";
 
-        mb.cpu.core.PC = linked_bin.entry_pc;
-        mb.load_prog(linked_bin.text);
+        ram_image.assign(mb.ram.begin(), mb.ram.begin() + std::max(data.size(), rodata.size()));
+        entry_pc = entry;
+        text_symbols = std::move(symbols);
+        for (Profile& p : profiles) p = { };
+        mb.cpu.core.PC = entry_pc;
+        mb.load_prog(std::move(program));
         return "";
     }
 
@@ -99,13 +272,146 @@ struct EnvironmentManager {
         return 0;
     }
 
-    void start() {
-        run(mb.cpu.core, mb.rom);
+    // runs one core until HALT (or the end of the ROM), on the calling thread
+    void run_core(SimpleCore& core, ExecMode mode) {
+        bool ok = guarded_run(mb.ram, [&] {
+            switch (mode) {
+            case ExecMode::AUTO:
+#ifdef TALOS_TAIL_DISPATCH
+                run(core, tail);
+#else
+                run(core, mb.threaded);
+#endif
+                break;
+            case ExecMode::STEP:
+                while (core.PC < mb.rom.size() && mb.rom[core.PC].opcode != HALT)
+                    step_instr(core, mb.rom[core.PC]);
+                if (core.PC > mb.rom.size()) core.PC = static_cast<uint32_t>(mb.rom.size()); // out of the ROM: on its end, as in run()
+                break;
+            case ExecMode::JIT:
+                if (jit.empty()) run(core, mb.threaded);
+                else run_jit(core, mb.rom, jit);
+                break;
+            case ExecMode::PROFILE:
+                run(core, mb.threaded, profiles[core.id]);
+                break;
+            case ExecMode::AOT:
+                if (aot == nullptr) run(core, mb.threaded);
+                else aot->run(core);
+                break;
+            case ExecMode::TAIL:
+                run(core, tail);
+                break;
+            }
+        });
+        if (!ok) core.faulted = true;
+    }
+
+    // cores started by spawn or start_all() run in the same mode as core 0
+    void prepare(ExecMode mode) {
+        if (mode == ExecMode::JIT && jit.empty()) jit.compile(mb.cpu.core, mb.rom);
+#ifdef TALOS_TAIL_DISPATCH
+        if (tail.empty()) tail = tail_prog(mb.threaded);
+#else
+        if (mode == ExecMode::TAIL && tail.empty()) tail = tail_prog(mb.threaded);
+#endif
+        if (mode == ExecMode::PROFILE)
+            for (Profile& p : profiles) p.resize(mb.threaded.size());
+        mb.cpu.runner = [this, mode](SimpleCore& core) { run_core(core, mode); };
+    }
+
+    // waits for every core, RAM_OVERFLOW if one of them stored outside of its RAM
+    ErrorCode join() {
+        mb.cpu.join_all();
+        return mb.cpu.any_faulted() ? ErrorCode::RAM_OVERFLOW : ErrorCode::OK;
+    }
+
+    // runs core 0 from its PC, returns once it and every core it spawned halted
+    // RAM_OVERFLOW if the guest stored outside of its RAM: in every mode the faulting core stops with PC
+    // on the store and the registers of the instructions before it
+    ErrorCode start(ExecMode mode = ExecMode::AUTO) {
+        prepare(mode);
+        mb.cpu.core.faulted = false;
+        run_core(mb.cpu.core, mode);
+        return join();
+    }
+
+    // SPMD: every core runs the program from the entry point, each one reads its index with coreid
+    ErrorCode start_all(ExecMode mode = ExecMode::AUTO) {
+        prepare(mode);
+        for (uint32_t i = 1; i < mb.cpu.count(); i++)
+            mb.cpu.launch(i, entry_pc);
+        mb.cpu.core.reset();
+        mb.cpu.core.PC = entry_pc;
+        run_core(mb.cpu.core, mode);
+        return join();
+    }
+
+    // time slice: at most budget instructions of core 0 from its PC (AUTO mode), call it again to resume
+    // cores it spawned keep running on their own, join() waits for them
+    RunSlice run_for(uint64_t budget) {
+        prepare(ExecMode::AUTO);
+        RunSlice slice = run(mb.cpu.core, mb.threaded, budget);
+        if (slice.status == RunStatus::FAULT) mb.cpu.core.faulted = true;
+        return slice;
+    }
+
+    // SIMT batch: the built program once per input, every lane gets its own RAM (ram_image + its input at input_addr)
+    // of lane_ram_size bytes, the stack included: all of them are allocated up front, so keep it to what the program uses
+    // without a built program every lane is left RUNNING (see BatchEngine::run())
+    BatchEngine run_batch(std::span<const std::vector<uint8_t>> inputs, uint32_t input_addr, size_t lane_ram_size) {
+        BatchEngine batch(mb.threaded, inputs.size(), lane_ram_size);
+        batch.load_all(ram_image);
+        for (size_t l = 0; l < inputs.size(); l++)
+            batch.load(l, inputs[l], input_addr);
+        batch.run(entry_pc);
+        return batch;
+    }
+
+    // counts of every PROFILE run since the build (or clear_profile()), all cores together
+    Profile profile() const {
+        Profile total;
+        for (const Profile& p : profiles) total.merge(p);
+        return total;
+    }
+
+    void clear_profile() {
+        for (Profile& p : profiles) p.clear();
+    }
+
+    // the next builds of the same sources are laid out with what PROFILE runs counted so far
+    // false if nothing was profiled, or if this build was laid out already (its PCs are not the ones of the sources)
+    bool layout_from_profile() {
+        Profile counts = profile();
+        if (counts.total() == 0 || layout.blocks != 0) return false;
+        layout_profile.executed = std::move(counts.executed);
+        layout_profile.taken = std::move(counts.taken);
+        return true;
+    }
+
+    // registers and RAM of the board (cores joined), restore() resets to it by copying back only the pages
+    // stored to since: cheap after a short run. The next build() drops it
+    void snapshot() {
+        mb.snapshot();
+    }
+
+    bool restore() {
+        return mb.restore();
+    }
+
+    size_t core_count() const {
+        return mb.cpu.cores.size();
+    }
+
+    // state of any core, only meaningful once they are joined
+    StepInfo core_state(size_t id) const {
+        if (id >= mb.cpu.cores.size()) return { };
+        return { mb, mb.cpu.cores[id] };
     }
 
     StepInfo step() {
         if (mb.cpu.core.PC >= mb.rom.size()) return { };
-        step_instr(mb.cpu.core, mb.rom[mb.cpu.core.PC]);
+        if (!guarded_run(mb.ram, [&] { step_instr(mb.cpu.core, mb.rom[mb.cpu.core.PC]); })) return { };
 
         return { mb };
     }
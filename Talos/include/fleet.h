@@ -0,0 +1,219 @@
+#ifndef ERGON_FLEET_H
+#define ERGON_FLEET_H
+
+#include "environment_manager.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+/*
+Fleet: many short independent guest runs on a pool of host threads.
+ - a program is built once (FleetProgram), every job only brings its input
+ - every worker owns one GuestRam for its whole life, a job just gives the pages back (GuestRam::clear())
+ - each worker has its own job deque: it pops from the back of its own and steals from the front of the others
+ - results come back through a std::future or a callback run on the worker thread
+*/
+
+// everything a job needs from a build, shared by all the jobs of that program
+struct FleetProgram {
+    std::vector<DecodedInstr> rom;
+    ThreadedCode threaded;
+    std::vector<uint8_t> ram_image;
+    uint32_t entry_pc = 0;
+
+    FleetProgram() = default;
+    explicit FleetProgram(const EnvironmentManager& env_m) : rom(env_m.mb.rom), threaded(thread_prog(env_m.mb.rom)), ram_image(env_m.ram_image), entry_pc(env_m.entry_pc) {}
+};
+
+struct FleetJob {
+    std::shared_ptr<const FleetProgram> program;
+    std::vector<uint8_t> input;
+    uint32_t input_addr = 0;
+    uint32_t output_addr = 0; // RAM copied back in FleetResult::output
+    uint32_t output_size = 0;
+};
+
+struct FleetResult {
+    ErrorCode code = ErrorCode::OK; // RAM_OVERFLOW if the guest stored outside of its RAM
+    std::array<uint32_t, 16> regs{};
+    std::array<uint32_t, 16> fregs{};
+    uint32_t PC = 0;
+    std::vector<uint8_t> output;
+};
+
+struct Fleet {
+    using Callback = std::function<void(FleetResult&&)>;
+
+    // worker_count = 0 -> one per host thread, ram_size is the RAM of every job
+    explicit Fleet(size_t worker_count = 0, size_t ram_size = 65535, bool pin_workers = true) {
+        if (worker_count == 0) worker_count = std::max(1u, std::thread::hardware_concurrency());
+        for (size_t i = 0; i < worker_count; i++) workers.push_back(std::make_unique<Worker>(ram_size));
+        for (size_t i = 0; i < worker_count; i++)
+            workers[i]->thread = std::thread([this, i, pin_workers] {
+                if (pin_workers) pin(i);
+                work(i);
+            });
+    }
+    Fleet(const Fleet&) = delete;
+    Fleet& operator=(const Fleet&) = delete;
+
+    // runs what is left in the queues, then stops the workers
+    ~Fleet() {
+        {
+            std::lock_guard lock(sleep_mutex);
+            stopping = true;
+        }
+        wake_up.notify_all();
+        for (auto& w : workers) w->thread.join();
+    }
+
+    size_t worker_count() const {
+        return workers.size();
+    }
+
+    void submit(FleetJob job, Callback done) {
+        Worker& w = *workers[next_worker.fetch_add(1, std::memory_order_relaxed) % workers.size()];
+        {
+            std::lock_guard lock(w.mutex);
+            w.jobs.push_back({ std::move(job), std::move(done) });
+        }
+        {
+            std::lock_guard lock(sleep_mutex);
+            pending++;
+        }
+        wake_up.notify_one();
+    }
+
+    std::future<FleetResult> submit(FleetJob job) {
+        auto promise = std::make_shared<std::promise<FleetResult>>();
+        std::future<FleetResult> result = promise->get_future();
+        submit(std::move(job), [promise](FleetResult&& r) { promise->set_value(std::move(r)); });
+        return result;
+    }
+
+    // blocks until every submitted job is done
+    void wait() {
+        std::unique_lock lock(sleep_mutex);
+        all_done.wait(lock, [this] { return pending == 0 && in_flight == 0; });
+    }
+
+private:
+    struct Task {
+        FleetJob job;
+        Callback done;
+    };
+
+    struct Worker {
+        GuestRam ram; // pooled: reused by every job of this worker
+        SimpleCore core;
+        std::deque<Task> jobs;
+        std::mutex mutex;
+        std::thread thread;
+
+        explicit Worker(size_t ram_size) : ram(ram_size), core(ram) {}
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<size_t> next_worker = 0;
+
+    std::mutex sleep_mutex;
+    std::condition_variable wake_up;
+    std::condition_variable all_done;
+    size_t pending = 0; // queued, not taken yet
+    size_t in_flight = 0; // taken, not finished yet
+    bool stopping = false;
+
+    static void pin(size_t index) {
+        #if defined(__linux__)
+            const unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(index % cpus, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set); // best effort, the job runs anyway
+        #else
+            (void)index;
+        #endif
+    }
+
+    // own deque from the back (last submitted is the hottest), the others from the front
+    bool take(size_t self, Task& task) {
+        for (size_t k = 0; k < workers.size(); k++) {
+            Worker& w = *workers[(self + k) % workers.size()];
+            std::lock_guard lock(w.mutex);
+            if (w.jobs.empty()) continue;
+            if (k == 0) {
+                task = std::move(w.jobs.back());
+                w.jobs.pop_back();
+            } else {
+                task = std::move(w.jobs.front());
+                w.jobs.pop_front();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void work(size_t self) {
+        Worker& w = *workers[self];
+        while (true) {
+            {
+                std::unique_lock lock(sleep_mutex);
+                wake_up.wait(lock, [this] { return pending != 0 || stopping; });
+                if (pending == 0) return; // stopping and nothing left
+                pending--;
+                in_flight++;
+            }
+            // a job was counted for us, it is in one of the deques
+            Task task;
+            while (!take(self, task)) std::this_thread::yield();
+
+            FleetResult result = execute(w, task.job);
+            if (task.done) task.done(std::move(result));
+
+            {
+                std::lock_guard lock(sleep_mutex);
+                in_flight--;
+                if (pending == 0 && in_flight == 0) all_done.notify_all();
+            }
+        }
+    }
+
+    static FleetResult execute(Worker& w, const FleetJob& job) {
+        FleetResult result;
+        const FleetProgram& prog = *job.program;
+        GuestRam& ram = w.ram;
+        SimpleCore& core = w.core;
+
+        ram.clear();
+        std::memcpy(ram.data(), prog.ram_image.data(), std::min(prog.ram_image.size(), ram.size()));
+        if (job.input_addr < ram.size())
+            std::memcpy(ram.data() + job.input_addr, job.input.data(), std::min(job.input.size(), ram.size() - job.input_addr));
+
+        core.reset();
+        core.PC = prog.entry_pc;
+        if (!guarded_run(ram, [&] { run(core, prog.threaded); })) result.code = ErrorCode::RAM_OVERFLOW;
+
+        result.regs = core.regs;
+        result.fregs = core.fregs;
+        result.PC = core.PC;
+        if (job.output_size != 0 && job.output_addr < ram.size()) {
+            const uint8_t* out = ram.data() + job.output_addr;
+            result.output.assign(out, out + std::min<size_t>(job.output_size, ram.size() - job.output_addr));
+        }
+        return result;
+    }
+};
+
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef ERGON_PROFILER_H
+#define ERGON_PROFILER_H
+
+#include "environment_manager.h"
+
+#include <algorithm>
+#include <array>
+#include <string>
+#include <vector>
+
+/*
+Reading what a PROFILE run counted (env.start(ExecMode::PROFILE)):
+ - retired instructions per opcode and per PC, taken / not taken per conditional branch
+ - PCs are named after the labels of the build ("loop+2")
+ - to_json() for scripts, to_collapsed() for flamegraph.pl / speedscope: one "function;label count" line
+   per label, the function being the enclosing global label (no call stacks, only where the time went)
+*/
+
+struct PcCount {
+    uint32_t pc = 0;
+    uint64_t count = 0;
+};
+
+struct ProfileReport {
+    Profile profile;
+    std::vector<DecodedInstr> rom;
+    std::vector<Symbol> symbols; // sorted by PC
+
+    ProfileReport() = default;
+    explicit ProfileReport(const EnvironmentManager& env_m) : profile(env_m.profile()), rom(env_m.mb.rom), symbols(env_m.text_symbols) {
+        profile.resize(rom.size() + 1); // nothing was profiled yet: all zeros
+    }
+
+    uint64_t total() const {
+        return profile.total();
+    }
+
+    uint64_t count(uint32_t pc) const {
+        return pc < profile.executed.size() ? profile.executed[pc] : 0;
+    }
+
+    // a super-instruction slot counts for its head, the other slots keep their own opcode
+    std::array<uint64_t, 256> by_opcode() const {
+        std::array<uint64_t, 256> counts{};
+        for (size_t pc = 0; pc < rom.size(); pc++)
+            counts[fused_head(rom[pc].opcode)] += profile.executed[pc];
+        return counts;
+    }
+
+    // the n PCs that retired the most, hottest first
+    std::vector<PcCount> hot_pcs(size_t n) const {
+        std::vector<PcCount> pcs;
+        for (size_t pc = 0; pc < rom.size(); pc++)
+            if (profile.executed[pc] != 0) pcs.push_back({ static_cast<uint32_t>(pc), profile.executed[pc] });
+        std::ranges::stable_sort(pcs, [](const PcCount& a, const PcCount& b) { return a.count > b.count; });
+        if (pcs.size() > n) pcs.resize(n);
+        return pcs;
+    }
+
+    // last label at or before pc (the global one if several share its PC), nullptr before the first one
+    const Symbol* symbol_at(uint32_t pc) const {
+        auto it = std::ranges::upper_bound(symbols, pc, { }, &Symbol::value);
+        if (it == symbols.begin()) return nullptr;
+        auto found = std::prev(it);
+        while (found != symbols.begin() && std::prev(found)->value == found->value) --found;
+        return &*found;
+    }
+
+    // enclosing function: last global label at or before pc
+    const Symbol* function_at(uint32_t pc) const {
+        const Symbol* found = nullptr;
+        for (const Symbol& sym : symbols) {
+            if (sym.value > pc) break;
+            if (sym.bind == SymbolBinding::GLOBAL) found = &sym;
+        }
+        return found;
+    }
+
+    // "loop", "loop+2", or "pc 12" without any label before it
+    std::string location(uint32_t pc) const {
+        const Symbol* sym = symbol_at(pc);
+        if (sym == nullptr) return "pc " + std::to_string(pc);
+        if (sym->value == pc) return sym->name;
+        return sym->name + "+" + std::to_string(pc - sym->value);
+    }
+
+    std::string to_json() const {
+        std::string out = "{\n  \"instructions\": " + std::to_string(total()) + ",\n  \"opcodes\": {";
+
+        std::array<uint64_t, 256> opcodes = by_opcode();
+        bool first = true;
+        for (size_t op = 0; op < opcodes.size(); op++) {
+            if (opcodes[op] == 0) continue;
+            out += first ? "\n" : ",\n";
+            out += "    \"" + std::string(opcode_name(static_cast<uint8_t>(op))) + "\": " + std::to_string(opcodes[op]);
+            first = false;
+        }
+        out += "\n  },\n  \"pcs\": [";
+
+        first = true;
+        for (size_t pc = 0; pc < rom.size(); pc++) {
+            if (profile.executed[pc] == 0) continue;
+            out += first ? "\n" : ",\n";
+            out += "    { \"pc\": " + std::to_string(pc);
+            out += ", \"location\": \"" + escaped(location(static_cast<uint32_t>(pc))) + "\"";
+            out += ", \"opcode\": \"" + std::string(opcode_name(fused_head(rom[pc].opcode))) + "\"";
+            out += ", \"count\": " + std::to_string(profile.executed[pc]);
+            if (profile.taken[pc] != 0 || profile.not_taken[pc] != 0) {
+                out += ", \"taken\": " + std::to_string(profile.taken[pc]);
+                out += ", \"not_taken\": " + std::to_string(profile.not_taken[pc]);
+            }
+            out += " }";
+            first = false;
+        }
+        out += "\n  ]\n}\n";
+        return out;
+    }
+
+    // "function;label count", one line per label that retired something, in PC order
+    std::string to_collapsed() const {
+        std::string out;
+        uint32_t pc = 0;
+        while (pc < rom.size()) {
+            const Symbol* sym = symbol_at(pc);
+            // the label covers every PC up to the next label
+            uint32_t end = static_cast<uint32_t>(rom.size());
+            auto next = std::ranges::upper_bound(symbols, pc, { }, &Symbol::value);
+            if (next != symbols.end()) end = std::min(end, next->value);
+
+            uint64_t count = 0;
+            for (uint32_t p = pc; p < end; p++) count += profile.executed[p];
+
+            if (count != 0) {
+                const Symbol* fn = function_at(pc);
+                std::string frame = sym != nullptr ? sym->name : "[rom]";
+                if (fn != nullptr && fn != sym) frame = fn->name + ";" + frame;
+                out += frame + " " + std::to_string(count) + "\n";
+            }
+            pc = end;
+        }
+        return out;
+    }
+
+private:
+    static std::string escaped(const std::string& s) {
+        std::string out;
+        for (char ch : s) {
+            if (ch == '"' || ch == '\\') out += '\\';
+            out += ch;
+        }
+        return out;
+    }
+};
+
+
+#endif
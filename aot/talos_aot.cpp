@@ -0,0 +1,89 @@
+#include "environment_manager.h"
+#include "asm/aot.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+talos_aot [--optimize] <out.cpp> <name> <file.s>...
+talos_aot <out.cpp> <name> <program.ex>
+
+Assembly files are decoded and linked together like EnvironmentManager::build() (each one named after its file),
+an executable written by write_executable() is taken as it is. out.cpp defines `extern const AotProgram aot_<name>`
+and is only rewritten when it changes (no rebuild of what includes it)
+*/
+
+bool read_file(const std::string& path, std::string& out) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    std::stringstream ss;
+    ss << in.rdbuf();
+    out = ss.str();
+    return true;
+}
+
+int main(int argc, char** argv) {
+    bool optimize = false;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--optimize") optimize = true;
+        else args.push_back(arg);
+    }
+    if (args.size() < 3) {
+        std::cerr << "usage: talos_aot [--optimize] <out.cpp> <name> <file.s>... | <program.ex>" << std::endl;
+        return 2;
+    }
+    const std::string& out_path = args[0];
+    const std::string& name = args[1];
+    const std::vector<std::string> inputs(args.begin() + 2, args.end());
+
+    LinkedBinary bin;
+    if (inputs.size() == 1 && std::filesystem::path(inputs[0]).extension() == ".ex") {
+        MappedBinary file;
+        ErrorInfo e = file.open(inputs[0]);
+        if (e.code == ErrorCode::OK && file.header.kind != BinaryKind::EXECUTABLE) e = { ErrorCode::INVALID_BINARY, "it is an object file, link it first" };
+        if (e.code != ErrorCode::OK) {
+            std::cerr << inputs[0] << ": " << e.message << std::endl;
+            return 1;
+        }
+        bin.text.assign(file.text().begin(), file.text().end());
+        bin.data.assign(file.data().begin(), file.data().end());
+        bin.rodata.assign(file.rodata().begin(), file.rodata().end());
+        bin.entry_pc = file.header.entry_pc;
+        bin.text_symbols = file.symbols();
+    } else {
+        std::vector<std::pair<std::string, std::string>> files;
+        for (const std::string& path : inputs) {
+            std::string src;
+            if (!read_file(path, src)) {
+                std::cerr << "cannot read " << path << std::endl;
+                return 1;
+            }
+            files.emplace_back(std::filesystem::path(path).stem().string(), std::move(src));
+        }
+        auto env_m = EnvironmentManager(0x1000);
+        env_m.optimize = optimize;
+        auto [e, linked] = env_m.assemble(files);
+        if (!e.empty()) {
+            std::cerr << e << std::endl;
+            return 1;
+        }
+        bin = std::move(linked);
+    }
+
+    const std::string source = translate_to_cpp(bin, name);
+    std::string previous;
+    if (read_file(out_path, previous) && previous == source) return 0;
+    std::ofstream out(out_path, std::ios::binary);
+    out << source;
+    if (!out) {
+        std::cerr << "cannot write " << out_path << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,170 @@
+#ifndef ERGON_BENCH_KERNELS_H
+#define ERGON_BENCH_KERNELS_H
+
+#include "environment_manager.h"
+
+#include <bit>
+#include <string>
+#include <vector>
+
+/*
+Guest kernels of talos_bench, each one stresses a different part of the engines:
+ - int_loop: ALU + a fused inc/cmp/jl loop
+ - mem_copy: word loads / stores through a base register, 32 KB per pass
+ - call_recursion: call / ret / push / pop (recursive fib)
+ - fpu_math: fmul / fadd / fsqrt / fdiv
+ - branchy: collatz, data dependent branches
+check() reads the registers once it halted: a wrong result fails the bench whatever the time
+*/
+
+struct Kernel {
+    std::string name;
+    std::string source;
+    bool (*check)(const SimpleCore& c);
+};
+
+inline uint32_t collatz_steps(uint32_t limit) {
+    uint32_t steps = 0;
+    for (uint32_t n = 1; n < limit; n++)
+        for (uint32_t x = n; x != 1; steps++) x = x % 2 ? 3 * x + 1 : x / 2;
+    return steps;
+}
+
+inline std::vector<Kernel> bench_kernels() {
+    return {
+        { "int_loop",
+            ".section .text \n"
+            " .global main \n"
+            "main: \n"
+            "  clr r1 \n"
+            "  movi r2, 3000000 \n"
+            "  movi r3, 1 \n"
+            "loop: \n"
+            "  add r4, r4, r3 \n"
+            "  xor r5, r5, r4 \n"
+            "  shli r6, r4, 3 \n"
+            "  sub r5, r5, r6 \n"
+            "  addi r3, r3, 7 \n"
+            "  inc r1 \n"
+            "  cmp r1, r2 \n"
+            "  jl loop \n"
+            "  halt \n"
+            " .entry main \n",
+            [](const SimpleCore& c) { return c.regs[1] == 3000000 && c.regs[3] == 1 + 7 * 3000000u; } },
+
+        { "mem_copy",
+            ".section .text \n"
+            " .global main \n"
+            "main: \n"
+            "  movi r9, 40 \n"
+            "pass: \n"
+            "  movi r1, 4096 \n"
+            "  movi r2, 40960 \n"
+            "  movi r3, 8192 \n"
+            "copy: \n"
+            "  lbasew r4, r1, 0 \n"
+            "  addi r4, r4, 1 \n"
+            "  sbasew r4, r1, 0 \n"
+            "  sbasew r4, r2, 0 \n"
+            "  addi r1, r1, 4 \n"
+            "  addi r2, r2, 4 \n"
+            "  dec r3 \n"
+            "  cmpi r3, 0 \n"
+            "  jnz copy \n"
+            "  dec r9 \n"
+            "  cmpi r9, 0 \n"
+            "  jnz pass \n"
+            "  movi r1, 40960 \n"
+            "  lbasew r5, r1, 0 \n"
+            "  halt \n"
+            " .entry main \n",
+            [](const SimpleCore& c) { return c.regs[5] == 40; } },
+
+        { "call_recursion",
+            ".section .text \n"
+            " .global main \n"
+            "main: \n"
+            "  movi r1, 24 \n"
+            "  call fib \n"
+            "  halt \n"
+            "fib: \n"
+            "  cmpi r1, 2 \n"
+            "  jl base \n"
+            "  push r1 \n"
+            "  subi r1, r1, 1 \n"
+            "  call fib \n"
+            "  pop r1 \n"
+            "  push r2 \n"
+            "  subi r1, r1, 2 \n"
+            "  call fib \n"
+            "  pop r3 \n"
+            "  add r2, r2, r3 \n"
+            "  ret \n"
+            "base: \n"
+            "  mov r2, r1 \n"
+            "  ret \n"
+            " .entry main \n",
+            [](const SimpleCore& c) { return c.regs[2] == 46368; } },
+
+        { "fpu_math",
+            ".section .data \n"
+            "one: \n"
+            "  .word 0x3F800000 \n"
+            "half: \n"
+            "  .word 0x3F000000 \n"
+            ".section .text \n"
+            " .global main \n"
+            "main: \n"
+            "  fldw f1, one \n"
+            "  fldw f2, half \n"
+            "  fldw f3, one \n"
+            "  clr r1 \n"
+            "  movi r2, 1000000 \n"
+            "loop: \n"
+            "  fmul f4, f3, f3 \n"
+            "  fadd f4, f4, f1 \n"
+            "  fsqrt f5, f4 \n"
+            "  fdiv f3, f5, f4 \n"
+            "  fadd f6, f6, f2 \n"
+            "  inc r1 \n"
+            "  cmp r1, r2 \n"
+            "  jl loop \n"
+            "  halt \n"
+            " .entry main \n",
+            [](const SimpleCore& c) { return std::bit_cast<float>(c.fregs[6]) == 500000.0f; } },
+
+        { "branchy",
+            ".section .text \n"
+            " .global main \n"
+            "main: \n"
+            "  movi r1, 1 \n"
+            "  movi r2, 30000 \n"
+            "  clr r5 \n"
+            "outer: \n"
+            "  mov r3, r1 \n"
+            "inner: \n"
+            "  cmpi r3, 1 \n"
+            "  jz next \n"
+            "  andi r4, r3, 1 \n"
+            "  cmpi r4, 0 \n"
+            "  jz even \n"
+            "  muli r3, r3, 3 \n"
+            "  addi r3, r3, 1 \n"
+            "  inc r5 \n"
+            "  jmp inner \n"
+            "even: \n"
+            "  shri r3, r3, 1 \n"
+            "  inc r5 \n"
+            "  jmp inner \n"
+            "next: \n"
+            "  inc r1 \n"
+            "  cmp r1, r2 \n"
+            "  jl outer \n"
+            "  halt \n"
+            " .entry main \n",
+            [](const SimpleCore& c) { return c.regs[5] == collatz_steps(30000); } },
+    };
+}
+
+
+#endif
@@ -0,0 +1,226 @@
+#include "kernels.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+talos_bench [--reps N] [--warmup N] [--mode auto|jit|tail] [--filter name] [--json out.json]
+            [--baseline baseline.json] [--write-baseline baseline.json]
+
+For every kernel: decode time, link time (best of reps) and execution MIPS (instructions retired / best run).
+With --baseline, exits 1 if a kernel runs below min_ratio * its baseline MIPS (or computes a wrong result)
+*/
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    int reps = 5;
+    int warmup = 1;
+    ExecMode mode = ExecMode::AUTO;
+    std::string filter;
+    std::string json_path;
+    std::string baseline_path;
+    std::string write_baseline_path;
+};
+
+struct Result {
+    std::string name;
+    uint64_t instructions = 0;
+    double decode_us = 0;
+    double link_us = 0;
+    double run_ms_best = 0;
+    double run_ms_median = 0;
+    double mips = 0;
+    bool correct = false;
+};
+
+struct Baseline {
+    double min_ratio = 0.5;
+    std::vector<std::pair<std::string, double>> mips;
+
+    // only reads what write_baseline() writes: "min_ratio": x and "<kernel>": { "mips": x }
+    static Baseline read(const std::string& path, bool& ok) {
+        Baseline b;
+        std::ifstream in(path);
+        std::stringstream ss;
+        ss << in.rdbuf();
+        const std::string text = ss.str();
+        ok = in.good() || in.eof();
+        if (text.empty()) ok = false;
+
+        auto number_after = [&](size_t pos) { return std::strtod(text.c_str() + text.find(':', pos) + 1, nullptr); };
+        if (size_t p = text.find("\"min_ratio\""); p != std::string::npos) b.min_ratio = number_after(p);
+        for (size_t p = text.find("\"mips\""); p != std::string::npos; p = text.find("\"mips\"", p + 1)) {
+            const size_t open = text.rfind('{', p);
+            const size_t name_end = text.rfind('"', text.rfind(':', open));
+            const size_t name_begin = text.rfind('"', name_end - 1);
+            b.mips.emplace_back(text.substr(name_begin + 1, name_end - name_begin - 1), number_after(p));
+        }
+        return b;
+    }
+
+    const double* find(const std::string& name) const {
+        for (const auto& [n, m] : mips)
+            if (n == name) return &m;
+        return nullptr;
+    }
+};
+
+double best(std::vector<double> v) {
+    return *std::ranges::min_element(v);
+}
+
+double median(std::vector<double> v) {
+    std::ranges::sort(v);
+    return v[v.size() / 2];
+}
+
+template <typename F>
+double time_us(F&& f) {
+    const auto start = Clock::now();
+    f();
+    return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+Result run_kernel(const Kernel& k, const Options& opt) {
+    Result r;
+    r.name = k.name;
+
+    // assembly: decode then link, separately
+    std::vector<double> decode_times, link_times;
+    AsmDecoder decoder;
+    ObjectFile obj;
+    for (int i = 0; i < opt.warmup + opt.reps; i++) {
+        decoder.constants.clear();
+        double t = time_us([&] { obj = decoder.decode(k.source).first; });
+        if (i >= opt.warmup) decode_times.push_back(t);
+    }
+    for (int i = 0; i < opt.warmup + opt.reps; i++) {
+        std::vector<ObjectFile> objs = { obj };
+        double t = time_us([&] { link(objs); });
+        if (i >= opt.warmup) link_times.push_back(t);
+    }
+    r.decode_us = best(decode_times);
+    r.link_us = best(link_times);
+
+    auto env_m = EnvironmentManager(0x100000);
+    env_m.cache.enabled = false;
+    std::string e = env_m.build_single(k.source);
+    if (!e.empty()) {
+        std::cerr << k.name << ": " << e << std::endl;
+        return r;
+    }
+    env_m.snapshot();
+
+    // one budgeted run to count what a run retires
+    r.instructions = env_m.run_for(UINT64_MAX).retired;
+
+    std::vector<double> run_times;
+    r.correct = true;
+    for (int i = 0; i < opt.warmup + opt.reps; i++) {
+        env_m.restore();
+        double t = time_us([&] { env_m.start(opt.mode); });
+        r.correct &= k.check(env_m.mb.cpu.core);
+        if (i >= opt.warmup) run_times.push_back(t / 1000);
+    }
+    r.run_ms_best = best(run_times);
+    r.run_ms_median = median(run_times);
+    r.mips = r.instructions / (r.run_ms_best * 1000);
+    return r;
+}
+
+const char* mode_name(ExecMode mode) {
+    return mode == ExecMode::JIT ? "jit" : mode == ExecMode::TAIL ? "tail" : "auto";
+}
+
+std::string to_json(const std::vector<Result>& results, const Options& opt) {
+    std::ostringstream out;
+    out << "{\n  \"mode\": \"" << mode_name(opt.mode) << "\",\n  \"reps\": " << opt.reps << ",\n  \"kernels\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        out << "    { \"name\": \"" << r.name << "\", \"instructions\": " << r.instructions
+            << ", \"decode_us\": " << r.decode_us << ", \"link_us\": " << r.link_us
+            << ", \"run_ms_best\": " << r.run_ms_best << ", \"run_ms_median\": " << r.run_ms_median
+            << ", \"mips\": " << r.mips << ", \"correct\": " << (r.correct ? "true" : "false") << " }"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+    return out.str();
+}
+
+std::string baseline_json(const std::vector<Result>& results, double min_ratio) {
+    std::ostringstream out;
+    out << "{\n  \"min_ratio\": " << min_ratio << ",\n  \"kernels\": {\n";
+    for (size_t i = 0; i < results.size(); i++)
+        out << "    \"" << results[i].name << "\": { \"mips\": " << static_cast<int>(results[i].mips) << " }" << (i + 1 < results.size() ? ",\n" : "\n");
+    out << "  }\n}\n";
+    return out.str();
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                std::cerr << arg << " expects a value" << std::endl;
+                std::exit(2);
+            }
+            return argv[++i];
+        };
+        if (arg == "--reps") opt.reps = std::max(1, std::stoi(value()));
+        else if (arg == "--warmup") opt.warmup = std::max(0, std::stoi(value()));
+        else if (arg == "--mode") {
+            const std::string mode = value();
+            opt.mode = mode == "jit" ? ExecMode::JIT : mode == "tail" ? ExecMode::TAIL : ExecMode::AUTO;
+        }
+        else if (arg == "--filter") opt.filter = value();
+        else if (arg == "--json") opt.json_path = value();
+        else if (arg == "--baseline") opt.baseline_path = value();
+        else if (arg == "--write-baseline") opt.write_baseline_path = value();
+        else {
+            std::cerr << "unknown argument " << arg << std::endl;
+            return 2;
+        }
+    }
+
+    std::vector<Result> results;
+    std::printf("%-16s %12s %10s %10s %10s %10s\n", "kernel", "instructions", "decode_us", "link_us", "run_ms", "MIPS");
+    for (const Kernel& k : bench_kernels()) {
+        if (!opt.filter.empty() && k.name.find(opt.filter) == std::string::npos) continue;
+        results.push_back(run_kernel(k, opt));
+        const Result& r = results.back();
+        std::printf("%-16s %12llu %10.1f %10.1f %10.2f %10.1f%s\n", r.name.c_str(), static_cast<unsigned long long>(r.instructions),
+                    r.decode_us, r.link_us, r.run_ms_best, r.mips, r.correct ? "" : "  WRONG RESULT");
+    }
+
+    if (!opt.json_path.empty()) std::ofstream(opt.json_path) << to_json(results, opt);
+
+    bool ok = std::ranges::all_of(results, &Result::correct);
+    if (!opt.baseline_path.empty()) {
+        bool read = false;
+        Baseline baseline = Baseline::read(opt.baseline_path, read);
+        if (!read) {
+            std::cerr << "cannot read the baseline " << opt.baseline_path << std::endl;
+            return 1;
+        }
+        for (const Result& r : results) {
+            const double* expected = baseline.find(r.name);
+            if (expected == nullptr) continue;
+            if (r.mips < *expected * baseline.min_ratio) {
+                std::printf("REGRESSION %s: %.1f MIPS, baseline %.1f (min %.0f%%)\n", r.name.c_str(), r.mips, *expected, baseline.min_ratio * 100);
+                ok = false;
+            }
+        }
+    }
+    if (!opt.write_baseline_path.empty()) std::ofstream(opt.write_baseline_path) << baseline_json(results, 0.5);
+
+    return ok ? 0 : 1;
+}
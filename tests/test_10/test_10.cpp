@@ -0,0 +1,117 @@
+#include "../../Talos/include/environment_manager.h"
+
+#include <iostream>
+#include <string>
+#include <chrono>
+
+// snapshot() / restore(): back to the snapshot by copying only the granules stored to since
+
+// counter += 1, then one word in each of 64 pages (one MiB further per core)
+const std::string program =
+    ".section .text \n"
+    " ldw r0, counter \n"
+    " inc r0 \n"
+    " stw r0, counter \n"
+    " movi r1, 0x10000 \n"
+    " coreid r5 \n"
+    " shli r5, r5, 20 \n"
+    " add r1, r1, r5 \n"
+    " movi r2, 64 \n"
+    " movi r4, 4096 \n"
+    " clr r3 \n"
+    " loop: \n"
+    "  sbasew r0, r1, 0 \n"
+    "  add r1, r1, r4 \n"
+    "  inc r3 \n"
+    "  cmp r3, r2 \n"
+    "  jl loop \n"
+    " halt \n"
+    ".section .data \n"
+    " counter: \n"
+    "  .word 7 \n";
+
+constexpr size_t RAM = 0x1000000; // 16 MiB
+
+uint32_t word(EnvironmentManager& env_m, uint32_t addr) {
+    uint32_t value;
+    std::memcpy(&value, env_m.mb.ram.data() + addr, 4);
+    return value;
+}
+
+size_t dirty(EnvironmentManager& env_m) {
+    return std::ranges::count(env_m.mb.ram.dirty, 1);
+}
+
+int main() {
+    bool ok = true;
+
+    auto env_m = EnvironmentManager(RAM);
+    std::string e = env_m.build_single(program);
+    if (!e.empty()) std::cout << "ERROR: " << e << std::endl;
+
+    if (env_m.restore()) ok = false; // nothing to go back to yet
+    env_m.snapshot();
+    const std::vector<uint8_t> before(env_m.mb.ram.begin(), env_m.mb.ram.begin() + 0x100000);
+
+    // every run starts from the same machine: the counter is 8 each time, not 8, 9, 10
+    for (ExecMode mode : { ExecMode::AUTO, ExecMode::STEP, ExecMode::JIT, ExecMode::AUTO }) {
+        if (env_m.start(mode) != ErrorCode::OK || word(env_m, 0) != 8 || word(env_m, 0x10000 + 63 * 4096) != 8) {
+            std::cout << "run from the snapshot: counter " << word(env_m, 0) << std::endl;
+            ok = false;
+        }
+        if (dirty(env_m) != 65) { // the counter and the 64 words
+            std::cout << dirty(env_m) << " dirty granules instead of 65" << std::endl;
+            ok = false;
+        }
+        env_m.restore();
+        if (!std::equal(before.begin(), before.end(), env_m.mb.ram.begin()) || env_m.mb.cpu.core.PC != 0 || env_m.mb.cpu.core.regs[1] != 0) {
+            std::cout << "restore() did not give the machine back" << std::endl;
+            ok = false;
+        }
+    }
+
+    // a store outside of the RAM faults before marking anything
+    auto faulty = EnvironmentManager(RAM);
+    faulty.build_single(".section .text \n movi r0, 1 \n shli r0, r0, 24 \n sbasew r1, r0, 0 \n halt \n");
+    faulty.snapshot();
+    if (faulty.start() != ErrorCode::RAM_OVERFLOW || dirty(faulty) != 0) ok = false;
+    faulty.restore();
+    if (faulty.mb.cpu.core.faulted || faulty.mb.cpu.core.regs[0] != 0) ok = false;
+
+    // 4 cores storing at once, each in its own MiB (the counter is racy, it just has to change)
+    auto spmd = EnvironmentManager(RAM, 4);
+    spmd.build_single(program);
+    spmd.snapshot();
+    for (int round = 0; round < 3; round++) {
+        if (spmd.start_all() != ErrorCode::OK || word(spmd, 0) == 7 || word(spmd, 0x10000 + (3 << 20) + 63 * 4096) == 0) ok = false;
+        if (dirty(spmd) != 1 + 4 * 64) ok = false;
+        spmd.restore();
+        if (word(spmd, 0x10000 + (3 << 20)) != 0 || word(spmd, 0) != 7) ok = false;
+    }
+
+    // a new build forgets the snapshot
+    env_m.build_single(program);
+    if (env_m.restore()) ok = false;
+    env_m.snapshot();
+
+    // reset after a short job: restore() against a rebuild
+    constexpr int RUNS = 500;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < RUNS; i++) {
+        env_m.start();
+        env_m.restore();
+    }
+    auto stop = std::chrono::high_resolution_clock::now();
+    std::cout << "run + restore " << duration_cast<std::chrono::microseconds>(stop - start).count() << " micro_sec" << std::endl;
+
+    auto plain = EnvironmentManager(RAM);
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < RUNS; i++) {
+        plain.build_single(program);
+        plain.start();
+    }
+    stop = std::chrono::high_resolution_clock::now();
+    std::cout << "build + run " << duration_cast<std::chrono::microseconds>(stop - start).count() << " micro_sec" << std::endl;
+
+    return ok ? 0 : 1;
+}
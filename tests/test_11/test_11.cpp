@@ -0,0 +1,165 @@
+#include "../../Talos/include/environment_manager.h"
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <tuple>
+
+// binary objects / executables: written once, loaded by mapping the file instead of decoding + linking again
+
+const std::string main_file =
+    ".section .text \n"
+    " .extern sum \n"
+    " .global main \n"
+    " main: \n"
+    "  ldw r2, count \n"
+    "  clr r1 \n"
+    "  clr r4 \n"
+    " loop: \n"
+    "  call sum \n"
+    "  inc r1 \n"
+    "  cmp r1, r2 \n"
+    "  jl loop \n"
+    "  stw r4, result \n"
+    "  halt \n"
+    " .entry main \n"
+    ".section .data \n"
+    " count: \n"
+    "  .word 300 \n"
+    " result: \n"
+    "  .word 0 \n";
+
+const std::string sum_file =
+    ".section .text \n"
+    " .global sum \n"
+    " sum: \n"
+    "  add r4, r4, r1 \n"
+    "  ret \n";
+
+const std::vector<std::pair<std::string, std::string>> files = { { "main", main_file }, { "sum", sum_file } };
+
+constexpr uint32_t SUM = 300 * 299 / 2;
+
+// n copies of a small block, to see what a cold start costs
+std::string big_program(int n) {
+    std::string program = ".section .text \n clr r1 \n";
+    for (int i = 0; i < n; i++) program += " addi r1, r1, 3 \n xori r1, r1, 5 \n shli r2, r1, 1 \n add r1, r1, r2 \n";
+    return program + " halt \n";
+}
+
+bool same_text(const std::vector<DecodedInstr>& a, std::span<const DecodedInstr> b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](const DecodedInstr& x, const DecodedInstr& y) {
+        return x.opcode == y.opcode && x.rd == y.rd && x.rs1 == y.rs1 && x.rs2 == y.rs2 && x.imm == y.imm;
+    });
+}
+
+int main() {
+    bool ok = true;
+    const std::filesystem::path dir = std::filesystem::temp_directory_path();
+    const std::string exe = (dir / "ergon_test_11.ex").string();
+
+    // executable: same program, same results, labels included
+    auto env_m = EnvironmentManager(0x10000);
+    auto [e, linked_bin] = env_m.assemble(files);
+    if (!e.empty()) std::cout << "ERROR: " << e << std::endl;
+    if (write_executable(exe, linked_bin).code != ErrorCode::OK) ok = false;
+
+    auto loaded = EnvironmentManager(0x10000);
+    e = loaded.load_binary(exe);
+    if (!e.empty()) std::cout << "ERROR: " << e << std::endl;
+    for (ExecMode mode : { ExecMode::AUTO, ExecMode::STEP, ExecMode::JIT }) {
+        loaded.mb.cpu.core.reset();
+        loaded.mb.cpu.core.PC = loaded.entry_pc;
+        if (loaded.start(mode) != ErrorCode::OK || loaded.mb.cpu.core.regs[4] != SUM) ok = false;
+    }
+    if (loaded.text_symbols.size() != linked_bin.text_symbols.size() || loaded.text_symbols[0].name != "main" || loaded.ram_image != std::vector<uint8_t>{ 44, 1, 0, 0, 0, 0, 0, 0 }) {
+        std::cout << "the executable lost its symbols or its data" << std::endl;
+        ok = false;
+    }
+
+    // objects: decoded once, linked from the files
+    std::vector<ObjectFile> read;
+    for (size_t i = 0; i < files.size(); i++) {
+        AsmDecoder decoder;
+        auto [obj, error] = decoder.decode(files[i].second);
+        std::string path = (dir / ("ergon_test_11_" + std::to_string(i) + ".eo")).string();
+        if (write_object(path, obj).code != ErrorCode::OK) ok = false;
+        auto [read_error, read_obj] = read_object(path);
+        if (read_error.code != ErrorCode::OK || read_obj.symbols.size() != obj.symbols.size() || read_obj.relocations.size() != obj.relocations.size()
+            || read_obj.entry_symbol != obj.entry_symbol || read_obj.data != obj.data) ok = false;
+        read.push_back(std::move(read_obj));
+        std::filesystem::remove(path);
+    }
+    auto [link_error, relinked] = link(read);
+    if (link_error.code != ErrorCode::OK || !same_text(relinked.text, linked_bin.text) || relinked.entry_pc != linked_bin.entry_pc) {
+        std::cout << "objects read back do not link to the same program" << std::endl;
+        ok = false;
+    }
+
+    // broken files are refused, the board is left as it was
+    const std::string junk = (dir / "ergon_test_11.junk").string();
+    std::vector<uint8_t> bytes(200, 0xAB);
+    binary::write_file(junk, bytes);
+    if (loaded.load_binary(junk).empty() || loaded.load_binary((dir / "does_not_exist.ex").string()).empty()) ok = false;
+    MappedBinary mapped;
+    mapped.open(exe);
+    bytes.assign(mapped.base, mapped.base + mapped.length - 8); // truncated string table
+    binary::write_file(junk, bytes);
+    if (loaded.load_binary(junk).find("truncated") == std::string::npos) ok = false;
+    // corrupted instruction records: the ROM would index the register file or the dispatch table with them
+    for (auto [field, value, why] : { std::tuple<size_t, uint8_t, const char*>{ offsetof(DecodedInstr, opcode), 0xF0, "opcode" },
+                                      { offsetof(DecodedInstr, rd), 200, "register" }, { offsetof(DecodedInstr, rs1), 16, "register" } }) {
+        bytes.assign(mapped.base, mapped.base + mapped.length);
+        bytes[mapped.header.text_offset + field] = value;
+        binary::write_file(junk, bytes);
+        if (loaded.load_binary(junk).find(why) == std::string::npos) {
+            std::cout << "a corrupted instruction was loaded" << std::endl;
+            ok = false;
+        }
+    }
+    AsmDecoder decoder;
+    write_object(junk, decoder.decode(sum_file).first);
+    if (loaded.load_binary(junk).find("object file") == std::string::npos) ok = false;
+    // corrupted relocation records: the linker would patch past the text of the object
+    write_object(junk, decoder.decode(main_file).first);
+    MappedBinary object;
+    object.open(junk);
+    if (object.header.reloc_count == 0) ok = false;
+    const std::vector<uint8_t> object_bytes(object.base, object.base + object.length);
+    const uint64_t reloc = object.header.reloc_offset;
+    const uint32_t text_count = object.header.text_count;
+    object = MappedBinary();
+    for (auto [field, value] : { std::pair<size_t, uint32_t>{ offsetof(BinaryReloc, offset), text_count },
+                                 { offsetof(BinaryReloc, section), static_cast<uint32_t>(Section::DATA) }, { offsetof(BinaryReloc, type), 7 } }) {
+        bytes = object_bytes;
+        std::memcpy(&bytes[reloc + field], &value, field == offsetof(BinaryReloc, offset) ? 4 : 1);
+        binary::write_file(junk, bytes);
+        if (read_object(junk).first.message.find("relocation") == std::string::npos) {
+            std::cout << "a corrupted relocation was read" << std::endl;
+            ok = false;
+        }
+    }
+    std::filesystem::remove(junk);
+
+    // cold start of a big program: source against binary
+    constexpr int BLOCKS = 25000;
+    auto big = EnvironmentManager(0x10000);
+    auto start = std::chrono::high_resolution_clock::now();
+    big.build_single(big_program(BLOCKS));
+    auto stop = std::chrono::high_resolution_clock::now();
+    std::cout << "build from source " << duration_cast<std::chrono::microseconds>(stop - start).count() << " micro_sec" << std::endl;
+    uint32_t expected = (big.start(), big.mb.cpu.core.regs[1]);
+
+    auto [big_error, big_bin] = big.assemble({ { "big", big_program(BLOCKS) } });
+    write_executable(exe, big_bin);
+    start = std::chrono::high_resolution_clock::now();
+    e = big.load_binary(exe);
+    stop = std::chrono::high_resolution_clock::now();
+    std::cout << "load binary " << duration_cast<std::chrono::microseconds>(stop - start).count() << " micro_sec (" << big.mb.rom.size() << " instructions)" << std::endl;
+    if (!e.empty() || big.start() != ErrorCode::OK || big.mb.cpu.core.regs[1] != expected) ok = false;
+    std::filesystem::remove(exe);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,94 @@
+#include "../../Talos/include/environment_manager.h"
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <filesystem>
+
+// build cache: a rebuild only decodes the files that changed, in memory or from a cache directory
+
+constexpr int FILES = 50;
+
+using Inputs = std::vector<std::pair<std::string, std::string>>;
+
+// main defines STEP and calls every f_i, which adds STEP to r4 (after a bit of padding)
+Inputs sources(int step) {
+    std::string main_file = ".section .data \n .equ STEP, " + std::to_string(step) + " \n.section .text \n";
+    for (int i = 0; i < FILES; i++) main_file += " .extern f_" + std::to_string(i) + " \n";
+    main_file += " .global main \n main: \n  clr r4 \n";
+    for (int i = 0; i < FILES; i++) main_file += "  call f_" + std::to_string(i) + " \n";
+    main_file += "  halt \n .entry main \n";
+
+    Inputs inputs = { { "main", main_file } };
+    for (int i = 0; i < FILES; i++) {
+        std::string f = ".section .text \n .global f_" + std::to_string(i) + " \n f_" + std::to_string(i) + ": \n";
+        for (int j = 0; j < 200; j++) f += "  addi r5, r5, 1 \n";
+        f += "  addi r4, r4, STEP \n  ret \n";
+        inputs.emplace_back("f_" + std::to_string(i), f);
+    }
+    return inputs;
+}
+
+bool check(EnvironmentManager& env_m, const Inputs& inputs, BuildStats expected, uint32_t r4) {
+    std::string e = env_m.build(inputs);
+    if (!e.empty()) std::cout << "ERROR: " << e << std::endl;
+    env_m.start();
+    const BuildStats& stats = env_m.cache.stats;
+    if (stats.hits != expected.hits || stats.disk_hits != expected.disk_hits || stats.misses != expected.misses || env_m.mb.cpu.core.regs[4] != r4) {
+        std::cout << stats.hits << " hits, " << stats.disk_hits << " from disk, " << stats.misses << " misses, r4 = " << env_m.mb.cpu.core.regs[4] << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main() {
+    bool ok = true;
+    constexpr size_t N = FILES + 1;
+
+    auto env_m = EnvironmentManager(0x10000);
+    Inputs inputs = sources(3);
+    ok &= check(env_m, inputs, { 0, 0, N }, 3 * FILES);
+    ok &= check(env_m, inputs, { N, 0, 0 }, 3 * FILES);
+
+    // one file changed
+    inputs[8].second.replace(inputs[8].second.find("STEP"), 4, "10");
+    ok &= check(env_m, inputs, { N - 1, 0, 1 }, 3 * FILES + 7);
+
+    // STEP changed: every file that comes after main is decoded again
+    ok &= check(env_m, sources(4), { 0, 0, N }, 4 * FILES);
+    ok &= check(env_m, sources(3), { N, 0, 0 }, 3 * FILES);
+
+    // a decode error still points at its line
+    Inputs broken = sources(3);
+    broken[3].second += " addi r99, r4, 1 \n";
+    if (env_m.build(broken).find("r99") == std::string::npos) ok = false;
+
+    // the cache directory outlives the EnvironmentManager, constants included
+    const std::filesystem::path dir = std::filesystem::temp_directory_path() / "ergon_test_12_cache";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    {
+        auto first = EnvironmentManager(0x10000);
+        first.cache.directory = dir.string();
+        ok &= check(first, sources(3), { 0, 0, N }, 3 * FILES);
+    }
+    auto second = EnvironmentManager(0x10000);
+    second.cache.directory = dir.string();
+    ok &= check(second, sources(3), { 0, N, 0 }, 3 * FILES);
+    ok &= check(second, sources(3), { N, 0, 0 }, 3 * FILES);
+    std::filesystem::remove_all(dir);
+
+    // cold against warm
+    constexpr int RUNS = 20;
+    for (bool enabled : { false, true }) {
+        auto timed = EnvironmentManager(0x10000);
+        timed.cache.enabled = enabled;
+        timed.build(inputs);
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < RUNS; i++) timed.build(inputs);
+        auto stop = std::chrono::high_resolution_clock::now();
+        std::cout << (enabled ? "cached " : "no cache ") << duration_cast<std::chrono::microseconds>(stop - start).count() / RUNS << " micro_sec per build" << std::endl;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,94 @@
+#include "../../Talos/include/environment_manager.h"
+
+#include <iostream>
+#include <string>
+#include <chrono>
+
+// parallel assembly: same binary whatever the number of host threads, .equ still seen by the files after it
+
+constexpr int FILES = 64;
+
+using Inputs = std::vector<std::pair<std::string, std::string>>;
+
+// main defines STEP, f_31 defines EXTRA for the files after it: f_i adds STEP (+ EXTRA past 31) to r4
+Inputs sources() {
+    std::string main_file = ".section .data \n .equ STEP, 3 \n.section .text \n";
+    for (int i = 0; i < FILES; i++) main_file += " .extern f_" + std::to_string(i) + " \n";
+    main_file += " .global main \n main: \n  clr r4 \n";
+    for (int i = 0; i < FILES; i++) main_file += "  call f_" + std::to_string(i) + " \n";
+    main_file += "  halt \n .entry main \n";
+
+    Inputs inputs = { { "main", main_file } };
+    for (int i = 0; i < FILES; i++) {
+        std::string f = i == 31 ? ".section .data \n .equ EXTRA, 2 \n" : "";
+        f += ".section .text \n .global f_" + std::to_string(i) + " \n f_" + std::to_string(i) + ": \n";
+        for (int j = 0; j < 300; j++) f += "  addi r5, r5, 1 \n";
+        f += i > 31 ? "  addi r4, r4, STEP \n  addi r4, r4, EXTRA \n  ret \n" : "  addi r4, r4, STEP \n  ret \n";
+        inputs.emplace_back("f_" + std::to_string(i), f);
+    }
+    return inputs;
+}
+
+bool same_rom(const std::vector<DecodedInstr>& a, const std::vector<DecodedInstr>& b) {
+    return std::ranges::equal(a, b, [](const DecodedInstr& x, const DecodedInstr& y) {
+        return x.opcode == y.opcode && x.rd == y.rd && x.rs1 == y.rs1 && x.rs2 == y.rs2 && x.imm == y.imm;
+    });
+}
+
+int main() {
+    bool ok = true;
+    const Inputs inputs = sources();
+    constexpr uint32_t R4 = 3 * FILES + 2 * (FILES - 32);
+
+    auto sequential = EnvironmentManager(0x10000);
+    sequential.cache.enabled = false;
+    sequential.build_threads = 1;
+    std::string e = sequential.build(inputs);
+    if (!e.empty()) std::cout << "ERROR: " << e << std::endl;
+    sequential.start();
+    ok &= sequential.mb.cpu.core.regs[4] == R4;
+
+    for (size_t threads : { 2, 4, 0 }) {
+        auto parallel = EnvironmentManager(0x10000);
+        parallel.cache.enabled = false;
+        parallel.build_threads = threads;
+        e = parallel.build(inputs);
+        if (!e.empty()) std::cout << "ERROR: " << e << std::endl;
+        parallel.start();
+        if (!same_rom(parallel.mb.rom, sequential.mb.rom) || parallel.mb.cpu.core.regs[4] != R4) {
+            std::cout << threads << " threads: r4 = " << parallel.mb.cpu.core.regs[4] << std::endl;
+            ok = false;
+        }
+    }
+
+    // the first broken file in input order is the one reported, .equ file or not
+    auto env_m = EnvironmentManager(0x10000);
+    env_m.build_threads = 4;
+    Inputs broken = inputs;
+    broken[40].second += " addi r98, r4, 1 \n";
+    broken[32].second += " addi r99, r4, 1 \n"; // f_31, with the .equ
+    broken[12].second += " addi r97, r4, 1 \n";
+    e = env_m.build(broken);
+    ok &= e.find("f_11") != std::string::npos && e.find("r97") != std::string::npos;
+    broken[12] = inputs[12];
+    e = env_m.build(broken);
+    ok &= e.find("f_31") != std::string::npos && e.find("r99") != std::string::npos;
+    broken[32] = inputs[32];
+    e = env_m.build(broken);
+    ok &= e.find("f_39") != std::string::npos && e.find("r98") != std::string::npos;
+    broken[40] = inputs[40];
+    ok &= env_m.build(broken).empty();
+
+    constexpr int RUNS = 10;
+    for (size_t threads : { 1, 0 }) {
+        auto timed = EnvironmentManager(0x10000);
+        timed.cache.enabled = false;
+        timed.build_threads = threads;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < RUNS; i++) timed.build(inputs);
+        auto stop = std::chrono::high_resolution_clock::now();
+        std::cout << (threads == 1 ? "1 thread " : "every host thread ") << duration_cast<std::chrono::microseconds>(stop - start).count() / RUNS << " micro_sec per build" << std::endl;
+    }
+
+    return ok ? 0 : 1;
+}
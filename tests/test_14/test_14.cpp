@@ -0,0 +1,80 @@
+#include "../../Talos/include/environment_manager.h"
+
+#include <iostream>
+#include <string>
+#include <chrono>
+
+// lexer on string_views + perfect hash tables: same programs, same errors, and the decode throughput
+
+bool expect_error(EnvironmentManager& env_m, const std::string& program, const std::string& what) {
+    std::string e = env_m.build_single(program);
+    if (e.find(what) != std::string::npos) return true;
+    std::cout << "expected \"" << what << "\", got: " << e << std::endl;
+    return false;
+}
+
+int main() {
+    bool ok = true;
+    auto env_m = EnvironmentManager(0x10000);
+
+    // every key of the tables is found, and nothing else
+    for (const auto& [name, def] : instr_table.entries) ok &= instr_table.find(name) == &def;
+    for (const auto& [name, reg] : reg_table.entries) ok &= reg_table.find(name) == &reg;
+    for (const auto& [name, d] : directive_table.entries) ok &= directive_table.find(name) == &d;
+    for (const char* name : { "", "r12", "addd", "ad", ".sectio", "zero ", "R1" })
+        ok &= !instr_table.contains(name) && !reg_table.contains(name) && !directive_table.contains(name);
+
+    // tabs, spaces around the commas, '_' in numbers, .text alone, .equ in .text
+    std::string e = env_m.build_single(
+        ".text \n"
+        ".equ BIG, 1_000 \n"
+        ".global main \n"
+        "main:\t\n"
+        "\tmovi\tr1 ,BIG   ; comment, with a comma \n"
+        "  addi r2 , r1,0x1_0 \n"
+        "  movi r3, -1_05 \n"
+        "  halt \n"
+        ".entry main \n"
+    );
+    if (!e.empty()) std::cout << "ERROR: " << e << std::endl;
+    env_m.start();
+    const auto& regs = env_m.mb.cpu.core.regs;
+    ok &= e.empty() && regs[1] == 1000 && regs[2] == 1016 && static_cast<int32_t>(regs[3]) == -105;
+
+    // errors still point at their line
+    ok &= expect_error(env_m, ".text \n main: \n  addi r1, r1 \n halt \n", "line 2");
+    ok &= expect_error(env_m, ".text \n main: \n  movi r1, 1 \n  frob r1 \n", "unknown instruction \"frob\"");
+    ok &= expect_error(env_m, ".text \n main: \n  movi r13x, 1 \n", "invalid register \"r13x\"");
+    ok &= expect_error(env_m, ".section .code \n", "unknown section");
+    ok &= expect_error(env_m, ".text \n main: \n  jmp nowhere \n", "unknown symbol \"nowhere\"");
+
+    // throughput on a big generated file
+    constexpr int FUNCTIONS = 20000;
+    std::string big = ".section .data \n .equ STEP, 3 \n counter: \n .word 0 \n.section .text \n";
+    for (int i = 0; i < FUNCTIONS; i++) {
+        const std::string n = std::to_string(i);
+        big += "f_" + n + ": \n";
+        big += "    movi r1, 12          ; a comment \n";
+        big += "    addi r2, r1, STEP \n";
+        big += "    lbasew r3, r2, 4 \n";
+        big += "    cmp r1, r2 \n";
+        big += "    jz f_" + n + " \n";
+        big += "    stw r3, counter \n";
+        big += "    ret \n";
+    }
+    big += ".global main \nmain: \n halt \n.entry main \n";
+
+    AsmDecoder decoder;
+    constexpr int RUNS = 5;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < RUNS; i++) {
+        decoder.constants.clear();
+        auto [obj, err] = decoder.decode(big);
+        ok &= err.code == ErrorCode::OK && obj.text.size() == FUNCTIONS * 7 + 1;
+    }
+    auto stop = std::chrono::high_resolution_clock::now();
+    const double sec = std::chrono::duration<double>(stop - start).count() / RUNS;
+    std::cout << big.size() / 1e6 << " MB, " << FUNCTIONS * 8 << " lines: " << sec * 1e3 << " ms per decode, " << big.size() / 1e6 / sec << " MB/s" << std::endl;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,104 @@
+#include "../../Talos/include/environment_manager.h"
+
+#include <iostream>
+#include <string>
+#include <chrono>
+
+// interned symbols: one id per name for the whole process, links resolved by id, relocations applied in parallel
+
+constexpr int OBJECTS = 200;
+constexpr int FUNCTIONS = 600; // per object: 120k global symbols
+
+// f_<o>_<i> calls the same function of the next object, f_<last>_<i> returns
+std::vector<ObjectFile> objects() {
+    AsmDecoder decoder;
+    std::vector<ObjectFile> out;
+    for (int o = 0; o < OBJECTS; o++) {
+        std::string src = ".section .text \n";
+        for (int i = 0; i < FUNCTIONS; i++) {
+            const std::string f = "f_" + std::to_string(o) + "_" + std::to_string(i);
+            src += " .global " + f + " \n";
+            if (o + 1 < OBJECTS) src += " .extern f_" + std::to_string(o + 1) + "_" + std::to_string(i) + " \n";
+        }
+        for (int i = 0; i < FUNCTIONS; i++) {
+            src += "f_" + std::to_string(o) + "_" + std::to_string(i) + ": \n";
+            src += "  addi r4, r4, 1 \n";
+            if (o + 1 < OBJECTS) src += "  call f_" + std::to_string(o + 1) + "_" + std::to_string(i) + " \n";
+            src += "  ret \n";
+        }
+        if (o == 0) src += " .global main \nmain: \n  call f_0_7 \n  halt \n .entry main \n";
+        out.push_back(decoder.decode(src).first);
+    }
+    return out;
+}
+
+bool same_text(const LinkedBinary& a, const LinkedBinary& b) {
+    return a.entry_pc == b.entry_pc && std::ranges::equal(a.text, b.text, [](const DecodedInstr& x, const DecodedInstr& y) {
+        return x.opcode == y.opcode && x.rd == y.rd && x.rs1 == y.rs1 && x.rs2 == y.rs2 && x.imm == y.imm;
+    });
+}
+
+int main() {
+    bool ok = true;
+
+    // same name, same id, from any thread
+    SymbolInterner& names = symbol_names();
+    const SymbolId a = names.intern("some_label");
+    ok &= names.intern(std::string("some_") + "label") == a && names.intern("some_label2") != a && names.name(a) == "some_label";
+    // an empty name as the first one of its shard (a lone ":" line)
+    auto fresh = std::make_unique<SymbolInterner>();
+    const SymbolId empty = fresh->intern("");
+    ok &= fresh->intern("") == empty && fresh->name(empty).empty() && fresh->name(fresh->intern("after_empty")) == "after_empty";
+    std::vector<std::vector<SymbolId>> ids(4);
+    parallel_for(ids.size(), 4, [&](size_t t) {
+        for (int i = 0; i < 20000; i++) ids[t].push_back(names.intern("sym_" + std::to_string(i)));
+    });
+    for (auto& v : ids) ok &= v == ids[0];
+    for (int i = 0; i < 20000; i++) ok &= names.name(ids[0][i]) == "sym_" + std::to_string(i);
+
+    // a local label wins over a global of the same name in another file, local data gets its own base
+    auto env_m = EnvironmentManager(0x10000);
+    std::string e = env_m.build({
+        { "a", ".section .data \n pad: \n .word 7 \n.section .text \n .global helper \n .global main \n"
+               " main: \n  call helper \n  call local \n  ldw r2, value \n  call other \n  halt \n"
+               " helper: \n  movi r1, 1 \n  ret \n"
+               " local: \n  movi r3, 3 \n  ret \n"
+               " .extern value \n .extern other \n .entry main \n" },
+        { "b", ".section .data \n .global value \n value: \n .word 42 \n mine: \n .word 5 \n.section .text \n .global other \n"
+               " other: \n  call local \n  ldw r6, mine \n  ret \n"
+               " local: \n  movi r5, 5 \n  ret \n" },
+    });
+    if (!e.empty()) std::cout << "ERROR: " << e << std::endl;
+    env_m.start();
+    const auto& regs = env_m.mb.cpu.core.regs;
+    ok &= e.empty() && regs[1] == 1 && regs[2] == 42 && regs[3] == 3 && regs[5] == 5 && regs[6] == 5;
+
+    ok &= env_m.build({ { "a", ".section .text \n .global x \n x: \n halt \n" }, { "b", ".section .text \n .global x \n x: \n halt \n" } }).find("duplicate global symbol \"x\"") != std::string::npos;
+    ok &= env_m.build({ { "a", ".section .text \n .extern nope \n main: \n call nope \n" } }).find("unresolved extern symbol \"nope\"") != std::string::npos;
+
+    // relocations on 1 thread or all of them: same binary
+    const std::vector<ObjectFile> objs = objects();
+    std::vector<ObjectFile> copy = objs;
+    auto [e1, sequential] = link(copy, nullptr, 1);
+    copy = objs;
+    auto [e2, parallel] = link(copy, nullptr, 0);
+    ok &= e1.code == ErrorCode::OK && e2.code == ErrorCode::OK && same_text(sequential, parallel);
+
+    auto big = EnvironmentManager(0x10000);
+    big.load(parallel.text, parallel.data, parallel.rodata, parallel.entry_pc, std::move(parallel.text_symbols));
+    big.start();
+    ok &= big.mb.cpu.core.regs[4] == OBJECTS;
+
+    constexpr int RUNS = 5;
+    double total = 0;
+    for (int i = 0; i < RUNS; i++) {
+        copy = objs;
+        auto start = std::chrono::high_resolution_clock::now();
+        auto [err, bin] = link(copy);
+        total += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        ok &= err.code == ErrorCode::OK;
+    }
+    std::cout << OBJECTS * FUNCTIONS << " global symbols: " << total / RUNS << " ms per link" << std::endl;
+
+    return ok ? 0 : 1;
+}
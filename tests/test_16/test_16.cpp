@@ -0,0 +1,152 @@
+#include "../../Talos/include/environment_manager.h"
+
+#include <iostream>
+#include <string>
+#include <random>
+
+// link-time optimizer: same registers at the end with or without it, less instructions, PCs mapped back
+
+const std::string program =
+    ".section .text \n"
+    " .global main \n"
+    "main: \n"
+    "  movi r1, 5 \n"
+    "  addi r1, r1, 3 \n" // movi r1, 8, the movi before is dead
+    "  muli r2, r1, 4 \n" // movi r2, 32
+    "  mov r3, r3 \n" // no-op
+    "  mov r4, r1 \n" // movi r4, 8
+    "  movi r5, 10 \n"
+    "  movi r5, 10 \n" // already there
+    "  movi r8, 3 \n"
+    "  cmpi r8, 3 \n"
+    "  jz skip \n" // always taken: jmp, what follows is never run
+    "  movi r10, 1 \n"
+    "skip: \n"
+    "  movi r7, 3 \n"
+    "  call work \n"
+    "  jmp step1 \n" // to the next instruction
+    "step1: \n"
+    "  jmp step2 \n"
+    "step2: \n"
+    "  halt \n"
+    "unused: \n" // nothing reaches it
+    "  movi r9, 99 \n"
+    "  ret \n"
+    "work: \n"
+    "  muli r6, r7, 8 \n" // r7 unknown here: shli r6, r7, 3
+    "  addi r6, r6, 0 \n"
+    "  movi r0, 2 \n"
+    "  mul r11, r6, r0 \n" // shli r11, r6, 1
+    "  cmpi r6, 24 \n"
+    "  jz hop \n" // threaded to done
+    "  movi r11, 1 \n"
+    "hop: \n"
+    "  jmp done \n"
+    "done: \n"
+    "  ret \n"
+    " .entry main \n";
+
+struct Run {
+    std::array<uint32_t, 16> regs;
+    size_t size;
+};
+
+Run run(const std::string& src, bool optimize, EnvironmentManager& env_m) {
+    env_m.optimize = optimize;
+    std::string e = env_m.build_single(src);
+    if (!e.empty()) std::cout << "ERROR: " << e << std::endl;
+    env_m.start();
+    return { env_m.mb.cpu.core.regs, env_m.mb.rom.size() };
+}
+
+// forward jumps only: every program halts
+std::string random_program(std::mt19937& rng) {
+    auto pick = [&](int n) { return static_cast<int>(rng() % n); };
+    auto reg = [&] { return "r" + std::to_string(pick(6)); };
+    const char* rrr[] = { "add", "sub", "and", "or", "xor", "mul", "shl", "shr", "div", "mod", "min", "max" };
+    const char* rri[] = { "addi", "subi", "muli", "andi", "ori", "xori", "shli", "shri", "sari", "divi", "modi" };
+    const char* jumps[] = { "jz", "jnz", "jg", "jl", "jmp" };
+
+    constexpr int BLOCKS = 12;
+    std::string src = ".section .text \n .global main \nmain: \n";
+    for (int i = 0; i < 6; i++) src += "  movi r" + std::to_string(i) + ", " + std::to_string(pick(2) ? pick(20) : static_cast<int>(rng())) + " \n";
+    for (int b = 0; b < BLOCKS; b++) {
+        src += "L" + std::to_string(b) + ": \n";
+        for (int i = pick(8); i > 0; i--) {
+            switch (pick(8)) {
+            case 0: src += "  movi " + reg() + ", " + std::to_string(pick(300)) + " \n"; break;
+            case 1: src += "  mov " + reg() + ", " + reg() + " \n"; break;
+            case 2: src += "  " + std::string(rrr[pick(std::size(rrr))]) + " " + reg() + ", " + reg() + ", " + reg() + " \n"; break;
+            case 3: src += "  " + std::string(rri[pick(std::size(rri))]) + " " + reg() + ", " + reg() + ", " + std::to_string(pick(3) ? 1 << pick(5) : pick(256)) + " \n"; break;
+            case 4: src += "  " + std::string(pick(2) ? "cmp " : "test ") + reg() + ", " + reg() + " \n"; break;
+            case 5: src += "  cmpi " + reg() + ", " + std::to_string(pick(20)) + " \n"; break;
+            case 6: src += "  " + std::string(pick(2) ? "inc " : "clr ") + reg() + " \n"; break;
+            default: src += "  push " + reg() + " \n  pop " + reg() + " \n"; break;
+            }
+        }
+        if (pick(3) != 0 && b + 1 < BLOCKS)
+            src += "  " + std::string(jumps[pick(std::size(jumps))]) + " L" + std::to_string(b + 1 + pick(BLOCKS - b - 1)) + " \n";
+    }
+    return src + "  halt \n .entry main \n";
+}
+
+int main() {
+    bool ok = true;
+
+    auto env_m = EnvironmentManager(0x10000);
+    const Run plain = run(program, false, env_m);
+    const Run optimized = run(program, true, env_m);
+    const OptimizeStats& s = env_m.optimized;
+    std::cout << plain.size << " -> " << optimized.size << " instructions: " << s.folded << " folded, " << s.strength_reduced << " strength reduced, "
+              << s.moves_removed << " no-ops, " << s.dead_removed << " dead, " << s.jumps_threaded << " jumps threaded, " << s.rounds << " rounds" << std::endl;
+    ok &= plain.regs == optimized.regs && plain.regs[2] == 32 && plain.regs[6] == 24 && plain.regs[10] == 0 && plain.regs[11] == 48;
+    ok &= optimized.size < plain.size && s.removed == plain.size - optimized.size;
+    ok &= s.folded > 0 && s.strength_reduced > 0 && s.moves_removed > 0 && s.dead_removed > 0 && s.jumps_threaded > 0;
+
+    // no unoptimized copy of muli / mul / the jmp chain left
+    for (const DecodedInstr& I : env_m.mb.rom) ok &= I.opcode != MULI && I.opcode != MUL;
+
+    // every PC maps back to the one it had after linking, in order
+    auto [e, linked] = env_m.assemble({ { "main", program } });
+    ok &= e.empty() && env_m.origin_pc.size() == optimized.size && linked.origin_pc == env_m.origin_pc;
+    for (size_t pc = 1; pc < env_m.origin_pc.size(); pc++) ok &= env_m.origin_pc[pc] > env_m.origin_pc[pc - 1];
+    env_m.optimize = false;
+    auto [e2, unoptimized] = env_m.assemble({ { "main", program } });
+    ok &= unoptimized.origin_pc.empty() && env_m.origin_pc[linked.entry_pc] == unoptimized.entry_pc + 1; // movi r1, 5 is gone
+    for (const Symbol& sym : linked.text_symbols)
+        if (sym.name == "work") ok &= unoptimized.text[env_m.origin_pc[sym.value]].opcode == MULI;
+
+    // the profile-guided layout runs after it and keeps the map
+    env_m.optimize = true;
+    run(program, true, env_m);
+    env_m.start(ExecMode::PROFILE);
+    ok &= env_m.layout_from_profile();
+    const Run laid_out = run(program, true, env_m);
+    ok &= laid_out.regs == plain.regs && env_m.layout.blocks != 0 && env_m.origin_pc.size() == laid_out.size;
+    env_m.layout_profile = { };
+
+    // INT32_MIN % -1 would trap the host: folded to 0 like the engines do it, even in a block that never runs
+    env_m.optimize = true;
+    e = env_m.build_single(".section .text \n .global main \nmain: \n  halt \nnever: \n  movi r1, 0x7FFFFFFF \n  inc r1 \n"
+                           "  movi r2, 0 \n  dec r2 \n  movi r3, 1 \n  mod r3, r1, r2 \n  halt \n .entry main \n");
+    ok &= e.empty();
+
+    // random straight-line blocks with forward jumps: same end state
+    std::mt19937 rng(16);
+    size_t before = 0, after = 0;
+    for (int i = 0; i < 300; i++) {
+        const std::string src = random_program(rng);
+        const Run a = run(src, false, env_m);
+        const Run b = run(src, true, env_m);
+        before += a.size;
+        after += b.size;
+        if (a.regs != b.regs) {
+            std::cout << "different registers:\n" << src << std::endl;
+            ok = false;
+            break;
+        }
+    }
+    std::cout << "random programs: " << before << " -> " << after << " instructions" << std::endl;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,235 @@
+#include "../../Talos/include/environment_manager.h"
+
+#include <iostream>
+#include <string>
+#include <random>
+#include <chrono>
+
+// tracing tier: hot loops compiled with their registers in host registers, same end state as AUTO
+
+struct Run {
+    std::array<uint32_t, 16> regs;
+    std::vector<uint8_t> ram;
+    double ms;
+    TraceStats traces;
+};
+
+Run run(const std::string& src, ExecMode mode, bool tracing, EnvironmentManager& env_m) {
+    env_m.jit.tracing = tracing;
+    std::string e = env_m.build_single(src);
+    if (!e.empty()) std::cout << "ERROR: " << e << std::endl;
+    auto start = std::chrono::high_resolution_clock::now();
+    env_m.start(mode);
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    return { env_m.mb.cpu.core.regs, { env_m.mb.ram.begin(), env_m.mb.ram.end() }, ms, env_m.jit.traces.stats };
+}
+
+// AUTO, the baseline JIT and the tracing JIT: same registers and RAM
+bool same(const std::string& name, const std::string& src, EnvironmentManager& env_m, size_t min_traces = 0, bool print = true) {
+    const Run a = run(src, ExecMode::AUTO, true, env_m);
+    const Run base = run(src, ExecMode::JIT, false, env_m);
+    const Run traced = run(src, ExecMode::JIT, true, env_m);
+    bool ok = a.regs == base.regs && a.regs == traced.regs && a.ram == base.ram && a.ram == traced.ram;
+    ok &= traced.traces.compiled >= min_traces;
+    if (print)
+        std::cout << name << ": AUTO " << a.ms << " ms, JIT " << base.ms << " ms, traced " << traced.ms << " ms, "
+                  << traced.traces.compiled << " traces, " << traced.traces.aborted << " aborted" << (ok ? "" : "  DIFFERENT") << std::endl;
+    return ok;
+}
+
+const std::string numeric =
+    ".section .text \n"
+    "  clr r1 \n"
+    "  movi r2, 2000000 \n"
+    "  movi r3, 1 \n"
+    "loop: \n"
+    "  add r4, r4, r3 \n"
+    "  xor r5, r5, r4 \n"
+    "  shli r6, r4, 3 \n"
+    "  sub r5, r5, r6 \n"
+    "  muli r7, r5, 3 \n"
+    "  addi r3, r3, 7 \n"
+    "  inc r1 \n"
+    "  cmp r1, r2 \n"
+    "  jl loop \n"
+    "  halt \n";
+
+// loads, stores of every size, push / pop: RAM and dirty granules like the interpreter
+const std::string memory =
+    ".section .text \n"
+    "  movi r9, 30 \n"
+    "pass: \n"
+    "  movi r1, 4096 \n"
+    "  movi r2, 20000 \n"
+    "  movi r3, 2000 \n"
+    "copy: \n"
+    "  lbasew r4, r1, 0 \n"
+    "  add r4, r4, r3 \n"
+    "  sbasew r4, r1, 0 \n"
+    "  sbaseh r4, r2, 0 \n"
+    "  lbaseh r5, r2, 0 \n"
+    "  sbaseb r5, r2, 0 \n"
+    "  lbaseb r6, r2, 0 \n"
+    "  push r6 \n"
+    "  pop r7 \n"
+    "  add r8, r8, r7 \n"
+    "  stw r8, acc \n"
+    "  addi r1, r1, 4 \n"
+    "  addi r2, r2, 3 \n"
+    "  dec r3 \n"
+    "  cmpi r3, 0 \n"
+    "  jnz copy \n"
+    "  dec r9 \n"
+    "  cmpi r9, 0 \n"
+    "  jnz pass \n"
+    "  halt \n"
+    ".section .data \n"
+    "acc: \n"
+    "  .word 0 \n";
+
+// data dependent branches: guards fail half of the time, the side exits go back to the baseline
+const std::string branchy =
+    ".section .text \n"
+    "  movi r1, 1 \n"
+    "  movi r2, 3000 \n"
+    "outer: \n"
+    "  mov r3, r1 \n"
+    "inner: \n"
+    "  cmpi r3, 1 \n"
+    "  jz next \n"
+    "  testi r3, 1 \n"
+    "  jz even \n"
+    "  muli r3, r3, 3 \n"
+    "  addi r3, r3, 1 \n"
+    "  inc r5 \n"
+    "  jmp inner \n"
+    "even: \n"
+    "  shri r3, r3, 1 \n"
+    "  inc r5 \n"
+    "  jmp inner \n"
+    "next: \n"
+    "  inc r1 \n"
+    "  cmp r1, r2 \n"
+    "  jl outer \n"
+    "  halt \n";
+
+// regs[13] read as a register, unsigned compares, cmpui, a side exit on the last iteration only
+const std::string flags =
+    ".section .text \n"
+    "  movi r1, 500000 \n"
+    "  not r2, r0 \n"
+    "loop: \n"
+    "  cmpu r1, r2 \n"
+    "  add r3, r3, cmp \n"
+    "  cmpui r1, 100 \n"
+    "  sub r4, r4, cmp \n"
+    "  test r1, r2 \n"
+    "  jl never \n"
+    "  subi r2, r2, 3 \n"
+    "  neg r6, r2 \n"
+    "  abs r7, r6 \n"
+    "  min r8, r6, r7 \n"
+    "  max r9, r6, r2 \n"
+    "  swap r8, r9 \n"
+    "  rori r10, r9, 5 \n"
+    "  rol r11, r10, r1 \n"
+    "  dec r1 \n"
+    "  cmpi r1, 0 \n"
+    "  jg loop \n"
+    "never: \n"
+    "  halt \n";
+
+// a division in the loop: never traced
+const std::string untraceable =
+    ".section .text \n"
+    "  movi r1, 100000 \n"
+    "  movi r2, 7 \n"
+    "loop: \n"
+    "  div r3, r1, r2 \n"
+    "  add r4, r4, r3 \n"
+    "  dec r1 \n"
+    "  cmpi r1, 0 \n"
+    "  jnz loop \n"
+    "  halt \n";
+
+// counted loop around random straight-line code with forward branches in it
+std::string random_loop(std::mt19937& rng) {
+    auto pick = [&](int n) { return static_cast<int>(rng() % n); };
+    auto reg = [&] { return "r" + std::to_string(pick(8)); };
+    const char* rrr[] = { "add", "sub", "and", "or", "xor", "mul", "shl", "shr", "sar", "rol", "ror", "min", "max" };
+    const char* rri[] = { "addi", "subi", "muli", "andi", "ori", "xori", "shli", "shri", "sari", "roli", "rori" };
+    const char* jumps[] = { "jz", "jnz", "jg", "jl", "jmp" };
+
+    constexpr int BLOCKS = 6;
+    std::string src = ".section .text \n";
+    for (int i = 0; i < 8; i++) src += "  movi r" + std::to_string(i) + ", " + std::to_string(pick(2) ? pick(20) : static_cast<int>(rng())) + " \n";
+    src += "  movi r9, " + std::to_string(200 + pick(300)) + " \n  movi r10, 8192 \nloop: \n";
+    for (int b = 0; b < BLOCKS; b++) {
+        src += "L" + std::to_string(b) + ": \n";
+        for (int i = pick(6); i > 0; i--) {
+            switch (pick(11)) {
+            case 0: src += "  movi " + reg() + ", " + std::to_string(pick(300)) + " \n"; break;
+            case 1: src += "  " + std::string(pick(2) ? "mov " : "swap ") + reg() + ", " + reg() + " \n"; break;
+            case 2: src += "  " + std::string(rrr[pick(std::size(rrr))]) + " " + reg() + ", " + reg() + ", " + reg() + " \n"; break;
+            case 3: src += "  " + std::string(rri[pick(std::size(rri))]) + " " + reg() + ", " + reg() + ", " + std::to_string(pick(256)) + " \n"; break;
+            case 4: src += "  " + std::string(pick(2) ? "cmp " : pick(2) ? "cmpu " : "test ") + reg() + ", " + reg() + " \n"; break;
+            case 5: src += "  " + std::string(pick(2) ? "cmpi " : "testi ") + reg() + ", " + std::to_string(pick(20)) + " \n"; break;
+            case 6: src += pick(2) ? "  inc " + reg() + " \n" : "  " + std::string(pick(2) ? "neg " : "not ") + reg() + ", " + reg() + " \n"; break;
+            case 7: src += "  add " + reg() + ", " + reg() + ", cmp \n"; break;
+            case 8: src += "  andi r11, " + reg() + ", 252 \n  sbasew " + reg() + ", r11, 0 \n  lbaseh " + reg() + ", r11, 0 \n"; break;
+            case 9: src += "  sbaseb " + reg() + ", r10, 0 \n  lbasew " + reg() + ", r10, 0 \n"; break;
+            default: src += "  push " + reg() + " \n  pop " + reg() + " \n"; break;
+            }
+        }
+        if (pick(2) != 0 && b + 1 < BLOCKS)
+            src += "  " + std::string(jumps[pick(std::size(jumps))]) + " L" + std::to_string(b + 1 + pick(BLOCKS - b - 1)) + " \n";
+    }
+    return src + "  dec r9 \n  cmpi r9, 0 \n  jnz loop \n  halt \n";
+}
+
+int main() {
+    bool ok = true;
+    auto env_m = EnvironmentManager(0x10000);
+
+    ok &= same("numeric", numeric, env_m, 1);
+    ok &= same("memory", memory, env_m, 1);
+    ok &= same("branchy", branchy, env_m, 1);
+    ok &= same("flags", flags, env_m, 1);
+    ok &= same("untraceable", untraceable, env_m);
+    ok &= env_m.jit.traces.stats.compiled == 0 && env_m.jit.traces.stats.aborted > 0;
+
+    // baseline only: no counters in the generated code
+    run(numeric, ExecMode::JIT, false, env_m);
+    ok &= !env_m.jit.hot && env_m.jit.traces.stats.compiled == 0;
+
+    // the loop gets hot right before its store leaves the RAM: the fault happens while the trace is recorded,
+    // the next build must not wait on the trace cache
+    const std::string faulting =
+        ".section .text \n"
+        "  movi r1, 0xFF00 \n"
+        "loop: \n"
+        "  sbasew r2, r1, 0 \n"
+        "  addi r1, r1, 4 \n"
+        "  jmp loop \n";
+    for (int i = 0; i < 2; i++) {
+        env_m.jit.tracing = true;
+        ok &= env_m.build_single(faulting).empty() && env_m.start(ExecMode::JIT) == ErrorCode::RAM_OVERFLOW;
+    }
+    ok &= env_m.build_single(numeric).empty();
+
+    std::mt19937 rng(17);
+    size_t traced = 0;
+    for (int i = 0; i < 300; i++) {
+        const std::string src = random_loop(rng);
+        if (!same("random", src, env_m, 0, false)) {
+            std::cout << "different end state:\n" << src << std::endl;
+            ok = false;
+            break;
+        }
+        traced += env_m.jit.traces.stats.compiled;
+    }
+    std::cout << "random loops: " << traced << " traces" << std::endl;
+    ok &= traced > 0;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,29 @@
+.section .text
+ .global sum_to
+ .global fill
+ ; r2 = 0 + 1 + ... + r1 - 1, keeps r1
+ sum_to:
+  push r3
+  clr r2
+  clr r3
+ sum_loop:
+  add r2, r2, r3
+  inc r3
+  cmp r3, r1
+  jl sum_loop
+  pop r3
+  ret
+ ; r3 bytes from r1 on: i * 7, r4 = r1 + r3 after
+ fill:
+  push r5
+  clr r5
+  mov r4, r1
+ fill_loop:
+  muli r6, r5, 7
+  sbaseb r6, r4, 0
+  inc r4
+  inc r5
+  cmp r5, r3
+  jl fill_loop
+  pop r5
+  ret
@@ -0,0 +1,52 @@
+; demo for the ahead-of-time translation: calls across files, the stack, memory, the FPU and a spawned core
+.section .text
+ .extern sum_to
+ .extern fill
+ .global main
+ main:
+  movi r1, 40
+  spawn r8, worker
+  movi r1, 200000
+  call sum_to
+  stw r2, total
+  movi r1, 0x2000
+  movi r3, 64
+  call fill
+  movi r9, 0x3000
+  memcpy r9, r1, 64
+  fldw f1, one
+  fldw f2, step
+ floop:
+  fadd f1, f1, f2
+  fcmp f1, f3
+  jz fdone
+  movf r5, f1
+  subi r3, r3, 1
+  cmpi r3, 0
+  jnz floop
+ fdone:
+  fmov f4, r5
+  fstw f4, result
+  join r8
+  movi r9, 0x9000
+  lbasew r6, r9, 0
+  halt
+ worker:
+  movi r7, 1
+ wloop:
+  movi r9, 0x9000
+  xadd r10, r9, r7
+  dec r1
+  cmpi r1, 0
+  jg wloop
+  halt
+ .entry main
+.section .data
+ total:
+  .word 0
+ result:
+  .word 0
+ one:
+  .word 0x3F800000
+ step:
+  .word 0x3E800000
@@ -0,0 +1,8 @@
+; x % -1 is 0: INT32_MIN % -1 must not trap the host in the translated code either
+.section .text
+ movi r1, -2147483648
+ movi r2, -1
+ mod r3, r1, r2
+ movi r4, 7
+ mod r4, r1, r2
+ halt
@@ -0,0 +1,7 @@
+; a store outside of the RAM: the translated code stops on it with the registers of the interpreter
+.section .text
+ movi r1, 5
+ movi r2, 0x7FFFFFF0
+ inc r3
+ sbasew r1, r2, 0
+ halt
@@ -0,0 +1,93 @@
+#include "../../Talos/include/environment_manager.h"
+#include "../../Talos/include/asm/aot.h"
+
+#include <iostream>
+#include <string>
+#include <chrono>
+
+// ahead-of-time translation: main.s + lib.s translated to C++ by talos_aot when building (talos_aot_add in CMakeLists.txt)
+
+extern const AotProgram aot_demo;
+extern const AotProgram aot_mod;
+extern const AotProgram aot_store;
+
+constexpr uint32_t N = 200000;
+constexpr uint32_t SUM = static_cast<uint32_t>(uint64_t(N) * (N - 1) / 2);
+
+double time_ms(EnvironmentManager& env_m, ExecMode mode) {
+    env_m.restore();
+    auto start = std::chrono::high_resolution_clock::now();
+    env_m.start(mode);
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+int main() {
+    bool ok = true;
+    auto env_m = EnvironmentManager(0x10000, 2);
+    std::string e = env_m.load_aot(aot_demo);
+    if (!e.empty()) std::cout << "ERROR: " << e << std::endl;
+
+    // translated code against the interpreter, from the entry point
+    e = env_m.check_aot();
+    if (!e.empty()) {
+        std::cout << "from the entry point: " << e << std::endl;
+        ok = false;
+    }
+    env_m.restore();
+    if (env_m.start(ExecMode::AOT) != ErrorCode::OK) ok = false;
+    const std::array<uint32_t, 16>& regs = env_m.mb.cpu.core.regs;
+    uint32_t total;
+    std::memcpy(&total, &env_m.mb.ram[0], 4); // first word of .data
+    if (regs[2] != SUM || total != SUM || regs[6] != 40 || env_m.mb.ram[0x3000 + 10] != 70 || env_m.mb.ram[0x3000 + 63] != static_cast<uint8_t>(63 * 7)) {
+        std::cout << "wrong results: r2 = " << regs[2] << ", r6 = " << regs[6] << std::endl;
+        ok = false;
+    }
+
+    // from the middle of the program: AUTO for a while (in sum_to, worker spawned), then from there
+    env_m.restore();
+    env_m.run_for(1000);
+    env_m.join();
+    e = env_m.check_aot();
+    if (!e.empty()) {
+        std::cout << "from the middle: " << e << std::endl;
+        ok = false;
+    }
+
+    // the translation of the same sources: one label per block, the sections as they are linked
+    auto [link_error, bin] = env_m.assemble({ { "main", std::string(".section .text \n halt \n") } });
+    const std::string source = translate_to_cpp(bin, "my-program");
+    if (!link_error.empty() || source.find("aot_my_program") == std::string::npos || source.find("B0:") == std::string::npos) {
+        std::cout << "unexpected translation:\n" << source << std::endl;
+        ok = false;
+    }
+    if (env_m.mb.rom.size() != aot_demo.text.size()) ok = false;
+
+    // any other load drops the translated code: AOT runs the interpreter
+    env_m.build_single(".section .text \n movi r1, 5 \n halt \n");
+    ok &= env_m.aot == nullptr && env_m.start(ExecMode::AOT) == ErrorCode::OK && env_m.mb.cpu.core.regs[1] == 5;
+
+    // INT32_MIN % -1: 0 like the interpreter, the host does not trap
+    env_m.load_aot(aot_mod);
+    e = env_m.check_aot();
+    if (!e.empty() || env_m.start(ExecMode::AOT) != ErrorCode::OK || env_m.mb.cpu.core.regs[3] != 0 || env_m.mb.cpu.core.regs[4] != 0) {
+        std::cout << "INT32_MIN % -1: " << e << std::endl;
+        ok = false;
+    }
+
+    // a faulting store: PC on it, what ran before it done
+    env_m.load_aot(aot_store);
+    e = env_m.check_aot();
+    env_m.restore();
+    if (!e.empty() || env_m.start(ExecMode::AOT) != ErrorCode::RAM_OVERFLOW || env_m.mb.cpu.core.PC != 3 || env_m.mb.cpu.core.regs[3] != 1) {
+        std::cout << "store outside of the RAM: " << e << std::endl;
+        ok = false;
+    }
+
+    env_m.load_aot(aot_demo);
+    env_m.snapshot();
+    const double interpreted = time_ms(env_m, ExecMode::AUTO);
+    const double translated = time_ms(env_m, ExecMode::AOT);
+    std::cout << "AUTO " << interpreted << " ms, AOT " << translated << " ms" << std::endl;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,165 @@
+#include "../../Talos/include/environment_manager.h"
+
+#include <iostream>
+#include <string>
+#include <chrono>
+
+// programs assembled and linked by the host compiler: same sections as assemble(), nothing done at startup
+
+constexpr AsmSource main_src =
+    ".section .text \n"
+    " .extern sum \n"
+    " .extern table \n"
+    " .global main \n"
+    " .equ COUNT, 300 \n"
+    " main: \n"
+    "  movi r2, COUNT \n"
+    "  clr r1 \n"
+    "  clr r4 \n"
+    " loop: \n"
+    "  call sum \n"
+    "  inc r1 \n"
+    "  cmp r1, r2 \n"
+    "  jl loop \n"
+    "  stw r4, result \n"
+    "  ldw r5, table \n"
+    "  movi r6, COUNT \n"
+    "  halt \n"
+    " .entry main \n"
+    ".section .data \n"
+    " count: \n"
+    "  .word COUNT \n"
+    " result: \n"
+    "  .word 0 \n"
+    " bytes: \n"
+    "  .byte 1, 2, 0x3 \n"
+    "  .hword 0b101 \n"
+    "  .align 3 \n"
+    "  .space 5 \n"
+    ".section .bss \n"
+    " scratch: \n"
+    "  .word 0, 0 \n";
+
+constexpr AsmSource sum_src =
+    ".section .text \n"
+    " .global sum \n"
+    " .global table \n"
+    " sum: \n" // ; comments too
+    "  add r4, r4, r1 \n"
+    "  ret \n"
+    ".section .rodata \n"
+    " table: \n"
+    "  .word 0x12345678, -7 \n";
+
+constexpr auto program = assemble_static<main_src, sum_src>();
+
+// checked while compiling
+static_assert(program.text.size() == 13 && program.text[0].opcode == MOV_IMM && program.text[3].opcode == CALL);
+static_assert(program.text[3].imm == 11 - 4); // call sum: relocated to the second file
+static_assert(program.text_symbols[0].name == "main" && program.entry_pc == 0);
+static_assert(program.rodata.size() == 8 && program.bss_size == 8);
+
+// what would not compile: the error is there, without failing this file
+static_assert(static_asm::sizes_of<" add r1, r1 \n">().error.code == ErrorCode::INVALID_ARG_SIZE);
+static_assert(static_asm::sizes_of<".section .text \n nop \n">().error.index_line == 1);
+static_assert(static_asm::sizes_of<" jmp nowhere \n">().error.code == ErrorCode::UNKNOWN_SYMBOL);
+static_assert(static_asm::sizes_of<" .extern f \n call f \n">().error.code == ErrorCode::UNRESOLVED_EXTERN_SYMBOL);
+static_assert(static_asm::sizes_of<" .global a \n a: \n halt \n", " .global a \n a: \n halt \n">().error.file == 1);
+
+bool same_text(const std::vector<DecodedInstr>& a, std::span<const DecodedInstr> b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](const DecodedInstr& x, const DecodedInstr& y) {
+        return x.opcode == y.opcode && x.rd == y.rd && x.rs1 == y.rs1 && x.rs2 == y.rs2 && x.imm == y.imm;
+    });
+}
+
+// the runtime front end without EnvironmentManager: the error code and line of decode() / link() like build()
+std::pair<ErrorInfo, LinkedBinary> runtime_build(const std::vector<std::string_view>& files) {
+    ConstantTable constants;
+    std::vector<ObjectFile> objects;
+    for (std::string_view file : files) {
+        AsmDecoder decoder;
+        decoder.constants = std::move(constants);
+        auto [obj, e] = decoder.decode(file);
+        if (e.code != ErrorCode::OK) return { e, { } };
+        constants = std::move(decoder.constants);
+        objects.push_back(std::move(obj));
+    }
+    return link(objects);
+}
+
+// identical sources through both front ends: the same error on the same line, or the same program
+template <AsmSource... files>
+bool same_front_ends(const char* name, ErrorCode expected) {
+    constexpr static_asm::Error compiled = static_asm::sizes_of<files...>().error;
+    const static_asm::Linked l = static_asm::build({ files.view()... });
+    auto [e, linked] = runtime_build({ files.view()... });
+
+    bool ok = compiled.code == expected && e.code == expected && compiled.index_line == e.index_line && l.error.code == compiled.code;
+    if (ok && expected == ErrorCode::OK)
+        ok = same_text(linked.text, l.text) && linked.data == l.data && linked.rodata == l.rodata && linked.bss_size == l.bss_size && linked.entry_pc == l.entry_pc;
+    if (!ok)
+        std::cout << name << ": host compiler " << static_cast<int>(compiled.code) << " line " << compiled.index_line << " \"" << compiled.message
+                  << "\", runtime " << static_cast<int>(e.code) << " line " << e.index_line << " \"" << e.message << "\"" << std::endl;
+    return ok;
+}
+
+int main() {
+    bool ok = true;
+
+    ok &= same_front_ends<main_src, sum_src>("two files", ErrorCode::OK);
+    ok &= same_front_ends<".text \n .align 4 \n halt \n.data \n .byte 1 \n .align 2 \n d: \n .hword 2 \n.bss \n .byte 0 \n .word 0 \n">("alignment", ErrorCode::OK);
+    ok &= same_front_ends<" .byte 1 \n">("byte in .text", ErrorCode::INVALID_ARG);
+    ok &= same_front_ends<".text \n halt \n .word 5 \n">("word in .text", ErrorCode::INVALID_ARG);
+    ok &= same_front_ends<".data \n .word 1 \n.section .text \n .hword 7 \n">("hword in .text", ErrorCode::INVALID_ARG);
+    ok &= same_front_ends<".section .text \n .space 4 \n">("space in .text", ErrorCode::INVALID_ARG);
+    ok &= same_front_ends<".data \n .word 99999999999 \n">("number too large", ErrorCode::STOI_POS_OVERFLOW);
+    ok &= same_front_ends<".section .code \n">("unknown section", ErrorCode::INVALID_ARG);
+    ok &= same_front_ends<" .equ A \n">(".equ without value", ErrorCode::INVALID_ARG_SIZE);
+    ok &= same_front_ends<" halt \n frob r1 \n">("unknown instruction", ErrorCode::UNKNOWN_INSTR);
+    ok &= same_front_ends<" add r1, r1 \n">("argument count", ErrorCode::INVALID_ARG_SIZE);
+    ok &= same_front_ends<" movi r13x, 1 \n">("register", ErrorCode::INVALID_REG);
+    ok &= same_front_ends<" a: \n halt \n a: \n">("duplicate label", ErrorCode::DUPLICATE_LABEL);
+    ok &= same_front_ends<" jmp nowhere \n">("unknown symbol", ErrorCode::UNKNOWN_SYMBOL);
+    ok &= same_front_ends<".rodata \n k: \n .word 1 \n.text \n stw r1, k \n">("rodata store", ErrorCode::RODATA_VAR_MODIFIED);
+    ok &= same_front_ends<" .global a \n a: \n halt \n", " .global a \n a: \n halt \n">("duplicate global", ErrorCode::DUPLICATE_GLOBAL_SYMBOL);
+    ok &= same_front_ends<" .extern f \n call f \n">("unresolved extern", ErrorCode::UNRESOLVED_EXTERN_SYMBOL);
+    ok &= same_front_ends<" .entry nowhere \n halt \n">("unknown entry", ErrorCode::UNKNOWN_ENTRY_SYBOL);
+
+    // the same sections and symbols as the runtime assembler
+    auto env_m = EnvironmentManager(0x10000);
+    auto [e, linked] = env_m.assemble({ { "main", std::string(main_src.view()) }, { "sum", std::string(sum_src.view()) } });
+    if (!e.empty()) std::cout << "ERROR: " << e << std::endl;
+    const std::vector<Symbol> symbols = program.symbols();
+    bool same_symbols = symbols.size() == linked.text_symbols.size();
+    for (size_t i = 0; same_symbols && i < symbols.size(); i++)
+        same_symbols = symbols[i].name == linked.text_symbols[i].name && symbols[i].value == linked.text_symbols[i].value && symbols[i].bind == linked.text_symbols[i].bind;
+    if (!same_text(linked.text, program.text) || !std::ranges::equal(linked.data, program.data) || !std::ranges::equal(linked.rodata, program.rodata)
+        || linked.entry_pc != program.entry_pc || linked.bss_size != program.bss_size || !same_symbols) {
+        std::cout << "the static program differs from assemble()" << std::endl;
+        ok = false;
+    }
+
+    // and it runs like a build
+    auto start = std::chrono::high_resolution_clock::now();
+    e = env_m.load_static(program);
+    auto stop = std::chrono::high_resolution_clock::now();
+    std::cout << "load_static " << duration_cast<std::chrono::microseconds>(stop - start).count() << " micro_sec" << std::endl;
+    if (!e.empty() || env_m.start() != ErrorCode::OK) ok = false;
+    const auto& regs = env_m.mb.cpu.core.regs;
+    if (regs[4] != 300 * 299 / 2 || regs[5] != 0x12345678 || regs[6] != 300 || env_m.text_symbols.size() != symbols.size()) {
+        std::cout << "wrong results: r4 = " << regs[4] << ", r5 = " << regs[5] << std::endl;
+        ok = false;
+    }
+
+    start = std::chrono::high_resolution_clock::now();
+    e = env_m.build({ { "main", std::string(main_src.view()) }, { "sum", std::string(sum_src.view()) } });
+    stop = std::chrono::high_resolution_clock::now();
+    std::cout << "build " << duration_cast<std::chrono::microseconds>(stop - start).count() << " micro_sec" << std::endl;
+
+    // straight on the board
+    MotherBoard mb(0x10000);
+    mb.load_prog(program.text);
+    ok &= mb.rom.size() == program.text.size() && mb.rom[3].imm == program.text[3].imm;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,106 @@
+#include "../../Talos/include/environment_manager.h"
+
+#include <iostream>
+#include <string>
+#include <chrono>
+
+// super-instructions benchmark: same programs with and without the fusion pass
+
+struct BenchResult {
+    uint64_t dispatches = 0;
+    long long duration = 0;
+    std::array<uint32_t, 16> regs{};
+};
+
+BenchResult bench(const std::vector<std::pair<std::string, std::string>>& files, bool fused) {
+    auto env_m = EnvironmentManager(0xFFFF);
+    env_m.superinstructions = fused;
+
+    std::string e = env_m.build(files);
+    if (!e.empty()) std::cout << "ERROR: " << e << std::endl;
+
+    dispatch_count = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    env_m.start();
+    auto stop = std::chrono::high_resolution_clock::now();
+
+    return { dispatch_count, duration_cast<std::chrono::microseconds>(stop - start).count(), env_m.mb.cpu.core.regs };
+}
+
+bool compare(const std::string& name, const std::vector<std::pair<std::string, std::string>>& files) {
+    BenchResult plain = bench(files, false);
+    BenchResult fused = bench(files, true);
+
+    std::cout << "\n---------- " << name << " ----------\n";
+    std::cout << "DISPATCHES: " << plain.dispatches << " -> " << fused.dispatches;
+    if (plain.dispatches != 0)
+        std::cout << " (" << 100 - fused.dispatches * 100 / plain.dispatches << "% saved)";
+    std::cout << "\nRUN DURATION: " << plain.duration << " -> " << fused.duration << " micro_sec" << std::endl;
+
+    if (plain.regs != fused.regs) {
+        std::cout << "registers differ after the run" << std::endl;
+        return false;
+    }
+    return fused.dispatches < plain.dispatches;
+}
+
+// STEP mode reports the instructions as written, even where the ROM holds a fused head
+bool check_step_info(const std::string& program) {
+    auto env_m = EnvironmentManager(0xFFFF);
+    std::string e = env_m.build_single(program);
+    if (!e.empty()) std::cout << "ERROR: " << e << std::endl;
+    if (env_m.mb.rom[1].opcode != INC_CMP_JL) return false;
+
+    StepInfo info = env_m.step(); // ldw, then stands on the inc
+    if (info.PC != 1 || info.instr.opcode != INC) {
+        std::cout << "StepInfo shows a fused opcode" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main() {
+    // test_0 style: counter loop
+    std::string loop =
+        ".section .text \n"
+        " ldw r1, var \n"
+        " loop: \n"
+        "  inc r0 \n"
+        "  cmp r0, r1 \n"
+        "  jl loop \n"
+        " halt \n"
+        ".section .data \n"
+        " var: \n"
+        "  .word 2_000_000 \n";
+
+    // test_1 style: call into another file from a loop
+    std::string file1 =
+        ".section .text \n"
+        " .extern func2 \n"
+        " .global main \n"
+        " main: \n"
+        "  ldw r3, count \n"
+        " loop: \n"
+        "  call func2 \n"
+        "  addi r2, r2, 1 \n"
+        "  cmp r2, r3 \n"
+        "  jl loop \n"
+        "  halt \n"
+        " .entry main \n"
+        ".section .data \n"
+        " count: \n"
+        "  .word 500_000 \n";
+
+    std::string file2 =
+        ".section .text \n"
+        " .global func2 \n"
+        " func2: \n"
+        "  movi r1, 42 \n"
+        "  ret \n";
+
+    bool ok = compare("LOOP", { { "main", loop } });
+    ok &= compare("CALL LOOP", { { "file1", file1 }, { "file2", file2 } });
+    ok &= check_step_info(loop);
+
+    return ok ? 0 : 1;
+}
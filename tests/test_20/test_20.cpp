@@ -0,0 +1,233 @@
+#include "../../Talos/include/environment_manager.h"
+
+#include <iostream>
+#include <string>
+#include <random>
+#include <chrono>
+
+// one function per handler tail-calling the next one: same end state as the computed-goto run()
+
+struct Run {
+    std::array<uint32_t, 16> regs;
+    std::array<uint32_t, 16> fregs;
+    std::vector<uint8_t> ram;
+    uint32_t pc;
+    double ms;
+};
+
+Run run(const std::string& src, ExecMode mode, EnvironmentManager& env_m, bool all = false) {
+    std::string e = env_m.build_single(src);
+    if (!e.empty()) std::cout << "ERROR: " << e << std::endl;
+    auto start = std::chrono::high_resolution_clock::now();
+    if (all) env_m.start_all(mode);
+    else env_m.start(mode);
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    const SimpleCore& c = env_m.mb.cpu.core;
+    return { c.regs, c.fregs, { env_m.mb.ram.begin(), env_m.mb.ram.begin() + 0x10000 }, c.PC, ms };
+}
+
+bool same(const std::string& name, const std::string& src, EnvironmentManager& env_m, bool print = true, bool all = false) {
+    const Run a = run(src, ExecMode::AUTO, env_m, all);
+    const Run t = run(src, ExecMode::TAIL, env_m, all);
+    const bool ok = a.regs == t.regs && a.fregs == t.fregs && a.ram == t.ram && a.pc == t.pc;
+    if (print) std::cout << name << ": AUTO " << a.ms << " ms, TAIL " << t.ms << " ms" << (ok ? "" : "  DIFFERENT") << std::endl;
+    return ok;
+}
+
+const std::string numeric =
+    ".section .text \n"
+    "  clr r1 \n"
+    "  movi r2, 2000000 \n"
+    "  movi r3, 1 \n"
+    "loop: \n"
+    "  add r4, r4, r3 \n"
+    "  xor r5, r5, r4 \n"
+    "  shli r6, r4, 3 \n"
+    "  sub r5, r5, r6 \n"
+    "  muli r7, r5, 3 \n"
+    "  addi r3, r3, 7 \n"
+    "  inc r1 \n"
+    "  cmp r1, r2 \n"
+    "  jl loop \n"
+    "  halt \n";
+
+// loads and stores of every size, push / pop, memcpy
+const std::string memory =
+    ".section .text \n"
+    "  movi r9, 30 \n"
+    "pass: \n"
+    "  movi r1, 4096 \n"
+    "  movi r2, 20000 \n"
+    "  movi r3, 2000 \n"
+    "copy: \n"
+    "  lbasew r4, r1, 0 \n"
+    "  add r4, r4, r3 \n"
+    "  sbasew r4, r1, 0 \n"
+    "  sbaseh r4, r2, 0 \n"
+    "  lbaseh r5, r2, 0 \n"
+    "  sbaseb r5, r2, 0 \n"
+    "  lbaseb r6, r2, 0 \n"
+    "  push r6 \n"
+    "  pop r7 \n"
+    "  add r8, r8, r7 \n"
+    "  stw r8, acc \n"
+    "  addi r1, r1, 4 \n"
+    "  addi r2, r2, 3 \n"
+    "  dec r3 \n"
+    "  cmpi r3, 0 \n"
+    "  jnz copy \n"
+    "  dec r9 \n"
+    "  cmpi r9, 0 \n"
+    "  jnz pass \n"
+    "  movi r1, 4096 \n"
+    "  movi r2, 40000 \n"
+    "  memcpy r2, r1, 64 \n"
+    "  halt \n"
+    ".section .data \n"
+    "acc: \n"
+    "  .word 0 \n";
+
+const std::string recursion =
+    ".section .text \n"
+    " .global main \n"
+    "main: \n"
+    "  movi r1, 20 \n"
+    "  call fib \n"
+    "  halt \n"
+    "fib: \n"
+    "  cmpi r1, 2 \n"
+    "  jl base \n"
+    "  push r1 \n"
+    "  subi r1, r1, 1 \n"
+    "  call fib \n"
+    "  pop r1 \n"
+    "  push r2 \n"
+    "  subi r1, r1, 2 \n"
+    "  call fib \n"
+    "  pop r3 \n"
+    "  add r2, r2, r3 \n"
+    "  ret \n"
+    "base: \n"
+    "  mov r2, r1 \n"
+    "  ret \n"
+    " .entry main \n";
+
+const std::string fpu =
+    ".section .data \n"
+    "one: \n"
+    "  .word 0x3F800000 \n"
+    "half: \n"
+    "  .word 0x3F000000 \n"
+    ".section .text \n"
+    "  fldw f1, one \n"
+    "  fldw f2, half \n"
+    "  fldw f3, one \n"
+    "  clr r1 \n"
+    "  movi r2, 100000 \n"
+    "loop: \n"
+    "  fmul f4, f3, f3 \n"
+    "  fadd f4, f4, f1 \n"
+    "  fsqrt f5, f4 \n"
+    "  fdiv f3, f5, f4 \n"
+    "  fadd f6, f6, f2 \n"
+    "  fcmp f6, f1 \n"
+    "  add r3, r3, cmp \n"
+    "  inc r1 \n"
+    "  cmp r1, r2 \n"
+    "  jl loop \n"
+    "  halt \n";
+
+// every core adds its id to a counter with xadd (what it read depends on the others, cleared)
+const std::string cores =
+    ".section .text \n"
+    "  coreid r0 \n"
+    "  ncores r1 \n"
+    "  movi r5, 0x8000 \n"
+    "  movi r2, 1000 \n"
+    "loop: \n"
+    "  xadd r3, r5, r0 \n"
+    "  dec r2 \n"
+    "  cmpi r2, 0 \n"
+    "  jnz loop \n"
+    "  fence \n"
+    "  clr r3 \n"
+    "  halt \n";
+
+// counted loop around random straight-line code with forward branches in it
+std::string random_loop(std::mt19937& rng) {
+    auto pick = [&](int n) { return static_cast<int>(rng() % n); };
+    auto reg = [&] { return "r" + std::to_string(pick(8)); };
+    const char* rrr[] = { "add", "sub", "and", "or", "xor", "mul", "div", "mod", "shl", "shr", "sar", "rol", "ror", "min", "max" };
+    const char* rri[] = { "addi", "subi", "muli", "divi", "modi", "andi", "ori", "xori", "shli", "shri", "sari", "roli", "rori" };
+    const char* jumps[] = { "jz", "jnz", "jg", "jl", "jmp" };
+
+    constexpr int BLOCKS = 6;
+    std::string src = ".section .text \n";
+    for (int i = 0; i < 8; i++) src += "  movi r" + std::to_string(i) + ", " + std::to_string(pick(2) ? pick(20) : static_cast<int>(rng())) + " \n";
+    src += "  movi r9, " + std::to_string(50 + pick(100)) + " \n  movi r10, 8192 \nloop: \n";
+    for (int b = 0; b < BLOCKS; b++) {
+        src += "L" + std::to_string(b) + ": \n";
+        for (int i = pick(6); i > 0; i--) {
+            switch (pick(11)) {
+            case 0: src += "  movi " + reg() + ", " + std::to_string(pick(300)) + " \n"; break;
+            case 1: src += "  " + std::string(pick(2) ? "mov " : "swap ") + reg() + ", " + reg() + " \n"; break;
+            case 2: src += "  " + std::string(rrr[pick(std::size(rrr))]) + " " + reg() + ", " + reg() + ", " + reg() + " \n"; break;
+            case 3: src += "  " + std::string(rri[pick(std::size(rri))]) + " " + reg() + ", " + reg() + ", " + std::to_string(pick(256)) + " \n"; break;
+            case 4: src += "  " + std::string(pick(2) ? "cmp " : pick(2) ? "cmpu " : "test ") + reg() + ", " + reg() + " \n"; break;
+            case 5: src += "  " + std::string(pick(2) ? "cmpi " : "testi ") + reg() + ", " + std::to_string(pick(20)) + " \n"; break;
+            case 6: src += pick(2) ? "  inc " + reg() + " \n" : "  " + std::string(pick(2) ? "neg " : "abs ") + reg() + ", " + reg() + " \n"; break;
+            case 7: src += "  add " + reg() + ", " + reg() + ", cmp \n"; break;
+            case 8: src += "  andi r11, " + reg() + ", 252 \n  sbasew " + reg() + ", r11, 0 \n  lbaseh " + reg() + ", r11, 0 \n"; break;
+            case 9: src += "  sbaseb " + reg() + ", r10, 0 \n  lbasew " + reg() + ", r10, 0 \n"; break;
+            default: src += "  push " + reg() + " \n  pop " + reg() + " \n"; break;
+            }
+        }
+        if (pick(2) != 0 && b + 1 < BLOCKS)
+            src += "  " + std::string(jumps[pick(std::size(jumps))]) + " L" + std::to_string(b + 1 + pick(BLOCKS - b - 1)) + " \n";
+    }
+    return src + "  dec r9 \n  cmpi r9, 0 \n  jnz loop \n  halt \n";
+}
+
+int main() {
+    bool ok = true;
+#ifdef TALOS_TAIL_CALLS
+    std::cout << "handlers tail-call each other" << std::endl;
+#else
+    std::cout << "no musttail: handlers return to a loop" << std::endl;
+#endif
+
+    auto env_m = EnvironmentManager(0x10000, 4);
+    ok &= same("numeric", numeric, env_m);
+    ok &= same("memory", memory, env_m);
+    ok &= same("recursion", recursion, env_m);
+    ok &= same("fpu", fpu, env_m);
+    ok &= same("cores", cores, env_m, true, true);
+    uint32_t counter;
+    std::memcpy(&counter, &env_m.mb.ram[0x8000], 4);
+    ok &= counter == (0 + 1 + 2 + 3) * 1000 && env_m.tail.size() == env_m.mb.rom.size() + 1;
+
+    // stores through the handlers mark the RAM dirty: restore() undoes them
+    run(memory, ExecMode::AUTO, env_m);
+    const std::vector<uint8_t> ram_after(env_m.mb.ram.begin(), env_m.mb.ram.begin() + 0x10000);
+    env_m.mb.cpu.core.PC = env_m.entry_pc;
+    env_m.snapshot();
+    env_m.start(ExecMode::TAIL);
+    env_m.restore();
+    ok &= std::equal(ram_after.begin(), ram_after.end(), env_m.mb.ram.begin());
+
+    // a new build drops the handlers of the previous one
+    env_m.build_single(".section .text \n movi r1, 5 \n halt \n");
+    ok &= env_m.tail.empty() && env_m.start(ExecMode::TAIL) == ErrorCode::OK && env_m.mb.cpu.core.regs[1] == 5;
+
+    std::mt19937 rng(20);
+    for (int i = 0; i < 300; i++) {
+        const std::string src = random_loop(rng);
+        if (!same("random", src, env_m, false)) {
+            std::cout << "different end state:\n" << src << std::endl;
+            ok = false;
+            break;
+        }
+    }
+
+    return ok ? 0 : 1;
+}
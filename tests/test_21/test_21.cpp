@@ -0,0 +1,182 @@
+#include "../../Talos/include/environment_manager.h"
+
+#include <iostream>
+#include <string>
+#include <random>
+#include <chrono>
+
+// handlers specialized for their operands (registers, immediates of 0 and powers of two): same end state
+// as the generic handlers and as step_instr
+
+struct Run {
+    std::array<uint32_t, 16> regs;
+    std::vector<uint8_t> ram;
+    double ms;
+};
+
+Run run(const std::string& src, ExecMode mode, bool specialize, EnvironmentManager& env_m) {
+    std::string e = env_m.build_single(src);
+    if (!e.empty()) {
+        std::cout << "ERROR: " << e << std::endl;
+        std::exit(1);
+    }
+    if (!specialize) env_m.mb.threaded = thread_prog(env_m.mb.rom, false);
+    auto start = std::chrono::high_resolution_clock::now();
+    env_m.start(mode);
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    return { env_m.mb.cpu.core.regs, { env_m.mb.ram.begin(), env_m.mb.ram.begin() + 0x10000 }, ms };
+}
+
+bool same(const std::string& name, const std::string& src, EnvironmentManager& env_m, bool print = true) {
+    const Run generic = run(src, ExecMode::AUTO, false, env_m);
+    const Run stepped = run(src, ExecMode::STEP, true, env_m);
+    const Run specialized = run(src, ExecMode::AUTO, true, env_m);
+    const bool ok = generic.regs == specialized.regs && stepped.regs == specialized.regs && generic.ram == specialized.ram && stepped.ram == specialized.ram;
+    if (print)
+        std::cout << name << ": generic " << generic.ms << " ms, specialized " << specialized.ms << " ms, "
+                  << env_m.mb.threaded.specialized << " slots specialized" << (ok ? "" : "  DIFFERENT") << std::endl;
+    return ok;
+}
+
+const char* reg_names[16] = { "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7", "r8", "r9", "r10", "r11", "tmp", "cmp", "sp", "zero" };
+
+// every register through inc / dec / addi / cmp / lbasew, the flags register (cmp) and the stack pointer too
+std::string every_register() {
+    std::string src = ".section .text \n";
+    for (int r = 0; r < 16; r++) {
+        const std::string reg = reg_names[r];
+        src += "  movi " + reg + ", " + std::to_string(1000 * r + 5) + " \n";
+        src += "  inc " + reg + " \n  addi " + reg + ", " + reg + ", 40 \n  dec " + reg + " \n  subi " + reg + ", " + reg + ", 1 \n";
+        src += "  addi " + reg + ", " + reg + ", 1 \n  add r11, r11, " + reg + " \n";
+    }
+    for (int a = 0; a < 16; a++)
+        for (int b = 0; b < 16; b++) {
+            src += "  cmp " + std::string(reg_names[a]) + ", " + reg_names[b] + " \n";
+            src += "  add r11, r11, cmp \n  shli r11, r11, 1 \n";
+        }
+    src += "  movi tmp, 0x4000 \n";
+    for (int d = 0; d < 16; d++)
+        for (int s = 0; s < 16; s++) {
+            if (s == 12) continue; // kept as base
+            src += "  movi " + std::string(reg_names[s]) + ", " + std::to_string(0x4000 + 4 * ((d + s) % 16)) + " \n";
+            src += "  lbasew " + std::string(reg_names[d]) + ", " + reg_names[s] + ", " + std::to_string(4 * (s % 3)) + " \n";
+            src += "  sbasew " + std::string(reg_names[d]) + ", tmp, " + std::to_string(4 * (d % 8)) + " \n";
+        }
+    return src + "  halt \n";
+}
+
+// immediates of 0, 1 and powers of two on positive and negative values
+const std::string immediates =
+    ".section .text \n"
+    "  movi r1, -2000 \n"
+    "  movi r9, 4000 \n"
+    "loop: \n"
+    "  muli r2, r1, 8 \n"
+    "  muli r3, r1, 1 \n"
+    "  muli r4, r1, 0 \n"
+    "  divi r5, r1, 4 \n"
+    "  divi r6, r1, 128 \n"
+    "  divi r7, r1, 0 \n"
+    "  divi r8, r1, 1 \n"
+    "  add r10, r10, r5 \n"
+    "  add r10, r10, r6 \n"
+    "  add r10, r10, r8 \n"
+    "  modi r5, r1, 16 \n"
+    "  modi r6, r1, 1 \n"
+    "  modi r7, r1, 0 \n"
+    "  add r11, r11, r5 \n"
+    "  xor r11, r11, r2 \n"
+    "  addi r3, r1, 0 \n"
+    "  subi r4, r3, 0 \n"
+    "  addi r4, r4, 0 \n"
+    "  ori r5, r4, 0 \n"
+    "  xori r5, r5, 0 \n"
+    "  andi r6, r5, 0 \n"
+    "  shli r7, r5, 0 \n"
+    "  sari r7, r7, 0 \n"
+    "  roli r8, r7, 0 \n"
+    "  add r0, r0, r8 \n"
+    "  add r0, r0, r6 \n"
+    "  addi r1, r1, 1 \n"
+    "  dec r9 \n"
+    "  cmpi r9, 0 \n"
+    "  jnz loop \n"
+    "  movi r1, -2147483648 \n"
+    "  divi r2, r1, 2 \n"
+    "  modi r3, r1, 2 \n"
+    "  muli r4, r1, 2 \n"
+    "  halt \n";
+
+// mostly specialized slots, not fused
+const std::string hot =
+    ".section .text \n"
+    "  movi r1, 0x1000 \n"
+    "  movi r2, 3000000 \n"
+    "loop: \n"
+    "  lbasew r3, r1, 0 \n"
+    "  addi r3, r3, 3 \n"
+    "  muli r4, r3, 4 \n"
+    "  add r5, r5, r4 \n"
+    "  inc r6 \n"
+    "  cmp r6, r5 \n"
+    "  add r7, r7, cmp \n"
+    "  dec r2 \n"
+    "  cmpi r2, 0 \n"
+    "  jnz loop \n"
+    "  halt \n";
+
+// random immediates around 0, 1 and powers of two, random registers
+std::string random_program(std::mt19937& rng) {
+    auto pick = [&](int n) { return static_cast<int>(rng() % n); };
+    auto reg = [&] { return "r" + std::to_string(pick(8)); };
+    auto imm = [&] { return std::to_string(pick(3) == 0 ? pick(256) : pick(2) ? 1 << pick(8) : pick(2)); };
+    const char* rri[] = { "addi", "subi", "muli", "divi", "modi", "andi", "ori", "xori", "shli", "shri", "sari", "roli", "rori" };
+
+    std::string src = ".section .text \n  movi r8, 0x2000 \n";
+    for (int i = 0; i < 8; i++) src += "  movi r" + std::to_string(i) + ", " + std::to_string(pick(2) ? pick(20) - 10 : static_cast<int>(rng())) + " \n";
+    for (int i = 0; i < 60; i++) {
+        switch (pick(6)) {
+        case 0: src += "  " + std::string(rri[pick(std::size(rri))]) + " " + reg() + ", " + reg() + ", " + imm() + " \n"; break;
+        case 1: {
+            const std::string r = reg();
+            src += "  " + std::string(rri[pick(std::size(rri))]) + " " + r + ", " + r + ", " + imm() + " \n";
+            break;
+        }
+        case 2: src += "  " + std::string(pick(2) ? "inc " : "dec ") + reg() + " \n"; break;
+        case 3: src += "  cmp " + reg() + ", " + reg() + " \n  add " + reg() + ", " + reg() + ", cmp \n"; break;
+        case 4: src += "  andi r9, " + reg() + ", 60 \n  add r9, r9, r8 \n  lbasew " + reg() + ", r9, " + std::to_string(pick(8)) + " \n"; break;
+        default: src += "  sbasew " + reg() + ", r8, " + std::to_string(4 * pick(16)) + " \n"; break;
+        }
+    }
+    return src + "  halt \n";
+}
+
+int main() {
+    bool ok = true;
+    auto env_m = EnvironmentManager(0x10000);
+
+    ok &= same("registers", every_register(), env_m);
+    ok &= same("immediates", immediates, env_m);
+    ok &= same("hot", hot, env_m);
+
+    // what gets a specialized handler, the rest keeps the generic one
+    env_m.build_single(".section .text \n inc r3 \n addi r1, r1, 9 \n addi r1, r2, 9 \n muli r1, r2, 6 \n muli r1, r2, 64 \n cmp r4, r5 \n lbasew r1, r2, 0 \n add r1, r2, r3 \n halt \n");
+    const ThreadedCode generic = thread_prog(env_m.mb.rom, false);
+    const ThreadedCode& code = env_m.mb.threaded;
+    ok &= code.specialized == 5 && generic.specialized == 0;
+    for (size_t pc : { 0, 1, 4, 5, 6 }) ok &= code[pc].handler != generic[pc].handler;
+    for (size_t pc : { 2, 3, 7, 8 }) ok &= code[pc].handler == generic[pc].handler;
+    for (size_t pc = 0; pc < code.size(); pc++) ok &= code[pc].opcode == generic[pc].opcode && code[pc].imm == generic[pc].imm;
+
+    std::mt19937 rng(21);
+    for (int i = 0; i < 500; i++) {
+        const std::string src = random_program(rng);
+        if (!same("random", src, env_m, false)) {
+            std::cout << "different end state:\n" << src << std::endl;
+            ok = false;
+            break;
+        }
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,200 @@
+#include "../../Talos/include/environment_manager.h"
+
+#include <iostream>
+#include <string>
+#include <chrono>
+
+// JIT mode against AUTO and STEP: same registers and RAM at the end of every program
+
+struct RunResult {
+    long long duration = 0;
+    std::array<uint32_t, 16> regs{};
+    std::array<uint32_t, 16> fregs{};
+    uint32_t PC = 0;
+    std::vector<uint8_t> ram;
+};
+
+RunResult run_in(const std::vector<std::pair<std::string, std::string>>& files, ExecMode mode) {
+    auto env_m = EnvironmentManager(0xFFFF);
+
+    std::string e = env_m.build(files);
+    if (!e.empty()) std::cout << "ERROR: " << e << std::endl;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    env_m.start(mode);
+    auto stop = std::chrono::high_resolution_clock::now();
+
+    return { duration_cast<std::chrono::microseconds>(stop - start).count(), env_m.mb.cpu.core.regs, env_m.mb.cpu.core.fregs, env_m.mb.cpu.core.PC, { env_m.mb.ram.begin(), env_m.mb.ram.end() } };
+}
+
+bool compare(const std::string& name, const std::vector<std::pair<std::string, std::string>>& files) {
+    RunResult autom = run_in(files, ExecMode::AUTO);
+    RunResult step = run_in(files, ExecMode::STEP);
+    RunResult jit = run_in(files, ExecMode::JIT);
+    RunResult profile = run_in(files, ExecMode::PROFILE);
+    RunResult tail = run_in(files, ExecMode::TAIL);
+
+    std::cout << "\n---------- " << name << " ----------\n";
+    std::cout << "RUN DURATION: AUTO " << autom.duration << ", STEP " << step.duration << ", JIT " << jit.duration << " micro_sec" << std::endl;
+
+    bool ok = true;
+    for (auto [r, mode] : { std::pair{ &step, "STEP" }, { &jit, "JIT" }, { &profile, "PROFILE" }, { &tail, "TAIL" } }) {
+        if (r->regs != autom.regs || r->fregs != autom.fregs || r->PC != autom.PC || r->ram != autom.ram) {
+            std::cout << mode << " differs from AUTO" << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+int main() {
+    std::string loop =
+        ".section .text \n"
+        " ldw r1, var \n"
+        " loop: \n"
+        "  inc r0 \n"
+        "  cmp r0, r1 \n"
+        "  jl loop \n"
+        " halt \n"
+        ".section .data \n"
+        " var: \n"
+        "  .word 5_000_000 \n";
+
+    std::string alu =
+        ".section .text \n"
+        " movi r0, 0x12345 \n"
+        " movi r1, -7 \n"
+        " add r2, r0, r1 \n"
+        " sub r3, r0, r1 \n"
+        " mul r4, r0, r1 \n"
+        " muli r5, r1, 9 \n"
+        " and r6, r0, r1 \n"
+        " xori r7, r0, 255 \n"
+        " shli r8, r0, 3 \n"
+        " sar r9, r1, r8 \n"
+        " rori r10, r0, 5 \n"
+        " cmpu r1, r0 \n"
+        " jg unsigned_ok \n"
+        " movi r11, 1 \n"
+        " unsigned_ok: \n"
+        " abs r11, r1 \n"
+        " neg r1, r11 \n"
+        " min r2, r0, r1 \n"
+        " max r3, r0, r1 \n"
+        " divi r4, r0, 3 \n"
+        " not r5, r5 \n"
+        " swap r6, r7 \n"
+        " halt \n";
+
+    // test_1 style, with the stack and memory in the loop
+    std::string file1 =
+        ".section .text \n"
+        " .extern func2 \n"
+        " .global main \n"
+        " main: \n"
+        "  ldw r3, count \n"
+        " loop: \n"
+        "  push r2 \n"
+        "  call func2 \n"
+        "  pop r2 \n"
+        "  stw r1, var1 \n"
+        "  addi r2, r2, 1 \n"
+        "  cmp r2, r3 \n"
+        "  jl loop \n"
+        "  halt \n"
+        " .entry main \n"
+        ".section .data \n"
+        " count: \n"
+        "  .word 100_000 \n"
+        " var1: \n"
+        "  .word 0x1234 \n";
+
+    std::string file2 =
+        ".section .text \n"
+        " .global func2 \n"
+        " func2: \n"
+        "  ldw r1, var2 \n"
+        "  addi r1, r1, 3 \n"
+        "  stw r1, var2 \n"
+        "  ret \n"
+        ".section .data \n"
+        " var2: \n"
+        "  .word 0 \n";
+
+    // test_0 style: FPU instructions go through the fallback
+    std::string fpu =
+        ".section .text \n"
+        " fldw f0, var \n"
+        " fldw f2, increment \n"
+        " loop: \n"
+        "  fadd f1, f1, f2 \n"
+        "  fcmp f1, f0 \n"
+        "  jl loop \n"
+        " halt \n"
+        ".section .data \n"
+        " var: \n"
+        "   .word 0x47C35000 ; 100000.0 en float\n"
+        " increment: \n"
+        "   .word 0x3F800000 ; 1.0 en float\n";
+
+    // ret to a PC past the ROM: every mode stops with PC on the end of the ROM
+    std::string ret_out =
+        ".section .text \n"
+        " movi r1, 1000 \n"
+        " push r1 \n"
+        " ret \n";
+
+    // x % -1 is 0 in every mode: INT32_MIN % -1 must not trap the host (AOT: see test_18)
+    std::string mod_overflow =
+        ".section .text \n"
+        " movi r1, -2147483648 \n"
+        " movi r2, -1 \n"
+        " mod r3, r1, r2 \n"
+        " movi r4, 7 \n"
+        " mod r4, r1, r2 \n"
+        " halt \n";
+
+    bool ok = compare("LOOP", { { "main", loop } });
+    ok &= compare("ALU", { { "main", alu } });
+    ok &= compare("CALL LOOP", { { "file1", file1 }, { "file2", file2 } });
+    ok &= compare("FPU", { { "main", fpu } });
+    ok &= compare("RET OUT OF ROM", { { "main", ret_out } });
+    ok &= compare("MOD OVERFLOW", { { "main", mod_overflow } });
+    const RunResult mod = run_in({ { "main", mod_overflow } }, ExecMode::AUTO);
+    ok &= mod.regs[3] == 0 && mod.regs[4] == 0 && mod.PC == 5;
+
+    // stores above the RAM end the run in every mode, the core stops on the store with what ran before it
+    // (AOT: see test_18). The loop gets hot before its push faults: the JIT leaves its trace on it
+    std::string store_out =
+        ".section .text \n"
+        " movi r1, 5 \n"
+        " movi r2, 0x7FFFFFF0 \n"
+        " inc r3 \n"
+        " sbasew r1, r2, 0 \n"
+        " halt \n";
+    std::string push_out =
+        ".section .text \n"
+        " loop: \n"
+        "  inc r1 \n"
+        "  push r1 \n"
+        "  jmp loop \n";
+    for (ExecMode mode : { ExecMode::AUTO, ExecMode::STEP, ExecMode::JIT, ExecMode::PROFILE, ExecMode::TAIL }) {
+        auto env_m = EnvironmentManager(0x1000);
+        env_m.build_single(store_out);
+        const SimpleCore& core = env_m.mb.cpu.core;
+        if (env_m.start(mode) != ErrorCode::RAM_OVERFLOW || core.PC != 3 || core.regs[3] != 1) {
+            std::cout << "store outside of the RAM: PC " << core.PC << ", r3 " << core.regs[3] << std::endl;
+            ok = false;
+        }
+        // sp starts on 0xFFF: 1023 pushes fit, the next one faults with SP already moved (as step_instr() does it)
+        auto pushing = EnvironmentManager(0x1000);
+        pushing.build_single(push_out);
+        const SimpleCore& pusher = pushing.mb.cpu.core;
+        if (pushing.start(mode) != ErrorCode::RAM_OVERFLOW || pusher.PC != 1 || pusher.regs[1] != 1024 || pusher.regs[15] != 0xFFFFFFFF) {
+            std::cout << "push outside of the RAM: PC " << pusher.PC << ", r1 " << pusher.regs[1] << ", sp " << pusher.regs[15] << std::endl;
+            ok = false;
+        }
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,197 @@
+#include "../../Talos/include/environment_manager.h"
+
+#include <iostream>
+#include <string>
+#include <chrono>
+
+// multi-core: SPMD programs over 1..N cores, and cores spawned/joined by the guest
+
+constexpr uint32_t RESULTS = 0x8000; // one word per core
+
+// every core sums its share of [0, total) and stores it at RESULTS + 4 * id
+const std::string spmd =
+    ".section .text \n"
+    " coreid r0 \n"
+    " ncores r1 \n"
+    " ldw r2, total \n"
+    " div r3, r2, r1 \n"
+    " mul r4, r3, r0 \n"
+    " add r3, r3, r4 \n"
+    " clr r5 \n"
+    " loop: \n"
+    "  add r5, r5, r4 \n"
+    "  inc r4 \n"
+    "  cmp r4, r3 \n"
+    "  jl loop \n"
+    " movi r6, 0x8000 \n"
+    " shli r7, r0, 2 \n"
+    " add r6, r6, r7 \n"
+    " sbasew r5, r6, 0 \n"
+    " halt \n"
+    ".section .data \n"
+    " total: \n"
+    "  .word 8_000_000 \n";
+
+// core 0 starts 3 workers with r1 as argument and waits for them, the workers use their own stack
+// the workers hold at the gate until every spawn is done, so none is free again for the 4th one
+const std::string fork_join =
+    ".section .text \n"
+    " .global main \n"
+    " main: \n"
+    "  movi r1, 10 \n"
+    "  spawn r8, worker \n"
+    "  movi r1, 20 \n"
+    "  spawn r9, worker \n"
+    "  movi r1, 30 \n"
+    "  spawn r10, worker \n"
+    "  spawn r11, worker \n" // every core is busy: r11 = -1
+    "  movi r5, 0x9100 \n"
+    "  movi r3, 1 \n"
+    "  stlr r3, r5 \n" // opens the gate
+    "  wake r5 \n"
+    "  join r8 \n"
+    "  join r9 \n"
+    "  join r10 \n"
+    "  halt \n"
+    " worker: \n"
+    "  movi r5, 0x9100 \n"
+    "  clr r3 \n"
+    " gate: \n"
+    "  ldar r4, r5 \n"
+    "  cmpi r4, 0 \n"
+    "  jnz go \n"
+    "  wait r3, r5 \n"
+    "  jmp gate \n"
+    " go: \n"
+    "  coreid r0 \n"
+    "  push r1 \n"
+    "  call twice \n"
+    "  pop r1 \n"
+    "  movi r6, 0x8000 \n"
+    "  shli r7, r0, 2 \n"
+    "  add r6, r6, r7 \n"
+    "  sbasew r2, r6, 0 \n"
+    "  halt \n"
+    " twice: \n"
+    "  add r2, r1, r1 \n"
+    "  ret \n"
+    " .entry main \n";
+
+// every core: 20 000 xadd on one counter, then 20 000 increments of another one under a cas/wait/wake lock
+const std::string atomics =
+    ".section .text \n"
+    " movi r7, 0x9000 \n" // xadd counter
+    " movi r8, 0x9004 \n" // lock
+    " movi r9, 0x9008 \n" // counter behind the lock
+    " movi r10, 1 \n"
+    " movi r11, 20000 \n"
+    " clr r4 \n"
+    " add_loop: \n"
+    "  xadd r0, r7, r10 \n"
+    "  inc r4 \n"
+    "  cmp r4, r11 \n"
+    "  jl add_loop \n"
+    " clr r4 \n"
+    " lock_loop: \n"
+    "  clr r1 \n"
+    "  cas r1, r8, r10 \n"
+    "  jz locked \n"
+    "  wait r10, r8 \n" // sleeps while the lock is taken
+    "  jmp lock_loop \n"
+    " locked: \n"
+    "  lbasew r3, r9, 0 \n"
+    "  inc r3 \n"
+    "  sbasew r3, r9, 0 \n"
+    "  clr r1 \n"
+    "  stlr r1, r8 \n"
+    "  wake r8 \n"
+    "  inc r4 \n"
+    "  cmp r4, r11 \n"
+    "  jl lock_loop \n"
+    " fence \n"
+    " ldar r5, r9 \n"
+    " halt \n";
+
+uint32_t word(EnvironmentManager& env_m, uint32_t addr) {
+    return env_m.mb.cpu.core.load32(addr);
+}
+
+uint32_t result(EnvironmentManager& env_m, uint32_t id) {
+    return word(env_m, RESULTS + 4 * id);
+}
+
+bool check_spmd(size_t cores, ExecMode mode, long long& duration) {
+    auto env_m = EnvironmentManager(0x100000, cores);
+    std::string e = env_m.build_single(spmd);
+    if (!e.empty()) std::cout << "ERROR: " << e << std::endl;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    ErrorCode code = env_m.start_all(mode);
+    auto stop = std::chrono::high_resolution_clock::now();
+    duration = duration_cast<std::chrono::microseconds>(stop - start).count();
+
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < cores; i++) sum += result(env_m, i);
+    uint64_t total = 8'000'000;
+    return code == ErrorCode::OK && static_cast<uint32_t>(sum) == static_cast<uint32_t>(total * (total - 1) / 2);
+}
+
+bool check_fork_join(ExecMode mode) {
+    auto env_m = EnvironmentManager(0x100000, 4);
+    std::string e = env_m.build_single(fork_join);
+    if (!e.empty()) std::cout << "ERROR: " << e << std::endl;
+
+    if (env_m.start(mode) != ErrorCode::OK) return false;
+
+    const auto& regs = env_m.mb.cpu.core.regs;
+    if (regs[8] != 1 || regs[9] != 2 || regs[10] != 3 || regs[11] != UINT32_MAX) return false;
+    for (uint32_t id = 1; id < 4; id++) {
+        if (result(env_m, id) != id * 20) return false;
+        // stack back where the worker found it
+        if (env_m.core_state(id).SP != env_m.mb.cpu.cores[id].stack_top) return false;
+    }
+    return true;
+}
+
+bool check_atomics(ExecMode mode) {
+    auto env_m = EnvironmentManager(0x100000, 4);
+    std::string e = env_m.build_single(atomics);
+    if (!e.empty()) std::cout << "ERROR: " << e << std::endl;
+
+    if (env_m.start_all(mode) != ErrorCode::OK) return false;
+    return word(env_m, 0x9000) == 4 * 20000 && word(env_m, 0x9008) == 4 * 20000 && word(env_m, 0x9004) == 0;
+}
+
+int main() {
+    bool ok = true;
+
+    for (ExecMode mode : { ExecMode::AUTO, ExecMode::STEP, ExecMode::JIT }) {
+        const char* name = mode == ExecMode::AUTO ? "AUTO" : mode == ExecMode::STEP ? "STEP" : "JIT";
+        std::cout << "\n---------- SPMD " << name << " ----------\n";
+
+        long long single = 0;
+        for (size_t cores : { 1, 2, 4, 8 }) {
+            long long duration = 0;
+            if (!check_spmd(cores, mode, duration)) {
+                std::cout << cores << " cores: wrong sum" << std::endl;
+                ok = false;
+            }
+            if (cores == 1) single = duration;
+            std::cout << cores << " cores: " << duration << " micro_sec";
+            if (duration != 0) std::cout << " (x" << static_cast<double>(single) / duration << ")";
+            std::cout << std::endl;
+        }
+        std::cout << "host threads: " << std::thread::hardware_concurrency() << std::endl;
+
+        if (!check_fork_join(mode)) {
+            std::cout << "spawn/join differs in " << name << std::endl;
+            ok = false;
+        }
+        if (!check_atomics(mode)) {
+            std::cout << "atomic counters are wrong in " << name << std::endl;
+            ok = false;
+        }
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,180 @@
+#include "../../Talos/include/environment_manager.h"
+
+#include <iostream>
+#include <string>
+#include <chrono>
+
+// SIMT batch: one program over thousands of inputs, against one scalar run per input
+
+// collatz steps of the input word, branches diverge on every lane
+const std::string collatz =
+    ".section .text \n"
+    " ldw r0, n \n"
+    " clr r1 \n"
+    " loop: \n"
+    "  cmpi r0, 1 \n"
+    "  jz done \n"
+    "  andi r2, r0, 1 \n"
+    "  cmpi r2, 0 \n"
+    "  jz even \n"
+    "  muli r0, r0, 3 \n"
+    "  inc r0 \n"
+    "  jmp next \n"
+    " even: \n"
+    "  shri r0, r0, 1 \n"
+    " next: \n"
+    "  push r0 \n"
+    "  call count \n"
+    "  pop r0 \n"
+    "  jmp loop \n"
+    " done: \n"
+    "  stw r1, steps \n"
+    "  halt \n"
+    " count: \n"
+    "  inc r1 \n"
+    "  ret \n"
+    ".section .data \n"
+    " n: \n"
+    "  .word 0 \n"
+    " steps: \n"
+    "  .word 0 \n";
+
+// xorshift rounds: same path for every lane
+const std::string hash =
+    ".section .text \n"
+    " ldw r0, n \n"
+    " clr r1 \n"
+    " clr r4 \n"
+    " movi r2, 2000 \n"
+    " loop: \n"
+    "  shli r3, r0, 13 \n"
+    "  xor r0, r0, r3 \n"
+    "  shri r3, r0, 17 \n"
+    "  xor r0, r0, r3 \n"
+    "  shli r3, r0, 5 \n"
+    "  xor r0, r0, r3 \n"
+    "  add r4, r4, r0 \n"
+    "  inc r1 \n"
+    "  cmp r1, r2 \n"
+    "  jl loop \n"
+    " stw r4, out \n"
+    " halt \n"
+    ".section .data \n"
+    " n: \n"
+    "  .word 0 \n"
+    " out: \n"
+    "  .word 0 \n";
+
+std::vector<uint8_t> word_bytes(uint32_t value) {
+    return { static_cast<uint8_t>(value), static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value >> 16), static_cast<uint8_t>(value >> 24) };
+}
+
+uint32_t lane_word(BatchEngine& batch, size_t lane, uint32_t addr) {
+    uint32_t value;
+    std::memcpy(&value, batch.ram(lane) + addr, 4);
+    return value;
+}
+
+// batch against one start() per input on the same build, r1/r4 and the word at result_addr must match
+bool compare(const std::string& name, const std::string& program, const std::vector<std::vector<uint8_t>>& inputs, uint8_t result_reg, uint32_t result_addr) {
+    auto env_m = EnvironmentManager(0x1000);
+    std::string e = env_m.build_single(program);
+    if (!e.empty()) std::cout << "ERROR: " << e << std::endl;
+
+    std::vector<uint32_t> expected(inputs.size());
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t l = 0; l < inputs.size(); l++) {
+        std::ranges::copy(env_m.ram_image, env_m.mb.ram.begin());
+        std::ranges::copy(inputs[l], env_m.mb.ram.begin());
+        env_m.mb.cpu.core.reset();
+        env_m.mb.cpu.core.PC = env_m.entry_pc;
+        env_m.start();
+        expected[l] = env_m.mb.cpu.core.regs[result_reg];
+    }
+    auto stop = std::chrono::high_resolution_clock::now();
+    long long scalar = duration_cast<std::chrono::microseconds>(stop - start).count();
+
+    start = std::chrono::high_resolution_clock::now();
+    BatchEngine batch = env_m.run_batch(inputs, 0, 0x1000);
+    stop = std::chrono::high_resolution_clock::now();
+    long long simt = duration_cast<std::chrono::microseconds>(stop - start).count();
+
+    std::cout << "\n---------- " << name << " x" << inputs.size() << " ----------\n";
+    std::cout << "RUN DURATION: scalar " << scalar << ", batch " << simt << " micro_sec\n";
+    std::cout << "batch steps: " << batch.steps << ", lanes ended in run(): " << batch.scalar_lanes << std::endl;
+
+    for (size_t l = 0; l < inputs.size(); l++) {
+        if (batch.status[l] != LaneStatus::HALTED || batch.reg(result_reg)[l] != expected[l] || lane_word(batch, l, result_addr) != expected[l]) {
+            std::cout << "lane " << l << " differs: " << batch.reg(result_reg)[l] << " instead of " << expected[l] << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    constexpr size_t LANES = 4096;
+
+    std::vector<std::vector<uint8_t>> inputs;
+    for (uint32_t i = 0; i < LANES; i++) inputs.push_back(word_bytes(i + 1));
+
+    bool ok = compare("HASH", hash, inputs, 4, 4);
+    ok &= compare("COLLATZ", collatz, inputs, 1, 4);
+
+    // collatz again, with lanes pushed out to run() as soon as they diverge for a while
+    auto env_m = EnvironmentManager(0x1000);
+    env_m.build_single(collatz);
+    std::vector<uint32_t> expected(LANES);
+    for (size_t l = 0; l < LANES; l++) {
+        std::ranges::copy(inputs[l], env_m.mb.ram.begin());
+        env_m.mb.cpu.core.reset();
+        env_m.mb.cpu.core.PC = env_m.entry_pc;
+        env_m.start();
+        expected[l] = env_m.mb.cpu.core.regs[1];
+    }
+
+    // same thing with lanes pushed out to run() as soon as they diverge for a while
+    BatchEngine impatient(env_m.mb.threaded, LANES, 0x1000);
+    impatient.divergence_limit = 4;
+    impatient.load_all(env_m.ram_image);
+    for (size_t l = 0; l < LANES; l++) impatient.load(l, inputs[l], 0);
+    impatient.run(env_m.entry_pc);
+    std::cout << "divergence_limit 4: lanes ended in run(): " << impatient.scalar_lanes << std::endl;
+    for (size_t l = 0; l < LANES; l++) {
+        if (impatient.status[l] != LaneStatus::HALTED || impatient.reg(1)[l] != expected[l]) {
+            std::cout << "lane " << l << " differs after run(): " << impatient.reg(1)[l] << " instead of " << expected[l] << std::endl;
+            ok = false;
+            break;
+        }
+    }
+
+    // a store above the lane RAM only stops that lane
+    auto faulty = EnvironmentManager(0x1000);
+    faulty.build_single(".section .text \n ldw r0, addr \n sbasew r1, r0, 0 \n halt \n.section .data \n addr: \n .word 0 \n");
+    std::vector<std::vector<uint8_t>> addrs = { word_bytes(0x100), word_bytes(0x20000) };
+    BatchEngine faults = faulty.run_batch(addrs, 0, 0x1000);
+    if (faults.status[0] != LaneStatus::HALTED || faults.status[1] != LaneStatus::FAULT) {
+        std::cout << "store outside of the lane RAM was not caught" << std::endl;
+        ok = false;
+    }
+
+    // the batch keeps its own copy of the program: it runs again once the board is rebuilt
+    faulty.build_single(".section .text \n movi r1, 9 \n halt \n");
+    faults.load(1, word_bytes(0x100), 0);
+    faults.status.assign(addrs.size(), LaneStatus::RUNNING);
+    if (!faults.run(0) || faults.status[1] != LaneStatus::HALTED || faults.reg(1)[1] == 9) {
+        std::cout << "the batch ran the rebuilt program" << std::endl;
+        ok = false;
+    }
+
+    // no program (the build failed): nothing runs
+    auto unbuilt = EnvironmentManager(0x1000);
+    if (unbuilt.build_single(".section .text \n bogus r1 \n").empty()) ok = false;
+    BatchEngine idle = unbuilt.run_batch(addrs, 0, 0x1000);
+    if (idle.run(0) || idle.status[0] != LaneStatus::RUNNING || idle.steps != 0) {
+        std::cout << "a batch without a program ran" << std::endl;
+        ok = false;
+    }
+
+    return ok ? 0 : 1;
+}
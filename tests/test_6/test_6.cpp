@@ -0,0 +1,117 @@
+#include "../../Talos/include/fleet.h"
+
+#include <iostream>
+#include <string>
+#include <chrono>
+
+// fleet benchmark: jobs per second for 1..N workers, every result checked against a single start()
+
+// sum of the input word times [0, 2000)
+const std::string job =
+    ".section .text \n"
+    " ldw r0, n \n"
+    " clr r1 \n"
+    " clr r4 \n"
+    " movi r2, 2000 \n"
+    " loop: \n"
+    "  mul r3, r0, r1 \n"
+    "  add r4, r4, r3 \n"
+    "  inc r1 \n"
+    "  cmp r1, r2 \n"
+    "  jl loop \n"
+    " stw r4, out \n"
+    " halt \n"
+    ".section .data \n"
+    " n: \n"
+    "  .word 0 \n"
+    " out: \n"
+    "  .word 0 \n";
+
+constexpr size_t JOBS = 20000;
+
+uint32_t expected_out(uint32_t n) {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < 2000; i++) sum += n * i;
+    return sum;
+}
+
+FleetJob make_job(const std::shared_ptr<const FleetProgram>& program, uint32_t n) {
+    FleetJob j;
+    j.program = program;
+    j.input = { static_cast<uint8_t>(n), static_cast<uint8_t>(n >> 8), static_cast<uint8_t>(n >> 16), static_cast<uint8_t>(n >> 24) };
+    j.output_addr = 4;
+    j.output_size = 4;
+    return j;
+}
+
+int main() {
+    auto env_m = EnvironmentManager(0xFFFF);
+    std::string e = env_m.build_single(job);
+    if (!e.empty()) std::cout << "ERROR: " << e << std::endl;
+    auto program = std::make_shared<const FleetProgram>(env_m);
+
+    bool ok = true;
+
+    // one EnvironmentManager per job, like before the fleet
+    auto start = std::chrono::high_resolution_clock::now();
+    for (uint32_t n = 0; n < 2000; n++) {
+        auto single = EnvironmentManager(0xFFFF);
+        single.build_single(job);
+        single.mb.cpu.core.store32(0, n);
+        single.start();
+        if (single.mb.cpu.core.regs[4] != expected_out(n)) ok = false;
+    }
+    auto stop = std::chrono::high_resolution_clock::now();
+    double seconds = std::chrono::duration<double>(stop - start).count();
+    std::cout << "---------- FLEET ----------\n";
+    std::cout << "one EnvironmentManager per job: " << static_cast<long long>(2000 / seconds) << " jobs/sec" << std::endl;
+
+    double single_rate = 0;
+    for (size_t workers : { 1, 2, 4, 8 }) {
+        Fleet fleet(workers);
+        std::vector<std::future<FleetResult>> results;
+        results.reserve(JOBS);
+
+        start = std::chrono::high_resolution_clock::now();
+        for (uint32_t n = 0; n < JOBS; n++) results.push_back(fleet.submit(make_job(program, n)));
+        for (uint32_t n = 0; n < JOBS; n++) {
+            FleetResult r = results[n].get();
+            uint32_t out = 0;
+            if (r.output.size() == 4) std::memcpy(&out, r.output.data(), 4);
+            if (r.code != ErrorCode::OK || r.regs[4] != expected_out(n) || out != expected_out(n)) {
+                std::cout << "job " << n << " differs" << std::endl;
+                ok = false;
+                break;
+            }
+        }
+        stop = std::chrono::high_resolution_clock::now();
+
+        double rate = JOBS / std::chrono::duration<double>(stop - start).count();
+        if (workers == 1) single_rate = rate;
+        std::cout << workers << " workers: " << static_cast<long long>(rate) << " jobs/sec (x" << rate / single_rate << ")" << std::endl;
+    }
+    std::cout << "host threads: " << std::thread::hardware_concurrency() << std::endl;
+
+    // callbacks + wait(), and a faulting job does not take the worker down
+    {
+        Fleet fleet(2);
+        std::atomic<size_t> done = 0;
+        std::atomic<size_t> faults = 0;
+        auto bad_env = EnvironmentManager(0x1000);
+        bad_env.build_single(".section .text \n movi r0, 0x20000 \n sbasew r1, r0, 0 \n halt \n");
+        auto bad = std::make_shared<const FleetProgram>(bad_env);
+        for (uint32_t n = 0; n < 100; n++) {
+            fleet.submit(make_job(n % 10 == 0 ? bad : program, n), [&](FleetResult&& r) {
+                if (r.code == ErrorCode::RAM_OVERFLOW) faults++;
+                done++;
+            });
+        }
+        fleet.wait();
+        if (done != 100 || faults != 10) {
+            std::cout << "callbacks: " << done << " done, " << faults << " faults" << std::endl;
+            ok = false;
+        }
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,129 @@
+#include "../../Talos/include/environment_manager.h"
+
+#include <iostream>
+#include <string>
+#include <chrono>
+
+// budgeted run(): stops after at most N instructions and resumes where it stopped
+
+const std::string forever =
+    ".section .text \n"
+    " loop: \n"
+    "  inc r0 \n"
+    "  jmp loop \n";
+
+// 4 + 2000 * 12 + 2 = 24006 instructions, the HALT included
+const std::string hash =
+    ".section .text \n"
+    " movi r0, 12345 \n"
+    " clr r1 \n"
+    " clr r4 \n"
+    " movi r2, 2000 \n"
+    " loop: \n"
+    "  shli r3, r0, 13 \n"
+    "  xor r0, r0, r3 \n"
+    "  shri r3, r0, 17 \n"
+    "  xor r0, r0, r3 \n"
+    "  push r0 \n"
+    "  call mix \n"
+    "  pop r0 \n"
+    "  inc r1 \n"
+    "  cmp r1, r2 \n"
+    "  jl loop \n"
+    " stw r4, out \n"
+    " halt \n"
+    " mix: \n"
+    "  add r4, r4, r0 \n"
+    "  ret \n"
+    ".section .data \n"
+    " out: \n"
+    "  .word 0 \n";
+
+constexpr uint64_t HASH_LENGTH = 4 + 2000 * 12 + 2;
+
+bool check_forever() {
+    auto env_m = EnvironmentManager(0x1000);
+    env_m.build_single(forever);
+
+    uint64_t total = 0;
+    for (uint64_t budget : { 1, 2, 3, 1000, 12345 }) {
+        RunSlice slice = env_m.run_for(budget);
+        if (slice.status != RunStatus::BUDGET || slice.retired != budget) {
+            std::cout << "forever: budget " << budget << " ran " << slice.retired << std::endl;
+            return false;
+        }
+        total += budget;
+    }
+    // inc, jmp, inc, jmp...
+    return env_m.mb.cpu.core.regs[0] == (total + 1) / 2;
+}
+
+bool check_slices(uint64_t budget, const std::array<uint32_t, 16>& expected) {
+    auto env_m = EnvironmentManager(0x1000);
+    env_m.build_single(hash);
+
+    uint64_t retired = 0;
+    RunSlice slice;
+    do {
+        slice = env_m.run_for(budget);
+        retired += slice.retired;
+        if (slice.retired > budget) return false;
+    } while (slice.status == RunStatus::BUDGET);
+
+    if (slice.status != RunStatus::HALTED || retired != HASH_LENGTH || env_m.mb.cpu.core.regs != expected) {
+        std::cout << "slices of " << budget << ": " << retired << " instructions instead of " << HASH_LENGTH << std::endl;
+        return false;
+    }
+    // PC stays on the HALT
+    return env_m.run_for(budget).status == RunStatus::HALTED;
+}
+
+int main() {
+    bool ok = check_forever();
+
+    auto env_m = EnvironmentManager(0x1000);
+    std::string e = env_m.build_single(hash);
+    if (!e.empty()) std::cout << "ERROR: " << e << std::endl;
+    env_m.start();
+    const std::array<uint32_t, 16> expected = env_m.mb.cpu.core.regs;
+
+    for (uint64_t budget : { 1, 2, 5, 12, 13, 100, 4096, 1'000'000 })
+        ok &= check_slices(budget, expected);
+
+    // a store outside of the RAM ends the slice on it: PC on the store, what ran before it retired
+    // (100: in run_threaded(), 4: the last region is stepped)
+    for (uint64_t budget : { 100, 4 }) {
+        auto faulty = EnvironmentManager(0x1000);
+        faulty.build_single(".section .text \n movi r1, 5 \n movi r2, 0x7FFFFFF0 \n inc r3 \n sbasew r1, r2, 0 \n halt \n");
+        const RunSlice slice = faulty.run_for(budget);
+        const SimpleCore& core = faulty.mb.cpu.core;
+        if (slice.status != RunStatus::FAULT || slice.retired != 3 || core.PC != 3 || core.regs[3] != 1) {
+            std::cout << "store outside of the RAM (budget " << budget << "): retired " << slice.retired << ", PC " << core.PC << std::endl;
+            ok = false;
+        }
+    }
+
+    // what the budget costs: one long run, against the same work cut in slices
+    constexpr int RUNS = 200;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < RUNS; i++) {
+        env_m.mb.cpu.core.reset();
+        env_m.mb.cpu.core.PC = env_m.entry_pc;
+        run(env_m.mb.cpu.core, env_m.mb.threaded);
+    }
+    auto stop = std::chrono::high_resolution_clock::now();
+    long long plain = duration_cast<std::chrono::microseconds>(stop - start).count();
+
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < RUNS; i++) {
+        env_m.mb.cpu.core.reset();
+        env_m.mb.cpu.core.PC = env_m.entry_pc;
+        while (env_m.run_for(1000).status == RunStatus::BUDGET) {}
+    }
+    stop = std::chrono::high_resolution_clock::now();
+    long long sliced = duration_cast<std::chrono::microseconds>(stop - start).count();
+
+    std::cout << "RUN DURATION: run() " << plain << ", run_for(1000) " << sliced << " micro_sec" << std::endl;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,122 @@
+#include "../../Talos/include/profiler.h"
+
+#include <iostream>
+#include <string>
+#include <chrono>
+
+// PROFILE mode: exact counts per PC / opcode / branch, labels on the hot PCs, JSON and collapsed exports
+
+// main calls square 1000 times, square is where the time goes
+const std::string program =
+    ".section .text \n"
+    " .global main \n"
+    " .global square \n"
+    " main: \n"
+    "  clr r1 \n"
+    "  clr r4 \n"
+    "  movi r2, 1000 \n"
+    " loop: \n"
+    "  push r1 \n"
+    "  call square \n"
+    "  pop r1 \n"
+    "  inc r1 \n"
+    "  cmp r1, r2 \n"
+    "  jl loop \n"
+    "  halt \n"
+    " square: \n"
+    "  mul r3, r1, r1 \n"
+    "  add r4, r4, r3 \n"
+    "  andi r5, r3, 1 \n"
+    "  cmpi r5, 0 \n"
+    "  jz even \n"
+    "  inc r6 \n"
+    " even: \n"
+    "  ret \n"
+    " .entry main \n";
+
+// main: 3 + 6 per loop + halt, square: 6 per call + the inc of the odd squares
+constexpr uint64_t LOOPS = 1000;
+constexpr uint64_t ODD = 500;
+constexpr uint64_t INSTRUCTIONS = 3 + LOOPS * 6 + 1 + LOOPS * 6 + ODD;
+
+bool check_counts(EnvironmentManager& env_m) {
+    ProfileReport report(env_m);
+    if (report.total() != INSTRUCTIONS) {
+        std::cout << "profiled " << report.total() << " instructions instead of " << INSTRUCTIONS << std::endl;
+        return false;
+    }
+
+    // jl loop: taken 999 times, falls through once
+    for (uint32_t pc = 0; pc < report.rom.size(); pc++) {
+        std::string where = report.location(pc);
+        if (where == "loop+5" && (report.profile.taken[pc] != LOOPS - 1 || report.profile.not_taken[pc] != 1)) return false;
+        if (where == "square+4" && (report.profile.taken[pc] != ODD || report.profile.not_taken[pc] != ODD)) return false;
+    }
+
+    std::array<uint64_t, 256> opcodes = report.by_opcode();
+    if (opcodes[CALL] != LOOPS || opcodes[RET] != LOOPS || opcodes[MUL] != LOOPS || opcodes[HALT] != 1) return false;
+
+    // the hottest PCs are all in the loop or in square
+    for (const PcCount& hot : report.hot_pcs(5)) {
+        std::string where = report.location(hot.pc);
+        if (where.rfind("loop", 0) != 0 && where.rfind("square", 0) != 0 && where != "even") return false;
+    }
+    return true;
+}
+
+int main() {
+    bool ok = true;
+
+    auto env_m = EnvironmentManager(0x10000);
+    std::string e = env_m.build_single(program);
+    if (!e.empty()) std::cout << "ERROR: " << e << std::endl;
+
+    if (env_m.start(ExecMode::PROFILE) != ErrorCode::OK || env_m.mb.cpu.core.regs[6] != ODD) ok = false;
+    ok &= check_counts(env_m);
+
+    ProfileReport report(env_m);
+    std::string json = report.to_json();
+    std::string collapsed = report.to_collapsed();
+    std::cout << collapsed;
+    for (const PcCount& hot : report.hot_pcs(3))
+        std::cout << "hot: " << report.location(hot.pc) << " " << hot.count << std::endl;
+    if (json.find("\"instructions\": " + std::to_string(INSTRUCTIONS)) == std::string::npos || json.find("\"location\": \"square+1\"") == std::string::npos) {
+        std::cout << "JSON export is missing counts" << std::endl;
+        ok = false;
+    }
+    if (collapsed.find("main;loop ") == std::string::npos || collapsed.find("square;even " + std::to_string(LOOPS)) == std::string::npos) {
+        std::cout << "collapsed export is missing frames" << std::endl;
+        ok = false;
+    }
+
+    // counts add up until clear_profile()
+    env_m.mb.cpu.core.reset();
+    env_m.mb.cpu.core.PC = env_m.entry_pc;
+    env_m.start(ExecMode::PROFILE);
+    if (env_m.profile().total() != 2 * INSTRUCTIONS) ok = false;
+    env_m.clear_profile();
+    if (env_m.profile().total() != 0) ok = false;
+
+    // every core counts in its own profile, merged by profile()
+    auto spmd = EnvironmentManager(0x10000, 4);
+    spmd.build_single(program);
+    if (spmd.start_all(ExecMode::PROFILE) != ErrorCode::OK || spmd.profile().total() != 4 * INSTRUCTIONS) {
+        std::cout << "4 cores: " << spmd.profile().total() << " instructions instead of " << 4 * INSTRUCTIONS << std::endl;
+        ok = false;
+    }
+
+    // what the counters cost, AUTO itself does not change
+    constexpr int RUNS = 500;
+    for (ExecMode mode : { ExecMode::AUTO, ExecMode::PROFILE }) {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < RUNS; i++) {
+            env_m.mb.cpu.core.reset();
+            env_m.mb.cpu.core.PC = env_m.entry_pc;
+            env_m.start(mode);
+        }
+        auto stop = std::chrono::high_resolution_clock::now();
+        std::cout << (mode == ExecMode::AUTO ? "AUTO " : "PROFILE ") << duration_cast<std::chrono::microseconds>(stop - start).count() << " micro_sec" << std::endl;
+    }
+
+    return ok ? 0 : 1;
+}
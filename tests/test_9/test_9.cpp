@@ -0,0 +1,120 @@
+#include "../../Talos/include/profiler.h"
+
+#include <iostream>
+#include <string>
+#include <chrono>
+
+// profile-guided layout: profile a build, rebuild the same sources with the counts, same results with less jumps
+
+// the cold overflow handler sits in the middle of the loop, which jumps back to its condition every time
+const std::string main_file =
+    ".section .text \n"
+    " .extern work \n"
+    " .global main \n"
+    " main: \n"
+    "  clr r1 \n"
+    "  clr r4 \n"
+    "  movi r2, 1000 \n"
+    "  movi r3, 5000 \n"
+    " cond: \n"
+    "  cmp r1, r2 \n"
+    "  jl body \n"
+    "  jmp done \n"
+    " overflow: \n"
+    "  movi r7, 99 \n"
+    "  halt \n"
+    " body: \n"
+    "  cmp r1, r3 \n"
+    "  jz overflow \n"
+    "  call work \n"
+    "  inc r1 \n"
+    "  jmp cond \n"
+    " done: \n"
+    "  halt \n"
+    " .entry main \n";
+
+// the rare case falls through, the jnz is inverted so the common one does
+const std::string work_file =
+    ".section .text \n"
+    " .global work \n"
+    " work: \n"
+    "  andi r5, r1, 3 \n"
+    "  cmpi r5, 0 \n"
+    "  jnz skip \n"
+    "  inc r6 \n"
+    " skip: \n"
+    "  add r4, r4, r1 \n"
+    "  ret \n";
+
+const std::vector<std::pair<std::string, std::string>> files = { { "main", main_file }, { "work", work_file } };
+
+struct Result {
+    uint32_t r1, r4, r6, r7;
+    bool operator==(const Result&) const = default;
+};
+
+Result run_from_entry(EnvironmentManager& env_m, ExecMode mode) {
+    env_m.mb.cpu.core.reset();
+    env_m.mb.cpu.core.PC = env_m.entry_pc;
+    env_m.start(mode);
+    const auto& regs = env_m.mb.cpu.core.regs;
+    return { regs[1], regs[4], regs[6], regs[7] };
+}
+
+int main() {
+    bool ok = true;
+
+    auto plain = EnvironmentManager(0x10000);
+    std::string e = plain.build(files);
+    if (!e.empty()) std::cout << "ERROR: " << e << std::endl;
+    run_from_entry(plain, ExecMode::PROFILE);
+    ProfileReport before(plain);
+
+    auto laid_out = EnvironmentManager(0x10000);
+    laid_out.build(files);
+    run_from_entry(laid_out, ExecMode::PROFILE);
+    if (!laid_out.layout_from_profile()) ok = false;
+    e = laid_out.build(files);
+    if (!e.empty()) std::cout << "ERROR: " << e << std::endl;
+    std::cout << laid_out.layout.blocks << " blocks, " << laid_out.layout.hot_blocks << " hot, " << laid_out.layout.jumps_removed << " jumps removed, "
+              << laid_out.layout.jumps_added << " added, " << laid_out.layout.branches_inverted << " branches inverted" << std::endl;
+    if (laid_out.layout.jumps_removed == 0 || laid_out.layout.branches_inverted == 0) ok = false;
+    if (laid_out.layout_from_profile()) ok = false; // its PCs are not the ones of the sources anymore
+
+    // same results in every mode
+    const Result expected = { 1000, 499500, 250, 0 };
+    for (ExecMode mode : { ExecMode::AUTO, ExecMode::STEP, ExecMode::JIT }) {
+        if (run_from_entry(plain, mode) != expected || run_from_entry(laid_out, mode) != expected) {
+            std::cout << "layout changed the results" << std::endl;
+            ok = false;
+        }
+    }
+
+    // the jmp back to the condition is gone (1000), the rare case of work jumps back to skip (250)
+    laid_out.clear_profile();
+    run_from_entry(laid_out, ExecMode::PROFILE);
+    ProfileReport after(laid_out);
+    std::cout << before.total() << " instructions before, " << after.total() << " after" << std::endl;
+    if (before.total() - after.total() != 1000 - 250) ok = false;
+
+    // everything that ran comes before everything that did not
+    bool cold = false;
+    for (uint32_t pc = 0; pc < after.rom.size(); pc++) {
+        if (after.count(pc) == 0) cold = true;
+        else if (cold) {
+            std::cout << after.location(pc) << " ran after cold code" << std::endl;
+            ok = false;
+        }
+    }
+    if (after.symbol_at(static_cast<uint32_t>(after.rom.size() - 1))->name != "overflow") ok = false;
+
+    constexpr int RUNS = 2000;
+    for (EnvironmentManager* env_m : { &plain, &laid_out }) {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < RUNS; i++) run_from_entry(*env_m, ExecMode::AUTO);
+        auto stop = std::chrono::high_resolution_clock::now();
+        std::cout << (env_m == &plain ? "plain " : "laid out ") << duration_cast<std::chrono::microseconds>(stop - start).count() << " micro_sec" << std::endl;
+    }
+
+    return ok ? 0 : 1;
+}